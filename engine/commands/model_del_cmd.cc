@@ -1,5 +1,6 @@
 #include "model_del_cmd.h"
 #include "cmd_info.h"
+#include "config/model_config_snapshot.h"
 #include "config/yaml_config.h"
 #include "utils/file_manager_utils.h"
 
@@ -35,8 +36,12 @@ bool ModelDelCmd::Exec(const std::string& model_id) {
               }
             }
 
-            // Delete yaml file
+            // Delete yaml file and its compiled config
             std::filesystem::remove(entry);
+            std::error_code ec;
+            std::filesystem::remove(
+                config::ModelConfigSnapshot::PathFor(entry.path().string()),
+                ec);
             CLI_LOG("The model " << model_id << " was deleted");
             return true;
           }
@@ -1,13 +1,7 @@
 #include "model_import_cmd.h"
-#include <filesystem>
-#include <iostream>
-#include <vector>
-#include "config/gguf_parser.h"
-#include "config/yaml_config.h"
-#include "trantor/utils/Logger.h"
-#include "utils/file_manager_utils.h"
+#include <string>
+#include "services/model_import_service.h"
 #include "utils/logging_utils.h"
-#include "utils/modellist_utils.h"
 
 namespace commands {
 
@@ -16,39 +10,38 @@ ModelImportCmd::ModelImportCmd(std::string model_handle, std::string model_path)
       model_path_(std::move(model_path)) {}
 
 void ModelImportCmd::Exec() {
-  config::GGUFHandler gguf_handler;
-  config::YamlHandler yaml_handler;
-  modellist_utils::ModelListUtils modellist_utils_obj;
-
-  std::string model_yaml_path = (file_manager_utils::GetModelsContainerPath() /
-                                 std::filesystem::path("imported") /
-                                 std::filesystem::path(model_handle_ + ".yml"))
-                                    .string();
-  modellist_utils::ModelEntry model_entry{
-      model_handle_,   "local",       "imported",
-      model_yaml_path, model_handle_, modellist_utils::ModelStatus::READY};
+  bool batch = ModelImportService::IsBatch(model_path_);
+  if (!batch && model_handle_.empty()) {
+    CLI_LOG("--model_id is required to import a single file");
+    return;
+  }
+  std::vector<ModelImportService::Result> results;
   try {
-    std::filesystem::create_directories(
-        std::filesystem::path(model_yaml_path).parent_path());
-    gguf_handler.Parse(model_path_);
-    auto model_config = gguf_handler.GetModelConfig();
-    model_config.files.push_back(model_path_);
-    model_config.model = model_handle_;
-    yaml_handler.UpdateModelConfig(model_config);
+    results =
+        ModelImportService::Global().ImportPath(model_path_, model_handle_);
+  } catch (const std::exception& e) {
+    CLI_LOG("Error importing model path '" + model_path_ + "': " + e.what());
+    return;
+  }
 
-    if (modellist_utils_obj.AddModelEntry(model_entry)) {
-      yaml_handler.WriteYamlFile(model_yaml_path);
-      CLI_LOG("Model is imported successfully!");
+  size_t imported = 0;
+  for (const auto& r : results) {
+    if (r.ok()) {
+      imported++;
+      if (batch) {
+        CLI_LOG("Imported " + r.model_id);
+      }
     } else {
-      CLI_LOG("Fail to import model, model_id '" + model_handle_ +
-              "' already exists!");
+      CLI_LOG(r.error);
     }
-
-  } catch (const std::exception& e) {
-    // don't need to remove yml file here, because it's written only if model entry is successfully added, 
-    // remove file here can make it fail with edge case when user try to import new model with existed model_id
-    CLI_LOG("Error importing model path '" + model_path_ + "' with model_id '" +
-            model_handle_ + "': " + e.what());
   }
+  if (!batch) {
+    if (imported == 1) {
+      CLI_LOG("Model is imported successfully!");
+    }
+    return;
+  }
+  CLI_LOG("Imported " + std::to_string(imported) + " of " +
+          std::to_string(results.size()) + " models");
 }
 }  // namespace commands
@@ -31,8 +31,10 @@ bool ModelStartCmd::Exec() {
 
   nlohmann::json json_data;
   if (mc_.files.size() > 0) {
-    // TODO(sang) support multiple files
+    // llama.cpp finds the other shards of a split model from the first one,
+    // other engines get the whole list
     json_data["model_path"] = mc_.files[0];
+    json_data["files"] = mc_.files;
   } else {
     LOG_WARN << "model_path is empty";
     return false;
@@ -42,6 +44,7 @@ bool ModelStartCmd::Exec() {
   json_data["user_prompt"] = mc_.user_template;
   json_data["ai_prompt"] = mc_.ai_template;
   json_data["ctx_len"] = mc_.ctx_len;
+  json_data["ngl"] = mc_.ngl;
   json_data["stop"] = mc_.stop;
   json_data["engine"] = mc_.engine;
 
@@ -0,0 +1,82 @@
+#include "model_verify_cmd.h"
+#include <chrono>
+#include <filesystem>
+#include <vector>
+#include "config/yaml_config.h"
+#include "services/file_hash_service.h"
+#include "utils/format_utils.h"
+#include "utils/logging_utils.h"
+#include "utils/modellist_utils.h"
+
+namespace commands {
+
+bool ModelVerifyCmd::Exec(const std::string& model_handle, bool quick,
+                          bool sha256) {
+  modellist_utils::ModelListUtils modellist_handler;
+  config::YamlHandler yaml_handler;
+  try {
+    auto model_entry = modellist_handler.GetModelInfo(model_handle);
+    yaml_handler.ModelConfigFromFile(model_entry.path_to_model_yaml);
+    std::vector<std::filesystem::path> files;
+    for (const auto& f : yaml_handler.GetModelConfig().files) {
+      files.emplace_back(f);
+    }
+    if (files.empty()) {
+      CLI_LOG("Model '" + model_handle + "' has no files to verify");
+      return false;
+    }
+
+    FileHashService hasher;
+    auto identity = FileHashService::FilesIdentity(files);
+    auto recorded = IntegrityRecord::FromString(model_entry.integrity);
+    if (sha256) {
+      auto digests = hasher.Sha256(files);
+      for (size_t i = 0; i < files.size(); ++i) {
+        CLI_LOG(files[i].filename().string() << " sha256: " << digests[i]);
+      }
+    }
+    if (quick && recorded.has_value() &&
+        recorded->files_identity == identity) {
+      CLI_LOG("Model '" + model_handle +
+              "' is unchanged since it was last verified");
+      return true;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto fingerprints = hasher.Fingerprint(files);
+    uint64_t bytes = 0;
+    for (const auto& f : files) {
+      bytes += std::filesystem::file_size(f);
+    }
+    auto seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+    CTL_INF("Hashed " << format_utils::BytesToHumanReadable(bytes) << " in "
+                      << seconds << "s");
+
+    if (recorded.has_value()) {
+      bool ok = recorded->fingerprints.size() == fingerprints.size();
+      for (size_t i = 0; ok && i < files.size(); ++i) {
+        if (recorded->fingerprints[i] != fingerprints[i]) {
+          CLI_LOG(files[i].string() << " has changed since it was verified");
+          ok = false;
+        }
+      }
+      if (!ok) {
+        CLI_LOG("Model '" + model_handle + "' failed verification");
+        return false;
+      }
+    }
+    model_entry.integrity =
+        IntegrityRecord{fingerprints, identity}.ToString();
+    modellist_handler.UpdateModelEntry(model_entry.model_id, model_entry);
+    CLI_LOG("Model '" + model_handle + "' verified"
+            << (recorded.has_value() ? "" : ", fingerprint recorded"));
+    return true;
+  } catch (const std::exception& e) {
+    CLI_LOG("Fail to verify model with ID '" + model_handle + "': " +
+            e.what());
+    return false;
+  }
+}
+}  // namespace commands
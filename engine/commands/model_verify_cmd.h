@@ -0,0 +1,15 @@
+#pragma once
+
+#include <string>
+namespace commands {
+
+class ModelVerifyCmd {
+ public:
+  // Hashes the files of a model and checks them against the last
+  // verification recorded in the model list. The first run records it.
+  // `quick` trusts files whose size, mtime and inode are unchanged since
+  // then, which misses in-place corruption. `sha256` also prints their
+  // SHA-256, which Hugging Face shows as the LFS oid.
+  bool Exec(const std::string& model_handle, bool quick, bool sha256);
+};
+}  // namespace commands
@@ -0,0 +1,132 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+namespace config {
+// Metadata keys the server reads. Keys under the model architecture, such as
+// "llama.context_length" or "qwen2.context_length", are named without it.
+enum class GGUFKey : uint8_t {
+  kGeneralArchitecture,
+  kGeneralName,
+  kGeneralAlignment,
+  kGeneralQuantizationVersion,
+  kGeneralFileType,
+  kSplitNo,
+  kSplitCount,
+  kSplitTensorsCount,
+  kTokenizerTokens,
+  kTokenizerBosTokenId,
+  kTokenizerEosTokenId,
+  kTokenizerChatTemplate,
+  kContextLength,
+  kBlockCount,
+  kEmbeddingLength,
+  kFeedForwardLength,
+  kHeadCount,
+  kHeadCountKv,
+  kKeyLength,
+  kValueLength,
+  kCount,
+};
+
+namespace gguf_keys {
+struct KeyName {
+  std::string_view name;
+  // Stored as "<general.architecture>.<name>"
+  bool arch_prefixed;
+};
+
+// Indexed by GGUFKey
+constexpr std::array<KeyName, static_cast<size_t>(GGUFKey::kCount)> kNames{{
+    {"general.architecture", false},
+    {"general.name", false},
+    {"general.alignment", false},
+    {"general.quantization_version", false},
+    {"general.file_type", false},
+    {"split.no", false},
+    {"split.count", false},
+    {"split.tensors.count", false},
+    {"tokenizer.ggml.tokens", false},
+    {"tokenizer.ggml.bos_token_id", false},
+    {"tokenizer.ggml.eos_token_id", false},
+    {"tokenizer.chat_template", false},
+    {"context_length", true},
+    {"block_count", true},
+    {"embedding_length", true},
+    {"feed_forward_length", true},
+    {"attention.head_count", true},
+    {"attention.head_count_kv", true},
+    {"attention.key_length", true},
+    {"attention.value_length", true},
+}};
+
+constexpr size_t kTableSize = 128;
+constexpr uint8_t kEmpty = 0xff;
+
+// Seeded FNV-1a with a murmur3 finalizer, the low bits of plain FNV-1a
+// depend only on the low bits of the input
+constexpr uint32_t Hash(std::string_view s, uint32_t seed) {
+  uint32_t h = 2166136261u ^ seed;
+  for (char c : s) {
+    h = (h ^ static_cast<uint8_t>(c)) * 16777619u;
+  }
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+// The first seed for which every name gets its own slot
+constexpr uint32_t FindSeed() {
+  for (uint32_t seed = 1; seed < 10000; seed++) {
+    std::array<bool, kTableSize> used{};
+    bool ok = true;
+    for (const auto& k : kNames) {
+      auto slot = Hash(k.name, seed) % kTableSize;
+      ok = ok && !used[slot];
+      used[slot] = true;
+    }
+    if (ok) {
+      return seed;
+    }
+  }
+  return 0;
+}
+
+constexpr uint32_t kSeed = FindSeed();
+static_assert(kSeed != 0, "No perfect hash for the GGUF key names");
+
+constexpr std::array<uint8_t, kTableSize> BuildTable() {
+  std::array<uint8_t, kTableSize> table{};
+  for (auto& t : table) {
+    t = kEmpty;
+  }
+  for (size_t i = 0; i < kNames.size(); i++) {
+    table[Hash(kNames[i].name, kSeed) % kTableSize] = static_cast<uint8_t>(i);
+  }
+  return table;
+}
+
+constexpr auto kTable = BuildTable();
+
+// The well-known key named `name`, which is a full key, or for architecture
+// keys the part after the architecture
+constexpr std::optional<GGUFKey> Lookup(std::string_view name,
+                                        bool arch_prefixed) {
+  auto i = kTable[Hash(name, kSeed) % kTableSize];
+  if (i == kEmpty || kNames[i].name != name ||
+      kNames[i].arch_prefixed != arch_prefixed) {
+    return std::nullopt;
+  }
+  return static_cast<GGUFKey>(i);
+}
+
+static_assert(Lookup("context_length", true) == GGUFKey::kContextLength);
+static_assert(Lookup("general.name", false) == GGUFKey::kGeneralName);
+static_assert(!Lookup("context_length", false).has_value());
+}  // namespace gguf_keys
+}  // namespace config
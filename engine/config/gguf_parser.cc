@@ -1,12 +1,18 @@
+#include <algorithm>
 #include <cstdint>
+#include <cstdio>
 #include <cstring>
 #include <ctime>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <regex>
+#include <sstream>
 #include <stdexcept>
 #include <string>
+#include <tuple>
 #include <vector>
 
 #ifdef _WIN32
@@ -23,9 +29,77 @@
 
 #include "gguf_parser.h"
 #include "trantor/utils/Logger.h"
+#include "utils/binary_io_utils.h"
 
 namespace config {
+namespace {
+enum GGUFType : uint32_t {
+  kUint8 = 0,
+  kInt8,
+  kUint16,
+  kInt16,
+  kUint32,
+  kInt32,
+  kFloat32,
+  kBool,
+  kString,
+  kArray,
+  kUint64,
+  kInt64,
+  kFloat64,
+};
+
+// Byte size of the fixed size metadata types, 0 for string and array
+constexpr std::size_t kScalarSize[] = {1, 1, 2, 2, 4, 4, 4, 1, 0, 0, 8, 8, 8};
+// The length of an empty key, the value type and a one byte value
+constexpr std::size_t kMinMetadataEntryBytes = 8 + 4 + 1;
+// The length of an empty name, no dimensions, the type and the data offset
+constexpr std::size_t kMinTensorInfoBytes = 8 + 4 + 4 + 8;
+
+template <typename T>
+T ReadScalar(const uint8_t* p) {
+  T v;
+  std::memcpy(&v, p, sizeof(T));
+  return v;
+}
+
+struct GGMLTypeTraits {
+  const char* name;
+  // Values per block and bytes per block, 0 for removed types
+  uint64_t block_size;
+  uint64_t type_size;
+};
+
+// Indexed by ggml_type, see ggml.h
+constexpr GGMLTypeTraits kGGMLTypes[] = {
+    {"F32", 1, 4},        {"F16", 1, 2},       {"Q4_0", 32, 18},
+    {"Q4_1", 32, 20},     {"Q4_2", 0, 0},      {"Q4_3", 0, 0},
+    {"Q5_0", 32, 22},     {"Q5_1", 32, 24},    {"Q8_0", 32, 34},
+    {"Q8_1", 32, 36},     {"Q2_K", 256, 84},   {"Q3_K", 256, 110},
+    {"Q4_K", 256, 144},   {"Q5_K", 256, 176},  {"Q6_K", 256, 210},
+    {"Q8_K", 256, 292},   {"IQ2_XXS", 256, 66}, {"IQ2_XS", 256, 74},
+    {"IQ3_XXS", 256, 98}, {"IQ1_S", 256, 50},  {"IQ4_NL", 32, 18},
+    {"IQ3_S", 256, 110},  {"IQ2_S", 256, 82},  {"IQ4_XS", 256, 136},
+    {"I8", 1, 1},         {"I16", 1, 2},       {"I32", 1, 4},
+    {"I64", 1, 8},        {"F64", 1, 8},       {"IQ1_M", 256, 56},
+    {"BF16", 1, 2},       {"Q4_0_4_4", 32, 18}, {"Q4_0_4_8", 32, 18},
+    {"Q4_0_8_8", 32, 18}, {"TQ1_0", 256, 54},  {"TQ2_0", 256, 66},
+};
+
+constexpr uint64_t kDefaultAlignment = 32;
+constexpr uint32_t kMaxTensorDims = 4;
+
+// "CGSC", bump the version whenever the layout changes
+constexpr uint32_t kSidecarMagic = 0x43534743;
+constexpr uint32_t kSidecarVersion = 2;
+}  // namespace
+
+GGUFHandler::~GGUFHandler() {
+  CloseFile();
+}
+
 void GGUFHandler::OpenFile(const std::string& file_path) {
+  CloseFile();
 #ifdef _WIN32
   HANDLE file_handle_ = INVALID_HANDLE_VALUE;
   HANDLE file_mapping_ = nullptr;
@@ -98,6 +172,22 @@ void GGUFHandler::OpenFile(const std::string& file_path) {
 }
 
 void GGUFHandler::CloseFile() {
+  // The index points into the mapping
+  metadata_index_.clear();
+  metadata_lookup_.clear();
+  well_known_.fill(-1);
+  if (from_sidecar_) {
+    sidecar_data_.clear();
+    from_sidecar_ = false;
+    data_ = nullptr;
+    return;
+  }
+  if (from_head_) {
+    head_data_.clear();
+    from_head_ = false;
+    data_ = nullptr;
+    return;
+  }
 #ifdef _WIN32
   if (data_ != nullptr) {
     UnmapViewOfFile(data_);
@@ -107,196 +197,220 @@ void GGUFHandler::CloseFile() {
   if (data_ != nullptr && data_ != MAP_FAILED) {
     munmap(data_, file_size_);
   }
+  data_ = nullptr;
 #endif
 }
 
-std::pair<std::size_t, std::string> GGUFHandler::ReadString(
-    std::size_t offset) const {
-  uint64_t length;
-  std::memcpy(&length, data_ + offset, sizeof(uint64_t));
+void GGUFHandler::CheckBounds(std::size_t offset, std::size_t length) const {
+  if (offset > file_size_ || length > file_size_ - offset) {
+    throw GGUFTruncatedError();
+  }
+}
 
-  std::string value(reinterpret_cast<const char*>(data_ + offset + 8), length);
-  return {8 + static_cast<std::size_t>(length), value};
+std::string_view GGUFHandler::ReadStringView(std::size_t offset) const {
+  CheckBounds(offset, 8);
+  auto length = ReadScalar<uint64_t>(data_ + offset);
+  CheckBounds(offset + 8, length);
+  return {reinterpret_cast<const char*>(data_ + offset + 8),
+          static_cast<std::size_t>(length)};
 }
 
-size_t GGUFHandler::ReadMetadataValue(int type, std::size_t offset,
-                                      const std::string& key) {
+size_t GGUFHandler::SkipValue(uint32_t type, std::size_t offset) const {
+  if (type == kString) {
+    return 8 + ReadStringView(offset).size();
+  }
+  if (type == kArray) {
+    CheckBounds(offset, 12);
+    auto array_type = ReadScalar<uint32_t>(data_ + offset);
+    auto array_length = ReadScalar<uint64_t>(data_ + offset + 4);
+    if (array_type == kArray || array_type > kFloat64) {
+      throw std::runtime_error("Unsupported metadata type: " +
+                               std::to_string(array_type));
+    }
+    // Before multiplying, a crafted length would overflow past the check.
+    // Each string takes at least its 8 byte length.
+    auto element_size =
+        array_type == kString ? std::size_t{8} : kScalarSize[array_type];
+    if (array_length > (file_size_ - offset - 12) / element_size) {
+      throw GGUFTruncatedError();
+    }
+    if (array_type != kString) {
+      return 12 + array_length * element_size;
+    }
+    // Strings have to be walked, but nothing is copied
+    std::size_t array_offset = 12;
+    for (uint64_t i = 0; i < array_length; ++i) {
+      array_offset += 8 + ReadStringView(offset + array_offset).size();
+    }
+    return array_offset;
+  }
+  if (type > kFloat64) {
+    throw std::runtime_error("Unsupported metadata type: " +
+                             std::to_string(type));
+  }
+  CheckBounds(offset, kScalarSize[type]);
+  return kScalarSize[type];
+}
+
+GGUFValue GGUFHandler::DecodeValue(uint32_t type, std::size_t offset) const {
+  const uint8_t* p = data_ + offset;
   switch (type) {
-    case 0:  // UINT8
-      metadata_uint8_[key] = data_[offset];
-      return 1;
-    case 1:  // INT8
-      metadata_int8_[key] = static_cast<int8_t>(data_[offset]);
-      return 1;
-    case 2:  // UINT16
-      metadata_uint16_[key] =
-          *reinterpret_cast<const uint16_t*>(data_ + offset);
-      return 2;
-    case 3:  // INT16
-      metadata_int16_[key] = *reinterpret_cast<const int16_t*>(data_ + offset);
-      return 2;
-    case 4:  // UINT32
-      metadata_uint32_[key] =
-          *reinterpret_cast<const uint32_t*>(data_ + offset);
-      return 4;
-    case 5:  // INT32
-      metadata_int32_[key] = *reinterpret_cast<const int32_t*>(data_ + offset);
-      return 4;
-    case 6:  // FLOAT32
-      metadata_float_[key] = *reinterpret_cast<const float*>(data_ + offset);
-      return 4;
-    case 7:  // BOOL
-      metadata_bool_[key] = data_[offset] != 0;
-      return 1;
-    case 8:  // STRING
-    {
-      auto [byte_length, value] = ReadString(offset);
-      metadata_string_[key] = value;
-      return byte_length;
-    }
-    case 9:  // ARRAY
-
-      return ReadArray(offset, key);
-    case 10:  // UINT64
-      metadata_uint64_[key] =
-          *reinterpret_cast<const uint64_t*>(data_ + offset);
-      return 8;
-    case 11:  // INT64
-      metadata_int64_[key] = *reinterpret_cast<const int64_t*>(data_ + offset);
-      return 8;
-    case 12:  // FLOAT64
-      metadata_double_[key] = *reinterpret_cast<const double*>(data_ + offset);
-      return 8;
+    case kUint8:
+      return static_cast<int64_t>(ReadScalar<uint8_t>(p));
+    case kInt8:
+      return static_cast<int64_t>(ReadScalar<int8_t>(p));
+    case kUint16:
+      return static_cast<int64_t>(ReadScalar<uint16_t>(p));
+    case kInt16:
+      return static_cast<int64_t>(ReadScalar<int16_t>(p));
+    case kUint32:
+      return static_cast<int64_t>(ReadScalar<uint32_t>(p));
+    case kInt32:
+      return static_cast<int64_t>(ReadScalar<int32_t>(p));
+    case kUint64:
+      return static_cast<int64_t>(ReadScalar<uint64_t>(p));
+    case kInt64:
+      return ReadScalar<int64_t>(p);
+    case kFloat32:
+      return static_cast<double>(ReadScalar<float>(p));
+    case kFloat64:
+      return ReadScalar<double>(p);
+    case kBool:
+      return *p != 0;
+    case kString:
+      return std::string(ReadStringView(offset));
+    case kArray:
+      break;
     default:
       throw std::runtime_error("Unsupported metadata type: " +
                                std::to_string(type));
   }
+
+  auto array_type = ReadScalar<uint32_t>(p);
+  auto array_length = ReadScalar<uint64_t>(p + 4);
+  LOG_TRACE << "Parsing array type: " << array_type
+            << ", array length:" << array_length;
+  std::size_t array_offset = offset + 12;
+  if (array_type == kString) {
+    std::vector<std::string> values;
+    values.reserve(array_length);
+    for (uint64_t i = 0; i < array_length; ++i) {
+      auto v = ReadStringView(array_offset);
+      array_offset += 8 + v.size();
+      values.emplace_back(v);
+    }
+    return values;
+  }
+  std::vector<double> values;
+  values.reserve(array_length);
+  for (uint64_t i = 0; i < array_length; ++i) {
+    auto v = DecodeValue(array_type, array_offset);
+    array_offset += kScalarSize[array_type];
+    if (auto d = std::get_if<double>(&v)) {
+      values.push_back(*d);
+    } else if (auto n = std::get_if<int64_t>(&v)) {
+      values.push_back(static_cast<double>(*n));
+    } else {
+      values.push_back(std::get<bool>(v) ? 1.0 : 0.0);
+    }
+  }
+  return values;
 }
 
-size_t GGUFHandler::ReadArray(std::size_t offset, const std::string& key) {
-  uint32_t array_type = *reinterpret_cast<const uint32_t*>(data_ + offset);
-  // std::memcpy(&array_type, data_ + offset, sizeof(uint32_t));
-
-  uint64_t array_length =
-      *reinterpret_cast<const uint64_t*>(data_ + offset + 4);
-  // std::memcpy(&array_length, data_ + offset + 4, sizeof(uint64_t));
-  LOG_INFO << "\n"
-           << "Parsing array type: " << array_type
-           << ", array length:" << array_length << "\n";
-  std::size_t array_offset = 12;
-  std::vector<std::string> array_values_string;
-  std::vector<float> array_values_float;
-  uint8_t uint8_value;
-  int8_t int8_value;
-  uint16_t uint16_value;
-  int16_t int16_value;
-  uint32_t uint32_value;
-  int32_t int32_value;
-  float float_value;
-  bool bool_value;
-  std::string string_value;
-  uint64_t uint64_value;
-  int64_t int64_value;
-  double double_value;
-  size_t length;
+void GGUFHandler::AddEntry(std::string_view key, uint32_t type,
+                           std::size_t offset) {
+  MetadataEntry e{key, type, offset, {}};
+  if (type != kString && type != kArray) {
+    e.value = DecodeValue(type, offset);
+  }
+  metadata_lookup_.emplace(key, metadata_index_.size());
+  metadata_index_.push_back(std::move(e));
+}
 
-  for (uint64_t i = 0; i < array_length; ++i) {
-    // auto [byteLength, value] = ReadMetadataValue(array_type, offset + array_offset);
-    // assume that array ony has 2 type string and int
-    switch (array_type) {
-      case 0:
-        uint8_value = data_[offset + array_offset];
-        length = 1;
-        array_values_float.push_back(static_cast<float>(uint8_value));
-        break;
-      case 1: {
-        int8_value = static_cast<int8_t>(data_[offset + array_offset]);
-        length = 1;
-        array_values_float.push_back(static_cast<float>(int8_value));
-      }
+void GGUFHandler::IndexWellKnownKeys() {
+  well_known_.fill(-1);
+  std::string_view arch;
+  if (auto it = metadata_lookup_.find("general.architecture");
+      it != metadata_lookup_.end() &&
+      metadata_index_[it->second].type == kString) {
+    arch = ReadStringView(metadata_index_[it->second].offset);
+  }
+  for (size_t i = 0; i < metadata_index_.size(); ++i) {
+    auto name = metadata_index_[i].key;
+    bool arch_prefixed = !arch.empty() && name.size() > arch.size() &&
+                         name.compare(0, arch.size(), arch) == 0 &&
+                         name[arch.size()] == '.';
+    if (arch_prefixed) {
+      name.remove_prefix(arch.size() + 1);
+    }
+    if (auto k = gguf_keys::Lookup(name, arch_prefixed); k.has_value()) {
+      well_known_[static_cast<size_t>(*k)] = static_cast<int32_t>(i);
+    }
+  }
+}
 
-      break;
-      case 2:
-        uint16_value =
-            *reinterpret_cast<const uint16_t*>(data_ + offset + array_offset);
-        length = 2;
-        array_values_float.push_back(static_cast<float>(uint16_value));
-        break;
-      case 3:
-        int16_value =
-            *reinterpret_cast<const int16_t*>(data_ + offset + array_offset);
-        length = 2;
-        array_values_float.push_back(static_cast<float>(int16_value));
-        break;
-      case 4:
-        uint32_value =
-            *reinterpret_cast<const uint32_t*>(data_ + offset + array_offset);
-        length = 4;
-        array_values_float.push_back(static_cast<float>(uint32_value));
-        break;
-      case 5:
-        int32_value =
-            *reinterpret_cast<const int32_t*>(data_ + offset + array_offset);
-        length = 4;
-        array_values_float.push_back(static_cast<float>(int32_value));
-        break;
-      case 6:
-        float_value =
-            *reinterpret_cast<const float*>(data_ + offset + array_offset);
-        length = 4;
-        array_values_float.push_back(static_cast<float>(float_value));
-        break;
-      case 7:
-        bool_value = data_[offset + array_offset] != 0;
-        length = 1;
-        array_values_float.push_back(static_cast<float>(bool_value));
-        break;
-      case 8: {
-        uint64_t length_ =
-            *reinterpret_cast<const uint64_t*>(data_ + offset + array_offset);
-        std::string value(
-            reinterpret_cast<const char*>(data_ + offset + array_offset + 8),
-            length_);
-        length = 8 + static_cast<std::size_t>(length_);
-        array_values_string.push_back(value);
-      } break;
-      case 10:
-        uint64_value =
-            *reinterpret_cast<const uint64_t*>(data_ + offset + array_offset);
-        length = 8;
-        array_values_float.push_back(static_cast<float>(uint64_value));
-        break;
-      case 11:
-        int64_value =
-            *reinterpret_cast<const int64_t*>(data_ + offset + array_offset);
-        length = 8;
-        array_values_float.push_back(static_cast<float>(int64_value));
-        break;
-      case 12:
-        double_value =
-            *reinterpret_cast<const double*>(data_ + offset + array_offset);
-        length = 8;
-        array_values_float.push_back(static_cast<float>(double_value));
-        break;
-      default:
-        throw std::runtime_error("Unsupported metadata type: " +
-                                 std::to_string(array_type));
-        break;
-    }
-
-    array_offset += length;
-  }
-  if (array_values_string.size() > 0)
-    metadata_array_string_[key] = array_values_string;
-  else
-    metadata_array_float_[key] = array_values_float;
-  return array_offset;
-}
-
-void GGUFHandler::Parse(const std::string& file_path) {
+void GGUFHandler::Parse(const std::string& file_path, GGUFParseMode mode) {
+  if (mode == GGUFParseMode::kCached && LoadSidecar(file_path)) {
+    LOG_DEBUG << "Metadata of " << file_path << " served from sidecar cache";
+    return;
+  }
+  ParseFile(file_path, mode);
+  ParseShards(file_path);
+  if (mode == GGUFParseMode::kEager) {
+    try {
+      PrintMetadata();
+    } catch (const std::exception& e) {
+      LOG_ERROR << "Error parsing metadata: " << e.what() << "\n";
+    }
+  }
+  ModelConfigFromMetadata();
+  if (mode == GGUFParseMode::kCached) {
+    WriteSidecar(file_path);
+  }
+}
+
+void GGUFHandler::ParseHead(const std::string& path,
+                            const RangeReader& read) {
+  ParseHeadFile(path, read);
+  ParseShards(path, ShardNames(path),
+              [&read](GGUFHandler& shard, const std::string& shard_path) {
+                shard.ParseHeadFile(shard_path, read);
+              });
+  ModelConfigFromMetadata();
+}
+
+void GGUFHandler::ParseFile(const std::string& file_path, GGUFParseMode mode) {
   OpenFile(file_path);
-  LOG_INFO << "GGUF magic number: " << *reinterpret_cast<const uint32_t*>(data_)
-           << "\n";
+  ParseData(file_path, mode);
+}
+
+void GGUFHandler::ParseHeadFile(const std::string& file_path,
+                                const RangeReader& read) {
+  CloseFile();
+  std::string head;
+  for (auto length = kInitialHeadBytes;; length *= 4) {
+    // Only what is missing is read
+    auto more = read(file_path, head.size(), length - head.size());
+    auto at_end = head.size() + more.size() < length;
+    head += more;
+    try {
+      head_data_ = head;
+      data_ = reinterpret_cast<uint8_t*>(head_data_.data());
+      file_size_ = head_data_.size();
+      from_head_ = true;
+      ParseData(file_path, GGUFParseMode::kLazy);
+      return;
+    } catch (const GGUFTruncatedError&) {
+      CloseFile();
+      if (at_end || length >= kMaxHeadBytes) {
+        throw;
+      }
+    }
+  }
+}
+
+void GGUFHandler::ParseData(const std::string& file_path, GGUFParseMode mode) {
+  CheckBounds(0, 24);
   if (*reinterpret_cast<const uint32_t*>(data_) != GGUF_MAGIC_NUMBER) {
     throw std::runtime_error("Not a valid GGUF file");
   }
@@ -304,62 +418,609 @@ void GGUFHandler::Parse(const std::string& file_path) {
   version_ = *reinterpret_cast<const uint32_t*>(data_ + 4);
   tensor_count_ = *reinterpret_cast<const uint64_t*>(data_ + 8);
   uint64_t metadata_kv_count = *reinterpret_cast<const uint64_t*>(data_ + 16);
-  LOG_INFO << "version: " << version_ << "\ntensor count: " << tensor_count_
-           << "\nmetadata key-value pairs: " << metadata_kv_count << "\n";
+  LOG_DEBUG << "version: " << version_ << ", tensor count: " << tensor_count_
+            << ", metadata key-value pairs: " << metadata_kv_count;
 
   std::size_t offset = 24;
-
+  // Counts the rest of the file cannot hold must not size the reserve
+  if (metadata_kv_count > (file_size_ - offset) / kMinMetadataEntryBytes) {
+    throw GGUFTruncatedError();
+  }
+  metadata_index_.reserve(metadata_kv_count);
   for (uint64_t i = 0; i < metadata_kv_count; ++i) {
-    LOG_INFO << "Parsing key-value number " << i << "\n";
-    auto [key_byte_length, key] = ReadString(offset);
-    offset += key_byte_length;
-    LOG_INFO << "key: " << key << "\n";
-    uint32_t value_type = *reinterpret_cast<const uint32_t*>(data_ + offset);
+    auto key = ReadStringView(offset);
+    offset += 8 + key.size();
+    CheckBounds(offset, 4);
+    uint32_t value_type = ReadScalar<uint32_t>(data_ + offset);
     offset += 4;
-    LOG_INFO << "value type number: " << value_type << "\n";
-    size_t value_byte_length = ReadMetadataValue(value_type, offset, key);
-    offset += value_byte_length;
-    LOG_INFO << "-------------------------------------------- " << "\n";
+    auto size = SkipValue(value_type, offset);
+    AddEntry(key, value_type, offset);
+    if (mode == GGUFParseMode::kEager) {
+      LOG_TRACE << "key: " << key << ", value type number: " << value_type;
+      metadata_index_.back().value = DecodeValue(value_type, offset);
+    }
+    offset += size;
+  }
+  IndexWellKnownKeys();
+  ParseTensorInfos(offset);
+  shards_ = {GGUFShard{file_path, tensor_data_offset_}};
+}
+
+void GGUFHandler::ParseShards(const std::string& file_path) {
+  if (GetInt(GGUFKey::kSplitCount).value_or(1) <= 1) {
+    return;
+  }
+  ParseShards(file_path, FindShards(file_path),
+              [](GGUFHandler& shard, const std::string& shard_path) {
+                shard.ParseFile(shard_path, GGUFParseMode::kLazy);
+              });
+}
+
+void GGUFHandler::ParseShards(
+    const std::string& file_path, const std::vector<std::string>& paths,
+    const std::function<void(GGUFHandler&, const std::string&)>& parse) {
+  auto split_count = GetInt(GGUFKey::kSplitCount).value_or(1);
+  if (split_count <= 1) {
+    return;
+  }
+  auto split_no = GetInt(GGUFKey::kSplitNo).value_or(0);
+  if (split_no != 0) {
+    throw std::runtime_error(file_path + " is shard " +
+                             std::to_string(split_no + 1) + " of " +
+                             std::to_string(split_count) +
+                             ", use the first shard");
+  }
+  if (paths.size() != static_cast<size_t>(split_count)) {
+    throw std::runtime_error("Expected " + std::to_string(split_count) +
+                             " shards for " + file_path + ", found " +
+                             std::to_string(paths.size()));
+  }
+
+  // Only the tensor tables are needed from the other shards, each is parsed
+  // on its own thread
+  using ShardTable = std::pair<std::vector<GGUFTensorInfo>, uint64_t>;
+  std::vector<std::future<ShardTable>> pending;
+  for (size_t i = 1; i < paths.size(); ++i) {
+    pending.push_back(
+        std::async(std::launch::async, [&paths, &parse, i, split_count]() {
+          GGUFHandler shard;
+          parse(shard, paths[i]);
+          if (shard.GetInt(GGUFKey::kSplitNo) != static_cast<int64_t>(i) ||
+              shard.GetInt(GGUFKey::kSplitCount) != split_count) {
+            throw std::runtime_error(paths[i] + " is not shard " +
+                                     std::to_string(i + 1) + " of " +
+                                     std::to_string(split_count));
+          }
+          return ShardTable(std::move(shard.tensor_infos_),
+                            shard.tensor_data_offset_);
+        }));
+  }
+  for (size_t i = 1; i < paths.size(); ++i) {
+    auto table = pending[i - 1].get();
+    for (auto& t : table.first) {
+      t.shard = static_cast<uint32_t>(i);
+      tensor_infos_.push_back(std::move(t));
+    }
+    shards_.push_back(GGUFShard{paths[i], table.second});
+  }
+  tensor_count_ = tensor_infos_.size();
+  if (auto expected = GetInt(GGUFKey::kSplitTensorsCount);
+      expected.has_value() && *expected != static_cast<int64_t>(tensor_count_)) {
+    throw std::runtime_error("Expected " + std::to_string(*expected) +
+                             " tensors in the shards of " + file_path +
+                             ", found " + std::to_string(tensor_count_));
+  }
+  LOG_DEBUG << "shards: " << shards_.size() << ", tensors: " << tensor_count_;
+}
+
+std::vector<std::string> GGUFHandler::FindShards(
+    const std::string& file_path) {
+  auto shards = ShardNames(file_path);
+  for (const auto& shard : shards) {
+    if (!std::filesystem::exists(shard)) {
+      throw std::runtime_error("Missing shard " + shard);
+    }
+  }
+  return shards;
+}
+
+std::vector<std::string> GGUFHandler::ShardNames(
+    const std::string& file_path) {
+  static const std::regex kShardName(R"((.*)-(\d{5})-of-(\d{5})\.gguf)");
+  // Split by hand rather than with std::filesystem, which would turn the
+  // slashes of a URL into backslashes on Windows
+  auto slash = file_path.find_last_of("/\\");
+  auto dir = slash == std::string::npos ? "" : file_path.substr(0, slash + 1);
+  auto name = file_path.substr(dir.size());
+  std::smatch match;
+  if (!std::regex_match(name, match, kShardName)) {
+    return {file_path};
+  }
+  auto count = std::stoi(match[3].str());
+  std::vector<std::string> shards;
+  for (int i = 1; i <= count; ++i) {
+    char suffix[32];
+    std::snprintf(suffix, sizeof(suffix), "-%05d-of-%05d.gguf", i, count);
+    shards.push_back(dir + match[1].str() + suffix);
+  }
+  return shards;
+}
+
+std::filesystem::path GGUFHandler::SidecarPath(const std::string& file_path) {
+  return std::filesystem::path(file_path + ".cortex-cache");
+}
+
+void GGUFHandler::SetSidecarFallbackDir(const std::filesystem::path& dir) {
+  sidecar_fallback_dir_ = dir;
+}
+
+std::filesystem::path GGUFHandler::FallbackSidecarPath(
+    const std::string& file_path) {
+  if (sidecar_fallback_dir_.empty()) {
+    return {};
+  }
+  std::error_code ec;
+  auto abs = std::filesystem::absolute(file_path, ec).string();
+  std::ostringstream name;
+  name << std::hex << std::hash<std::string>{}(abs) << ".cortex-cache";
+  return sidecar_fallback_dir_ / name.str();
+}
+
+bool GGUFHandler::LoadSidecar(const std::string& file_path) {
+  for (const auto& p :
+       {SidecarPath(file_path), FallbackSidecarPath(file_path)}) {
+    if (!p.empty() && LoadSidecarFile(p, file_path)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool GGUFHandler::LoadSidecarFile(const std::filesystem::path& sidecar_path,
+                                  const std::string& file_path) {
+  CloseFile();
+  if (!binary_io_utils::ReadFile(sidecar_path, sidecar_data_)) {
+    return false;
   }
   try {
-    PrintMetadata();
+    binary_io_utils::BinaryReader r(sidecar_data_);
+    if (r.Read<uint32_t>() != kSidecarMagic ||
+        r.Read<uint32_t>() != kSidecarVersion) {
+      throw std::runtime_error("Unknown sidecar format");
+    }
+    version_ = r.Read<uint32_t>();
+
+    // Every shard has to be unchanged, the others are found next to the first
+    std::vector<GGUFShard> shards(r.Read<uint64_t>());
+    if (shards.empty()) {
+      throw std::runtime_error("No shards");
+    }
+    for (size_t i = 0; i < shards.size(); ++i) {
+      auto name = r.ReadString();
+      shards[i].path =
+          i == 0 ? file_path
+                 : (std::filesystem::path(file_path).parent_path() / name)
+                       .string();
+      binary_io_utils::FileIdentity cached, id;
+      cached.size = r.Read<uint64_t>();
+      cached.mtime_ns = r.Read<int64_t>();
+      cached.inode = r.Read<uint64_t>();
+      if (!binary_io_utils::GetFileIdentity(shards[i].path, id) ||
+          cached != id) {
+        throw std::runtime_error("Stale sidecar");
+      }
+      shards[i].tensor_data_offset = r.Read<uint64_t>();
+    }
+
+    // Same encoding as the GGUF key/value section, so the accessors work
+    // unchanged over sidecar_data_
+    auto n_metadata = r.Read<uint64_t>();
+    std::vector<std::tuple<std::string_view, uint32_t, size_t>> entries;
+    for (uint64_t i = 0; i < n_metadata; ++i) {
+      auto key = r.ReadStringView();
+      auto type = r.Read<uint32_t>();
+      auto offset = r.Position();
+      if (type == kString) {
+        r.ReadStringView();
+      } else if (type == kArray) {
+        r.ReadBytes(12);
+      } else if (type <= kFloat64) {
+        r.ReadBytes(kScalarSize[type]);
+      } else {
+        throw std::runtime_error("Unsupported metadata type");
+      }
+      entries.emplace_back(key, type, offset);
+    }
+
+    std::vector<GGUFTensorInfo> tensors(r.Read<uint64_t>());
+    for (auto& t : tensors) {
+      t.name = r.ReadString();
+      auto n_dims = r.Read<uint32_t>();
+      if (n_dims > kMaxTensorDims) {
+        throw std::runtime_error("Invalid tensor");
+      }
+      for (uint32_t d = 0; d < n_dims; ++d) {
+        t.dims.push_back(r.Read<uint64_t>());
+      }
+      t.type = r.Read<uint32_t>();
+      t.offset = r.Read<uint64_t>();
+      t.size = r.Read<uint64_t>();
+      t.shard = r.Read<uint32_t>();
+      if (t.shard >= shards.size()) {
+        throw std::runtime_error("Invalid tensor");
+      }
+    }
+
+    SetModelConfigDefaults();
+    model_config_.name = r.ReadString();
+    model_config_.model = model_config_.name;
+    model_config_.id = model_config_.name;
+    model_config_.version = r.ReadString();
+    auto n_stop = r.Read<uint64_t>();
+    for (uint64_t i = 0; i < n_stop; ++i) {
+      model_config_.stop.push_back(r.ReadString());
+    }
+    model_config_.prompt_template = r.ReadString();
+    model_config_.max_tokens = r.Read<int32_t>();
+    model_config_.ctx_len = r.Read<int32_t>();
+    model_config_.ngl = r.Read<int32_t>();
+    if (!r.AtEnd()) {
+      throw std::runtime_error("Trailing data");
+    }
+
+    tensor_infos_ = std::move(tensors);
+    tensor_count_ = tensor_infos_.size();
+    shards_ = std::move(shards);
+    tensor_data_offset_ = shards_[0].tensor_data_offset;
+    data_ = reinterpret_cast<uint8_t*>(sidecar_data_.data());
+    file_size_ = sidecar_data_.size();
+    from_sidecar_ = true;
+    for (const auto& [key, type, offset] : entries) {
+      AddEntry(key, type, offset);
+    }
+    IndexWellKnownKeys();
+    return true;
   } catch (const std::exception& e) {
-    LOG_ERROR << "Error parsing metadata: " << e.what() << "\n";
+    LOG_DEBUG << "Ignoring sidecar " << sidecar_path.string() << ": "
+              << e.what();
+    sidecar_data_.clear();
+    CloseFile();
+    return false;
   }
-  ModelConfigFromMetadata();
-  CloseFile();
 }
 
-void GGUFHandler::PrintMetadata() {
-  LOG_INFO << "GGUF Metadata:" << "\n";
-  for (const auto& [key, value] : metadata_uint8_)
-    LOG_INFO << key << ": " << value << "\n";
+void GGUFHandler::WriteSidecar(const std::string& file_path) const {
+  binary_io_utils::BinaryWriter w;
+  w.Write<uint32_t>(kSidecarMagic);
+  w.Write<uint32_t>(kSidecarVersion);
+  w.Write<uint32_t>(version_);
+  w.Write<uint64_t>(shards_.size());
+  for (const auto& shard : shards_) {
+    binary_io_utils::FileIdentity id;
+    if (!binary_io_utils::GetFileIdentity(shard.path, id)) {
+      return;
+    }
+    w.WriteString(std::filesystem::path(shard.path).filename().string());
+    w.Write<uint64_t>(id.size);
+    w.Write<int64_t>(id.mtime_ns);
+    w.Write<uint64_t>(id.inode);
+    w.Write<uint64_t>(shard.tensor_data_offset);
+  }
+
+  w.Write<uint64_t>(metadata_index_.size());
+  for (const auto& e : metadata_index_) {
+    w.WriteString(e.key);
+    w.Write<uint32_t>(e.type);
+    // Arrays keep their element type and length, not the elements
+    auto size = e.type == kArray ? 12 : SkipValue(e.type, e.offset);
+    w.WriteBytes(data_ + e.offset, size);
+  }
+
+  w.Write<uint64_t>(tensor_infos_.size());
+  for (const auto& t : tensor_infos_) {
+    w.WriteString(t.name);
+    w.Write<uint32_t>(static_cast<uint32_t>(t.dims.size()));
+    for (auto d : t.dims) {
+      w.Write<uint64_t>(d);
+    }
+    w.Write<uint32_t>(t.type);
+    w.Write<uint64_t>(t.offset);
+    w.Write<uint64_t>(t.size);
+    w.Write<uint32_t>(t.shard);
+  }
+
+  w.WriteString(model_config_.name);
+  w.WriteString(model_config_.version);
+  w.Write<uint64_t>(model_config_.stop.size());
+  for (const auto& stop : model_config_.stop) {
+    w.WriteString(stop);
+  }
+  w.WriteString(model_config_.prompt_template);
+  w.Write<int32_t>(model_config_.max_tokens);
+  w.Write<int32_t>(model_config_.ctx_len);
+  w.Write<int32_t>(model_config_.ngl);
+
+  if (binary_io_utils::WriteFileAtomically(SidecarPath(file_path), w.data())) {
+    return;
+  }
+  auto fallback = FallbackSidecarPath(file_path);
+  if (!fallback.empty()) {
+    std::error_code ec;
+    std::filesystem::create_directories(fallback.parent_path(), ec);
+    if (binary_io_utils::WriteFileAtomically(fallback, w.data())) {
+      return;
+    }
+  }
+  LOG_DEBUG << "Could not write a sidecar cache for " << file_path;
+}
+
+std::size_t GGUFHandler::ParseTensorInfos(std::size_t offset) {
+  tensor_infos_.clear();
+  CheckBounds(offset, 0);
+  if (tensor_count_ > (file_size_ - offset) / kMinTensorInfoBytes) {
+    throw GGUFTruncatedError();
+  }
+  tensor_infos_.reserve(tensor_count_);
+  // Tensors whose type is not in the table get their size from the layout
+  std::vector<size_t> unsized;
+  for (uint64_t i = 0; i < tensor_count_; ++i) {
+    GGUFTensorInfo info;
+    auto name = ReadStringView(offset);
+    info.name = std::string(name);
+    offset += 8 + name.size();
+    CheckBounds(offset, 4);
+    auto n_dims = ReadScalar<uint32_t>(data_ + offset);
+    offset += 4;
+    if (n_dims > kMaxTensorDims) {
+      throw std::runtime_error("Invalid tensor " + info.name + ": " +
+                               std::to_string(n_dims) + " dimensions");
+    }
+    CheckBounds(offset, 8 * n_dims + 12);
+    uint64_t n_elements = 1;
+    for (uint32_t d = 0; d < n_dims; ++d) {
+      info.dims.push_back(ReadScalar<uint64_t>(data_ + offset));
+      n_elements *= info.dims.back();
+      offset += 8;
+    }
+    info.type = ReadScalar<uint32_t>(data_ + offset);
+    info.offset = ReadScalar<uint64_t>(data_ + offset + 4);
+    offset += 12;
+    if (auto size = GGMLTypeSize(info.type, n_elements); size.has_value()) {
+      info.size = *size;
+    } else {
+      LOG_WARN << "Unknown ggml type " << info.type << " for tensor "
+               << info.name;
+      info.size = 0;
+      unsized.push_back(tensor_infos_.size());
+    }
+    tensor_infos_.push_back(std::move(info));
+  }
+
+  auto alignment = static_cast<uint64_t>(
+      GetInt(GGUFKey::kGeneralAlignment).value_or(kDefaultAlignment));
+  if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+    throw std::runtime_error("Invalid general.alignment: " +
+                             std::to_string(alignment));
+  }
+  tensor_data_offset_ = (offset + alignment - 1) / alignment * alignment;
+
+  for (auto i : unsized) {
+    // Up to the next tensor in the file, or the end of the data section
+    uint64_t end = std::numeric_limits<uint64_t>::max();
+    for (const auto& t : tensor_infos_) {
+      if (t.offset > tensor_infos_[i].offset) {
+        end = std::min(end, t.offset);
+      }
+    }
+    if (end == std::numeric_limits<uint64_t>::max()) {
+      end = file_size_ > tensor_data_offset_ ? file_size_ - tensor_data_offset_
+                                             : 0;
+    }
+    tensor_infos_[i].size =
+        end > tensor_infos_[i].offset ? end - tensor_infos_[i].offset : 0;
+  }
+  LOG_DEBUG << "tensors: " << tensor_infos_.size()
+            << ", data offset: " << tensor_data_offset_;
+  return offset;
+}
 
-  for (const auto& [key, value] : metadata_int8_)
-    LOG_INFO << key << ": " << value << "\n";
+const std::vector<GGUFTensorInfo>& GGUFHandler::GetTensorInfos() const {
+  return tensor_infos_;
+}
 
-  for (const auto& [key, value] : metadata_uint16_)
-    LOG_INFO << key << ": " << value << "\n";
+uint64_t GGUFHandler::GetTensorDataOffset() const {
+  return tensor_data_offset_;
+}
 
-  for (const auto& [key, value] : metadata_int16_)
-    LOG_INFO << key << ": " << value << "\n";
+const std::vector<GGUFShard>& GGUFHandler::GetShards() const {
+  return shards_;
+}
 
-  for (const auto& [key, value] : metadata_uint32_)
-    LOG_INFO << key << ": " << value << "\n";
+std::vector<std::string> GGUFHandler::GetFiles() const {
+  std::vector<std::string> files;
+  for (const auto& shard : shards_) {
+    files.push_back(shard.path);
+  }
+  return files;
+}
 
-  for (const auto& [key, value] : metadata_int32_)
-    LOG_INFO << key << ": " << value << "\n";
+GGUFTensorSummary GGUFHandler::GetTensorSummary() const {
+  GGUFTensorSummary summary;
+  for (const auto& t : tensor_infos_) {
+    summary.total_bytes += t.size;
+    summary.type_bytes[GGMLTypeName(t.type)] += t.size;
+    int block = -1;
+    if (t.name.rfind("blk.", 0) == 0) {
+      try {
+        block = std::stoi(t.name.substr(4));
+      } catch (const std::exception&) {
+      }
+    }
+    if (block >= 0) {
+      summary.block_bytes[block] += t.size;
+    } else if (t.name.rfind("token_embd.", 0) == 0) {
+      summary.embedding_bytes += t.size;
+    } else if (t.name.rfind("output.", 0) == 0 ||
+               t.name.rfind("output_norm.", 0) == 0) {
+      summary.output_bytes += t.size;
+    } else {
+      summary.other_bytes += t.size;
+    }
+  }
+  return summary;
+}
 
-  for (const auto& [key, value] : metadata_float_)
-    LOG_INFO << key << ": " << value << "\n";
+std::string GGUFHandler::GGMLTypeName(uint32_t type) {
+  if (type >= std::size(kGGMLTypes) || kGGMLTypes[type].block_size == 0) {
+    return "unknown";
+  }
+  return kGGMLTypes[type].name;
+}
 
-  for (const auto& [key, value] : metadata_bool_)
-    LOG_INFO << key << ": " << value << "\n";
+std::optional<uint64_t> GGUFHandler::GGMLTypeSize(uint32_t type,
+                                                  uint64_t n_elements) {
+  if (type >= std::size(kGGMLTypes) || kGGMLTypes[type].block_size == 0) {
+    return std::nullopt;
+  }
+  const auto& t = kGGMLTypes[type];
+  return (n_elements + t.block_size - 1) / t.block_size * t.type_size;
+}
 
-  for (const auto& [key, value] : metadata_string_) {
+const GGUFHandler::MetadataEntry* GGUFHandler::FindEntry(
+    std::string_view key) const {
+  auto it = metadata_lookup_.find(key);
+  return it == metadata_lookup_.end() ? nullptr
+                                      : &metadata_index_[it->second];
+}
+
+const GGUFHandler::MetadataEntry* GGUFHandler::FindEntryContaining(
+    std::string_view part, bool integer) const {
+  for (const auto& e : metadata_index_) {
+    bool type_ok = integer ? e.type <= kInt32 || e.type == kUint64 ||
+                                 e.type == kInt64
+                           : e.type == kString;
+    if (type_ok && e.key.find(part) != std::string_view::npos) {
+      return &e;
+    }
+  }
+  return nullptr;
+}
 
-    if (key.compare("tokenizer.chat_template") == 0) {
-      LOG_INFO << key << ": " << "\n" << value << "\n";
+const GGUFHandler::MetadataEntry* GGUFHandler::FindEntry(GGUFKey key) const {
+  auto i = well_known_[static_cast<size_t>(key)];
+  return i < 0 ? nullptr : &metadata_index_[i];
+}
+
+std::optional<int64_t> GGUFHandler::AsInt(const MetadataEntry* e) {
+  if (auto v = e ? std::get_if<int64_t>(&e->value) : nullptr) {
+    return *v;
+  }
+  return std::nullopt;
+}
+
+std::optional<double> GGUFHandler::AsFloat(const MetadataEntry* e) {
+  if (auto v = e ? std::get_if<double>(&e->value) : nullptr) {
+    return *v;
+  }
+  return std::nullopt;
+}
+
+std::optional<std::string> GGUFHandler::AsString(
+    const MetadataEntry* e) const {
+  if (!e || e->type != kString) {
+    return std::nullopt;
+  }
+  if (auto v = std::get_if<std::string>(&e->value)) {
+    return *v;
+  }
+  return std::string(ReadStringView(e->offset));
+}
+
+std::optional<uint64_t> GGUFHandler::AsArrayLength(
+    const MetadataEntry* e) const {
+  if (!e || e->type != kArray) {
+    return std::nullopt;
+  }
+  return ReadScalar<uint64_t>(data_ + e->offset + 4);
+}
+
+std::optional<std::string> GGUFHandler::AsArrayString(const MetadataEntry* e,
+                                                      uint64_t index) const {
+  if (!e || e->type != kArray) {
+    return std::nullopt;
+  }
+  if (auto v = std::get_if<std::vector<std::string>>(&e->value)) {
+    return index < v->size() ? std::optional<std::string>((*v)[index])
+                             : std::nullopt;
+  }
+  if (from_sidecar_ || ReadScalar<uint32_t>(data_ + e->offset) != kString ||
+      index >= ReadScalar<uint64_t>(data_ + e->offset + 4)) {
+    return std::nullopt;
+  }
+  std::size_t offset = e->offset + 12;
+  for (uint64_t i = 0; i < index; ++i) {
+    offset += 8 + ReadStringView(offset).size();
+  }
+  return std::string(ReadStringView(offset));
+}
+
+std::optional<int64_t> GGUFHandler::GetInt(std::string_view key) const {
+  return AsInt(FindEntry(key));
+}
+
+std::optional<double> GGUFHandler::GetFloat(std::string_view key) const {
+  return AsFloat(FindEntry(key));
+}
+
+std::optional<bool> GGUFHandler::GetBool(std::string_view key) const {
+  auto e = FindEntry(key);
+  if (auto v = e ? std::get_if<bool>(&e->value) : nullptr) {
+    return *v;
+  }
+  return std::nullopt;
+}
+
+std::optional<std::string> GGUFHandler::GetString(std::string_view key) const {
+  return AsString(FindEntry(key));
+}
+
+std::optional<uint64_t> GGUFHandler::GetArrayLength(
+    std::string_view key) const {
+  return AsArrayLength(FindEntry(key));
+}
+
+std::optional<std::string> GGUFHandler::GetArrayString(std::string_view key,
+                                                       uint64_t index) const {
+  return AsArrayString(FindEntry(key), index);
+}
+
+std::optional<int64_t> GGUFHandler::GetInt(GGUFKey key) const {
+  return AsInt(FindEntry(key));
+}
+
+std::optional<double> GGUFHandler::GetFloat(GGUFKey key) const {
+  return AsFloat(FindEntry(key));
+}
+
+std::optional<std::string> GGUFHandler::GetString(GGUFKey key) const {
+  return AsString(FindEntry(key));
+}
+
+std::optional<uint64_t> GGUFHandler::GetArrayLength(GGUFKey key) const {
+  return AsArrayLength(FindEntry(key));
+}
+
+std::optional<std::string> GGUFHandler::GetArrayString(GGUFKey key,
+                                                       uint64_t index) const {
+  return AsArrayString(FindEntry(key), index);
+}
+
+void GGUFHandler::PrintMetadata() {
+  LOG_INFO << "GGUF Metadata:" << "\n";
+  for (const auto& e : metadata_index_) {
+    if (e.key == "tokenizer.chat_template" && e.type == kString) {
+      auto value = *AsString(&e);
+      LOG_INFO << e.key << ": " << "\n" << value << "\n";
 
       jinja2::Template chat_template;
       chat_template.Load(value);
@@ -375,31 +1036,24 @@ void GGUFHandler::PrintMetadata() {
       std::string result = chat_template.RenderAsString(params).value();
 
       LOG_INFO << "result jinja render: " << result << "\n";
-    } else {
-      LOG_INFO << key << ": " << value << "\n";
+      continue;
+    }
+    if (e.type == kArray) {
+      LOG_INFO << e.key << " num elements: " << *AsArrayLength(&e) << "\n";
+    } else if (e.type == kString) {
+      LOG_INFO << e.key << ": " << *AsString(&e) << "\n";
+    } else if (auto n = std::get_if<int64_t>(&e.value)) {
+      LOG_INFO << e.key << ": " << *n << "\n";
+    } else if (auto d = std::get_if<double>(&e.value)) {
+      LOG_INFO << e.key << ": " << *d << "\n";
+    } else if (auto b = std::get_if<bool>(&e.value)) {
+      LOG_INFO << e.key << ": " << *b << "\n";
     }
   }
-
-  for (const auto& [key, value] : metadata_uint64_)
-    LOG_INFO << key << ": " << value << "\n";
-
-  for (const auto& [key, value] : metadata_int64_)
-    LOG_INFO << key << ": " << value << "\n";
-
-  for (const auto& [key, value] : metadata_double_)
-    LOG_INFO << key << ": " << value << "\n";
-
-  for (const auto& [key, value] : metadata_array_float_)
-    LOG_INFO << key << "num elements: " << value.size() << "\n";
-
-  for (const auto& [key, value] : metadata_array_string_)
-    LOG_INFO << key << " num elements: " << value.size() << "\n";
 }
 
-void GGUFHandler::ModelConfigFromMetadata() {
-  int eos_token, bos_token, max_tokens, version, ngl;
-  std::string chat_template, name, eos_string, bos_string;
-  std::vector<std::string> tokens, stop;
+void GGUFHandler::SetModelConfigDefaults() {
+  model_config_ = ModelConfig();
   model_config_.top_p = 0.95;
   model_config_.temperature = 0.7;
   model_config_.frequency_penalty = 0;
@@ -426,168 +1080,93 @@ void GGUFHandler::ModelConfigFromMetadata() {
   model_config_.n_probs = 0;
   model_config_.min_keep = 0;
   model_config_.grammar = "";
+}
+
+void GGUFHandler::ModelConfigFromMetadata() {
+  int eos_token = -1, bos_token = -1, max_tokens = 0, version = 0, ngl = 0;
+  std::string chat_template, name, eos_string;
+  std::vector<std::string> stop;
+  SetModelConfigDefaults();
 
   // Get version, bos, eos id, contex_len, ngl from meta data
-  for (const auto& [key, value] : metadata_uint8_) {
-    if (key.compare("general.quantization_version") == 0)
-      version = static_cast<int>(value);
-    else if (key.compare("tokenizer.ggml.bos_token_id") == 0)
-      bos_token = static_cast<int>(value);
-    else if (key.compare("tokenizer.ggml.eos_token_id") == 0)
-      eos_token = static_cast<int>(value);
-    else if (key.find("context_length") != std::string::npos)
-      max_tokens = static_cast<int>(value);
-    else if (key.find("block_count") != std::string::npos)
-      ngl = static_cast<int>(value) + 1;
-  }
-
-  for (const auto& [key, value] : metadata_int8_) {
-    if (key.compare("general.quantization_version") == 0)
-      version = static_cast<int>(value);
-    else if (key.compare("tokenizer.ggml.bos_token_id") == 0)
-      bos_token = static_cast<int>(value);
-    else if (key.compare("tokenizer.ggml.eos_token_id") == 0)
-      eos_token = static_cast<int>(value);
-    else if (key.find("context_length") != std::string::npos)
-      max_tokens = static_cast<int>(value);
-    else if (key.find("block_count") != std::string::npos)
-      ngl = static_cast<int>(value) + 1;
-  }
-
-  for (const auto& [key, value] : metadata_uint16_) {
-    if (key.compare("general.quantization_version") == 0)
-      version = static_cast<int>(value);
-    else if (key.compare("tokenizer.ggml.bos_token_id") == 0)
-      bos_token = static_cast<int>(value);
-    else if (key.compare("tokenizer.ggml.eos_token_id") == 0)
-      eos_token = static_cast<int>(value);
-    else if (key.find("context_length") != std::string::npos)
-      max_tokens = static_cast<int>(value);
-    else if (key.find("block_count") != std::string::npos)
-      ngl = static_cast<int>(value) + 1;
-  }
-
-  for (const auto& [key, value] : metadata_int16_) {
-    if (key.compare("general.quantization_version") == 0)
-      version = static_cast<int>(value);
-    else if (key.compare("tokenizer.ggml.bos_token_id") == 0)
-      bos_token = static_cast<int>(value);
-    else if (key.compare("tokenizer.ggml.eos_token_id") == 0)
-      eos_token = static_cast<int>(value);
-    else if (key.find("context_length") != std::string::npos)
-      max_tokens = static_cast<int>(value);
-    else if (key.find("block_count") != std::string::npos)
-      ngl = static_cast<int>(value) + 1;
-  }
-
-  for (const auto& [key, value] : metadata_uint32_) {
-    if (key.compare("general.quantization_version") == 0)
-      version = static_cast<int>(value);
-    else if (key.compare("tokenizer.ggml.bos_token_id") == 0)
-      bos_token = static_cast<int>(value);
-    else if (key.compare("tokenizer.ggml.eos_token_id") == 0)
-      eos_token = static_cast<int>(value);
-    else if (key.find("context_length") != std::string::npos)
-      max_tokens = static_cast<int>(value);
-    else if (key.find("block_count") != std::string::npos)
-      ngl = static_cast<int>(value) + 1;
-  }
-
-  for (const auto& [key, value] : metadata_int32_) {
-    if (key.compare("general.quantization_version") == 0)
-      version = static_cast<int>(value);
-    else if (key.compare("tokenizer.ggml.bos_token_id") == 0)
-      bos_token = static_cast<int>(value);
-    else if (key.compare("tokenizer.ggml.eos_token_id") == 0)
-      eos_token = static_cast<int>(value);
-    else if (key.find("context_length") != std::string::npos)
-      max_tokens = static_cast<int>(value);
-    else if (key.find("block_count") != std::string::npos)
-      ngl = static_cast<int>(value) + 1;
-  }
-  for (const auto& [key, value] : metadata_uint64_) {
-    if (key.compare("general.quantization_version") == 0)
-      version = static_cast<int>(value);
-    else if (key.compare("tokenizer.ggml.bos_token_id") == 0)
-      bos_token = static_cast<int>(value);
-    else if (key.compare("tokenizer.ggml.eos_token_id") == 0)
-      eos_token = static_cast<int>(value);
-    else if (key.find("context_length") != std::string::npos)
-      max_tokens = static_cast<int>(value);
-    else if (key.find("block_count") != std::string::npos)
-      ngl = static_cast<int>(value) + 1;
-  }
-
-  for (const auto& [key, value] : metadata_int64_) {
-    if (key.compare("general.quantization_version") == 0)
-      version = static_cast<int>(value);
-    else if (key.compare("tokenizer.ggml.bos_token_id") == 0)
-      bos_token = static_cast<int>(value);
-    else if (key.compare("tokenizer.ggml.eos_token_id") == 0)
-      eos_token = static_cast<int>(value);
-    else if (key.find("context_length") != std::string::npos)
-      max_tokens = static_cast<int>(value);
-    else if (key.find("block_count") != std::string::npos)
-      ngl = static_cast<int>(value) + 1;
-  }
-  for (const auto& [key, value] : metadata_array_string_) {
-    if (key.compare("tokenizer.ggml.tokens") == 0) {
-      tokens = std::move(value);
-    }
-  }
-  for (const auto& [key, value] : metadata_string_) {
-    if (key.compare("general.name") == 0) {
-      name = std::regex_replace(value, std::regex(" "), "-");
-    } else if (key.find("chat_template") != std::string::npos) {
-      if (value.compare(ZEPHYR_JINJA) == 0) {
-        chat_template =
-            "<|system|>\n{system_message}</s>\n<|user|>\n{prompt}</"
-            "s>\n<|assistant|>\n";
-      } else if (value.compare(OPEN_CHAT_3_5_JINJA) == 0) {
-        chat_template =
-            "GPT4 Correct User: {prompt}<|end_of_turn|>GPT4 Correct Assistant:";
-      } else if (value.compare(LLAMA_3_JINJA) == 0 ||
-                 value.compare(LLAMA_3_1_JINJA) == 0) {
+  version = static_cast<int>(
+      GetInt(GGUFKey::kGeneralQuantizationVersion).value_or(version));
+  bos_token = static_cast<int>(
+      GetInt(GGUFKey::kTokenizerBosTokenId).value_or(bos_token));
+  eos_token = static_cast<int>(
+      GetInt(GGUFKey::kTokenizerEosTokenId).value_or(eos_token));
+  // Files without general.architecture fall back to a scan of the keys
+  auto context_length = FindEntry(GGUFKey::kContextLength);
+  if (!context_length) {
+    context_length = FindEntryContaining("context_length", true);
+  }
+  auto block_count = FindEntry(GGUFKey::kBlockCount);
+  if (!block_count) {
+    block_count = FindEntryContaining("block_count", true);
+  }
+  max_tokens = static_cast<int>(AsInt(context_length).value_or(max_tokens));
+  if (block_count) {
+    ngl = static_cast<int>(AsInt(block_count).value_or(0)) + 1;
+  }
+  // Only the special tokens are needed, the vocabulary is not decoded
+  auto token = [this](int id) {
+    return id < 0 ? std::string()
+                  : GetArrayString(GGUFKey::kTokenizerTokens, id).value_or("");
+  };
+
+  if (auto value = GetString(GGUFKey::kGeneralName); value.has_value()) {
+    name = std::regex_replace(*value, std::regex(" "), "-");
+  }
+  auto template_entry = FindEntry(GGUFKey::kTokenizerChatTemplate);
+  if (!template_entry || template_entry->type != kString) {
+    template_entry = FindEntryContaining("chat_template", false);
+  }
+  if (template_entry) {
+    auto value = std::string(ReadStringView(template_entry->offset));
+    if (value.compare(ZEPHYR_JINJA) == 0) {
+      chat_template =
+          "<|system|>\n{system_message}</s>\n<|user|>\n{prompt}</"
+          "s>\n<|assistant|>\n";
+    } else if (value.compare(OPEN_CHAT_3_5_JINJA) == 0) {
+      chat_template =
+          "GPT4 Correct User: {prompt}<|end_of_turn|>GPT4 Correct Assistant:";
+    } else if (value.compare(LLAMA_3_JINJA) == 0 ||
+               value.compare(LLAMA_3_1_JINJA) == 0) {
+      chat_template =
+          "<|begin_of_text|><|start_header_id|>system<|end_header_id|>\n\n{"
+          "system_message}<|eot_id|><|start_header_id|>user<|end_header_id|>"
+          "\n\n{prompt}<|eot_id|><|start_header_id|>assistant<|end_header_id|"
+          ">\n\n";
+    } else {
+      try {
+        jinja2::Template jinja2_chat_template;
+        jinja2_chat_template.Load(value);
+        jinja2::ValuesMap params{
+            {"add_generation_prompt", true},
+            {"bos_token", token(bos_token)},
+            {"eos_token", token(eos_token)},
+            {"messages",
+             jinja2::ValuesList{
+                 jinja2::ValuesMap{{"role", "system"},
+                                   {"content", "{system_message}"}},
+                 jinja2::ValuesMap{{"role", "user"},
+                                   {"content", "{prompt}"}}}}};
+        chat_template = jinja2_chat_template.RenderAsString(params).value();
+      } catch (const std::exception& e) {
+        std::cerr << "Error render chat template: " << e.what()
+                  << ". Using default template: \n[INST] "
+                     "<<SYS>>\n{system_message}\n<</SYS>>\n{prompt}[/INST]"
+                  << "\n";
         chat_template =
-            "<|begin_of_text|><|start_header_id|>system<|end_header_id|>\n\n{"
-            "system_message}<|eot_id|><|start_header_id|>user<|end_header_id|>"
-            "\n\n{prompt}<|eot_id|><|start_header_id|>assistant<|end_header_id|"
-            ">\n\n";
-      } else {
-        try {
-          jinja2::Template jinja2_chat_template;
-          jinja2_chat_template.Load(value);
-          jinja2::ValuesMap params{
-              {"add_generation_prompt", true},
-              {"bos_token", tokens[bos_token]},
-              {"eos_token", tokens[eos_token]},
-              {"messages",
-               jinja2::ValuesList{
-                   jinja2::ValuesMap{{"role", "system"},
-                                     {"content", "{system_message}"}},
-                   jinja2::ValuesMap{{"role", "user"},
-                                     {"content", "{prompt}"}}}}};
-          chat_template = jinja2_chat_template.RenderAsString(params).value();
-        } catch (const std::exception& e) {
-          std::cerr << "Error render chat template: " << e.what()
-                    << ". Using default template: \n[INST] "
-                       "<<SYS>>\n{system_message}\n<</SYS>>\n{prompt}[/INST]"
-                    << "\n";
-          chat_template =
-              "[INST] <<SYS>>\n{system_message}\n<</SYS>>\n{prompt}[/INST]";
-        }
+            "[INST] <<SYS>>\n{system_message}\n<</SYS>>\n{prompt}[/INST]";
       }
     }
   }
 
-  try {
-    if (tokens.size() > eos_token) {
-      eos_string = tokens[eos_token];
-      stop.push_back(std::move(eos_string));
-    } else {
-      LOG_ERROR << "Can't find stop token";
-    }
-  } catch (const std::exception& e) {
+  eos_string = token(eos_token);
+  if (!eos_string.empty()) {
+    stop.push_back(std::move(eos_string));
+  } else {
     LOG_ERROR << "Can't find stop token";
   }
 
@@ -1,5 +1,15 @@
 #pragma once
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+#include "gguf_keys.h"
 #include "yaml_config.h"
 
 namespace config {
@@ -32,40 +42,204 @@ constexpr char LLAMA_3_JINJA[] =
     "'<|start_header_id|>assistant<|end_header_id|>\n\n' }}";
 constexpr uint32_t GGUF_MAGIC_NUMBER = 1179993927;
 
+enum class GGUFParseMode {
+  // Index the metadata keys over the mapped file, decode values on demand
+  kLazy,
+  // Decode and log every metadata value up front, for debugging
+  kEager,
+  // Like kLazy, but served from the sidecar cache of an earlier parse when the
+  // file has not changed, and writes one otherwise. Array elements are not
+  // cached, GetArrayString() has nothing to return for a cached parse.
+  kCached,
+};
+
+// The file, or the part of it that was read, ends before the structure it
+// describes
+class GGUFTruncatedError : public std::runtime_error {
+ public:
+  GGUFTruncatedError() : std::runtime_error("Truncated GGUF file") {}
+};
+
+// Descriptor of a tensor from the tensor info table
+struct GGUFTensorInfo {
+  std::string name;
+  std::vector<uint64_t> dims;
+  // ggml_type
+  uint32_t type;
+  // Relative to the start of the tensor data section
+  uint64_t offset;
+  // Bytes of weight data
+  uint64_t size;
+  // Index of the file holding the data, see GGUFHandler::GetShards()
+  uint32_t shard = 0;
+};
+
+// One file of a model split into "<name>-00001-of-0000N.gguf" shards. The
+// first shard carries the metadata, every shard its own tensor table.
+struct GGUFShard {
+  std::string path;
+  // Absolute offset of the tensor data section in this file
+  uint64_t tensor_data_offset;
+};
+
+// Where the weight bytes of a model go, without loading it
+struct GGUFTensorSummary {
+  uint64_t total_bytes = 0;
+  // Repeating layers, by block index (blk.N.*)
+  std::map<int, uint64_t> block_bytes;
+  // token_embd.*
+  uint64_t embedding_bytes = 0;
+  // output.* and output_norm.*, the output head
+  uint64_t output_bytes = 0;
+  // Everything else, e.g. rope factors
+  uint64_t other_bytes = 0;
+  // Quantization type mix, ggml type name to bytes
+  std::map<std::string, uint64_t> type_bytes;
+};
+
+// A decoded metadata value. Integers of any width are widened to int64_t and
+// floats to double, numeric arrays become double arrays.
+using GGUFValue =
+    std::variant<std::monostate, int64_t, double, bool, std::string,
+                 std::vector<std::string>, std::vector<double>>;
+
 class GGUFHandler {
  public:
+  GGUFHandler() { well_known_.fill(-1); }
+  GGUFHandler(const GGUFHandler&) = delete;
+  GGUFHandler& operator=(const GGUFHandler&) = delete;
+  ~GGUFHandler();
+
   void CloseFile();
-  void Parse(const std::string& file_path);
+  void Parse(const std::string& file_path,
+             GGUFParseMode mode = GGUFParseMode::kLazy);
   const ModelConfig& GetModelConfig() const;
   void PrintMetadata();
 
+  // Bytes [offset, offset + length) of `path`, fewer at the end of the file
+  using RangeReader = std::function<std::string(
+      const std::string& path, uint64_t offset, uint64_t length)>;
+  static constexpr uint64_t kInitialHeadBytes = 1ull << 20;
+  static constexpr uint64_t kMaxHeadBytes = 256ull << 20;
+  /**
+   * Parse() of a model that is not on disk, e.g. behind a download URL. Only
+   * the head of each file is read through `read`, growing from
+   * kInitialHeadBytes until the tensor table fits. Shards of a split model
+   * are found by name next to `path`.
+   */
+  void ParseHead(const std::string& path, const RangeReader& read);
+
+  // Typed access to metadata values, a key of another type is treated as
+  // missing. Scalars are decoded while indexing, strings and arrays on demand
+  // from the mapping, which stays open until CloseFile() or the next Parse().
+  std::optional<int64_t> GetInt(std::string_view key) const;
+  std::optional<double> GetFloat(std::string_view key) const;
+  std::optional<bool> GetBool(std::string_view key) const;
+  std::optional<std::string> GetString(std::string_view key) const;
+  std::optional<uint64_t> GetArrayLength(std::string_view key) const;
+  std::optional<std::string> GetArrayString(std::string_view key,
+                                            uint64_t index) const;
+  // Well-known keys, without a string lookup. Architecture keys resolve
+  // against general.architecture.
+  std::optional<int64_t> GetInt(GGUFKey key) const;
+  std::optional<double> GetFloat(GGUFKey key) const;
+  std::optional<std::string> GetString(GGUFKey key) const;
+  std::optional<uint64_t> GetArrayLength(GGUFKey key) const;
+  std::optional<std::string> GetArrayString(GGUFKey key, uint64_t index) const;
+
+  // Tensors of all shards, in shard order
+  const std::vector<GGUFTensorInfo>& GetTensorInfos() const;
+  GGUFTensorSummary GetTensorSummary() const;
+  // Absolute offset of the tensor data section of the first shard
+  uint64_t GetTensorDataOffset() const;
+  // The parsed file, and the other shards of a split model
+  const std::vector<GGUFShard>& GetShards() const;
+  std::vector<std::string> GetFiles() const;
+
+  // All shards of the split model `file_path` belongs to, in order, or just
+  // `file_path` if it is not named like a shard. Throws if a shard is missing.
+  static std::vector<std::string> FindShards(const std::string& file_path);
+  // FindShards() by name only, `file_path` may also be a URL
+  static std::vector<std::string> ShardNames(const std::string& file_path);
+
+  // True if the last Parse() was served from the sidecar cache
+  bool FromSidecar() const { return from_sidecar_; }
+  // <model>.cortex-cache
+  static std::filesystem::path SidecarPath(const std::string& file_path);
+  // Where sidecars go when the model's directory is not writable, e.g. a
+  // read-only network mount
+  static void SetSidecarFallbackDir(const std::filesystem::path& dir);
+
+  // "Q4_K", "F16", ... or "unknown"
+  static std::string GGMLTypeName(uint32_t type);
+  // Bytes taken by `n_elements` values of a ggml type, nullopt if the type is
+  // not known
+  static std::optional<uint64_t> GGMLTypeSize(uint32_t type,
+                                              uint64_t n_elements);
+
  private:
-  std::pair<std::size_t, std::string> ReadString(std::size_t offset) const;
-  size_t ReadMetadataValue(int type, std::size_t offset,
-                           const std::string& key);
-  size_t ReadArray(std::size_t offset, const std::string& key);
+  struct MetadataEntry {
+    // Points into the mapped file
+    std::string_view key;
+    uint32_t type;
+    // Offset of the value
+    std::size_t offset;
+    // Scalars always, strings and arrays only in GGUFParseMode::kEager
+    GGUFValue value;
+  };
+
+  std::string_view ReadStringView(std::size_t offset) const;
+  GGUFValue DecodeValue(uint32_t type, std::size_t offset) const;
+  size_t SkipValue(uint32_t type, std::size_t offset) const;
+  void CheckBounds(std::size_t offset, std::size_t length) const;
+  void AddEntry(std::string_view key, uint32_t type, std::size_t offset);
+  void IndexWellKnownKeys();
+  const MetadataEntry* FindEntry(GGUFKey key) const;
+  const MetadataEntry* FindEntry(std::string_view key) const;
+  const MetadataEntry* FindEntryContaining(std::string_view part,
+                                           bool integer) const;
+  static std::optional<int64_t> AsInt(const MetadataEntry* e);
+  static std::optional<double> AsFloat(const MetadataEntry* e);
+  std::optional<std::string> AsString(const MetadataEntry* e) const;
+  std::optional<uint64_t> AsArrayLength(const MetadataEntry* e) const;
+  std::optional<std::string> AsArrayString(const MetadataEntry* e,
+                                           uint64_t index) const;
+  std::size_t ParseTensorInfos(std::size_t offset);
+  void ParseFile(const std::string& file_path, GGUFParseMode mode);
+  void ParseHeadFile(const std::string& file_path, const RangeReader& read);
+  void ParseData(const std::string& file_path, GGUFParseMode mode);
+  void ParseShards(const std::string& file_path);
+  void ParseShards(
+      const std::string& file_path, const std::vector<std::string>& paths,
+      const std::function<void(GGUFHandler&, const std::string&)>& parse);
+  void SetModelConfigDefaults();
   void ModelConfigFromMetadata();
+  bool LoadSidecar(const std::string& file_path);
+  bool LoadSidecarFile(const std::filesystem::path& sidecar_path,
+                       const std::string& file_path);
+  void WriteSidecar(const std::string& file_path) const;
+  static std::filesystem::path FallbackSidecarPath(
+      const std::string& file_path);
   void OpenFile(const std::string& file_path);
 
-  uint8_t* data_;
-  size_t file_size_;
+  uint8_t* data_ = nullptr;
+  size_t file_size_ = 0;
   uint32_t version_;
   uint64_t tensor_count_;
   ModelConfig model_config_;
-  std::unordered_map<std::string, uint8_t> metadata_uint8_;
-  std::unordered_map<std::string, int8_t> metadata_int8_;
-  std::unordered_map<std::string, uint16_t> metadata_uint16_;
-  std::unordered_map<std::string, int16_t> metadata_int16_;
-  std::unordered_map<std::string, uint32_t> metadata_uint32_;
-  std::unordered_map<std::string, int32_t> metadata_int32_;
-  std::unordered_map<std::string, float> metadata_float_;
-  std::unordered_map<std::string, bool> metadata_bool_;
-  std::unordered_map<std::string, std::string> metadata_string_;
-  std::unordered_map<std::string, uint64_t> metadata_uint64_;
-  std::unordered_map<std::string, int64_t> metadata_int64_;
-  std::unordered_map<std::string, double> metadata_double_;
-  std::unordered_map<std::string, std::vector<float>> metadata_array_float_;
-  std::unordered_map<std::string, std::vector<std::string>>
-      metadata_array_string_;
+  std::vector<MetadataEntry> metadata_index_;
+  std::unordered_map<std::string_view, size_t> metadata_lookup_;
+  // Entry of each GGUFKey, -1 if missing
+  std::array<int32_t, static_cast<size_t>(GGUFKey::kCount)> well_known_;
+  std::vector<GGUFTensorInfo> tensor_infos_;
+  uint64_t tensor_data_offset_ = 0;
+  std::vector<GGUFShard> shards_;
+  // Backs data_ instead of the mapping after a cached parse
+  std::string sidecar_data_;
+  bool from_sidecar_ = false;
+  // Backs data_ instead of the mapping after ParseHead()
+  std::string head_data_;
+  bool from_head_ = false;
+  inline static std::filesystem::path sidecar_fallback_dir_;
 };
 }
\ No newline at end of file
@@ -0,0 +1,320 @@
+#include "model_config_snapshot.h"
+#include <trantor/utils/Logger.h>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+namespace config {
+namespace {
+// "CMCS"
+constexpr uint32_t kMagic = 0x53434d43;
+constexpr uint32_t kDerivedFiles = 1;
+
+struct StrRef {
+  uint32_t offset;
+  uint32_t size;
+};
+
+// `count` StrRefs starting at `offset`
+struct ListRef {
+  uint32_t offset;
+  uint32_t count;
+};
+
+// The start of every snapshot. Fields are only ever appended, and any change
+// bumps kVersion.
+struct Table {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t table_size;
+  uint32_t flags;
+  uint64_t yaml_size;
+  int64_t yaml_mtime_ns;
+  uint64_t yaml_inode;
+  uint64_t created;
+
+  float top_p;
+  float temperature;
+  float frequency_penalty;
+  float presence_penalty;
+  float dynatemp_range;
+  float dynatemp_exponent;
+  float min_p;
+  float tfs_z;
+  float typ_p;
+  float repeat_penalty;
+  float mirostat_tau;
+  float mirostat_eta;
+
+  int32_t max_tokens;
+  int32_t ngl;
+  int32_t ctx_len;
+  int32_t tp;
+  int32_t seed;
+  int32_t top_k;
+  int32_t repeat_last_n;
+  int32_t n_probs;
+  int32_t min_keep;
+
+  uint8_t stream;
+  uint8_t text_model;
+  uint8_t mirostat;
+  uint8_t penalize_nl;
+  uint8_t ignore_eos;
+  uint8_t reserved[3];
+
+  StrRef name;
+  StrRef model;
+  StrRef version_str;
+  StrRef engine;
+  StrRef prompt_template;
+  StrRef system_template;
+  StrRef user_template;
+  StrRef ai_template;
+  StrRef os;
+  StrRef gpu_arch;
+  StrRef quantization_method;
+  StrRef precision;
+  StrRef trtllm_version;
+  StrRef id;
+  StrRef object;
+  StrRef owned_by;
+  StrRef grammar;
+
+  ListRef stop;
+  ListRef files;
+};
+static_assert(std::is_trivially_copyable_v<Table>);
+
+class PoolWriter {
+ public:
+  explicit PoolWriter(std::string& out) : out_(out) {}
+
+  StrRef Str(const std::string& s) {
+    StrRef ref{static_cast<uint32_t>(out_.size()),
+               static_cast<uint32_t>(s.size())};
+    out_ += s;
+    return ref;
+  }
+
+  ListRef List(const std::vector<std::string>& items) {
+    std::vector<StrRef> refs;
+    refs.reserve(items.size());
+    for (const auto& s : items) {
+      refs.push_back(Str(s));
+    }
+    // Keep the StrRef array aligned for readers that map the file
+    out_.resize((out_.size() + alignof(StrRef) - 1) / alignof(StrRef) *
+                alignof(StrRef));
+    ListRef ref{static_cast<uint32_t>(out_.size()),
+                static_cast<uint32_t>(refs.size())};
+    out_.append(reinterpret_cast<const char*>(refs.data()),
+                refs.size() * sizeof(StrRef));
+    return ref;
+  }
+
+ private:
+  std::string& out_;
+};
+
+class PoolReader {
+ public:
+  explicit PoolReader(std::string_view data) : data_(data) {}
+
+  bool Str(const StrRef& ref, std::string& out) const {
+    if (ref.offset > data_.size() || ref.size > data_.size() - ref.offset) {
+      return false;
+    }
+    out.assign(data_.data() + ref.offset, ref.size);
+    return true;
+  }
+
+  bool List(const ListRef& ref, std::vector<std::string>& out) const {
+    auto bytes = static_cast<uint64_t>(ref.count) * sizeof(StrRef);
+    if (ref.offset > data_.size() || bytes > data_.size() - ref.offset) {
+      return false;
+    }
+    out.resize(ref.count);
+    for (uint32_t i = 0; i < ref.count; i++) {
+      StrRef s;
+      std::memcpy(&s, data_.data() + ref.offset + i * sizeof(StrRef),
+                  sizeof(s));
+      if (!Str(s, out[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  std::string_view data_;
+};
+}  // namespace
+
+std::filesystem::path ModelConfigSnapshot::PathFor(
+    const std::string& yaml_path) {
+  return std::filesystem::path(yaml_path + ".cortex-cache");
+}
+
+std::string ModelConfigSnapshot::Encode(
+    const ModelConfig& c, const binary_io_utils::FileIdentity& yaml_id,
+    bool derived_files) {
+  std::string out(sizeof(Table), '\0');
+  PoolWriter pool(out);
+  Table t{};
+  t.magic = kMagic;
+  t.version = kVersion;
+  t.table_size = sizeof(Table);
+  t.flags = derived_files ? kDerivedFiles : 0;
+  t.yaml_size = yaml_id.size;
+  t.yaml_mtime_ns = yaml_id.mtime_ns;
+  t.yaml_inode = yaml_id.inode;
+  t.created = c.created;
+
+  t.top_p = c.top_p;
+  t.temperature = c.temperature;
+  t.frequency_penalty = c.frequency_penalty;
+  t.presence_penalty = c.presence_penalty;
+  t.dynatemp_range = c.dynatemp_range;
+  t.dynatemp_exponent = c.dynatemp_exponent;
+  t.min_p = c.min_p;
+  t.tfs_z = c.tfs_z;
+  t.typ_p = c.typ_p;
+  t.repeat_penalty = c.repeat_penalty;
+  t.mirostat_tau = c.mirostat_tau;
+  t.mirostat_eta = c.mirostat_eta;
+
+  t.max_tokens = c.max_tokens;
+  t.ngl = c.ngl;
+  t.ctx_len = c.ctx_len;
+  t.tp = c.tp;
+  t.seed = c.seed;
+  t.top_k = c.top_k;
+  t.repeat_last_n = c.repeat_last_n;
+  t.n_probs = c.n_probs;
+  t.min_keep = c.min_keep;
+
+  t.stream = c.stream;
+  t.text_model = c.text_model;
+  t.mirostat = c.mirostat;
+  t.penalize_nl = c.penalize_nl;
+  t.ignore_eos = c.ignore_eos;
+
+  t.name = pool.Str(c.name);
+  t.model = pool.Str(c.model);
+  t.version_str = pool.Str(c.version);
+  t.engine = pool.Str(c.engine);
+  t.prompt_template = pool.Str(c.prompt_template);
+  t.system_template = pool.Str(c.system_template);
+  t.user_template = pool.Str(c.user_template);
+  t.ai_template = pool.Str(c.ai_template);
+  t.os = pool.Str(c.os);
+  t.gpu_arch = pool.Str(c.gpu_arch);
+  t.quantization_method = pool.Str(c.quantization_method);
+  t.precision = pool.Str(c.precision);
+  t.trtllm_version = pool.Str(c.trtllm_version);
+  t.id = pool.Str(c.id);
+  t.object = pool.Str(c.object);
+  t.owned_by = pool.Str(c.owned_by);
+  t.grammar = pool.Str(c.grammar);
+  t.stop = pool.List(c.stop);
+  t.files = pool.List(c.files);
+
+  std::memcpy(out.data(), &t, sizeof(t));
+  return out;
+}
+
+bool ModelConfigSnapshot::Decode(std::string_view data,
+                                 const binary_io_utils::FileIdentity& yaml_id,
+                                 ModelConfig& config) {
+  Table t;
+  if (data.size() < sizeof(t)) {
+    return false;
+  }
+  std::memcpy(&t, data.data(), sizeof(t));
+  if (t.magic != kMagic || t.version != kVersion ||
+      t.table_size != sizeof(Table) || t.yaml_size != yaml_id.size ||
+      t.yaml_mtime_ns != yaml_id.mtime_ns || t.yaml_inode != yaml_id.inode) {
+    return false;
+  }
+
+  ModelConfig c;
+  PoolReader pool(data);
+  if (!pool.Str(t.name, c.name) || !pool.Str(t.model, c.model) ||
+      !pool.Str(t.version_str, c.version) || !pool.Str(t.engine, c.engine) ||
+      !pool.Str(t.prompt_template, c.prompt_template) ||
+      !pool.Str(t.system_template, c.system_template) ||
+      !pool.Str(t.user_template, c.user_template) ||
+      !pool.Str(t.ai_template, c.ai_template) || !pool.Str(t.os, c.os) ||
+      !pool.Str(t.gpu_arch, c.gpu_arch) ||
+      !pool.Str(t.quantization_method, c.quantization_method) ||
+      !pool.Str(t.precision, c.precision) ||
+      !pool.Str(t.trtllm_version, c.trtllm_version) ||
+      !pool.Str(t.id, c.id) || !pool.Str(t.object, c.object) ||
+      !pool.Str(t.owned_by, c.owned_by) || !pool.Str(t.grammar, c.grammar) ||
+      !pool.List(t.stop, c.stop) || !pool.List(t.files, c.files)) {
+    return false;
+  }
+  if (t.flags & kDerivedFiles) {
+    // Found in the directory rather than written in the YAML
+    for (const auto& f : c.files) {
+      std::error_code ec;
+      if (!std::filesystem::exists(f, ec)) {
+        return false;
+      }
+    }
+  }
+
+  c.created = t.created;
+  c.top_p = t.top_p;
+  c.temperature = t.temperature;
+  c.frequency_penalty = t.frequency_penalty;
+  c.presence_penalty = t.presence_penalty;
+  c.dynatemp_range = t.dynatemp_range;
+  c.dynatemp_exponent = t.dynatemp_exponent;
+  c.min_p = t.min_p;
+  c.tfs_z = t.tfs_z;
+  c.typ_p = t.typ_p;
+  c.repeat_penalty = t.repeat_penalty;
+  c.mirostat_tau = t.mirostat_tau;
+  c.mirostat_eta = t.mirostat_eta;
+
+  c.max_tokens = t.max_tokens;
+  c.ngl = t.ngl;
+  c.ctx_len = t.ctx_len;
+  c.tp = t.tp;
+  c.seed = t.seed;
+  c.top_k = t.top_k;
+  c.repeat_last_n = t.repeat_last_n;
+  c.n_probs = t.n_probs;
+  c.min_keep = t.min_keep;
+
+  c.stream = t.stream != 0;
+  c.text_model = t.text_model != 0;
+  c.mirostat = t.mirostat != 0;
+  c.penalize_nl = t.penalize_nl != 0;
+  c.ignore_eos = t.ignore_eos != 0;
+
+  config = std::move(c);
+  return true;
+}
+
+void ModelConfigSnapshot::Write(const std::string& yaml_path,
+                                const binary_io_utils::FileIdentity& yaml_id,
+                                const ModelConfig& config,
+                                bool derived_files) {
+  if (!binary_io_utils::WriteFileAtomically(
+          PathFor(yaml_path), Encode(config, yaml_id, derived_files))) {
+    LOG_DEBUG << "Could not write a config snapshot for " << yaml_path;
+  }
+}
+
+bool ModelConfigSnapshot::Load(const std::string& yaml_path,
+                               ModelConfig& config) {
+  binary_io_utils::FileIdentity id;
+  std::string data;
+  return binary_io_utils::GetFileIdentity(yaml_path, id) &&
+         binary_io_utils::ReadFile(PathFor(yaml_path), data) &&
+         Decode(data, id, config);
+}
+}  // namespace config
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include "config/model_config.h"
+#include "utils/binary_io_utils.h"
+
+namespace config {
+/**
+ * A compiled ModelConfig, written next to its model.yml so that the next
+ * read skips yaml-cpp.
+ *
+ * The snapshot is one fixed-layout table of every scalar field and of
+ * { offset, size } references into a string pool that follows it, so
+ * decoding is a copy of the table and of each string, with no per-field
+ * parsing or lookup. It records the identity (size, mtime, inode) of the
+ * model.yml it was compiled from and is ignored once that changes, or when
+ * its layout version is not this build's.
+ */
+class ModelConfigSnapshot {
+ public:
+  static constexpr uint32_t kVersion = 1;
+
+  static std::filesystem::path PathFor(const std::string& yaml_path);
+
+  /**
+   * `derived_files` is set when `config.files` was not in the YAML but
+   * found in the model's directory, those files must still exist for the
+   * snapshot to be fresh.
+   */
+  static std::string Encode(const ModelConfig& config,
+                            const binary_io_utils::FileIdentity& yaml_id,
+                            bool derived_files);
+  // False if `data` is not a snapshot of `yaml_id` in this layout
+  static bool Decode(std::string_view data,
+                     const binary_io_utils::FileIdentity& yaml_id,
+                     ModelConfig& config);
+
+  // Compiles `config`, read from `yaml_path` while it was `yaml_id`, best
+  // effort
+  static void Write(const std::string& yaml_path,
+                    const binary_io_utils::FileIdentity& yaml_id,
+                    const ModelConfig& config, bool derived_files);
+  // False if there is no fresh snapshot of `yaml_path`
+  static bool Load(const std::string& yaml_path, ModelConfig& config);
+};
+}  // namespace config
@@ -0,0 +1,188 @@
+#include "model_memory_estimator.h"
+#include <algorithm>
+#include <numeric>
+#include "trantor/utils/Logger.h"
+#include "utils/system_info_utils.h"
+
+namespace config {
+namespace {
+constexpr uint64_t kKvElementBytes = 2;  // f16
+}  // namespace
+
+ModelMemoryProfile ModelMemoryProfile::FromGGUF(const GGUFHandler& handler) {
+  ModelMemoryProfile p;
+  auto get = [&handler](GGUFKey key) -> uint64_t {
+    return static_cast<uint64_t>(
+        std::max<int64_t>(0, handler.GetInt(key).value_or(0)));
+  };
+
+  auto summary = handler.GetTensorSummary();
+  p.n_layer = get(GGUFKey::kBlockCount);
+  if (p.n_layer == 0 && !summary.block_bytes.empty()) {
+    p.n_layer = summary.block_bytes.rbegin()->first + 1;
+  }
+  p.n_ctx_train = get(GGUFKey::kContextLength);
+  auto n_embd = get(GGUFKey::kEmbeddingLength);
+  auto n_head = get(GGUFKey::kHeadCount);
+  // Per layer head counts come as an array, the plain head count is then an
+  // upper bound
+  p.n_head_kv = get(GGUFKey::kHeadCountKv);
+  if (p.n_head_kv == 0) {
+    p.n_head_kv = n_head;
+  }
+  auto head_dim = n_head > 0 ? n_embd / n_head : 0;
+  p.head_dim_k = get(GGUFKey::kKeyLength);
+  p.head_dim_v = get(GGUFKey::kValueLength);
+  if (p.head_dim_k == 0) {
+    p.head_dim_k = head_dim;
+  }
+  if (p.head_dim_v == 0) {
+    p.head_dim_v = head_dim;
+  }
+
+  p.layer_bytes.assign(p.n_layer, 0);
+  p.other_bytes = summary.embedding_bytes + summary.other_bytes;
+  for (const auto& [block, bytes] : summary.block_bytes) {
+    if (block < static_cast<int>(p.n_layer)) {
+      p.layer_bytes[block] = bytes;
+    } else {
+      p.other_bytes += bytes;
+    }
+  }
+  p.output_bytes = summary.output_bytes;
+  return p;
+}
+
+uint64_t ModelMemoryProfile::WeightBytes() const {
+  return std::accumulate(layer_bytes.begin(), layer_bytes.end(),
+                         output_bytes + other_bytes);
+}
+
+uint64_t ModelMemoryProfile::KvBytesPerLayerToken() const {
+  return n_head_kv * (head_dim_k + head_dim_v) * kKvElementBytes;
+}
+
+uint64_t ModelMemoryProfile::KvCacheBytes(uint64_t ctx_len) const {
+  return n_layer * KvBytesPerLayerToken() * ctx_len;
+}
+
+MemoryFit FitToMemory(const ModelMemoryProfile& profile,
+                      const MemoryBudget& budget, int max_ctx_len,
+                      int max_ngl) {
+  std::vector<int> contexts;
+  for (int c = std::max(1, max_ctx_len);; c /= 2) {
+    if (c <= kMinFitCtxLen) {
+      contexts.push_back(std::min(max_ctx_len, kMinFitCtxLen));
+      break;
+    }
+    contexts.push_back(c);
+  }
+
+  auto n_layer = static_cast<int>(profile.n_layer);
+  auto weights = profile.WeightBytes();
+  MemoryFit fit;
+  for (int ctx : contexts) {
+    auto kv_layer = profile.KvBytesPerLayerToken() * ctx;
+    fit.ctx_len = ctx;
+    if (budget.vram_bytes == 0) {
+      fit.ngl = max_ngl;
+      fit.vram_bytes = 0;
+      fit.ram_bytes =
+          weights + profile.n_layer * kv_layer + kComputeBufferBytes;
+      if (fit.ram_bytes <= budget.ram_bytes) {
+        fit.fits = true;
+        return fit;
+      }
+      continue;
+    }
+
+    // llama.cpp offloads the last layers first, and the output head once
+    // ngl is past the repeating layers
+    for (int ngl = std::max(0, max_ngl); ngl >= 0; ngl--) {
+      int offloaded = std::min(ngl, n_layer);
+      uint64_t offloaded_weights = ngl > n_layer ? profile.output_bytes : 0;
+      for (int i = n_layer - offloaded; i < n_layer; i++) {
+        offloaded_weights += profile.layer_bytes[i];
+      }
+      auto scratch = ngl > 0 ? kComputeBufferBytes : 0;
+      auto vram = offloaded_weights + offloaded * kv_layer + scratch;
+      if (vram > budget.vram_bytes) {
+        continue;
+      }
+      fit.ngl = ngl;
+      fit.vram_bytes = vram;
+      fit.ram_bytes = weights - offloaded_weights +
+                      (n_layer - offloaded) * kv_layer +
+                      (kComputeBufferBytes - scratch);
+      // Fewer layers on the GPU only leaves more in RAM
+      break;
+    }
+    if (fit.ram_bytes <= budget.ram_bytes) {
+      fit.fits = true;
+      return fit;
+    }
+  }
+  return fit;
+}
+
+MemoryBudget SystemMemoryBudget(int budget_percent, bool available_only) {
+  auto percent = static_cast<uint64_t>(std::clamp(budget_percent, 1, 100));
+  auto mem = system_info_utils::GetMemoryInfo();
+  MemoryBudget budget;
+  budget.ram_bytes = mem.total_bytes / 100 * percent;
+  if (available_only) {
+    budget.ram_bytes = std::min(budget.ram_bytes, mem.available_bytes);
+  }
+  if (system_info_utils::IsNvidiaSmiAvailable()) {
+    uint64_t vram_mib = 0;
+    for (const auto& gpu : system_info_utils::GetGpuInfoList()) {
+      try {
+        vram_mib += std::stoull(gpu.vram);
+      } catch (const std::exception&) {
+      }
+    }
+    budget.vram_bytes = vram_mib * 1024 * 1024 / 100 * percent;
+    // Other models and processes already hold part of it
+    if (auto free_mib = available_only
+                            ? system_info_utils::GetGpuFreeMemoryMiB()
+                            : 0;
+        free_mib > 0) {
+      budget.vram_bytes = std::min(budget.vram_bytes, free_mib * 1024 * 1024);
+    }
+  }
+  return budget;
+}
+
+MemoryFit FitModelConfig(const GGUFHandler& handler, ModelConfig& model_config,
+                         const MemoryBudget& budget) {
+  auto profile = ModelMemoryProfile::FromGGUF(handler);
+  int max_ctx_len = model_config.ctx_len > 0
+                        ? model_config.ctx_len
+                        : static_cast<int>(profile.n_ctx_train);
+  int max_ngl = model_config.ngl > 0 ? model_config.ngl
+                                     : static_cast<int>(profile.n_layer) + 1;
+  if (max_ctx_len <= 0 || profile.n_layer == 0) {
+    return MemoryFit{max_ctx_len, max_ngl, 0, 0, false};
+  }
+
+  auto fit = FitToMemory(profile, budget, max_ctx_len, max_ngl);
+  if (!fit.fits) {
+    LOG_WARN << "Model does not fit the memory budget (RAM "
+             << budget.ram_bytes / (1024 * 1024) << " MiB, VRAM "
+             << budget.vram_bytes / (1024 * 1024) << " MiB) even with ctx_len "
+             << fit.ctx_len;
+  }
+  if (fit.ctx_len != max_ctx_len || fit.ngl != max_ngl) {
+    LOG_INFO << "Fitted ctx_len " << max_ctx_len << " -> " << fit.ctx_len
+             << ", ngl " << max_ngl << " -> " << fit.ngl << " (RAM "
+             << fit.ram_bytes / (1024 * 1024) << " MiB, VRAM "
+             << fit.vram_bytes / (1024 * 1024) << " MiB)";
+  }
+  model_config.ctx_len = fit.ctx_len;
+  if (model_config.max_tokens > fit.ctx_len) {
+    model_config.max_tokens = fit.ctx_len;
+  }
+  model_config.ngl = fit.ngl;
+  return fit;
+}
+}  // namespace config
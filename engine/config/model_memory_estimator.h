@@ -0,0 +1,73 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "gguf_parser.h"
+#include "model_config.h"
+
+namespace config {
+// What a model needs in memory, from its GGUF header
+struct ModelMemoryProfile {
+  uint64_t n_layer = 0;
+  uint64_t n_ctx_train = 0;
+  uint64_t n_head_kv = 0;
+  uint64_t head_dim_k = 0;
+  uint64_t head_dim_v = 0;
+  // Weights of each repeating layer
+  std::vector<uint64_t> layer_bytes;
+  // Output head, offloaded as the last layer
+  uint64_t output_bytes = 0;
+  // Embeddings and the rest, kept in RAM
+  uint64_t other_bytes = 0;
+
+  static ModelMemoryProfile FromGGUF(const GGUFHandler& handler);
+
+  uint64_t WeightBytes() const;
+  // K and V of one layer for one token, f16 cache
+  uint64_t KvBytesPerLayerToken() const;
+  uint64_t KvCacheBytes(uint64_t ctx_len) const;
+};
+
+struct MemoryBudget {
+  uint64_t ram_bytes = 0;
+  // 0 when there is no GPU, or it could not be queried
+  uint64_t vram_bytes = 0;
+};
+
+struct MemoryFit {
+  int ctx_len = 0;
+  int ngl = 0;
+  uint64_t ram_bytes = 0;
+  uint64_t vram_bytes = 0;
+  // False if even the smallest context does not fit, the fit is then the
+  // smallest configuration
+  bool fits = false;
+};
+
+// Contexts below this are not worth loading a model for
+constexpr int kMinFitCtxLen = 2048;
+// Scratch buffers of the engine, next to the offloaded layers if any
+constexpr uint64_t kComputeBufferBytes = 512ull * 1024 * 1024;
+
+/**
+ * Picks the largest context, halving from `max_ctx_len`, and then the most
+ * offloaded layers (up to `max_ngl`) that fit the budget. Without VRAM the
+ * whole model is counted in RAM and `max_ngl` is kept.
+ */
+MemoryFit FitToMemory(const ModelMemoryProfile& profile,
+                      const MemoryBudget& budget, int max_ctx_len,
+                      int max_ngl);
+
+/**
+ * `budget_percent` of the machine's memory. With `available_only` RAM and
+ * VRAM are further capped by what is free right now, for decisions at load
+ * time.
+ */
+MemoryBudget SystemMemoryBudget(int budget_percent, bool available_only);
+
+/**
+ * Lowers ctx_len and ngl of `model_config` to what fits the budget. Values
+ * that already fit are kept.
+ */
+MemoryFit FitModelConfig(const GGUFHandler& handler, ModelConfig& model_config,
+                         const MemoryBudget& budget);
+}  // namespace config
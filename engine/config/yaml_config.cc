@@ -1,10 +1,13 @@
 #include <cmath>
 #include <ctime>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <string>
 using namespace std;
 
+#include "gguf_parser.h"
+#include "model_config_snapshot.h"
 #include "yaml_config.h"
 
 namespace config {
@@ -12,8 +15,9 @@ namespace config {
 void YamlHandler::Reset() {
   model_config_ = ModelConfig();
   yaml_node_.reset();
+  from_snapshot_ = false;
 };
-void YamlHandler::ReadYamlFile(const std::string& file_path) {
+bool YamlHandler::ReadYamlFile(const std::string& file_path) {
   try {
     yaml_node_ = YAML::LoadFile(file_path);
     // incase of model.yml file, we don't have files yet, create them
@@ -25,14 +29,31 @@ void YamlHandler::ReadYamlFile(const std::string& file_path) {
       if (yaml_node_["engine"] &&
           yaml_node_["engine"].as<std::string>() == "cortex.llamacpp") {
         // TODO: change prefix to models:// with source from cortexso
-        v.emplace_back(s.substr(0, s.find_last_of('/')) + "/model.gguf");
+        auto dir = s.substr(0, s.find_last_of('/'));
+        v.emplace_back(dir + "/model.gguf");
+        // A split model has no model.gguf, only its shards
+        std::error_code ec;
+        if (!std::filesystem::exists(v[0], ec)) {
+          for (const auto& entry :
+               std::filesystem::directory_iterator(dir, ec)) {
+            auto name = entry.path().filename().string();
+            if (name.find("-00001-of-") != std::string::npos &&
+                entry.path().extension() == ".gguf") {
+              // By name, a shard still downloading must not make the whole
+              // model.yml unreadable; loading reports it missing
+              v = GGUFHandler::ShardNames(entry.path().string());
+              break;
+            }
+          }
+        }
       } else {
         v.emplace_back(s.substr(0, s.find_last_of('/')));
       }
 
-      // TODO(any) need to support mutiple gguf files
       yaml_node_["files"] = v;
+      return true;
     }
+    return false;
   } catch (const YAML::BadFile& e) {
     std::cerr << "Failed to read file: " << e.what() << std::endl;
     throw;
@@ -55,12 +76,24 @@ const ModelConfig& YamlHandler::GetModelConfig() const {
   return model_config_;
 }
 
-void YamlHandler::ModelConfigFromFile(const std::string& file_path) {
-  ReadYamlFile(file_path);
-  ModelConfigFromYaml();
+void YamlHandler::ModelConfigFromFile(const std::string& file_path,
+                                      bool use_snapshot) {
+  from_snapshot_ = false;
+  if (use_snapshot && ModelConfigSnapshot::Load(file_path, model_config_)) {
+    yaml_node_.reset();
+    from_snapshot_ = true;
+    return;
+  }
+  // Before reading, so that an edit made meanwhile invalidates the snapshot
+  binary_io_utils::FileIdentity id;
+  bool has_id = binary_io_utils::GetFileIdentity(file_path, id);
+  bool derived_files = ReadYamlFile(file_path);
+  if (ModelConfigFromYaml() && use_snapshot && has_id) {
+    ModelConfigSnapshot::Write(file_path, id, model_config_, derived_files);
+  }
 }
 
-void YamlHandler::ModelConfigFromYaml() {
+bool YamlHandler::ModelConfigFromYaml() {
   ModelConfig tmp;
   try {
     if (yaml_node_["name"])
@@ -157,9 +190,10 @@ void YamlHandler::ModelConfigFromYaml() {
   } catch (const std::exception& e) {
     std::cerr << "Error when load model config : " << e.what() << std::endl;
     std::cerr << "Revert ..." << std::endl;
-    return;
+    return false;
   }
   model_config_ = std::move(tmp);
+  return true;
 }
 
 void YamlHandler::UpdateModelConfig(ModelConfig new_model_config) {
@@ -11,8 +11,12 @@ class YamlHandler {
  private:
   YAML::Node yaml_node_;
   ModelConfig model_config_;
-  void ReadYamlFile(const std::string& file_path);
-  void ModelConfigFromYaml();
+  bool from_snapshot_ = false;
+  // Returns true if `files` was not in the file and was filled in from the
+  // model's directory
+  bool ReadYamlFile(const std::string& file_path);
+  // False if the YAML did not fit ModelConfig, which is then left as it was
+  bool ModelConfigFromYaml();
   void SplitPromptTemplate(ModelConfig& mc);
 
  public:
@@ -21,7 +25,16 @@ class YamlHandler {
 
   const ModelConfig& GetModelConfig() const;
 
-  void ModelConfigFromFile(const std::string& file_path);
+  /**
+   * Served from the compiled ModelConfigSnapshot next to the file while it
+   * is fresh, otherwise parsed with yaml-cpp and compiled for the next call.
+   * A config served from the snapshot keeps no YAML node, which only
+   * UpdateModelConfig() builds again before writing.
+   */
+  void ModelConfigFromFile(const std::string& file_path,
+                           bool use_snapshot = true);
+  // True if the last ModelConfigFromFile() was served from the snapshot
+  bool FromSnapshot() const { return from_snapshot_; }
 
   void UpdateModelConfig(ModelConfig new_model_config);
   // Method to write all attributes to a YAML file
@@ -14,6 +14,7 @@
 #include "commands/model_pull_cmd.h"
 #include "commands/model_start_cmd.h"
 #include "commands/model_stop_cmd.h"
+#include "commands/model_verify_cmd.h"
 #include "commands/run_cmd.h"
 #include "commands/server_start_cmd.h"
 #include "commands/server_stop_cmd.h"
@@ -167,14 +168,32 @@ bool CommandLineParser::SetupCommand(int argc, char** argv) {
   auto model_update_cmd =
       models_cmd->add_subcommand("update", "Update configuration of a model");
 
+  bool verify_quick = false;
+  bool verify_sha256 = false;
+  auto model_verify_cmd = models_cmd->add_subcommand(
+      "verify", "Check the files of a model against the last verification");
+  model_verify_cmd->add_option("model_id", model_id, "");
+  model_verify_cmd->require_option();
+  model_verify_cmd->add_flag(
+      "--quick", verify_quick,
+      "Skip files whose size, mtime and inode are unchanged");
+  model_verify_cmd->add_flag("--sha256", verify_sha256,
+                             "Also print the SHA-256 of each file");
+  model_verify_cmd->callback([&model_id, &verify_quick, &verify_sha256]() {
+    commands::ModelVerifyCmd().Exec(model_id, verify_quick, verify_sha256);
+  });
+
   std::string model_path;
   auto model_import_cmd = models_cmd->add_subcommand(
-      "import", "Import a gguf model from local file");
-  model_import_cmd->add_option("--model_id", model_id, "");
+      "import", "Import gguf models from local files");
+  model_import_cmd->add_option("--model_id", model_id,
+                               "Model ID, or the prefix of the model IDs "
+                               "when importing a directory or pattern");
   model_import_cmd->add_option("--model_path", model_path,
-                               "Absolute path to .gguf model, the path should "
-                               "include the gguf file name");
-  model_import_cmd->require_option(2);
+                               "Absolute path to a .gguf model, a directory "
+                               "of them, or a pattern such as "
+                               "/models/*.gguf")
+      ->required();
   model_import_cmd->callback([&model_id,&model_path]() {
     commands::ModelImportCmd command(model_id, model_path);
     command.Exec();
@@ -0,0 +1,199 @@
+#include "downloads.h"
+#include <drogon/ResponseStream.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "services/download_manager.h"
+#include "utils/cortex_utils.h"
+
+namespace {
+// Longest an event stream waits for a change before looking at byte counts
+constexpr auto kStreamInterval = std::chrono::seconds(1);
+// Comment lines keep proxies from closing a quiet stream
+constexpr auto kKeepAliveInterval = std::chrono::seconds(15);
+
+// All jobs, or the one of `id` if there is such a job
+std::vector<DownloadManager::Job> Jobs(const std::string& id) {
+  auto& manager = DownloadManager::Global();
+  if (id.empty()) {
+    return manager.List();
+  }
+  std::vector<DownloadManager::Job> jobs;
+  if (auto job = manager.Get(id)) {
+    jobs.push_back(std::move(*job));
+  }
+  return jobs;
+}
+
+Json::Value Listing(const std::vector<DownloadManager::Job>& jobs) {
+  Json::Value ret;
+  ret["object"] = "list";
+  ret["data"] = Json::Value(Json::arrayValue);
+  for (const auto& job : jobs) {
+    ret["data"].append(job.ToJson());
+  }
+  return ret;
+}
+
+Json::Value NotFound(const std::string& id) {
+  Json::Value ret;
+  ret["message"] = "Download " + id + " not found";
+  return ret;
+}
+
+// Feeds every open event stream from one thread, so that no drogon thread
+// waits for a change
+class StreamHub {
+ public:
+  // Never destroyed, streams may still be open at exit
+  static StreamHub& Global() {
+    static auto* hub = new StreamHub();
+    return *hub;
+  }
+
+  void Add(std::string id, drogon::ResponseStreamPtr stream) {
+    auto subscriber = std::make_unique<Subscriber>();
+    subscriber->id = std::move(id);
+    subscriber->stream = std::move(stream);
+    // The first event right away, it does not wait for a change
+    if (!Update(*subscriber, DownloadManager::Global().List())) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!thread_.joinable()) {
+      thread_ = std::thread([this] { Run(); });
+    }
+    added_.push_back(std::move(subscriber));
+    cv_.notify_one();
+  }
+
+ private:
+  struct Subscriber {
+    std::string id;
+    drogon::ResponseStreamPtr stream;
+    std::string last_body;
+    std::chrono::steady_clock::time_point last_sent;
+  };
+
+  void Run() {
+    auto& manager = DownloadManager::Global();
+    uint64_t seen = 0;
+    std::vector<std::unique_ptr<Subscriber>> subscribers;
+    while (true) {
+      manager.WaitForChange(seen, kStreamInterval);
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock,
+                 [&] { return !subscribers.empty() || !added_.empty(); });
+        for (auto& s : added_) {
+          subscribers.push_back(std::move(s));
+        }
+        added_.clear();
+      }
+      auto jobs = manager.List();
+      std::erase_if(subscribers, [&jobs](const auto& s) {
+        return !Update(*s, jobs);
+      });
+    }
+  }
+
+  /**
+   * Sends `s` the listing if it changed, or a keepalive once in a while.
+   * False once its stream ended: the client went away, its job finished,
+   * or for a stream of all jobs, none is left running.
+   */
+  static bool Update(Subscriber& s,
+                     const std::vector<DownloadManager::Job>& all) {
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    auto jobs = s.id.empty() ? all : Jobs(s.id);
+    auto body = Json::writeString(builder, Listing(jobs));
+    auto now = std::chrono::steady_clock::now();
+    bool ok = true;
+    if (body != s.last_body) {
+      ok = s.stream->send("data: " + body + "\n\n");
+      s.last_body = std::move(body);
+      s.last_sent = now;
+    } else if (now - s.last_sent >= kKeepAliveInterval) {
+      ok = s.stream->send(": keepalive\n\n");
+      s.last_sent = now;
+    }
+    if (!ok) {
+      return false;
+    }
+    // The last event shows how the job, or every job, ended
+    bool done = std::all_of(jobs.begin(), jobs.end(),
+                            [](const auto& job) { return job.Finished(); });
+    if (done) {
+      s.stream->close();
+    }
+    return !done;
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<std::unique_ptr<Subscriber>> added_;
+  std::thread thread_;
+};
+}  // namespace
+
+void Downloads::ListDownloads(
+    const HttpRequestPtr& req,
+    std::function<void(const HttpResponsePtr&)>&& callback) const {
+  if (http_util::DispatchToWorkerPool(this, &Downloads::ListDownloads, req,
+                                      callback)) {
+    return;
+  }
+  auto id = req->getParameter("id");
+  if (!id.empty() && !DownloadManager::Global().Get(id).has_value()) {
+    auto resp = cortex_utils::CreateCortexHttpJsonResponse(NotFound(id));
+    resp->setStatusCode(k404NotFound);
+    callback(resp);
+    return;
+  }
+  auto resp = cortex_utils::CreateCortexHttpJsonResponse(Listing(Jobs(id)));
+  resp->setStatusCode(k200OK);
+  callback(resp);
+}
+
+void Downloads::StreamDownloads(
+    const HttpRequestPtr& req,
+    std::function<void(const HttpResponsePtr&)>&& callback) const {
+  auto id = req->getParameter("id");
+  if (!id.empty() && !DownloadManager::Global().Get(id).has_value()) {
+    auto resp = cortex_utils::CreateCortexHttpJsonResponse(NotFound(id));
+    resp->setStatusCode(k404NotFound);
+    callback(resp);
+    return;
+  }
+  auto resp = cortex_utils::CreateCortexAsyncStreamResponse(
+      [id](drogon::ResponseStreamPtr stream) {
+        StreamHub::Global().Add(id, std::move(stream));
+      });
+  resp->addHeader("Cache-Control", "no-cache");
+  callback(resp);
+}
+
+void Downloads::CancelDownload(
+    const HttpRequestPtr& req,
+    std::function<void(const HttpResponsePtr&)>&& callback,
+    const std::string& id) const {
+  if (!DownloadManager::Global().Cancel(id)) {
+    Json::Value ret;
+    ret["message"] = "Download " + id + " not found or already finished";
+    auto resp = cortex_utils::CreateCortexHttpJsonResponse(ret);
+    resp->setStatusCode(k404NotFound);
+    callback(resp);
+    return;
+  }
+  Json::Value ret;
+  ret["message"] = "Download " + id + " cancelled";
+  ret["id"] = id;
+  auto resp = cortex_utils::CreateCortexHttpJsonResponse(ret);
+  resp->setStatusCode(k200OK);
+  callback(resp);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <drogon/HttpController.h>
+#include <trantor/utils/Logger.h>
+#include "utils/http_util.h"
+
+using namespace drogon;
+
+class Downloads : public drogon::HttpController<Downloads> {
+ public:
+  METHOD_LIST_BEGIN
+  METHOD_ADD(Downloads::ListDownloads, "", Get);
+  METHOD_ADD(Downloads::StreamDownloads, "/events", Get);
+  METHOD_ADD(Downloads::CancelDownload, "/{1}", Delete);
+  METHOD_LIST_END
+
+  // All jobs, newest first, or the one given by `?id=`
+  void ListDownloads(
+      const HttpRequestPtr& req,
+      std::function<void(const HttpResponsePtr&)>&& callback) const;
+
+  /**
+   * Server-sent events with the same listing whenever it changed, at most
+   * about once a second. The stream ends once every job in it finished;
+   * with `?id=` only that job is listed.
+   */
+  void StreamDownloads(
+      const HttpRequestPtr& req,
+      std::function<void(const HttpResponsePtr&)>&& callback) const;
+
+  void CancelDownload(const HttpRequestPtr& req,
+                      std::function<void(const HttpResponsePtr&)>&& callback,
+                      const std::string& id) const;
+};
@@ -6,12 +6,17 @@
 #include "services/engine_service.h"
 #include "utils/archive_utils.h"
 #include "utils/cortex_utils.h"
+#include "utils/http_util.h"
 #include "utils/system_info_utils.h"
 
 void Engines::InstallEngine(
     const HttpRequestPtr& req,
     std::function<void(const HttpResponsePtr&)>&& callback,
     const std::string& engine) const {
+  if (http_util::DispatchToWorkerPool(this, &Engines::InstallEngine, req,
+                                      callback, engine)) {
+    return;
+  }
   LOG_DEBUG << "InitEngine, Engine: " << engine;
   if (engine.empty()) {
     Json::Value res;
@@ -66,28 +71,41 @@ void Engines::InstallEngine(
                                                .localPath = local_path,
                                            }}}};
 
-            DownloadService().AddAsyncDownloadTask(
-                downloadTask, [](const DownloadTask& finishedTask) {
-                  // try to unzip the downloaded file
-                  archive_utils::ExtractArchive(
-                      finishedTask.items[0].localPath.string(),
-                      finishedTask.items[0]
-                          .localPath.parent_path()
-                          .parent_path()
-                          .string());
-
-                  // remove the downloaded file
-                  try {
-                    std::filesystem::remove(finishedTask.items[0].localPath);
-                  } catch (const std::exception& e) {
-                    LOG_WARN << "Could not delete file: " << e.what();
-                  }
-                  LOG_INFO << "Finished!";
-                });
+            std::string downloadId;
+            try {
+              downloadId = DownloadService().AddAsyncDownloadTask(
+                  downloadTask, [](const DownloadTask& finishedTask) {
+                    // try to unzip the downloaded file
+                    archive_utils::ExtractArchive(
+                        finishedTask.items[0].localPath.string(),
+                        finishedTask.items[0]
+                            .localPath.parent_path()
+                            .parent_path()
+                            .string());
+
+                    // remove the downloaded file
+                    try {
+                      std::filesystem::remove(finishedTask.items[0].localPath);
+                    } catch (const std::exception& e) {
+                      LOG_WARN << "Could not delete file: " << e.what();
+                    }
+                    LOG_INFO << "Finished!";
+                  });
+            } catch (const std::exception& e) {
+              // Already downloading, or too many downloads queued
+              Json::Value res;
+              res["message"] = e.what();
+              res["result"] = "Error";
+              auto resp = cortex_utils::CreateCortexHttpJsonResponse(res);
+              resp->setStatusCode(k409Conflict);
+              callback(resp);
+              return;
+            }
 
             Json::Value res;
             res["message"] = "Engine download started";
             res["result"] = "OK";
+            res["downloadId"] = downloadId;
             auto resp = cortex_utils::CreateCortexHttpJsonResponse(res);
             resp->setStatusCode(k200OK);
             callback(resp);
@@ -113,6 +131,10 @@ void Engines::InstallEngine(
 void Engines::ListEngine(
     const HttpRequestPtr& req,
     std::function<void(const HttpResponsePtr&)>&& callback) const {
+  if (http_util::DispatchToWorkerPool(this, &Engines::ListEngine, req,
+                                      callback)) {
+    return;
+  }
   auto engine_service = EngineService();
   auto status_list = engine_service.GetEngineInfoList();
 
@@ -140,6 +162,10 @@ void Engines::ListEngine(
 void Engines::GetEngine(const HttpRequestPtr& req,
                         std::function<void(const HttpResponsePtr&)>&& callback,
                         const std::string& engine) const {
+  if (http_util::DispatchToWorkerPool(this, &Engines::GetEngine, req,
+                                      callback, engine)) {
+    return;
+  }
   auto engine_service = EngineService();
   try {
     auto status = engine_service.GetEngineInfo(engine);
@@ -172,6 +198,10 @@ void Engines::UninstallEngine(
     const HttpRequestPtr& req,
     std::function<void(const HttpResponsePtr&)>&& callback,
     const std::string& engine) const {
+  if (http_util::DispatchToWorkerPool(this, &Engines::UninstallEngine, req,
+                                      callback, engine)) {
+    return;
+  }
   LOG_INFO << "[Http] Uninstall engine " << engine;
   auto engine_service = EngineService();
 
@@ -1,15 +1,31 @@
 #include "models.h"
+#include <algorithm>
+#include <charconv>
+#include <iterator>
 #include "commands/model_del_cmd.h"
 #include "config/yaml_config.h"
+#include "services/model_catalog_service.h"
+#include "services/model_import_service.h"
 #include "trantor/utils/Logger.h"
 #include "utils/cortex_utils.h"
 #include "utils/file_manager_utils.h"
 #include "utils/model_callback_utils.h"
 #include "utils/modellist_utils.h"
+#include "utils/string_utils.h"
+
+namespace {
+// The parameters of a filtered or paged GET /models
+constexpr const char* kListQueryParams[] = {"limit", "after", "engine",
+                                            "prefix", "fields"};
+}  // namespace
 
 void Models::PullModel(
     const HttpRequestPtr& req,
     std::function<void(const HttpResponsePtr&)>&& callback) const {
+  if (http_util::DispatchToWorkerPool(this, &Models::PullModel, req,
+                                      callback)) {
+    return;
+  }
   if (!http_util::HasFieldInReq(req, callback, "modelId")) {
     return;
   }
@@ -26,13 +42,26 @@ void Models::PullModel(
 
   auto downloadTask = cortexso_parser::getDownloadTask(modelHandle);
   if (downloadTask.has_value()) {
-    DownloadService downloadService;
-    downloadService.AddAsyncDownloadTask(downloadTask.value(),
-                                         model_callback_utils::DownloadModelCb);
+    std::string downloadId;
+    try {
+      downloadId = DownloadService().AddAsyncDownloadTask(
+          downloadTask.value(), model_callback_utils::DownloadModelCb);
+    } catch (const std::exception& e) {
+      // Already downloading, or too many downloads queued
+      Json::Value ret;
+      ret["result"] = "Conflict";
+      ret["message"] = e.what();
+      ret["modelHandle"] = modelHandle;
+      auto resp = cortex_utils::CreateCortexHttpJsonResponse(ret);
+      resp->setStatusCode(k409Conflict);
+      callback(resp);
+      return;
+    }
 
     Json::Value ret;
     ret["result"] = "OK";
     ret["modelHandle"] = modelHandle;
+    ret["downloadId"] = downloadId;
     auto resp = cortex_utils::CreateCortexHttpJsonResponse(ret);
     resp->setStatusCode(k200OK);
     callback(resp);
@@ -49,43 +78,67 @@ void Models::PullModel(
 void Models::ListModel(
     const HttpRequestPtr& req,
     std::function<void(const HttpResponsePtr&)>&& callback) const {
-  Json::Value ret;
-  ret["object"] = "list";
-  Json::Value data(Json::arrayValue);
-
-  // Iterate through directory
-
+  if (http_util::DispatchToWorkerPool(this, &Models::ListModel, req,
+                                      callback)) {
+    return;
+  }
   try {
-    modellist_utils::ModelListUtils modellist_handler;
-    config::YamlHandler yaml_handler;
-
-    auto list_entry = modellist_handler.LoadModelList();
-
-    for (const auto& model_entry : list_entry) {
-      // auto model_entry = modellist_handler.GetModelInfo(model_handle);
-      try {
-
-        yaml_handler.ModelConfigFromFile(model_entry.path_to_model_yaml);
-        auto model_config = yaml_handler.GetModelConfig();
-        Json::Value obj = model_config.ToJson();
-
-        data.append(std::move(obj));
-        yaml_handler.Reset();
-      } catch (const std::exception& e) {
-        LOG_ERROR << "Failed to load yaml file for model: "
-                  << model_entry.path_to_model_yaml << ", error: " << e.what();
+    auto& catalog = ModelCatalogService::Global();
+    const auto& params = req->getParameters();
+    // Others, such as a cache buster, keep the plain cached listing
+    bool queried = std::any_of(
+        std::begin(kListQueryParams), std::end(kListQueryParams),
+        [&params](const char* p) { return params.find(p) != params.end(); });
+    if (queried) {
+      // Filtered or paged, streamed one model at a time
+      ModelCatalogService::ListQuery query;
+      query.after = req->getParameter("after");
+      query.engine = req->getParameter("engine");
+      query.prefix = req->getParameter("prefix");
+      query.fields = string_utils::SplitBy(req->getParameter("fields"), ",");
+      if (auto limit = req->getParameter("limit"); !limit.empty()) {
+        auto end = limit.data() + limit.size();
+        auto [ptr, ec] = std::from_chars(limit.data(), end, query.limit);
+        if (ec != std::errc() || ptr != end) {
+          Json::Value ret;
+          ret["message"] =
+              "Invalid limit '" + limit + "', expected a non-negative integer";
+          auto resp = cortex_utils::CreateCortexHttpJsonResponse(ret);
+          resp->setStatusCode(k400BadRequest);
+          callback(resp);
+          return;
+        }
       }
+      std::shared_ptr<ModelCatalogService::ListingStream> stream =
+          catalog.Query(std::move(query));
+      auto resp = cortex_utils::CreateCortexJsonStreamResponse(
+          [stream](char* buf, std::size_t size) -> std::size_t {
+            // Called without a buffer when the client went away
+            return buf == nullptr ? 0 : stream->Read(buf, size);
+          });
+      callback(resp);
+      return;
     }
-    ret["data"] = data;
-    ret["result"] = "OK";
-    auto resp = cortex_utils::CreateCortexHttpJsonResponse(ret);
-    resp->setStatusCode(k200OK);
+
+    // Parsed model.yml files are cached, an unchanged list is not rebuilt
+    auto listing = catalog.List();
+    HttpResponsePtr resp;
+    if (req->getHeader("if-none-match") == listing->etag) {
+      resp = HttpResponse::newHttpResponse();
+      resp->setStatusCode(k304NotModified);
+    } else {
+      resp = cortex_utils::CreateCortexHttpRawJsonResponse(listing->body);
+      resp->setStatusCode(k200OK);
+    }
+    resp->addHeader("ETag", listing->etag);
     callback(resp);
   } catch (const std::exception& e) {
     std::string message =
         "Fail to get list model information: " + std::string(e.what());
     LOG_ERROR << message;
-    ret["data"] = data;
+    Json::Value ret;
+    ret["object"] = "list";
+    ret["data"] = Json::Value(Json::arrayValue);
     ret["result"] = "Fail to get list model information";
     ret["message"] = message;
     auto resp = cortex_utils::CreateCortexHttpJsonResponse(ret);
@@ -97,6 +150,9 @@ void Models::ListModel(
 void Models::GetModel(
     const HttpRequestPtr& req,
     std::function<void(const HttpResponsePtr&)>&& callback) const {
+  if (http_util::DispatchToWorkerPool(this, &Models::GetModel, req, callback)) {
+    return;
+  }
   if (!http_util::HasFieldInReq(req, callback, "modelId")) {
     return;
   }
@@ -137,6 +193,10 @@ void Models::GetModel(
 void Models::DeleteModel(const HttpRequestPtr& req,
                          std::function<void(const HttpResponsePtr&)>&& callback,
                          const std::string& model_id) const {
+  if (http_util::DispatchToWorkerPool(this, &Models::DeleteModel, req,
+                                      callback, model_id)) {
+    return;
+  }
   LOG_DEBUG << "DeleteModel, Model handle: " << model_id;
   commands::ModelDelCmd mdc;
   if (mdc.Exec(model_id)) {
@@ -159,77 +219,91 @@ void Models::DeleteModel(const HttpRequestPtr& req,
 void Models::ImportModel(
     const HttpRequestPtr& req,
     std::function<void(const HttpResponsePtr&)>&& callback) const {
-  if (!http_util::HasFieldInReq(req, callback, "modelId") ||
-      !http_util::HasFieldInReq(req, callback, "modelPath")) {
+  if (http_util::DispatchToWorkerPool(this, &Models::ImportModel, req,
+                                      callback)) {
+    return;
+  }
+  if (!http_util::HasFieldInReq(req, callback, "modelPath")) {
     return;
   }
   auto modelHandle = (*(req->getJsonObject())).get("modelId", "").asString();
   auto modelPath = (*(req->getJsonObject())).get("modelPath", "").asString();
-  config::GGUFHandler gguf_handler;
-  config::YamlHandler yaml_handler;
-  modellist_utils::ModelListUtils modellist_utils_obj;
+  // A directory or pattern imports every model it holds, modelId is then
+  // the prefix of their IDs
+  bool batch = ModelImportService::IsBatch(modelPath);
+  if (!batch && !http_util::HasFieldInReq(req, callback, "modelId")) {
+    return;
+  }
 
-  std::string model_yaml_path = (file_manager_utils::GetModelsContainerPath() /
-                                 std::filesystem::path("imported") /
-                                 std::filesystem::path(modelHandle + ".yml"))
-                                    .string();
-  modellist_utils::ModelEntry model_entry{
-      modelHandle,     "local",     "imported",
-      model_yaml_path, modelHandle, modellist_utils::ModelStatus::READY};
+  std::vector<ModelImportService::Result> results;
   try {
-    std::filesystem::create_directories(
-        std::filesystem::path(model_yaml_path).parent_path());
-    gguf_handler.Parse(modelPath);
-    config::ModelConfig model_config = gguf_handler.GetModelConfig();
-    model_config.files.push_back(modelPath);
-    model_config.name = modelHandle;
-    yaml_handler.UpdateModelConfig(model_config);
+    results = ModelImportService::Global().ImportPath(modelPath, modelHandle);
+  } catch (const std::exception& e) {
+    std::string error_message =
+        "Error importing model path '" + modelPath + "': " + e.what();
+    LOG_ERROR << error_message;
+    Json::Value ret;
+    ret["result"] = "Import failed!";
+    ret["modelHandle"] = modelHandle;
+    ret["message"] = error_message;
+    auto resp = cortex_utils::CreateCortexHttpJsonResponse(ret);
+    resp->setStatusCode(k400BadRequest);
+    callback(resp);
+    return;
+  }
 
-    if (modellist_utils_obj.AddModelEntry(model_entry)) {
-      yaml_handler.WriteYamlFile(model_yaml_path);
+  if (!batch) {
+    const auto& r = results.front();
+    Json::Value ret;
+    ret["modelHandle"] = modelHandle;
+    if (r.ok()) {
       std::string success_message = "Model is imported successfully!";
       LOG_INFO << success_message;
-      Json::Value ret;
       ret["result"] = "OK";
-      ret["modelHandle"] = modelHandle;
       ret["message"] = success_message;
-      auto resp = cortex_utils::CreateCortexHttpJsonResponse(ret);
-      resp->setStatusCode(k200OK);
-      callback(resp);
-
     } else {
-      std::string error_message = "Fail to import model, model_id '" +
-                                  modelHandle + "' already exists!";
-      LOG_ERROR << error_message;
-      Json::Value ret;
+      LOG_ERROR << r.error;
       ret["result"] = "Import failed!";
-      ret["modelHandle"] = modelHandle;
-      ret["message"] = error_message;
-
-      auto resp = cortex_utils::CreateCortexHttpJsonResponse(ret);
-      resp->setStatusCode(k400BadRequest);
-      callback(resp);
+      ret["message"] = r.error;
     }
-
-  } catch (const std::exception& e) {
-    std::string error_message = "Error importing model path '" + modelPath +
-                                "' with model_id '" + modelHandle +
-                                "': " + e.what();
-    LOG_ERROR << error_message;
-    Json::Value ret;
-    ret["result"] = "Import failed!";
-    ret["modelHandle"] = modelHandle;
-    ret["message"] = error_message;
-
     auto resp = cortex_utils::CreateCortexHttpJsonResponse(ret);
-    resp->setStatusCode(k400BadRequest);
+    resp->setStatusCode(r.ok() ? k200OK : k400BadRequest);
     callback(resp);
+    return;
+  }
+
+  Json::Value models(Json::arrayValue);
+  int imported = 0;
+  for (const auto& r : results) {
+    Json::Value m;
+    m["modelHandle"] = r.model_id;
+    m["modelPath"] = r.model_path;
+    m["result"] = r.ok() ? "OK" : "Import failed!";
+    if (r.ok()) {
+      imported++;
+    } else {
+      LOG_ERROR << r.error;
+      m["message"] = r.error;
+    }
+    models.append(m);
   }
+  Json::Value ret;
+  ret["result"] = imported > 0 ? "OK" : "Import failed!";
+  ret["message"] = "Imported " + std::to_string(imported) + " of " +
+                   std::to_string(results.size()) + " models";
+  ret["models"] = models;
+  auto resp = cortex_utils::CreateCortexHttpJsonResponse(ret);
+  resp->setStatusCode(imported > 0 ? k200OK : k400BadRequest);
+  callback(resp);
 }
 
 void Models::SetModelAlias(
     const HttpRequestPtr& req,
     std::function<void(const HttpResponsePtr&)>&& callback) const {
+  if (http_util::DispatchToWorkerPool(this, &Models::SetModelAlias, req,
+                                      callback)) {
+    return;
+  }
   if (!http_util::HasFieldInReq(req, callback, "modelId") ||
       !http_util::HasFieldInReq(req, callback, "modelAlias")) {
     return;
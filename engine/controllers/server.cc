@@ -1,9 +1,16 @@
 #include "server.h"
 
+#include <algorithm>
+#include <limits>
+#include <thread>
+
 #include "trantor/utils/Logger.h"
+#include "config/model_memory_estimator.h"
 #include "utils/cortex_utils.h"
 #include "utils/cpuid/cpu_info.h"
 #include "utils/file_manager_utils.h"
+#include "utils/http_util.h"
+#include "utils/system_info_utils.h"
 
 using namespace inferences;
 using json = nlohmann::json;
@@ -13,15 +20,66 @@ constexpr static auto kLlamaEngine = "cortex.llamacpp";
 constexpr static auto kPythonRuntimeEngine = "cortex.python";
 constexpr static auto kOnnxEngine = "cortex.onnx";
 constexpr static auto kTensorrtLlmEngine = "cortex.tensorrt-llm";
+// Completion length assumed when a request does not set max_tokens
+constexpr static int64_t kDefaultCompletionTokens = 512;
+
+int64_t CountChars(const Json::Value& v) {
+  if (v.isString()) {
+    return static_cast<int64_t>(v.asString().size());
+  }
+  int64_t n = 0;
+  if (v.isArray()) {
+    for (const auto& e : v) {
+      n += CountChars(e.isObject() ? e["text"] : e);
+    }
+  }
+  return n;
+}
+
+// Rough token count of a request, only used to balance model replicas. About
+// four characters per token is close enough for that.
+int64_t EstimateTokens(const Json::Value& body, int64_t completion_tokens) {
+  int64_t chars = CountChars(body["prompt"]) + CountChars(body["input"]);
+  for (const auto& m : body["messages"]) {
+    chars += CountChars(m["content"]);
+  }
+  return chars / 4 + body.get("max_tokens", completion_tokens).asInt64();
+}
+
+// Engines ignore cpu_affinity, the threads they start while loading inherit
+// the loading thread's mask. On an IO loop that would be the IO cores.
+std::vector<int> LoadCores(const Json::Value& body) {
+  std::vector<int> cores;
+  for (const auto& c : body["cpu_affinity"]) {
+    cores.push_back(c.asInt());
+  }
+  return cores.empty() ? CpuBudgetService::Global().ComputeCores() : cores;
+}
 }  // namespace
 
 server::server() {
 #if defined(_WIN32)
   SetDefaultDllDirectories(LOAD_LIBRARY_SEARCH_DEFAULT_DIRS);
 #endif
+  try {
+    auto config = file_manager_utils::GetCortexConfig();
+    if (config.kvCacheSnapshotMaxMb > 0) {
+      kv_snapshots_ = std::make_unique<KvCacheSnapshotService>(
+          file_manager_utils::GetCortexDataPath() / "kvcache",
+          static_cast<uint64_t>(config.kvCacheSnapshotMaxMb) * 1024 * 1024);
+    }
+    if (config.pinnedModelsMaxMb > 0) {
+      pins_ = std::make_unique<ModelPinService>(
+          static_cast<uint64_t>(config.pinnedModelsMaxMb) * 1024 * 1024);
+    }
+  } catch (const std::exception& e) {
+    LOG_WARN << "KV cache snapshots are disabled: " << e.what();
+  }
 };
 
-server::~server() {}
+server::~server() {
+  kv_snapshot_queue_.waitAllTasksFinished();
+}
 
 void server::ChatCompletion(
     const HttpRequestPtr& req,
@@ -45,17 +103,31 @@ void server::ChatCompletion(
   LOG_TRACE << "Start chat completion";
   auto json_body = req->getJsonObject();
   bool is_stream = (*json_body).get("stream", false).asBool();
+  auto replica = PickReplica(
+      engine_type, *json_body,
+      EstimateTokens(*json_body, kDefaultCompletionTokens));
+  auto en = replica.first;
+  auto lease = replica.second;
+  // Sessions resume from their KV cache snapshot instead of re-prefilling
+  std::function<void()> on_done = nullptr;
+  if (!(*json_body).get("session_id", "").asString().empty()) {
+    RestoreSessionKVCache(en, *json_body);
+    on_done = [this, en, lease, body = *json_body] {
+      SaveSessionKVCache(en, body, lease);
+    };
+  }
   auto q = std::make_shared<SyncQueue>();
-  std::get<EngineI*>(engines_[engine_type].engine)
-      ->HandleChatCompletion(json_body,
-                             [q](Json::Value status, Json::Value res) {
-                               q->push(std::make_pair(status, res));
-                             });
+  en->HandleChatCompletion(json_body, [q](Json::Value status, Json::Value res) {
+    q->push(std::make_pair(status, res));
+  });
   LOG_TRACE << "Wait to chat completion responses";
   if (is_stream) {
-    ProcessStreamRes(std::move(callback), q);
+    ProcessStreamRes(std::move(callback), q, std::move(on_done), lease);
   } else {
     ProcessNonStreamRes(std::move(callback), *q);
+    if (on_done) {
+      on_done();
+    }
   }
   LOG_TRACE << "Done chat completion";
 }
@@ -76,11 +148,13 @@ void server::Embedding(const HttpRequestPtr& req,
 
   LOG_TRACE << "Start embedding";
   SyncQueue q;
-  std::get<EngineI*>(engines_[engine_type].engine)
-      ->HandleEmbedding(req->getJsonObject(),
-                        [&q](Json::Value status, Json::Value res) {
-                          q.push(std::make_pair(status, res));
-                        });
+  auto [en, lease] =
+      PickReplica(engine_type, *(req->getJsonObject()),
+                  EstimateTokens(*(req->getJsonObject()), 0));
+  en->HandleEmbedding(req->getJsonObject(),
+                      [&q](Json::Value status, Json::Value res) {
+                        q.push(std::make_pair(status, res));
+                      });
   LOG_TRACE << "Wait to embedding";
   ProcessNonStreamRes(std::move(callback), q);
   LOG_TRACE << "Done embedding";
@@ -105,6 +179,11 @@ void server::UnloadModel(
     return;
   }
   LOG_TRACE << "Start unload model";
+  auto model = (*(req->getJsonObject())).get("model", "").asString();
+  ForgetLiveSessions(model);
+  UnloadModelReplicas(model);
+  CpuBudgetService::Global().Release(model);
+  prefetch_.Cancel(model);
   std::get<EngineI*>(engines_[engine_type].engine)
       ->UnloadModel(
           req->getJsonObject(),
@@ -203,6 +282,97 @@ void server::GetEngines(
   callback(resp);
 }
 
+void server::PinModel(const HttpRequestPtr& req,
+                      std::function<void(const HttpResponsePtr&)>&& callback) {
+  if (http_util::DispatchToWorkerPool(this, &server::PinModel, req, callback)) {
+    return;
+  }
+  if (!HasFieldInReq(req, callback, "model") ||
+      !HasFieldInReq(req, callback, "model_path")) {
+    return;
+  }
+  Json::Value res;
+  if (!pins_) {
+    res["message"] =
+        "Model pinning is disabled, set pinnedModelsMaxMb in the config";
+    auto resp = cortex_utils::CreateCortexHttpJsonResponse(res);
+    resp->setStatusCode(k409Conflict);
+    callback(resp);
+    return;
+  }
+  auto model = (*(req->getJsonObject()))["model"].asString();
+  auto model_path = (*(req->getJsonObject()))["model_path"].asString();
+  // Every shard of a split model, or the file as is if it is not a GGUF
+  std::vector<std::string> files{model_path};
+  try {
+    config::GGUFHandler gguf_handler;
+    gguf_handler.Parse(model_path, config::GGUFParseMode::kCached);
+    files = gguf_handler.GetFiles();
+  } catch (const std::exception& e) {
+    LOG_DEBUG << model_path << " is not a GGUF model: " << e.what();
+  }
+  try {
+    auto pinned = pins_->Pin(model, files);
+    res["message"] = "Model pinned";
+    res["model"] = model;
+    res["bytes"] = static_cast<Json::UInt64>(pinned.bytes);
+    res["locked"] = pinned.locked;
+    callback(cortex_utils::CreateCortexHttpJsonResponse(res));
+  } catch (const std::exception& e) {
+    res["message"] = e.what();
+    auto resp = cortex_utils::CreateCortexHttpJsonResponse(res);
+    resp->setStatusCode(k400BadRequest);
+    callback(resp);
+    LOG_WARN << "Could not pin " << model << ": " << e.what();
+  }
+}
+
+void server::UnpinModel(
+    const HttpRequestPtr& req,
+    std::function<void(const HttpResponsePtr&)>&& callback) {
+  if (!HasFieldInReq(req, callback, "model")) {
+    return;
+  }
+  auto model = (*(req->getJsonObject()))["model"].asString();
+  Json::Value res;
+  if (!pins_ || !pins_->Unpin(model)) {
+    res["message"] = "Model is not pinned";
+    auto resp = cortex_utils::CreateCortexHttpJsonResponse(res);
+    resp->setStatusCode(k404NotFound);
+    callback(resp);
+    return;
+  }
+  res["message"] = "Model unpinned";
+  callback(cortex_utils::CreateCortexHttpJsonResponse(res));
+}
+
+void server::GetPinnedModels(
+    const HttpRequestPtr& req,
+    std::function<void(const HttpResponsePtr&)>&& callback) {
+  Json::Value res;
+  Json::Value data(Json::arrayValue);
+  if (pins_) {
+    for (const auto& p : pins_->List()) {
+      Json::Value val;
+      val["model"] = p.model;
+      val["bytes"] = static_cast<Json::UInt64>(p.bytes);
+      val["locked"] = p.locked;
+      Json::Value files(Json::arrayValue);
+      for (const auto& f : p.files) {
+        files.append(f);
+      }
+      val["files"] = files;
+      data.append(val);
+    }
+  }
+  res["object"] = "list";
+  res["data"] = data;
+  res["used_bytes"] =
+      static_cast<Json::UInt64>(pins_ ? pins_->UsedBytes() : 0);
+  res["max_bytes"] = static_cast<Json::UInt64>(pins_ ? pins_->MaxBytes() : 0);
+  callback(cortex_utils::CreateCortexHttpJsonResponse(res));
+}
+
 void server::FineTuning(
     const HttpRequestPtr& req,
     std::function<void(const HttpResponsePtr&)>&& callback) {
@@ -260,8 +430,14 @@ void server::FineTuning(
 
 void server::LoadModel(const HttpRequestPtr& req,
                        std::function<void(const HttpResponsePtr&)>&& callback) {
+  if (http_util::DispatchToWorkerPool(this, &server::LoadModel, req,
+                                      callback)) {
+    return;
+  }
   auto engine_type =
       (*(req->getJsonObject())).get("engine", kLlamaEngine).asString();
+  // Reading the model in can start before the engine library is loaded
+  bool prefetching = PrefetchModel(engine_type, *(req->getJsonObject()));
 
   // We have not loaded engine yet, should load it before using it
   if (engines_.find(engine_type) == engines_.end()) {
@@ -329,6 +505,10 @@ void server::LoadModel(const HttpRequestPtr& req,
     } catch (const cortex_cpp::dylib::load_error& e) {
       LOG_ERROR << "Could not load engine: " << e.what();
       engines_.erase(engine_type);
+      if (prefetching) {
+        prefetch_.Cancel(
+            (*(req->getJsonObject())).get("model", "").asString());
+      }
 
       Json::Value res;
       res["message"] = "Could not load engine " + engine_type;
@@ -357,14 +537,61 @@ void server::LoadModel(const HttpRequestPtr& req,
   }
 
   LOG_TRACE << "Load model";
-  auto& en = std::get<EngineI*>(engines_[engine_type].engine);
-  en->LoadModel(req->getJsonObject(), [cb = std::move(callback)](
-                                          Json::Value status, Json::Value res) {
+  if (auto model = (*(req->getJsonObject())).get("model", "").asString();
+      !model.empty()) {
+    ForgetLiveSessions(model);
+    auto model_path =
+        (*(req->getJsonObject())).get("model_path", "").asString();
+    if (!model_path.empty()) {
+      std::lock_guard<std::mutex> l(sessions_mtx_);
+      model_hashes_[model] = KvCacheSnapshotService::ModelHash(model_path);
+    }
+  }
+  auto n = (*(req->getJsonObject())).get("replicas", 1).asInt();
+  FitModelToMemory(engine_type, *(req->getJsonObject()), std::max(n, 1));
+  if (n > 1) {
+    Json::Value status, res;
+    LoadModelReplicas(engine_type, req->getJsonObject(), n, status, res);
+    auto model = req->getJsonObject()->get("model", "").asString();
+    if (prefetching && status["status_code"].asInt() != k200OK) {
+      prefetch_.Cancel(model);
+    }
+    AddPrefetchStatus(model, res);
     auto resp = cortex_utils::CreateCortexHttpJsonResponse(res);
     resp->setStatusCode(
         static_cast<drogon::HttpStatusCode>(status["status_code"].asInt()));
-    cb(resp);
-  });
+    callback(resp);
+    LOG_TRACE << "Done load model";
+    return;
+  }
+  // A model that already holds cores is loaded or being loaded
+  auto model = (*(req->getJsonObject())).get("model", "").asString();
+  bool assign_cores = engine_type == kLlamaEngine &&
+                      !CpuBudgetService::Global().Holds(model);
+  if (assign_cores) {
+    AssignCpuCores(engine_type, *(req->getJsonObject()));
+  }
+  auto& en = std::get<EngineI*>(engines_[engine_type].engine);
+  CpuBudgetService::ScopedPin pin(LoadCores(*(req->getJsonObject())));
+  en->LoadModel(
+      req->getJsonObject(),
+      [this, cb = std::move(callback), model, assign_cores, prefetching](
+          Json::Value status, Json::Value res) {
+        if (status["status_code"].asInt() != k200OK) {
+          if (assign_cores) {
+            CpuBudgetService::Global().Release(model);
+          }
+          // Reading the rest in would only fill the page cache for nothing
+          if (prefetching) {
+            prefetch_.Cancel(model);
+          }
+        }
+        AddPrefetchStatus(model, res);
+        auto resp = cortex_utils::CreateCortexHttpJsonResponse(res);
+        resp->setStatusCode(
+            static_cast<drogon::HttpStatusCode>(status["status_code"].asInt()));
+        cb(resp);
+      });
   LOG_TRACE << "Done load model";
 }
 
@@ -388,6 +615,37 @@ void server::UnloadEngine(
   }
 
   EngineI* e = std::get<EngineI*>(engines_[engine_type].engine);
+  // Pending snapshot saves still reference the engine
+  kv_snapshot_queue_.waitAllTasksFinished();
+  {
+    std::lock_guard<std::mutex> l(replicas_mtx_);
+    // A lease outlives the set, its replica would call into the unloaded
+    // library once the request is done
+    for (const auto& [_, set] : model_replicas_) {
+      if (set.engine_type != engine_type) {
+        continue;
+      }
+      for (const auto& r : set.replicas) {
+        if (r.use_count() > 1) {
+          Json::Value res;
+          res["message"] = "Engine " + engine_type +
+                           " is still serving requests, try again later";
+          auto resp = cortex_utils::CreateCortexHttpJsonResponse(res);
+          resp->setStatusCode(k409Conflict);
+          callback(resp);
+          return;
+        }
+      }
+    }
+    for (auto it = model_replicas_.begin(); it != model_replicas_.end();) {
+      if (it->second.engine_type == engine_type) {
+        it = model_replicas_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  CpuBudgetService::Global().ReleaseEngine(engine_type);
   delete e;
 #if defined(_WIN32)
   if (!RemoveDllDirectory(engines_[engine_type].cookie)) {
@@ -406,10 +664,14 @@ void server::UnloadEngine(
 }
 
 void server::ProcessStreamRes(std::function<void(const HttpResponsePtr&)> cb,
-                              std::shared_ptr<SyncQueue> q) {
+                              std::shared_ptr<SyncQueue> q,
+                              std::function<void()> on_done,
+                              std::shared_ptr<ReplicaLease> lease) {
   auto err_or_done = std::make_shared<std::atomic_bool>(false);
+  // The lease is held until the response is destroyed
   auto chunked_content_provider =
-      [q, err_or_done](char* buf, std::size_t buf_size) -> std::size_t {
+      [q, err_or_done, on_done = std::move(on_done), lease](
+          char* buf, std::size_t buf_size) -> std::size_t {
     if (buf == nullptr) {
       LOG_TRACE << "Buf is null";
       return 0;
@@ -424,6 +686,9 @@ void server::ProcessStreamRes(std::function<void(const HttpResponsePtr&)> cb,
 
     if (status["has_error"].asBool() || status["is_done"].asBool()) {
       *err_or_done = true;
+      if (!status["has_error"].asBool() && on_done) {
+        on_done();
+      }
     }
 
     auto str = res["data"].asString();
@@ -448,6 +713,338 @@ void server::ProcessNonStreamRes(std::function<void(const HttpResponsePtr&)> cb,
   cb(resp);
 }
 
+std::string server::GetModelHash(const std::string& model) {
+  std::lock_guard<std::mutex> l(sessions_mtx_);
+  if (auto it = model_hashes_.find(model); it != model_hashes_.end()) {
+    return it->second;
+  }
+  return KvCacheSnapshotService::ModelHash(model);
+}
+
+void server::RestoreSessionKVCache(EngineI* en, const Json::Value& body) {
+  if (!kv_snapshots_ || !en->IsSupported("RestoreKVCache")) {
+    return;
+  }
+  auto model = body.get("model", "").asString();
+  auto session_id = body["session_id"].asString();
+  auto model_hash = GetModelHash(model);
+  auto key = LiveSessionKey(en, model_hash, session_id);
+  {
+    std::lock_guard<std::mutex> l(sessions_mtx_);
+    if (live_sessions_.find(key) != live_sessions_.end()) {
+      return;
+    }
+  }
+
+  auto snapshot = kv_snapshots_->Find(model_hash, session_id);
+  if (!snapshot.has_value()) {
+    return;
+  }
+  LOG_INFO << "Restore KV cache of session " << session_id << " from "
+           << snapshot->string();
+  auto req = std::make_shared<Json::Value>();
+  (*req)["model"] = model;
+  (*req)["session_id"] = session_id;
+  (*req)["filename"] = snapshot->string();
+  SyncQueue q;
+  en->RestoreKVCache(req, [&q](Json::Value status, Json::Value res) {
+    q.push(std::make_pair(status, res));
+  });
+  auto [status, res] = q.wait_and_pop();
+  auto status_code = status["status_code"].asInt();
+  if (status_code == k422UnprocessableEntity) {
+    LOG_WARN << "KV cache snapshot of session " << session_id
+             << " does not fit the model, dropping it: "
+             << res["message"].asString();
+    kv_snapshots_->Remove(model_hash, session_id);
+    return;
+  }
+  if (status_code != k200OK) {
+    // Busy or out of memory, the snapshot may still restore next time
+    LOG_WARN << "Could not restore KV cache of session " << session_id
+             << ": " << res["message"].asString();
+    return;
+  }
+  std::lock_guard<std::mutex> l(sessions_mtx_);
+  live_sessions_.insert(key);
+}
+
+void server::SaveSessionKVCache(EngineI* en, const Json::Value& body,
+                                std::shared_ptr<ReplicaLease> lease) {
+  if (!kv_snapshots_ || !en->IsSupported("SaveKVCache")) {
+    return;
+  }
+  auto model = body.get("model", "").asString();
+  auto session_id = body["session_id"].asString();
+  auto model_hash = GetModelHash(model);
+  kv_snapshot_queue_.runTaskInQueue([this, en, lease, model, session_id,
+                                     model_hash] {
+    auto req = std::make_shared<Json::Value>();
+    (*req)["model"] = model;
+    (*req)["session_id"] = session_id;
+    (*req)["filename"] =
+        kv_snapshots_->SnapshotPath(model_hash, session_id).string();
+    SyncQueue q;
+    en->SaveKVCache(req, [&q](Json::Value status, Json::Value res) {
+      q.push(std::make_pair(status, res));
+    });
+    auto [status, res] = q.wait_and_pop();
+    if (status["status_code"].asInt() != k200OK) {
+      LOG_WARN << "Could not save KV cache of session " << session_id << ": "
+               << res["message"].asString();
+      return;
+    }
+    kv_snapshots_->Commit(model_hash, session_id);
+    std::lock_guard<std::mutex> l(sessions_mtx_);
+    live_sessions_.insert(LiveSessionKey(en, model_hash, session_id));
+  });
+}
+
+std::string server::LiveSessionKey(EngineI* en, const std::string& model_hash,
+                                   const std::string& session_id) {
+  // Each replica has its own KV cache
+  return model_hash + "/" + session_id + "@" +
+         std::to_string(reinterpret_cast<uintptr_t>(en));
+}
+
+bool server::LoadModelReplicas(const std::string& engine_type,
+                               const std::shared_ptr<Json::Value>& body, int n,
+                               Json::Value& status, Json::Value& res) {
+  auto model = body->get("model", "").asString();
+  {
+    std::lock_guard<std::mutex> l(replicas_mtx_);
+    if (model_replicas_.find(model) != model_replicas_.end()) {
+      status["status_code"] = k409Conflict;
+      res["message"] = "Model already loaded";
+      return false;
+    }
+  }
+
+  auto load = [](EngineI* en, const std::shared_ptr<Json::Value>& b) {
+    SyncQueue q;
+    CpuBudgetService::ScopedPin pin(LoadCores(*b));
+    en->LoadModel(b, [&q](Json::Value status, Json::Value res) {
+      q.push(std::make_pair(status, res));
+    });
+    return q.wait_and_pop();
+  };
+  auto unload = [&model](EngineI* en) {
+    auto b = std::make_shared<Json::Value>();
+    (*b)["model"] = model;
+    SyncQueue q;
+    en->UnloadModel(b, [&q](Json::Value status, Json::Value res) {
+      q.push(std::make_pair(status, res));
+    });
+    q.wait_and_pop();
+  };
+
+  // Split the thread budget between replicas unless each one is given its
+  // own settings (cpu_threads, devices, ...) in "replica_params"
+  bool assign_cores = engine_type == kLlamaEngine;
+  auto total_threads =
+      body->get("cpu_threads",
+                assign_cores ? CpuBudgetService::Global().FreeCores()
+                             : std::thread::hardware_concurrency())
+          .asInt();
+  const auto& overrides = (*body)["replica_params"];
+  auto get_engine =
+      engines_[engine_type].dl->get_function<EngineI*()>("get_engine");
+
+  ReplicaSet set{engine_type, {}};
+  for (int i = 0; i < n; i++) {
+    auto r = std::make_shared<ModelReplica>();
+    if (i == 0) {
+      r->engine = std::get<EngineI*>(engines_[engine_type].engine);
+    } else {
+      r->engine = get_engine();
+      r->owned = true;
+    }
+
+    auto replica_body = std::make_shared<Json::Value>(*body);
+    replica_body->removeMember("replicas");
+    replica_body->removeMember("replica_params");
+    (*replica_body)["cpu_threads"] = std::max(1, total_threads / n);
+    if (overrides.isArray() && i < static_cast<int>(overrides.size())) {
+      for (const auto& k : overrides[i].getMemberNames()) {
+        (*replica_body)[k] = overrides[i][k];
+      }
+    }
+    if (assign_cores) {
+      AssignCpuCores(engine_type, *replica_body);
+    }
+
+    std::tie(status, res) = load(r->engine, replica_body);
+    if (status["status_code"].asInt() != k200OK) {
+      LOG_ERROR << "Could not load replica " << i << " of model " << model
+                << ": " << res["message"].asString();
+      for (auto& loaded : set.replicas) {
+        unload(loaded->engine);
+      }
+      CpuBudgetService::Global().Release(model);
+      return false;
+    }
+    LOG_INFO << "Loaded replica " << i << " of model " << model;
+    set.replicas.push_back(std::move(r));
+  }
+
+  std::lock_guard<std::mutex> l(replicas_mtx_);
+  model_replicas_[model] = std::move(set);
+  return true;
+}
+
+void server::AssignCpuCores(const std::string& engine_type,
+                            Json::Value& body) {
+  auto cores = CpuBudgetService::Global().Acquire(
+      body.get("model", "").asString(), engine_type,
+      body.get("cpu_threads", 0).asInt());
+  Json::Value affinity(Json::arrayValue);
+  for (int c : cores) {
+    affinity.append(c);
+  }
+  body["cpu_threads"] = static_cast<int>(cores.size());
+  body["cpu_affinity"] = affinity;
+}
+
+void server::FitModelToMemory(const std::string& engine_type,
+                              Json::Value& body, int replicas) {
+  auto model_path = body.get("model_path", "").asString();
+  if (engine_type != kLlamaEngine || model_path.empty()) {
+    return;
+  }
+  // What was fitted at import may no longer fit next to the other models
+  try {
+    config::GGUFHandler gguf_handler;
+    gguf_handler.Parse(model_path, config::GGUFParseMode::kCached);
+    config::ModelConfig mc;
+    mc.ctx_len = body.get("ctx_len", 0).asInt();
+    mc.ngl = body.get("ngl", 0).asInt();
+    auto budget = config::SystemMemoryBudget(
+        file_manager_utils::GetCortexConfig().memoryBudgetPercent, true);
+    // Every replica holds its own weights, KV cache and offloaded layers
+    budget.ram_bytes /= replicas;
+    budget.vram_bytes /= replicas;
+    // An explicit ngl of 0 keeps the whole model on the CPU
+    bool cpu_only = body.isMember("ngl") && mc.ngl == 0;
+    if (cpu_only) {
+      budget.vram_bytes = 0;
+    }
+    auto fit = config::FitModelConfig(gguf_handler, mc, budget);
+    body["ctx_len"] = fit.ctx_len;
+    if (!cpu_only) {
+      body["ngl"] = fit.ngl;
+    }
+  } catch (const std::exception& e) {
+    LOG_WARN << "Could not estimate memory for " << model_path << ": "
+             << e.what();
+  }
+}
+
+bool server::PrefetchModel(const std::string& engine_type,
+                           const Json::Value& body) {
+  auto model = body.get("model", "").asString();
+  auto model_path = body.get("model_path", "").asString();
+  if (engine_type != kLlamaEngine || model.empty() || model_path.empty() ||
+      !body.get("prefetch", true).asBool()) {
+    return false;
+  }
+  // Loaded or loading already: its prefetch lasts until the model is
+  // unloaded or failed to load, and a model holding cores is in the engine
+  if (prefetch_.Has(model) || CpuBudgetService::Global().Holds(model)) {
+    return false;
+  }
+  try {
+    config::GGUFHandler gguf_handler;
+    gguf_handler.Parse(model_path, config::GGUFParseMode::kCached);
+    // Beyond what is free the prefetch would evict its own pages
+    auto available = system_info_utils::GetMemoryInfo().available_bytes;
+    auto ranges = ModelPrefetchService::PlanRanges(
+        gguf_handler.GetShards(), gguf_handler.GetTensorInfos(),
+        available > 0 ? available : std::numeric_limits<uint64_t>::max());
+    prefetch_.Start(model, std::move(ranges));
+    return true;
+  } catch (const std::exception& e) {
+    LOG_WARN << "Could not prefetch " << model_path << ": " << e.what();
+    return false;
+  }
+}
+
+void server::AddPrefetchStatus(const std::string& model,
+                               Json::Value& res) const {
+  auto progress = prefetch_.GetProgress(model);
+  if (!progress.has_value()) {
+    return;
+  }
+  Json::Value p;
+  p["total_bytes"] = static_cast<Json::UInt64>(progress->total_bytes);
+  p["done_bytes"] = static_cast<Json::UInt64>(progress->done_bytes);
+  p["seconds"] = progress->seconds;
+  p["bytes_per_second"] =
+      static_cast<Json::UInt64>(progress->BytesPerSecond());
+  p["finished"] = progress->finished;
+  res["prefetch"] = p;
+}
+
+std::pair<EngineI*, std::shared_ptr<server::ReplicaLease>> server::PickReplica(
+    const std::string& engine_type, const Json::Value& body, int64_t tokens) {
+  {
+    std::lock_guard<std::mutex> l(replicas_mtx_);
+    auto it = model_replicas_.find(body.get("model", "").asString());
+    if (it != model_replicas_.end() && it->second.engine_type == engine_type) {
+      auto& replicas = it->second.replicas;
+      // Least outstanding tokens rather than least requests, a long
+      // generation weighs more than a short one
+      auto best = *std::min_element(
+          replicas.begin(), replicas.end(), [](const auto& a, const auto& b) {
+            return a->outstanding_tokens < b->outstanding_tokens;
+          });
+      best->outstanding_tokens += tokens;
+      return {best->engine,
+              std::shared_ptr<ReplicaLease>(new ReplicaLease{best, tokens})};
+    }
+  }
+  return {std::get<EngineI*>(engines_[engine_type].engine), nullptr};
+}
+
+void server::UnloadModelReplicas(const std::string& model) {
+  ReplicaSet set;
+  {
+    std::lock_guard<std::mutex> l(replicas_mtx_);
+    auto it = model_replicas_.find(model);
+    if (it == model_replicas_.end()) {
+      return;
+    }
+    set = std::move(it->second);
+    model_replicas_.erase(it);
+  }
+  // Replica 0 is unloaded by the caller through the shared engine instance.
+  // The others are deleted once their last in-flight request is done, which
+  // must not be before their unload finished.
+  for (auto& r : set.replicas) {
+    if (!r->owned) {
+      continue;
+    }
+    auto b = std::make_shared<Json::Value>();
+    (*b)["model"] = model;
+    SyncQueue q;
+    r->engine->UnloadModel(b, [&q](Json::Value status, Json::Value res) {
+      q.push(std::make_pair(status, res));
+    });
+    q.wait_and_pop();
+  }
+}
+
+void server::ForgetLiveSessions(const std::string& model) {
+  auto prefix = GetModelHash(model) + "/";
+  std::lock_guard<std::mutex> l(sessions_mtx_);
+  for (auto it = live_sessions_.begin(); it != live_sessions_.end();) {
+    if (it->compare(0, prefix.size(), prefix) == 0) {
+      it = live_sessions_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
 bool server::IsEngineLoaded(const std::string& e) {
   return engines_.find(e) != engines_.end();
 }
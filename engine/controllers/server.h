@@ -11,9 +11,11 @@
 #define CPPHTTPLIB_NO_EXCEPTIONS 1
 #endif
 
+#include <atomic>
 #include <condition_variable>
 #include <cstddef>
 #include <string>
+#include <unordered_set>
 #include <variant>
 
 #include "common/base.h"
@@ -21,6 +23,10 @@
 #include "config/yaml_config.h"
 #include "cortex-common/EngineI.h"
 #include "cortex-common/cortexpythoni.h"
+#include "services/cpu_budget_service.h"
+#include "services/kv_cache_snapshot_service.h"
+#include "services/model_pin_service.h"
+#include "services/model_prefetch_service.h"
 #include "trantor/utils/SerialTaskQueue.h"
 #include "utils/dylib.h"
 #include "utils/json.hpp"
@@ -40,6 +46,7 @@ class server : public drogon::HttpController<server>,
                public BaseChatCompletion,
                public BaseEmbedding {
   struct SyncQueue;
+  struct ReplicaLease;
 
  public:
   server();
@@ -53,6 +60,9 @@ class server : public drogon::HttpController<server>,
   METHOD_ADD(server::ModelStatus, "modelstatus", Post);
   METHOD_ADD(server::GetModels, "models", Get);
   METHOD_ADD(server::GetEngines, "engines", Get);
+  METHOD_ADD(server::PinModel, "pinmodel", Post);
+  METHOD_ADD(server::UnpinModel, "unpinmodel", Post);
+  METHOD_ADD(server::GetPinnedModels, "pinnedmodels", Get);
 
   // cortex.python API
   METHOD_ADD(server::FineTuning, "finetuning", Post);
@@ -98,10 +108,19 @@ class server : public drogon::HttpController<server>,
       std::function<void(const HttpResponsePtr&)>&& callback) override;
   void UnloadEngine(const HttpRequestPtr& req,
                     std::function<void(const HttpResponsePtr&)>&& callback);
+  // Keep model files resident across unloads, see ModelPinService
+  void PinModel(const HttpRequestPtr& req,
+                std::function<void(const HttpResponsePtr&)>&& callback);
+  void UnpinModel(const HttpRequestPtr& req,
+                  std::function<void(const HttpResponsePtr&)>&& callback);
+  void GetPinnedModels(const HttpRequestPtr& req,
+                       std::function<void(const HttpResponsePtr&)>&& callback);
 
  private:
   void ProcessStreamRes(std::function<void(const HttpResponsePtr&)> cb,
-                        std::shared_ptr<SyncQueue> q);
+                        std::shared_ptr<SyncQueue> q,
+                        std::function<void()> on_done = nullptr,
+                        std::shared_ptr<ReplicaLease> lease = nullptr);
   void ProcessNonStreamRes(std::function<void(const HttpResponsePtr&)> cb,
                            SyncQueue& q);
   bool IsEngineLoaded(const std::string& e);
@@ -110,6 +129,33 @@ class server : public drogon::HttpController<server>,
                      std::function<void(const HttpResponsePtr&)>& callback,
                      const std::string& field);
 
+  // KV cache snapshots of chat sessions, see KvCacheSnapshotService
+  std::string GetModelHash(const std::string& model);
+  void RestoreSessionKVCache(EngineI* en, const Json::Value& body);
+  void SaveSessionKVCache(EngineI* en, const Json::Value& body,
+                          std::shared_ptr<ReplicaLease> lease);
+  void ForgetLiveSessions(const std::string& model);
+  std::string LiveSessionKey(EngineI* en, const std::string& model_hash,
+                             const std::string& session_id);
+
+  // Model replicas
+  bool LoadModelReplicas(const std::string& engine_type,
+                         const std::shared_ptr<Json::Value>& body, int n,
+                         Json::Value& status, Json::Value& res);
+  std::pair<EngineI*, std::shared_ptr<ReplicaLease>> PickReplica(
+      const std::string& engine_type, const Json::Value& body,
+      int64_t tokens);
+  void UnloadModelReplicas(const std::string& model);
+  void AssignCpuCores(const std::string& engine_type, Json::Value& body);
+  // Fits ctx_len and ngl of one of `replicas` copies of the model, each
+  // gets an equal share of the budget
+  void FitModelToMemory(const std::string& engine_type, Json::Value& body,
+                        int replicas);
+  // Page cache prefetch of the model files while the engine loads them.
+  // False if none was started, e.g. because the model is already loaded.
+  bool PrefetchModel(const std::string& engine_type, const Json::Value& body);
+  void AddPrefetchStatus(const std::string& model, Json::Value& res) const;
+
  private:
   struct SyncQueue {
     void push(std::pair<Json::Value, Json::Value>&& p) {
@@ -160,5 +206,45 @@ class server : public drogon::HttpController<server>,
   };
   std::unordered_map<std::string, EngineInfo> engines_;
   std::string cur_engine_type_;
+
+  // A model loaded with "replicas": N is served by N engine instances, each
+  // with its own thread budget or device. Replica 0 is the shared instance in
+  // engines_, the others are created for the model and deleted with it.
+  struct ModelReplica {
+    ~ModelReplica() {
+      if (owned) {
+        delete engine;
+      }
+    }
+    EngineI* engine = nullptr;
+    bool owned = false;
+    // Estimated prompt + completion tokens of the requests in flight
+    std::atomic<int64_t> outstanding_tokens{0};
+  };
+  struct ReplicaLease {
+    ~ReplicaLease() { replica->outstanding_tokens -= tokens; }
+    std::shared_ptr<ModelReplica> replica;
+    int64_t tokens;
+  };
+  struct ReplicaSet {
+    std::string engine_type;
+    std::vector<std::shared_ptr<ModelReplica>> replicas;
+  };
+  std::mutex replicas_mtx_;
+  std::unordered_map<std::string, ReplicaSet> model_replicas_;
+
+  std::unique_ptr<KvCacheSnapshotService> kv_snapshots_;
+  // Saving a snapshot can take a while, keep it off the request path
+  trantor::SerialTaskQueue kv_snapshot_queue_{"kv_snapshot"};
+  std::mutex sessions_mtx_;
+  // model name -> hash of the model file it was loaded from
+  std::unordered_map<std::string, std::string> model_hashes_;
+  // "<model_hash>/<session_id>@<engine>" whose KV cache is already in the
+  // engine instance
+  std::unordered_set<std::string> live_sessions_;
+
+  ModelPrefetchService prefetch_;
+  // Null when pinnedModelsMaxMb is 0
+  std::unique_ptr<ModelPinService> pins_;
 };
 };  // namespace inferences
\ No newline at end of file
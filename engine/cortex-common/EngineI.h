@@ -3,6 +3,7 @@
 #include <functional>
 #include <iostream>
 #include <memory>
+#include <string>
 
 #include "json/value.h"
 
@@ -37,4 +38,35 @@ class EngineI {
 
   virtual bool SetFileLogger(int max_log_lines,
                              const std::string& log_path) = 0;
+
+  // Save/restore the KV cache of the slot serving a session to/from a file.
+  // Request body: {"model", "session_id", "filename"}.
+  // Check IsSupported("SaveKVCache") / IsSupported("RestoreKVCache") first.
+  // RestoreKVCache answers 422 if the file can never be restored into the
+  // loaded model, which drops it; other errors keep it for the next try.
+  // Engines built before these existed answer 501.
+  virtual void SaveKVCache(
+      std::shared_ptr<Json::Value> /*json_body*/,
+      std::function<void(Json::Value&&, Json::Value&&)>&& callback) {
+    NotSupported("SaveKVCache", std::move(callback));
+  }
+  virtual void RestoreKVCache(
+      std::shared_ptr<Json::Value> /*json_body*/,
+      std::function<void(Json::Value&&, Json::Value&&)>&& callback) {
+    NotSupported("RestoreKVCache", std::move(callback));
+  }
+
+ protected:
+  static void NotSupported(
+      const std::string& function,
+      std::function<void(Json::Value&&, Json::Value&&)>&& callback) {
+    Json::Value status;
+    status["is_done"] = true;
+    status["has_error"] = true;
+    status["is_stream"] = false;
+    status["status_code"] = 501;
+    Json::Value res;
+    res["message"] = function + " is not supported by this engine";
+    callback(std::move(status), std::move(res));
+  }
 };
@@ -2,8 +2,13 @@
 #include <drogon/drogon.h>
 #include <climits>  // for PATH_MAX
 #include "commands/cortex_upd_cmd.h"
+#include "config/gguf_parser.h"
 #include "controllers/command_line_parser.h"
 #include "cortex-common/cortexpythoni.h"
+#include "services/config_service.h"
+#include "services/cpu_budget_service.h"
+#include "services/download_manager.h"
+#include "services/model_registry_service.h"
 #include "utils/archive_utils.h"
 #include "utils/cortex_utils.h"
 #include "utils/dylib.h"
@@ -11,6 +16,7 @@
 #include "utils/file_manager_utils.h"
 #include "utils/logging_utils.h"
 #include "utils/system_info_utils.h"
+#include "utils/worker_pool.h"
 
 #if defined(__APPLE__) && defined(__MACH__)
 #include <libgen.h>  // for dirname()
@@ -27,45 +33,85 @@
 #error "Unsupported platform!"
 #endif
 
-void RunServer() {
-  auto config = file_manager_utils::GetCortexConfig();
-  LOG_INFO << "Host: " << config.apiServerHost
-           << " Port: " << config.apiServerPort << "\n";
-
+std::shared_ptr<trantor::FileLogger> StartFileLogger(
+    const config_yaml_utils::CortexConfig& config) {
   // Create logs/ folder and setup log to file
   std::filesystem::create_directories(
       std::filesystem::path(config.logFolderPath) /
       std::filesystem::path(cortex_utils::logs_folder));
-  trantor::FileLogger asyncFileLogger;
-  asyncFileLogger.setFileName(config.logFolderPath + "/" +
-                              cortex_utils::logs_base_name);
-  asyncFileLogger.setMaxLines(config.maxLogLines);  // Keep last 100000 lines
-  asyncFileLogger.startLogging();
+  auto logger = std::make_shared<trantor::FileLogger>();
+  logger->setFileName(config.logFolderPath + "/" +
+                      cortex_utils::logs_base_name);
+  logger->setMaxLines(config.maxLogLines);  // Keep last 100000 lines
+  logger->startLogging();
+  return logger;
+}
+
+// Applies what can change without a restart, logs the rest
+void OnConfigChanged(const config_yaml_utils::CortexConfig& old,
+                     const config_yaml_utils::CortexConfig& now,
+                     std::shared_ptr<trantor::FileLogger>& logger) {
+  if (old.logFolderPath != now.logFolderPath ||
+      old.maxLogLines != now.maxLogLines) {
+    // The previous logger flushes once the last line in flight is written
+    std::atomic_store(&logger, StartFileLogger(now));
+    LOG_INFO << "Logging to " << now.logFolderPath
+             << ", max lines: " << now.maxLogLines;
+  }
+  if (old.workerQueueSize != now.workerQueueSize) {
+    WorkerPool::Global().SetMaxQueue(std::max(1, now.workerQueueSize));
+    LOG_INFO << "Worker queue size: " << now.workerQueueSize;
+  }
+  if (old.expectedCpuModels != now.expectedCpuModels) {
+    // Applies to the shares of the next models loaded
+    CpuBudgetService::Global().SetExpectedModels(now.expectedCpuModels);
+    LOG_INFO << "Expected CPU models: " << now.expectedCpuModels;
+  }
+  if (old.maxConcurrentDownloads != now.maxConcurrentDownloads) {
+    DownloadManager::Global().SetMaxActive(
+        std::max(1, now.maxConcurrentDownloads));
+    LOG_INFO << "Concurrent downloads: " << now.maxConcurrentDownloads;
+  }
+  // memoryBudgetPercent is read on every model load
+  if (old.apiServerHost != now.apiServerHost ||
+      old.apiServerPort != now.apiServerPort ||
+      old.ioThreads != now.ioThreads ||
+      old.workerThreads != now.workerThreads ||
+      old.keepAliveRequests != now.keepAliveRequests ||
+      old.idleConnectionTimeout != now.idleConnectionTimeout ||
+      old.kvCacheSnapshotMaxMb != now.kvCacheSnapshotMaxMb ||
+      old.pinnedModelsMaxMb != now.pinnedModelsMaxMb) {
+    LOG_WARN << "Listener, thread, KV cache and pinning settings take effect "
+                "after a restart";
+  }
+}
+
+void RunServer() {
+  // Reloaded when .cortexrc changes or on SIGHUP
+  auto& config_service = ConfigService::Global();
+  config_service.Start(true);
+  auto config = *config_service.Get();
+  LOG_INFO << "Host: " << config.apiServerHost
+           << " Port: " << config.apiServerPort << "\n";
+
+  auto asyncFileLogger = StartFileLogger(config);
   trantor::Logger::setOutputFunction(
       [&](const char* msg, const uint64_t len) {
-        asyncFileLogger.output_(msg, len);
+        std::atomic_load(&asyncFileLogger)->output_(msg, len);
       },
-      [&]() { asyncFileLogger.flush(); });
-  // Number of cortex.cpp threads
-  // if (argc > 1) {
-  //   thread_num = std::atoi(argv[1]);
-  // }
-
-  // // Check for host argument
-  // if (argc > 2) {
-  //   host = argv[2];
-  // }
-
-  // // Check for port argument
-  // if (argc > 3) {
-  //   port = std::atoi(argv[3]);  // Convert string argument to int
-  // }
-  int thread_num = 1;
-  // std::string host = "127.0.0.1";
-  // int port = 3928;
+      [&]() { std::atomic_load(&asyncFileLogger)->flush(); });
+  config_service.Subscribe(
+      [&asyncFileLogger](const auto& old, const auto& now) {
+        OnConfigChanged(old, now, asyncFileLogger);
+      });
 
   int logical_cores = std::thread::hardware_concurrency();
-  int drogon_thread_num = std::max(thread_num, logical_cores);
+  int drogon_thread_num =
+      config.ioThreads > 0 ? config.ioThreads : std::max(1, logical_cores);
+  // Blocking handlers (model listing, import, download, YAML parsing) run on
+  // the worker pool so that they do not stall the IO threads
+  WorkerPool::Configure(std::max(0, config.workerThreads),
+                        std::max(1, config.workerQueueSize));
   // cortex_utils::nitro_logo();
 #ifdef CORTEX_CPP_VERSION
   LOG_INFO << "cortex.cpp version: " << CORTEX_CPP_VERSION;
@@ -79,9 +125,42 @@ void RunServer() {
   drogon::app().addListener(config.apiServerHost,
                             std::stoi(config.apiServerPort));
   drogon::app().setThreadNum(drogon_thread_num);
-  LOG_INFO << "Number of thread is:" << drogon::app().getThreadNum();
+  drogon::app().setIdleConnectionTimeout(
+      std::max(0, config.idleConnectionTimeout));
+  drogon::app().setKeepaliveRequestsNumber(
+      std::max(0, config.keepAliveRequests));
+  LOG_INFO << "Number of thread is:" << drogon::app().getThreadNum()
+           << ", worker threads: " << WorkerPool::Global().Size();
+
+  // Opened (and migrated from model.list) before the first request needs it
+  try {
+    LOG_INFO << "Registered models: "
+             << ModelRegistryService::Global().Get()->Size();
+  } catch (const std::exception& e) {
+    LOG_ERROR << "Failed to open the model registry: " << e.what();
+  }
+
+  // Finished and failed downloads stay listed across restarts
+  auto& downloads = DownloadManager::Global();
+  downloads.Open(file_manager_utils::GetCortexDataPath() / "downloads.json");
+  downloads.SetMaxActive(std::max(1, config.maxConcurrentDownloads));
+
+  // IO threads mostly wait on engines, keep them off the cores that models
+  // compute on
+  auto& cpu_budget = CpuBudgetService::Global();
+  cpu_budget.SetExpectedModels(config.expectedCpuModels);
+  LOG_INFO << "Cores reserved for IO: " << cpu_budget.IoCores().size();
+  drogon::app().registerBeginningAdvice([&cpu_budget] {
+    for (size_t i = 0; i < drogon::app().getThreadNum(); i++) {
+      drogon::app().getIOLoop(i)->queueInLoop([&cpu_budget] {
+        CpuBudgetService::PinCurrentThread(cpu_budget.IoCores());
+      });
+    }
+  });
 
   drogon::app().run();
+  // The subscriber refers to the logger on this stack
+  config_service.Stop();
   // return 0;
 }
 
@@ -96,6 +175,8 @@ int main(int argc, char* argv[]) {
   }
 
   { file_manager_utils::CreateConfigFileIfNotExist(); }
+  config::GGUFHandler::SetSidecarFallbackDir(
+      file_manager_utils::GetCortexDataPath() / "cache" / "gguf");
 
   // Delete temporary file if it exists
   auto temp =
@@ -0,0 +1,292 @@
+#include "config_service.h"
+#include <trantor/utils/Logger.h>
+#include <cerrno>
+#include <chrono>
+#include <stdexcept>
+#include <vector>
+#include "utils/file_manager_utils.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <climits>
+#endif
+
+namespace {
+// Without inotify the file is checked this often
+constexpr auto kPollInterval = std::chrono::seconds(2);
+
+#ifdef __linux__
+// An editor either rewrites the file or renames a new one over it
+constexpr uint32_t kWatchMask =
+    IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO | IN_DELETE;
+#endif
+
+#ifndef _WIN32
+// Write end of the wake pipe of the service that reloads on SIGHUP
+std::atomic<int> sighup_fd{-1};
+
+void OnSighup(int) {
+  int saved_errno = errno;
+  int fd = sighup_fd.load();
+  if (fd >= 0) {
+    char c = 1;
+    // Non-blocking, a full pipe already has a reload pending
+    [[maybe_unused]] auto n = write(fd, &c, 1);
+  }
+  errno = saved_errno;
+}
+
+void DrainPipe(int fd) {
+  char buf[64];
+  while (read(fd, buf, sizeof(buf)) > 0) {
+  }
+}
+#endif
+}  // namespace
+
+ConfigService::ConfigService(std::filesystem::path path)
+    : path_(std::move(path)) {}
+
+ConfigService::~ConfigService() {
+  Stop();
+#ifndef _WIN32
+  for (int fd : wake_pipe_) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+#endif
+#ifdef __linux__
+  if (inotify_fd_ >= 0) {
+    close(inotify_fd_);
+  }
+#endif
+}
+
+ConfigService& ConfigService::Global() {
+  static ConfigService service(file_manager_utils::GetConfigurationPath());
+  return service;
+}
+
+ConfigService::Snapshot ConfigService::Get() {
+  auto config = std::atomic_load(&config_);
+  if (config && watching_.load(std::memory_order_acquire)) {
+    return config;
+  }
+  if (!config) {
+    Reload();
+    return std::atomic_load(&config_);
+  }
+  try {
+    if (Reload()) {
+      return std::atomic_load(&config_);
+    }
+  } catch (const std::exception& e) {
+    LOG_WARN << "Keeping the previous config: " << e.what();
+  }
+  return config;
+}
+
+bool ConfigService::Reload(bool force) {
+  std::lock_guard<std::recursive_mutex> lock(reload_mutex_);
+  auto old = std::atomic_load(&config_);
+  binary_io_utils::FileIdentity id;
+  if (!binary_io_utils::GetFileIdentity(path_, id)) {
+    if (!old) {
+      throw std::runtime_error("File not found: " + path_.string());
+    }
+    // Removed, or between an editor's delete and rename
+    return false;
+  }
+  if (!force && old && id == identity_) {
+    return false;
+  }
+  // Recorded before parsing so a broken file is not parsed on every Get()
+  identity_ = id;
+  auto now = std::make_shared<const Config>(
+      config_yaml_utils::FromYaml(path_.string(), ""));
+  std::atomic_store(&config_, Snapshot(now));
+  if (old) {
+    Notify(*old, *now);
+  }
+  return true;
+}
+
+int ConfigService::Subscribe(Subscriber subscriber) {
+  std::lock_guard<std::mutex> lock(subscribers_mutex_);
+  subscribers_.emplace(next_id_, std::move(subscriber));
+  return next_id_++;
+}
+
+void ConfigService::Unsubscribe(int id) {
+  std::lock_guard<std::mutex> lock(subscribers_mutex_);
+  subscribers_.erase(id);
+}
+
+void ConfigService::Notify(const Config& old, const Config& now) {
+  std::vector<Subscriber> subscribers;
+  {
+    std::lock_guard<std::mutex> lock(subscribers_mutex_);
+    for (const auto& [id, s] : subscribers_) {
+      subscribers.push_back(s);
+    }
+  }
+  for (const auto& s : subscribers) {
+    try {
+      s(old, now);
+    } catch (const std::exception& e) {
+      LOG_ERROR << "Config subscriber failed: " << e.what();
+    }
+  }
+}
+
+void ConfigService::Start(bool on_sighup) {
+  if (watcher_.joinable()) {
+    return;
+  }
+#ifndef _WIN32
+  if (wake_pipe_[0] < 0) {
+    if (pipe(wake_pipe_) != 0) {
+      throw std::runtime_error("Cannot create a pipe, errno " +
+                               std::to_string(errno));
+    }
+    for (int fd : wake_pipe_) {
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+  }
+#endif
+#ifdef __linux__
+  // Before the first read, so that no change is missed in between
+  if (inotify_fd_ < 0) {
+    inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  }
+  auto dir = path_.has_parent_path() ? path_.parent_path()
+                                     : std::filesystem::path(".");
+  if (inotify_fd_ >= 0 &&
+      inotify_add_watch(inotify_fd_, dir.string().c_str(), kWatchMask) < 0) {
+    close(inotify_fd_);
+    inotify_fd_ = -1;
+  }
+  if (inotify_fd_ < 0) {
+    LOG_WARN << "Cannot watch " << dir.string() << ", " << path_.string()
+             << " is checked every " << kPollInterval.count() << " seconds";
+  }
+#endif
+  try {
+    Reload();
+  } catch (const std::exception& e) {
+    LOG_WARN << "Failed to read " << path_.string() << ": " << e.what();
+  }
+
+  stop_ = false;
+  watching_.store(true, std::memory_order_release);
+  watcher_ = std::thread([this] { Watch(); });
+#ifndef _WIN32
+  if (on_sighup) {
+    sighup_fd = wake_pipe_[1];
+    struct sigaction sa = {};
+    sa.sa_handler = OnSighup;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGHUP, &sa, nullptr);
+  }
+#else
+  (void)on_sighup;
+#endif
+}
+
+void ConfigService::Stop() {
+  if (!watcher_.joinable()) {
+    return;
+  }
+  stop_ = true;
+#ifndef _WIN32
+  int expected = wake_pipe_[1];
+  sighup_fd.compare_exchange_strong(expected, -1);
+  char c = 0;
+  [[maybe_unused]] auto n = write(wake_pipe_[1], &c, 1);
+#else
+  {
+    std::lock_guard<std::mutex> lock(wait_mutex_);
+  }
+  wait_cv_.notify_all();
+#endif
+  watcher_.join();
+  watching_.store(false, std::memory_order_release);
+}
+
+void ConfigService::Watch() {
+  while (!stop_) {
+    bool changed = false;
+    bool forced = false;
+#ifdef _WIN32
+    {
+      std::unique_lock<std::mutex> lock(wait_mutex_);
+      wait_cv_.wait_for(lock, kPollInterval, [this] { return stop_.load(); });
+    }
+    changed = true;
+#else
+    pollfd fds[2] = {{wake_pipe_[0], POLLIN, 0}, {inotify_fd_, POLLIN, 0}};
+    nfds_t nfds = inotify_fd_ >= 0 ? 2 : 1;
+    int timeout_ms =
+        inotify_fd_ >= 0
+            ? -1
+            : static_cast<int>(
+                  std::chrono::milliseconds(kPollInterval).count());
+    int n = poll(fds, nfds, timeout_ms);
+    if (n < 0) {
+      if (errno != EINTR) {
+        LOG_ERROR << "Config watcher stopped, errno " << errno;
+        return;
+      }
+      continue;
+    }
+    if (n == 0) {
+      changed = true;
+    }
+    if (fds[0].revents & POLLIN) {
+      // SIGHUP, or Stop() which is checked below
+      DrainPipe(wake_pipe_[0]);
+      forced = true;
+    }
+#ifdef __linux__
+    if (nfds > 1 && (fds[1].revents & POLLIN)) {
+      constexpr size_t kEventSize = sizeof(inotify_event) + NAME_MAX + 1;
+      alignas(inotify_event) char buf[16 * kEventSize];
+      auto name = path_.filename().string();
+      ssize_t len;
+      while ((len = read(inotify_fd_, buf, sizeof(buf))) > 0) {
+        for (ssize_t pos = 0; pos < len;) {
+          auto* ev = reinterpret_cast<const inotify_event*>(buf + pos);
+          pos += sizeof(inotify_event) + ev->len;
+          changed = changed || (ev->mask & IN_Q_OVERFLOW) ||
+                    (ev->len > 0 && name == ev->name);
+        }
+      }
+    }
+#endif
+#endif
+    if (stop_) {
+      break;
+    }
+    if (!changed && !forced) {
+      continue;
+    }
+    try {
+      if (Reload(forced)) {
+        LOG_INFO << "Reloaded " << path_.string();
+      }
+    } catch (const std::exception& e) {
+      LOG_WARN << "Keeping the previous config, failed to read "
+               << path_.string() << ": " << e.what();
+    }
+  }
+}
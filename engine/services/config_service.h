@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "utils/binary_io_utils.h"
+#include "utils/config_yaml_utils.h"
+
+/**
+ * The parsed .cortexrc, shared by the whole process.
+ *
+ * The file is parsed once into an immutable CortexConfig behind an atomic
+ * pointer, so readers on the request path only copy a shared_ptr. Once
+ * Start() ran, a background thread re-reads the file when it changes
+ * (inotify on Linux, a stat every few seconds elsewhere) or when the process
+ * gets SIGHUP, and tells the subscribers what changed. Without that thread,
+ * as in CLI commands, Get() compares the file's size and mtime on every call
+ * so a config written by this process is read back.
+ *
+ * A file that fails to parse is logged and the previous config kept.
+ */
+class ConfigService {
+ public:
+  using Config = config_yaml_utils::CortexConfig;
+  using Snapshot = std::shared_ptr<const Config>;
+  // Called on the thread that reloaded, one change at a time
+  using Subscriber = std::function<void(const Config& old, const Config& now)>;
+
+  explicit ConfigService(std::filesystem::path path);
+  ~ConfigService();
+
+  ConfigService(const ConfigService&) = delete;
+  ConfigService& operator=(const ConfigService&) = delete;
+
+  // Over file_manager_utils::GetConfigurationPath()
+  static ConfigService& Global();
+
+  // Throws if the file was never read successfully
+  Snapshot Get();
+
+  /**
+   * Reads the file again if it changed since the last read, or always when
+   * `force` is set. Returns true if a new config was published. Throws if
+   * it fails to parse.
+   */
+  bool Reload(bool force = false);
+
+  // Returns an id for Unsubscribe()
+  int Subscribe(Subscriber subscriber);
+  void Unsubscribe(int id);
+
+  /**
+   * Starts watching the file. `on_sighup` also reloads it on SIGHUP, which
+   * only one service in the process can do.
+   */
+  void Start(bool on_sighup = false);
+  void Stop();
+
+  const std::filesystem::path& Path() const { return path_; }
+
+ private:
+  void Watch();
+  void Notify(const Config& old, const Config& now);
+
+  const std::filesystem::path path_;
+  Snapshot config_;
+  std::atomic<bool> watching_{false};
+
+  // Serializes reads of the file and notifications. Recursive, a subscriber
+  // may call Get().
+  std::recursive_mutex reload_mutex_;
+  binary_io_utils::FileIdentity identity_;
+
+  std::mutex subscribers_mutex_;
+  std::map<int, Subscriber> subscribers_;
+  int next_id_ = 0;
+
+  std::thread watcher_;
+  std::atomic<bool> stop_{false};
+  // inotify descriptor, -1 where unavailable
+  int inotify_fd_ = -1;
+  // Wakes the watcher: written by Stop() and the SIGHUP handler
+  int wake_pipe_[2] = {-1, -1};
+  std::mutex wait_mutex_;
+  std::condition_variable wait_cv_;
+};
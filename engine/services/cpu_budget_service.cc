@@ -0,0 +1,412 @@
+#include "cpu_budget_service.h"
+#include <trantor/utils/Logger.h>
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <map>
+#include "utils/cpuid/cpu_info.h"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+CpuBudgetService::CpuBudgetService(cortex::cpuid::CpuTopology topology,
+                                   int io_cores)
+    : topology_(std::move(topology)) {
+  std::vector<int> cores;
+  for (const auto& c : topology_.cpus) {
+    cores.push_back(c.id);
+  }
+  // E-cores first, then the lowest ids of the first node
+  std::sort(cores.begin(), cores.end(), [this](int a, int b) {
+    auto ca = topology_.find(a), cb = topology_.find(b);
+    return std::make_tuple(ca->performance, ca->numa_node, a) <
+           std::make_tuple(cb->performance, cb->numa_node, b);
+  });
+  auto n_io = std::min(static_cast<size_t>(std::max(1, io_cores)),
+                       cores.size());
+  io_cores_.assign(cores.begin(), cores.begin() + n_io);
+  // A machine this small cannot spare cores for IO alone
+  if (cores.size() > io_cores_.size()) {
+    compute_cores_.assign(cores.begin() + io_cores_.size(), cores.end());
+  } else {
+    compute_cores_ = cores;
+  }
+  std::sort(io_cores_.begin(), io_cores_.end());
+  std::sort(compute_cores_.begin(), compute_cores_.end());
+  free_ = compute_cores_;
+}
+
+CpuBudgetService::CpuBudgetService(const std::vector<int>& cores,
+                                   int io_cores)
+    : CpuBudgetService(cortex::cpuid::CpuTopology::Flat(cores), io_cores) {}
+
+CpuBudgetService& CpuBudgetService::Global() {
+  static CpuBudgetService budget = [] {
+    auto topology = cortex::cpuid::CpuInfo().topology();
+    LOG_INFO << "CPU topology: " << topology.to_string();
+    auto n = static_cast<int>(topology.cpus.size());
+    return CpuBudgetService(std::move(topology), DefaultIoCores(n));
+  }();
+  return budget;
+}
+
+int CpuBudgetService::DefaultIoCores(int n_cores) {
+  // HTTP parsing and streaming are cheap next to token generation
+  return std::clamp(n_cores / 16, 1, 4);
+}
+
+void CpuBudgetService::SetExpectedModels(int n) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  expected_models_ = static_cast<size_t>(std::max(1, n));
+}
+
+std::vector<int> CpuBudgetService::Acquire(const std::string& model,
+                                           const std::string& engine,
+                                           int requested) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t n = 0;
+  if (requested > 0) {
+    n = static_cast<size_t>(requested);
+  } else {
+    size_t sets = 1;
+    for (const auto& [_, h] : holdings_) {
+      sets += h.core_sets.size();
+    }
+    n = EvenShareLocked(sets);
+    if (free_.size() < n) {
+      ShrinkLocked(n, n);
+    }
+  }
+  auto& holding = holdings_[model];
+  holding.engine = engine;
+
+  if (free_.empty()) {
+    // Oversubscribe the largest holder rather than the whole machine
+    const std::vector<int>* largest = &compute_cores_;
+    size_t largest_size = 0;
+    for (const auto& [_, h] : holdings_) {
+      for (const auto& s : h.core_sets) {
+        if (s.cores.size() > largest_size) {
+          largest = &s.cores;
+          largest_size = s.cores.size();
+        }
+      }
+    }
+    LOG_WARN << "No free cores left for " << model << ", sharing "
+             << largest->size() << " cores with another model";
+    auto cores = *largest;
+    holding.core_sets.push_back({cores, false});
+    return cores;
+  }
+
+  // Cross-node memory traffic costs more than fewer threads, so stay in one
+  // NUMA node: the smallest one that fits, otherwise the one with most room
+  std::map<int, std::vector<int>> free_by_node;
+  for (int c : free_) {
+    free_by_node[topology_.find(c)->numa_node].push_back(c);
+  }
+  auto better = [n](const std::vector<int>& a, const std::vector<int>& b) {
+    if ((a.size() >= n) != (b.size() >= n)) {
+      return a.size() >= n;
+    }
+    return a.size() >= n ? a.size() < b.size() : a.size() > b.size();
+  };
+  const std::vector<int>* node = nullptr;
+  for (const auto& [_, node_free] : free_by_node) {
+    if (!node || better(node_free, *node)) {
+      node = &node_free;
+    }
+  }
+  auto candidates = *node;
+  std::sort(candidates.begin(), candidates.end(),
+            [this](int a, int b) { return Rank(a) < Rank(b); });
+  candidates.resize(std::min(n, candidates.size()));
+
+  std::vector<int> cores = candidates;
+  std::sort(cores.begin(), cores.end());
+  for (int c : cores) {
+    free_.erase(std::lower_bound(free_.begin(), free_.end(), c));
+  }
+  holding.core_sets.push_back({cores, requested <= 0});
+  LOG_INFO << "Assigned " << cores.size() << " cores to " << model << ", "
+           << free_.size() << " cores left";
+  return cores;
+}
+
+bool CpuBudgetService::Holds(const std::string& model) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return holdings_.find(model) != holdings_.end();
+}
+
+void CpuBudgetService::Release(const std::string& model) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ReleaseLocked(model);
+  GrowLocked();
+}
+
+void CpuBudgetService::ReleaseEngine(const std::string& engine) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<std::string> models;
+  for (const auto& [m, h] : holdings_) {
+    if (h.engine == engine) {
+      models.push_back(m);
+    }
+  }
+  for (const auto& m : models) {
+    ReleaseLocked(m);
+  }
+  GrowLocked();
+}
+
+int CpuBudgetService::FreeCores() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return static_cast<int>(free_.size());
+}
+
+void CpuBudgetService::ReleaseLocked(const std::string& model) {
+  auto it = holdings_.find(model);
+  if (it == holdings_.end()) {
+    return;
+  }
+  for (const auto& set : it->second.core_sets) {
+    for (int c : set.cores) {
+      // Shared sets are still owned by the model they were borrowed from
+      if (std::binary_search(free_.begin(), free_.end(), c) ||
+          HeldByOtherLocked(model, c)) {
+        continue;
+      }
+      free_.insert(std::lower_bound(free_.begin(), free_.end(), c), c);
+    }
+  }
+  holdings_.erase(it);
+}
+
+bool CpuBudgetService::HeldByOtherLocked(const std::string& model,
+                                         int core) const {
+  for (const auto& [m, h] : holdings_) {
+    if (m == model) {
+      continue;
+    }
+    for (const auto& s : h.core_sets) {
+      if (std::find(s.cores.begin(), s.cores.end(), core) != s.cores.end()) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+size_t CpuBudgetService::EvenShareLocked(size_t sets) const {
+  return std::max<size_t>(
+      1, compute_cores_.size() / std::max(expected_models_, sets));
+}
+
+void CpuBudgetService::ShrinkLocked(size_t share, size_t needed) {
+  // The largest shares have the most to give
+  std::vector<std::pair<const std::string*, CoreSet*>> sets;
+  for (auto& [m, h] : holdings_) {
+    for (auto& s : h.core_sets) {
+      if (s.even_share && s.cores.size() > share) {
+        sets.emplace_back(&m, &s);
+      }
+    }
+  }
+  std::sort(sets.begin(), sets.end(), [](const auto& a, const auto& b) {
+    return a.second->cores.size() > b.second->cores.size();
+  });
+  for (auto& [model, set] : sets) {
+    if (free_.size() >= needed) {
+      return;
+    }
+    const auto& m = *model;
+    if (std::any_of(set->cores.begin(), set->cores.end(),
+                    [&](int c) { return HeldByOtherLocked(m, c); })) {
+      continue;
+    }
+    // The cores worst for compute go back
+    auto keep = set->cores;
+    std::sort(keep.begin(), keep.end(),
+              [this](int a, int b) { return Rank(a) < Rank(b); });
+    auto excess = std::min(keep.size() - share, needed - free_.size());
+    for (auto it = keep.end() - excess; it != keep.end(); ++it) {
+      free_.insert(std::lower_bound(free_.begin(), free_.end(), *it), *it);
+    }
+    keep.resize(keep.size() - excess);
+    std::sort(keep.begin(), keep.end());
+    ResizeLocked(m, *set, std::move(keep));
+  }
+}
+
+void CpuBudgetService::GrowLocked() {
+  size_t sets = 0;
+  for (const auto& [_, h] : holdings_) {
+    sets += h.core_sets.size();
+  }
+  if (sets == 0) {
+    return;
+  }
+  auto share = EvenShareLocked(sets);
+  for (auto& [m, h] : holdings_) {
+    for (auto& s : h.core_sets) {
+      if (free_.empty()) {
+        return;
+      }
+      if (!s.even_share || s.cores.empty() || s.cores.size() >= share ||
+          std::any_of(s.cores.begin(), s.cores.end(),
+                      [&](int c) { return HeldByOtherLocked(m, c); })) {
+        continue;
+      }
+      // Within the set's NUMA node
+      auto node = topology_.find(s.cores.front())->numa_node;
+      std::vector<int> candidates;
+      for (int c : free_) {
+        if (topology_.find(c)->numa_node == node) {
+          candidates.push_back(c);
+        }
+      }
+      std::sort(candidates.begin(), candidates.end(),
+                [this](int a, int b) { return Rank(a) < Rank(b); });
+      candidates.resize(std::min(share - s.cores.size(), candidates.size()));
+      if (candidates.empty()) {
+        continue;
+      }
+      auto cores = s.cores;
+      for (int c : candidates) {
+        free_.erase(std::lower_bound(free_.begin(), free_.end(), c));
+        cores.push_back(c);
+      }
+      std::sort(cores.begin(), cores.end());
+      ResizeLocked(m, s, std::move(cores));
+    }
+  }
+}
+
+void CpuBudgetService::ResizeLocked(const std::string& model, CoreSet& set,
+                                    std::vector<int> cores) {
+  // Threads that were never pinned cannot be told apart from the model's if
+  // it held every core
+  auto moved = set.cores.size() < topology_.cpus.size()
+                   ? MoveThreads(set.cores, cores)
+                   : 0;
+  LOG_INFO << "Resized the cores of " << model << " from " << set.cores.size()
+           << " to " << cores.size() << ", moved " << moved << " threads";
+  set.cores = std::move(cores);
+}
+
+std::tuple<bool, int, int> CpuBudgetService::Rank(int cpu) const {
+  // Decode is bound by the slowest thread, so P-cores first, then one
+  // hardware thread per physical core before SMT siblings
+  auto c = topology_.find(cpu);
+  return {!c->performance, c->smt_rank, cpu};
+}
+
+bool CpuBudgetService::PinCurrentThread(const std::vector<int>& cores) {
+  if (cores.empty()) {
+    return false;
+  }
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int c : cores) {
+    CPU_SET(c, &set);
+  }
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+  DWORD_PTR mask = 0;
+  for (int c : cores) {
+    if (c < static_cast<int>(sizeof(DWORD_PTR) * 8)) {
+      mask |= static_cast<DWORD_PTR>(1) << c;
+    }
+  }
+  return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#else
+  // macOS only has affinity hints, not placement
+  return false;
+#endif
+}
+
+std::vector<int> CpuBudgetService::CurrentThreadCores() {
+  std::vector<int> cores;
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+    return cores;
+  }
+  for (int c = 0; c < CPU_SETSIZE; c++) {
+    if (CPU_ISSET(c, &set)) {
+      cores.push_back(c);
+    }
+  }
+#elif defined(_WIN32)
+  // There is no getter, the previous mask comes back from setting one
+  DWORD_PTR process = 0, system = 0;
+  if (!GetProcessAffinityMask(GetCurrentProcess(), &process, &system)) {
+    return cores;
+  }
+  auto previous = SetThreadAffinityMask(GetCurrentThread(), process);
+  if (previous == 0) {
+    return cores;
+  }
+  SetThreadAffinityMask(GetCurrentThread(), previous);
+  for (int c = 0; c < static_cast<int>(sizeof(DWORD_PTR) * 8); c++) {
+    if (previous & (static_cast<DWORD_PTR>(1) << c)) {
+      cores.push_back(c);
+    }
+  }
+#endif
+  return cores;
+}
+
+CpuBudgetService::ScopedPin::ScopedPin(const std::vector<int>& cores)
+    : previous_(CurrentThreadCores()) {
+  if (!previous_.empty()) {
+    PinCurrentThread(cores);
+  }
+}
+
+CpuBudgetService::ScopedPin::~ScopedPin() {
+  if (!previous_.empty()) {
+    PinCurrentThread(previous_);
+  }
+}
+
+int CpuBudgetService::MoveThreads(const std::vector<int>& from,
+                                  const std::vector<int>& to) {
+#if defined(__linux__)
+  if (from.empty() || to.empty()) {
+    return 0;
+  }
+  cpu_set_t from_set, to_set;
+  CPU_ZERO(&from_set);
+  CPU_ZERO(&to_set);
+  for (int c : from) {
+    CPU_SET(c, &from_set);
+  }
+  for (int c : to) {
+    CPU_SET(c, &to_set);
+  }
+  int moved = 0;
+  std::error_code ec;
+  for (const auto& entry :
+       std::filesystem::directory_iterator("/proc/self/task", ec)) {
+    auto tid = static_cast<pid_t>(
+        std::strtol(entry.path().filename().c_str(), nullptr, 10));
+    cpu_set_t current;
+    CPU_ZERO(&current);
+    if (tid > 0 && sched_getaffinity(tid, sizeof(current), &current) == 0 &&
+        CPU_EQUAL(&current, &from_set) &&
+        sched_setaffinity(tid, sizeof(to_set), &to_set) == 0) {
+      moved++;
+    }
+  }
+  return moved;
+#else
+  return 0;
+#endif
+}
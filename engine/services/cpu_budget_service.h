@@ -0,0 +1,134 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include "utils/cpuid/cpu_topology.h"
+
+/**
+ * Hands out disjoint sets of CPU cores so that drogon IO threads and the
+ * compute threads of every loaded model do not oversubscribe the machine.
+ *
+ * A few cores are reserved for IO up front, the rest are the compute pool.
+ * Each model (or model replica) takes a set from the pool when it is loaded
+ * and gives it back when it is unloaded. Models that did not ask for a number
+ * of cores get an even share of the pool, and are shrunk or grown to the new
+ * share as other models come and go: their threads are moved to the new set.
+ *
+ * Placement follows the topology: a model's set stays inside one NUMA node and
+ * takes P-cores and first hardware threads before E-cores and SMT siblings,
+ * while IO prefers the E-cores.
+ */
+class CpuBudgetService {
+ public:
+  CpuBudgetService(cortex::cpuid::CpuTopology topology, int io_cores);
+  CpuBudgetService(const std::vector<int>& cores, int io_cores);
+
+  /**
+   * Budget over all the cores of this machine, shared by the HTTP server and
+   * the inference controller.
+   */
+  static CpuBudgetService& Global();
+
+  static int DefaultIoCores(int n_cores);
+
+  const std::vector<int>& IoCores() const { return io_cores_; }
+  const std::vector<int>& ComputeCores() const { return compute_cores_; }
+
+  /**
+   * Models the pool is split between at least, so that a single model does
+   * not take every core only to be shrunk by the next one.
+   */
+  void SetExpectedModels(int n);
+
+  /**
+   * Reserves cores for a model. When `requested` is not positive the model gets
+   * an even share of the compute pool, taken back from other such models if
+   * need be. If the pool is exhausted the model shares the cores of the
+   * largest holder, returned with a warning, rather than running unpinned.
+   */
+  std::vector<int> Acquire(const std::string& model,
+                           const std::string& engine, int requested);
+
+  bool Holds(const std::string& model) const;
+
+  /**
+   * Returns the cores of all the sets (replicas) held by a model. Models with
+   * an even share grow into them.
+   */
+  void Release(const std::string& model);
+
+  void ReleaseEngine(const std::string& engine);
+
+  int FreeCores() const;
+
+  /**
+   * Pins the calling thread to the given cores. Returns false where thread
+   * affinity is not supported.
+   */
+  static bool PinCurrentThread(const std::vector<int>& cores);
+
+  // Empty where thread affinity is not supported
+  static std::vector<int> CurrentThreadCores();
+
+  /**
+   * Pins the calling thread to `cores` until destroyed, then restores its
+   * previous mask. Engines do not place their threads, those they start while
+   * loading a model inherit the mask of the loading thread.
+   */
+  class ScopedPin {
+   public:
+    explicit ScopedPin(const std::vector<int>& cores);
+    ~ScopedPin();
+
+    ScopedPin(const ScopedPin&) = delete;
+    ScopedPin& operator=(const ScopedPin&) = delete;
+
+   private:
+    std::vector<int> previous_;
+  };
+
+  /**
+   * Moves every thread of the process whose mask is exactly `from` to `to`.
+   * Returns how many moved, always 0 off Linux.
+   */
+  static int MoveThreads(const std::vector<int>& from,
+                         const std::vector<int>& to);
+
+ private:
+  struct CoreSet {
+    std::vector<int> cores;
+    // An even share, resized as models come and go
+    bool even_share = false;
+  };
+
+  struct Holding {
+    std::string engine;
+    std::vector<CoreSet> core_sets;
+  };
+
+  void ReleaseLocked(const std::string& model);
+  // Whether a model other than `model` holds `core`
+  bool HeldByOtherLocked(const std::string& model, int core) const;
+  // The share of a model that did not ask for a number of cores
+  size_t EvenShareLocked(size_t sets) const;
+  // Takes cores back from even shares above `share` until `needed` are free
+  void ShrinkLocked(size_t share, size_t needed);
+  // Grows even shares below the current share from the free cores
+  void GrowLocked();
+  void ResizeLocked(const std::string& model, CoreSet& set,
+                    std::vector<int> cores);
+  // Lower is better for compute
+  std::tuple<bool, int, int> Rank(int cpu) const;
+
+  cortex::cpuid::CpuTopology topology_;
+  std::vector<int> io_cores_;
+  std::vector<int> compute_cores_;
+  // Sorted, so that a model gets neighbouring cores
+  std::vector<int> free_;
+  std::unordered_map<std::string, Holding> holdings_;
+  size_t expected_models_ = 1;
+  mutable std::mutex mutex_;
+};
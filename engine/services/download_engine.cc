@@ -0,0 +1,258 @@
+#include "download_engine.h"
+#include <trantor/utils/Logger.h>
+#include <condition_variable>
+#include "exceptions/failed_init_curl_exception.h"
+
+namespace {
+// Longest the engine thread sleeps without a socket event
+constexpr int kPollTimeoutMs = 1000;
+// A stalled transfer fails rather than hanging the download
+constexpr long kLowSpeedBytes = 1024;
+constexpr long kLowSpeedSeconds = 30;
+constexpr long kConnectTimeoutSeconds = 30;
+
+void Done(const DownloadEngine::Transfer& transfer,
+          const DownloadEngine::Result& result) {
+  if (!transfer.on_done) {
+    return;
+  }
+  try {
+    transfer.on_done(result);
+  } catch (const std::exception& e) {
+    LOG_ERROR << "Download callback of " << transfer.url
+              << " failed: " << e.what();
+  }
+}
+}  // namespace
+
+struct DownloadEngine::Active {
+  Transfer transfer;
+  CURL* easy = nullptr;
+  char error[CURL_ERROR_SIZE] = {};
+  bool responded = false;
+  bool aborted = false;
+};
+
+DownloadEngine::DownloadEngine(long max_connections) {
+  multi_ = curl_multi_init();
+  if (!multi_) {
+    throw FailedInitCurlException();
+  }
+  curl_multi_setopt(multi_, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+  curl_multi_setopt(multi_, CURLMOPT_MAX_TOTAL_CONNECTIONS, max_connections);
+  // Idle connections kept open for the next transfer to the same host
+  curl_multi_setopt(multi_, CURLMOPT_MAXCONNECTS, max_connections);
+  thread_ = std::thread([this] { Run(); });
+}
+
+DownloadEngine::~DownloadEngine() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  curl_multi_wakeup(multi_);
+  thread_.join();
+  curl_multi_cleanup(multi_);
+}
+
+DownloadEngine& DownloadEngine::Global() {
+  static DownloadEngine engine;
+  return engine;
+}
+
+void DownloadEngine::Add(Transfer transfer) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!stop_) {
+      pending_.push_back(std::move(transfer));
+      curl_multi_wakeup(multi_);
+      return;
+    }
+  }
+  Result result;
+  result.error = "Download engine stopped";
+  Done(transfer, result);
+}
+
+std::vector<DownloadEngine::Result> DownloadEngine::Head(
+    const std::vector<std::string>& urls) {
+  std::vector<Result> results(urls.size());
+  std::mutex mutex;
+  std::condition_variable cv;
+  size_t left = urls.size();
+  for (size_t i = 0; i < urls.size(); i++) {
+    Transfer t;
+    t.url = urls[i];
+    t.head = true;
+    t.on_done = [&, i](const Result& result) {
+      std::lock_guard<std::mutex> lock(mutex);
+      results[i] = result;
+      // Under the lock, the waiter owns the condition variable
+      if (--left == 0) {
+        cv.notify_all();
+      }
+    };
+    Add(std::move(t));
+  }
+  std::unique_lock<std::mutex> lock(mutex);
+  cv.wait(lock, [&left] { return left == 0; });
+  return results;
+}
+
+size_t DownloadEngine::OnData(char* ptr, size_t size, size_t nmemb,
+                              void* userdata) {
+  auto* active = static_cast<Active*>(userdata);
+  const auto& t = active->transfer;
+  auto bytes = size * nmemb;
+  if (!active->responded) {
+    // Redirects are followed before any body arrives, this is the last one
+    active->responded = true;
+    long status = 0;
+    curl_easy_getinfo(active->easy, CURLINFO_RESPONSE_CODE, &status);
+    if (t.on_response && !t.on_response(status)) {
+      active->aborted = true;
+      return 0;
+    }
+  }
+  if (t.on_data && !t.on_data(ptr, bytes)) {
+    active->aborted = true;
+    return 0;
+  }
+  return bytes;
+}
+
+int DownloadEngine::OnProgress(void* userdata, curl_off_t, curl_off_t,
+                               curl_off_t, curl_off_t) {
+  auto* active = static_cast<Active*>(userdata);
+  if (active->transfer.cancel->load()) {
+    active->aborted = true;
+    return 1;
+  }
+  return 0;
+}
+
+void DownloadEngine::Start(Transfer transfer) {
+  auto active = std::make_unique<Active>();
+  active->transfer = std::move(transfer);
+  CURL* easy = curl_easy_init();
+  if (!easy) {
+    Result result;
+    result.error = "Failed to init curl";
+    Done(active->transfer, result);
+    return;
+  }
+  active->easy = easy;
+  const auto& t = active->transfer;
+  curl_easy_setopt(easy, CURLOPT_URL, t.url.c_str());
+  curl_easy_setopt(easy, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(easy, CURLOPT_FAILONERROR, 1L);
+  curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(easy, CURLOPT_ERRORBUFFER, active->error);
+  curl_easy_setopt(easy, CURLOPT_CONNECTTIMEOUT, kConnectTimeoutSeconds);
+  curl_easy_setopt(easy, CURLOPT_LOW_SPEED_LIMIT, kLowSpeedBytes);
+  curl_easy_setopt(easy, CURLOPT_LOW_SPEED_TIME, kLowSpeedSeconds);
+  curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, &DownloadEngine::OnData);
+  curl_easy_setopt(easy, CURLOPT_WRITEDATA, active.get());
+  if (t.cancel) {
+    curl_easy_setopt(easy, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(easy, CURLOPT_XFERINFOFUNCTION,
+                     &DownloadEngine::OnProgress);
+    curl_easy_setopt(easy, CURLOPT_XFERINFODATA, active.get());
+  }
+  if (t.head) {
+    curl_easy_setopt(easy, CURLOPT_NOBODY, 1L);
+  }
+  if (!t.range.empty()) {
+    curl_easy_setopt(easy, CURLOPT_RANGE, t.range.c_str());
+  } else if (t.resume_from > 0) {
+    curl_easy_setopt(easy, CURLOPT_RESUME_FROM_LARGE,
+                     static_cast<curl_off_t>(t.resume_from));
+  }
+  if (t.own_connection) {
+    curl_easy_setopt(easy, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+  } else {
+    curl_easy_setopt(easy, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+    // Waits for a connection that can be multiplexed rather than opening
+    // another one
+    curl_easy_setopt(easy, CURLOPT_PIPEWAIT, 1L);
+  }
+  auto code = curl_multi_add_handle(multi_, easy);
+  if (code != CURLM_OK) {
+    curl_easy_cleanup(easy);
+    Result result;
+    result.error = curl_multi_strerror(code);
+    Done(active->transfer, result);
+    return;
+  }
+  active_.emplace(easy, std::move(active));
+}
+
+void DownloadEngine::Finish(CURL* easy, CURLcode code) {
+  auto it = active_.find(easy);
+  if (it == active_.end()) {
+    return;
+  }
+  auto active = std::move(it->second);
+  active_.erase(it);
+
+  Result result;
+  curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &result.status);
+  curl_off_t length = -1;
+  curl_easy_getinfo(easy, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+  result.content_length = length;
+  result.aborted = active->aborted;
+  if (code != CURLE_OK) {
+    result.error =
+        active->error[0] != '\0' ? active->error : curl_easy_strerror(code);
+  }
+  curl_multi_remove_handle(multi_, easy);
+  curl_easy_cleanup(easy);
+  Done(active->transfer, result);
+}
+
+void DownloadEngine::Run() {
+  while (true) {
+    std::vector<Transfer> added;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stop_) {
+        break;
+      }
+      added.swap(pending_);
+    }
+    for (auto& t : added) {
+      Start(std::move(t));
+    }
+    int running = 0;
+    auto code = curl_multi_perform(multi_, &running);
+    if (code != CURLM_OK) {
+      LOG_ERROR << "curl_multi_perform failed: " << curl_multi_strerror(code);
+    }
+    int left = 0;
+    while (CURLMsg* msg = curl_multi_info_read(multi_, &left)) {
+      if (msg->msg == CURLMSG_DONE) {
+        Finish(msg->easy_handle, msg->data.result);
+      }
+    }
+    // Returns early on socket activity or curl_multi_wakeup() from Add()
+    curl_multi_poll(multi_, nullptr, 0, kPollTimeoutMs, nullptr);
+  }
+
+  // Whatever is left is reported as failed, Add() now fails right away
+  std::vector<Transfer> cut;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cut.swap(pending_);
+  }
+  for (auto& [easy, active] : active_) {
+    curl_multi_remove_handle(multi_, easy);
+    curl_easy_cleanup(easy);
+    cut.push_back(std::move(active->transfer));
+  }
+  active_.clear();
+  Result result;
+  result.error = "Download engine stopped";
+  for (const auto& t : cut) {
+    Done(t, result);
+  }
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <curl/curl.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Runs the HTTP transfers of all downloads on one thread, over a curl multi
+ * handle.
+ *
+ * Transfers share the multi handle's connection cache, so requests to the
+ * same host reuse an open connection, and over HTTP/2 many of them are
+ * multiplexed onto one. The number of connections across all downloads is
+ * capped; transfers beyond it wait in curl until one is free. Hundreds of
+ * small files therefore cost a few round trips rather than one connection
+ * setup and request each, one after the other.
+ *
+ * Callbacks run on the engine thread and must not block. A callback may
+ * Add() further transfers.
+ */
+class DownloadEngine {
+ public:
+  static constexpr long kDefaultMaxConnections = 16;
+
+  struct Result {
+    // Empty if the transfer succeeded
+    std::string error;
+    // Aborted by a callback of the transfer
+    bool aborted = false;
+    long status = 0;
+    // -1 if the server did not send it
+    int64_t content_length = -1;
+
+    bool ok() const { return error.empty(); }
+  };
+
+  struct Transfer {
+    std::string url;
+    // A HEAD request, with no body
+    bool head = false;
+    // Only bytes "first-last" of the file, or from `resume_from` on
+    std::string range;
+    uint64_t resume_from = 0;
+    // HTTP/1.1 on a connection of its own rather than an HTTP/2 stream
+    // beside others, for ranges that are meant to add bandwidth
+    bool own_connection = false;
+    // Aborts the transfer once set, also while it waits for a connection
+    std::shared_ptr<const std::atomic<bool>> cancel;
+    // With the status of the response the body belongs to, before its first
+    // byte. Returning false aborts the transfer.
+    std::function<bool(long status)> on_response;
+    // Returning false aborts the transfer
+    std::function<bool(const char* data, size_t size)> on_data;
+    // Exactly once, also for transfers cut short by the engine's destruction
+    std::function<void(const Result& result)> on_done;
+  };
+
+  explicit DownloadEngine(long max_connections = kDefaultMaxConnections);
+  ~DownloadEngine();
+
+  DownloadEngine(const DownloadEngine&) = delete;
+  DownloadEngine& operator=(const DownloadEngine&) = delete;
+
+  static DownloadEngine& Global();
+
+  void Add(Transfer transfer);
+
+  /**
+   * HEAD requests for all `urls` at once, in the same order. Blocks, so it
+   * must not be called from a callback.
+   */
+  std::vector<Result> Head(const std::vector<std::string>& urls);
+
+ private:
+  struct Active;
+
+  static size_t OnData(char* ptr, size_t size, size_t nmemb, void* userdata);
+  static int OnProgress(void* userdata, curl_off_t, curl_off_t, curl_off_t,
+                        curl_off_t);
+
+  void Run();
+  void Start(Transfer transfer);
+  void Finish(CURL* easy, CURLcode code);
+
+  CURLM* multi_;
+  std::mutex mutex_;
+  std::vector<Transfer> pending_;
+  bool stop_ = false;
+  // Only touched by the engine thread
+  std::unordered_map<CURL*, std::unique_ptr<Active>> active_;
+  std::thread thread_;
+};
@@ -0,0 +1,1211 @@
+#include "download_manager.h"
+#include <trantor/utils/Logger.h>
+#include <stdio.h>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include "exceptions/failed_open_file_exception.h"
+#include "services/download_engine.h"
+#include "utils/binary_io_utils.h"
+#include "utils/config_yaml_utils.h"
+#include "utils/format_utils.h"
+#include "utils/worker_pool.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#undef max
+#undef min
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+// Rates are averaged over this long
+constexpr auto kRateWindow = std::chrono::seconds(1);
+// Ranges are at least this large, so that request overhead stays small
+constexpr uint64_t kMinSegmentBytes = 16ull << 20;
+// Ranges per connection, so that a slow connection does not hold up the end
+constexpr uint64_t kSegmentsPerConnection = 4;
+// Attempts at a range before the download fails
+constexpr int kSegmentAttempts = 4;
+// How often the received ranges are saved
+constexpr auto kSegmentSaveInterval = std::chrono::seconds(1);
+// "CDSG"
+constexpr uint32_t kSegmentsMagic = 0x47534443;
+constexpr uint32_t kSegmentsVersion = 1;
+
+constexpr const char* kStateNames[] = {"queued",    "downloading",
+                                       "verifying", "completed",
+                                       "failed",    "cancelled"};
+constexpr const char* kTypeNames[] = {"model", "engine", "miscellaneous",
+                                      "cuda_toolkit", "cortex"};
+
+template <typename Enum, size_t N>
+std::optional<Enum> FromName(const char* const (&names)[N],
+                             const std::string& name) {
+  for (size_t i = 0; i < N; i++) {
+    if (name == names[i]) {
+      return static_cast<Enum>(i);
+    }
+  }
+  return std::nullopt;
+}
+
+int64_t UnixNow() {
+  return std::chrono::duration_cast<std::chrono::seconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+uint64_t Rate(uint64_t bytes, Clock::duration elapsed) {
+  std::chrono::duration<double> seconds = elapsed;
+  return static_cast<uint64_t>(bytes / std::max(seconds.count(), 1e-3));
+}
+
+// Updates `rate` once `window` is a rate window old and starts the next one
+void Advance(std::pair<Clock::time_point, uint64_t>& window, uint64_t bytes,
+             Clock::time_point now, uint64_t& rate) {
+  if (now - window.first >= kRateWindow) {
+    rate = Rate(bytes - window.second, now - window.first);
+    window = {now, bytes};
+  }
+}
+
+// Opened with the first byte, so that hundreds of queued files do not hold
+// hundreds of descriptors
+class FileSink {
+ public:
+  FileSink(std::filesystem::path path, bool append)
+      : path_(std::move(path)), append_(append) {}
+
+  ~FileSink() {
+    if (file_) {
+      fclose(file_);
+    }
+  }
+
+  FileSink(const FileSink&) = delete;
+  FileSink& operator=(const FileSink&) = delete;
+
+  bool Write(const char* data, size_t size) {
+    return Open() && fwrite(data, 1, size, file_) == size;
+  }
+
+  // Whether this sink created or truncated the file, rather than appending
+  // to one that was there
+  bool Created() const { return created_; }
+
+  // With `create`, also creates the file of an empty body
+  bool Close(bool create) {
+    if (!file_ && !create) {
+      return !failed_;
+    }
+    bool ok = Open() && fclose(file_) == 0;
+    file_ = nullptr;
+    return ok;
+  }
+
+ private:
+  bool Open() {
+    if (!file_ && !failed_) {
+      file_ = fopen(path_.string().c_str(), append_ ? "ab" : "wb");
+      failed_ = !file_;
+      created_ = file_ && !append_;
+    }
+    return file_ != nullptr;
+  }
+
+  std::filesystem::path path_;
+  bool append_;
+  FILE* file_ = nullptr;
+  bool failed_ = false;
+  bool created_ = false;
+};
+
+// A file written at explicit offsets, from several threads at once
+class PositionalFile {
+ public:
+  explicit PositionalFile(const std::filesystem::path& path) : path_(path) {
+#ifdef _WIN32
+    handle_ = CreateFileW(path.wstring().c_str(), GENERIC_READ | GENERIC_WRITE,
+                          FILE_SHARE_READ, nullptr, OPEN_ALWAYS,
+                          FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle_ == INVALID_HANDLE_VALUE) {
+#else
+    fd_ = open(path.string().c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+#endif
+      throw FailedOpenFileException("Failed to open output file " +
+                                    path.string());
+    }
+  }
+
+  ~PositionalFile() {
+#ifdef _WIN32
+    CloseHandle(handle_);
+#else
+    close(fd_);
+#endif
+  }
+
+  PositionalFile(const PositionalFile&) = delete;
+  PositionalFile& operator=(const PositionalFile&) = delete;
+
+  // Sets the size, and where possible reserves the disk space so that a full
+  // disk fails now rather than hours into the download
+  void Resize(uint64_t size) {
+#ifdef _WIN32
+    LARGE_INTEGER end;
+    end.QuadPart = static_cast<LONGLONG>(size);
+    bool ok = SetFilePointerEx(handle_, end, nullptr, FILE_BEGIN) &&
+              SetEndOfFile(handle_);
+#else
+    bool ok = ftruncate(fd_, static_cast<off_t>(size)) == 0;
+#endif
+    if (!ok) {
+      throw std::runtime_error("Failed to resize " + path_.string());
+    }
+#ifdef __linux__
+    // Not supported by every filesystem, the file is then sparse
+    if (size > 0 && fallocate(fd_, 0, 0, static_cast<off_t>(size)) != 0 &&
+        errno != EOPNOTSUPP && errno != ENOSYS) {
+      throw std::runtime_error("Failed to allocate " +
+                               format_utils::BytesToHumanReadable(size) +
+                               " for " + path_.string() + ": " +
+                               std::strerror(errno));
+    }
+#endif
+  }
+
+  bool WriteAt(const char* data, size_t size, uint64_t offset) {
+    while (size > 0) {
+#ifdef _WIN32
+      OVERLAPPED ov{};
+      ov.Offset = static_cast<DWORD>(offset);
+      ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+      DWORD n = 0;
+      if (!WriteFile(handle_, data,
+                     static_cast<DWORD>(std::min<size_t>(size, 1u << 30)), &n,
+                     &ov)) {
+        return false;
+      }
+#else
+      auto n = pwrite(fd_, data, size, static_cast<off_t>(offset));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        return false;
+      }
+#endif
+      data += n;
+      size -= n;
+      offset += n;
+    }
+    return true;
+  }
+
+  const std::filesystem::path& path() const { return path_; }
+
+  bool Sync() {
+#ifdef _WIN32
+    return FlushFileBuffers(handle_);
+#elif defined(__linux__)
+    return fdatasync(fd_) == 0;
+#else
+    return fsync(fd_) == 0;
+#endif
+  }
+
+ private:
+  std::filesystem::path path_;
+#ifdef _WIN32
+  HANDLE handle_;
+#else
+  int fd_;
+#endif
+};
+
+// How a file is split into ranges, and how much of each has been received
+struct SegmentState {
+  std::string url;
+  uint64_t total = 0;
+  uint64_t segment_bytes = 0;
+  std::vector<uint64_t> received;
+
+  static SegmentState Plan(const std::string& url, uint64_t total,
+                           int connections) {
+    SegmentState s;
+    s.url = url;
+    s.total = total;
+    auto segments = std::max<uint64_t>(1, connections) * kSegmentsPerConnection;
+    s.segment_bytes =
+        std::max(kMinSegmentBytes, (total + segments - 1) / segments);
+    s.received.assign((total + s.segment_bytes - 1) / s.segment_bytes, 0);
+    return s;
+  }
+
+  uint64_t Begin(size_t i) const { return i * segment_bytes; }
+  uint64_t End(size_t i) const {
+    return std::min(total, (i + 1) * segment_bytes);
+  }
+
+  uint64_t Received() const {
+    uint64_t sum = 0;
+    for (auto r : received) {
+      sum += r;
+    }
+    return sum;
+  }
+
+  // The first `bytes` of the file are there, as a single connection leaves it
+  void MarkPrefix(uint64_t bytes) {
+    for (size_t i = 0; i < received.size(); i++) {
+      received[i] = std::clamp(bytes, Begin(i), End(i)) - Begin(i);
+    }
+  }
+
+  std::string Encode() const {
+    binary_io_utils::BinaryWriter w;
+    w.Write<uint32_t>(kSegmentsMagic);
+    w.Write<uint32_t>(kSegmentsVersion);
+    w.WriteString(url);
+    w.Write<uint64_t>(total);
+    w.Write<uint64_t>(segment_bytes);
+    w.Write<uint64_t>(received.size());
+    for (auto r : received) {
+      w.Write<uint64_t>(r);
+    }
+    return w.data();
+  }
+
+  static bool Decode(const std::string& data, SegmentState& s) {
+    try {
+      binary_io_utils::BinaryReader r(data);
+      if (r.Read<uint32_t>() != kSegmentsMagic ||
+          r.Read<uint32_t>() != kSegmentsVersion) {
+        return false;
+      }
+      s.url = r.ReadString();
+      s.total = r.Read<uint64_t>();
+      s.segment_bytes = r.Read<uint64_t>();
+      auto count = r.Read<uint64_t>();
+      if (s.segment_bytes == 0 ||
+          count != (s.total + s.segment_bytes - 1) / s.segment_bytes) {
+        return false;
+      }
+      s.received.resize(count);
+      for (size_t i = 0; i < count; i++) {
+        s.received[i] = std::min(r.Read<uint64_t>(), s.End(i) - s.Begin(i));
+      }
+      return r.AtEnd();
+    } catch (const std::runtime_error&) {
+      return false;
+    }
+  }
+};
+
+// One range request in flight
+struct SegmentWrite {
+  PositionalFile* file;
+  // Next byte to write, and the end of the range
+  uint64_t offset;
+  uint64_t end;
+  std::atomic<uint64_t>* received;
+  bool ranges_ignored = false;
+  bool write_failed = false;
+
+  bool Write(const char* data, size_t size) {
+    // Never past the range, whatever the server sends
+    auto n = std::min<uint64_t>(size, end - offset);
+    if (n > 0 && !file->WriteAt(data, n, offset)) {
+      write_failed = true;
+      return false;
+    }
+    offset += n;
+    received->fetch_add(n);
+    return true;
+  }
+};
+
+std::filesystem::path SegmentsPathOf(const std::filesystem::path& path) {
+  auto state_path = path;
+  state_path += ".segments";
+  return state_path;
+}
+
+// The saved state of `item`, if it belongs to the item and its file
+std::optional<SegmentState> LoadSegments(const DownloadItem& item) {
+  std::string data;
+  SegmentState state;
+  std::error_code ec;
+  if (!item.bytes.has_value() ||
+      !binary_io_utils::ReadFile(SegmentsPathOf(item.localPath), data) ||
+      !SegmentState::Decode(data, state) || state.url != item.downloadUrl ||
+      state.total != *item.bytes ||
+      std::filesystem::file_size(item.localPath, ec) != state.total) {
+    return std::nullopt;
+  }
+  return state;
+}
+
+/**
+ * A file of known size downloaded as byte ranges over several connections,
+ * each written in place into the preallocated file. What each range has
+ * received is saved to <file>.segments, from which a later download of the
+ * same url resumes.
+ */
+class SegmentedDownload
+    : public std::enable_shared_from_this<SegmentedDownload> {
+ public:
+  // With the bytes of each write, on the engine thread
+  using OnData = std::function<void(size_t size)>;
+  // Exactly once. Nothing usable was written if the server ignored ranges.
+  using OnDone =
+      std::function<void(bool ranges_ignored, const std::string& error)>;
+
+  // Without a saved state, the first `resume_from` bytes are kept. Throws if
+  // the file cannot be prepared.
+  SegmentedDownload(const DownloadItem& item, int connections,
+                    uint64_t resume_from,
+                    std::shared_ptr<const std::atomic<bool>> cancel)
+      : url_(item.downloadUrl),
+        name_(item.localPath.filename().string()),
+        state_path_(SegmentsPathOf(item.localPath)),
+        state_(SegmentState::Plan(item.downloadUrl, item.bytes.value(),
+                                  connections)),
+        file_(item.localPath),
+        cancel_(std::move(cancel)) {
+    bool resume = false;
+    if (auto saved = LoadSegments(item)) {
+      state_ = std::move(*saved);
+      resume = true;
+    } else if (resume_from > 0) {
+      state_.MarkPrefix(resume_from);
+      resume = true;
+    }
+    // Saved before the file is resized, a full size file without its state
+    // would look complete
+    if (!binary_io_utils::WriteFileAtomically(state_path_, state_.Encode())) {
+      throw FailedOpenFileException("Failed to write " +
+                                    state_path_.string());
+    }
+    if (!resume) {
+      file_.Resize(0);
+    }
+    file_.Resize(state_.total);
+
+    count_ = state_.received.size();
+    received_ = std::make_unique<std::atomic<uint64_t>[]>(count_);
+    for (size_t i = 0; i < count_; i++) {
+      received_[i] = state_.received[i];
+    }
+    attempts_.assign(count_, 0);
+    connections_ = std::min<size_t>(std::max(1, connections), count_);
+  }
+
+  uint64_t Received() const {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < count_; i++) {
+      sum += received_[i];
+    }
+    return sum;
+  }
+
+  void Start(OnData on_data, OnDone on_done) {
+    on_data_ = std::move(on_data);
+    on_done_ = std::move(on_done);
+    last_save_ = Clock::now().time_since_epoch().count();
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    StartNext();
+    SettleIfIdle();
+  }
+
+ private:
+  bool Stopped() const { return stop_ || cancel_->load(); }
+
+  // These run under mutex_
+  void StartNext() {
+    while (!Stopped() && in_flight_ < connections_ && next_ < count_) {
+      auto i = next_++;
+      if (state_.Begin(i) + received_[i] < state_.End(i)) {
+        StartRange(i);
+      }
+    }
+  }
+
+  void StartRange(size_t i) {
+    auto w = std::make_shared<SegmentWrite>(
+        SegmentWrite{&file_, state_.Begin(i) + received_[i], state_.End(i),
+                     &received_[i]});
+    auto range = std::to_string(w->offset) + "-" + std::to_string(w->end - 1);
+    auto self = shared_from_this();
+    DownloadEngine::Transfer t;
+    t.url = url_;
+    t.range = range;
+    // Over HTTP/2 the ranges would share one connection
+    t.own_connection = true;
+    t.cancel = cancel_;
+    t.on_response = [w](long status) {
+      // A 200 is the whole file from the start
+      w->ranges_ignored = status != 206;
+      return !w->ranges_ignored;
+    };
+    t.on_data = [self, w](const char* data, size_t size) {
+      auto before = w->offset;
+      if (self->Stopped() || !w->Write(data, size)) {
+        return false;
+      }
+      self->on_data_(w->offset - before);
+      self->SaveEverySoOften();
+      return true;
+    };
+    t.on_done = [self, w, i, range](const DownloadEngine::Result& result) {
+      std::lock_guard<std::recursive_mutex> lock(self->mutex_);
+      self->in_flight_--;
+      if (w->ranges_ignored) {
+        self->ranges_ignored_ = true;
+        self->stop_ = true;
+      } else if (w->write_failed) {
+        self->Fail("Failed to write " + self->file_.path().string());
+      } else if (result.ok() && w->offset == w->end) {
+        // Done
+      } else if (!self->Stopped() &&
+                 ++self->attempts_[i] < kSegmentAttempts) {
+        LOG_WARN << "Range " << range << " of " << self->name_
+                 << " failed: " << result.error << ", retrying";
+        self->StartRange(i);
+      } else if (!self->Stopped()) {
+        self->Fail("Failed to download " + self->name_ + ": " +
+                   result.error);
+      }
+      self->StartNext();
+      self->SettleIfIdle();
+    };
+    in_flight_++;
+    DownloadEngine::Global().Add(std::move(t));
+  }
+
+  void Fail(const std::string& error) {
+    if (error_.empty()) {
+      error_ = error;
+    }
+    stop_ = true;
+  }
+
+  // Once no range is in flight and none will start, the rest of the work,
+  // syncing gigabytes, is too slow for the engine thread
+  void SettleIfIdle() {
+    if (in_flight_ > 0 || settled_) {
+      return;
+    }
+    settled_ = true;
+    auto work = [self = shared_from_this()] { self->Settle(); };
+    if (!WorkerPool::Global().Submit(work)) {
+      std::thread(work).detach();
+    }
+  }
+
+  void Settle() {
+    std::error_code ec;
+    if (ranges_ignored_) {
+      std::filesystem::remove(state_path_, ec);
+      on_done_(true, "");
+      return;
+    }
+    if (Stopped()) {
+      // Kept for the next download to resume from
+      Save();
+      on_done_(false, error_);
+      return;
+    }
+    if (!file_.Sync()) {
+      on_done_(false, "Failed to sync " + file_.path().string());
+      return;
+    }
+    std::filesystem::remove(state_path_, ec);
+    on_done_(false, "");
+  }
+
+  // Received bytes are only saved once the file is synced, so that a resume
+  // never trusts data still in the page cache at a crash
+  void Save() {
+    std::lock_guard<std::mutex> lock(save_mutex_);
+    for (size_t i = 0; i < count_; i++) {
+      state_.received[i] = received_[i];
+    }
+    if (file_.Sync()) {
+      binary_io_utils::WriteFileAtomically(state_path_, state_.Encode());
+    }
+  }
+
+  // On the WorkerPool, at most one save at a time
+  void SaveEverySoOften() {
+    auto now = Clock::now().time_since_epoch().count();
+    if (Clock::duration(now - last_save_) < kSegmentSaveInterval ||
+        saving_.exchange(true)) {
+      return;
+    }
+    last_save_ = now;
+    auto work = [self = shared_from_this()] {
+      self->Save();
+      self->saving_ = false;
+    };
+    if (!WorkerPool::Global().Submit(work)) {
+      saving_ = false;
+    }
+  }
+
+  const std::string url_;
+  const std::string name_;
+  const std::filesystem::path state_path_;
+  // Only the received counts change, under save_mutex_
+  SegmentState state_;
+  PositionalFile file_;
+  const std::shared_ptr<const std::atomic<bool>> cancel_;
+  size_t count_ = 0;
+  size_t connections_ = 1;
+  std::unique_ptr<std::atomic<uint64_t>[]> received_;
+  OnData on_data_;
+  OnDone on_done_;
+
+  std::atomic<bool> stop_{false};
+  // Recursive, a stopped engine fails a range inside Add()
+  std::recursive_mutex mutex_;
+  size_t next_ = 0;
+  size_t in_flight_ = 0;
+  std::vector<int> attempts_;
+  bool ranges_ignored_ = false;
+  bool settled_ = false;
+  std::string error_;
+
+  std::mutex save_mutex_;
+  std::atomic<bool> saving_{false};
+  std::atomic<Clock::rep> last_save_{0};
+};
+}  // namespace
+
+struct DownloadManager::Entry {
+  // Guarded by the manager's mutex
+  Job job;
+  // Start of the rate window of each item, and its bytes at that time
+  std::vector<std::pair<Clock::time_point, uint64_t>> windows;
+  // The same for the whole job
+  std::pair<Clock::time_point, uint64_t> window;
+
+  // Empty for jobs loaded from the table
+  DownloadTask task;
+  Options options;
+  std::optional<DownloadService::OnDownloadTaskSuccessfully> callback;
+  std::shared_ptr<std::atomic<bool>> cancelled =
+      std::make_shared<std::atomic<bool>>(false);
+
+  // Transfers still running. They finish on the engine thread, segmented
+  // ones on the WorkerPool.
+  std::atomic<size_t> left{0};
+  // The first error, guarded by the manager's mutex once downloading
+  std::string error;
+  // Per item, whether this job created its file. Set by the engine thread
+  // before the item counts as done.
+  std::vector<char> created;
+};
+
+bool DownloadManager::Job::Finished() const {
+  return state == State::kCompleted || state == State::kFailed ||
+         state == State::kCancelled;
+}
+
+uint64_t DownloadManager::Job::TotalBytes() const {
+  uint64_t sum = 0;
+  for (const auto& item : items) {
+    sum += item.total_bytes;
+  }
+  return sum;
+}
+
+uint64_t DownloadManager::Job::DownloadedBytes() const {
+  uint64_t sum = 0;
+  for (const auto& item : items) {
+    sum += item.downloaded_bytes;
+  }
+  return sum;
+}
+
+Json::Value DownloadManager::Job::ToJson() const {
+  Json::Value json;
+  json["id"] = id;
+  json["type"] = kTypeNames[static_cast<int>(type)];
+  json["status"] = kStateNames[static_cast<int>(state)];
+  if (!error.empty()) {
+    json["error"] = error;
+  }
+  json["created_at"] = Json::Int64(created_at);
+  json["finished_at"] = Json::Int64(finished_at);
+  json["total_bytes"] = Json::UInt64(TotalBytes());
+  json["downloaded_bytes"] = Json::UInt64(DownloadedBytes());
+  json["bytes_per_second"] = Json::UInt64(bytes_per_second);
+  json["items"] = Json::Value(Json::arrayValue);
+  for (const auto& item : items) {
+    Json::Value i;
+    i["id"] = item.id;
+    i["url"] = item.url;
+    i["path"] = item.path;
+    i["total_bytes"] = Json::UInt64(item.total_bytes);
+    i["downloaded_bytes"] = Json::UInt64(item.downloaded_bytes);
+    i["bytes_per_second"] = Json::UInt64(item.bytes_per_second);
+    i["done"] = item.done;
+    json["items"].append(i);
+  }
+  return json;
+}
+
+std::optional<DownloadManager::Job> DownloadManager::Job::FromJson(
+    const Json::Value& json) {
+  if (!json.isObject()) {
+    return std::nullopt;
+  }
+  auto type = FromName<DownloadType>(kTypeNames, json["type"].asString());
+  auto state = FromName<State>(kStateNames, json["status"].asString());
+  if (json["id"].asString().empty() || !type || !state) {
+    return std::nullopt;
+  }
+  Job job;
+  job.id = json["id"].asString();
+  job.type = *type;
+  job.state = *state;
+  job.error = json["error"].asString();
+  job.created_at = json["created_at"].asInt64();
+  job.finished_at = json["finished_at"].asInt64();
+  for (const auto& i : json["items"]) {
+    job.items.push_back({i["id"].asString(), i["url"].asString(),
+                         i["path"].asString(), i["total_bytes"].asUInt64(),
+                         i["downloaded_bytes"].asUInt64(), 0,
+                         i["done"].asBool()});
+  }
+  return job;
+}
+
+std::filesystem::path DownloadManager::SegmentsPath(
+    const std::filesystem::path& path) {
+  return SegmentsPathOf(path);
+}
+
+std::optional<uint64_t> DownloadManager::SavedSegmentBytes(
+    const DownloadItem& item) {
+  auto state = LoadSegments(item);
+  if (!state.has_value()) {
+    return std::nullopt;
+  }
+  return state->Received();
+}
+
+DownloadManager::DownloadManager(size_t max_active, size_t max_queued)
+    : max_active_(max_active), max_queued_(max_queued) {}
+
+DownloadManager::~DownloadManager() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  max_active_ = 0;
+  for (auto& [id, entry] : entries_) {
+    entry->cancelled->store(true);
+  }
+  for (const auto& id : queue_) {
+    entries_[id]->job.state = State::kCancelled;
+  }
+  queue_.clear();
+  cv_.wait(lock, [this] { return active_ == 0 && finishing_ == 0; });
+}
+
+DownloadManager& DownloadManager::Global() {
+  // Created first so that they are destroyed last, the engine's destruction
+  // still reports to the manager
+  WorkerPool::Global();
+  DownloadEngine::Global();
+  static auto* manager = new DownloadManager(
+      config_yaml_utils::kDefaultMaxConcurrentDownloads, kDefaultMaxQueued);
+  return *manager;
+}
+
+void DownloadManager::Open(const std::filesystem::path& table_path) {
+  std::string data;
+  if (binary_io_utils::ReadFile(table_path, data)) {
+    Json::Value table;
+    Json::CharReaderBuilder builder;
+    std::string errors;
+    std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+    if (!reader->parse(data.data(), data.data() + data.size(), &table,
+                       &errors) ||
+        !table.isArray()) {
+      LOG_WARN << "Ignoring the broken download table " << table_path.string()
+               << ": " << errors;
+      table = Json::Value(Json::arrayValue);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& json : table) {
+      auto job = Job::FromJson(json);
+      if (!job || entries_.count(job->id) > 0) {
+        continue;
+      }
+      if (!job->Finished()) {
+        job->state = State::kFailed;
+        job->error = "Interrupted by a restart";
+        job->finished_at = UnixNow();
+      }
+      auto entry = std::make_shared<Entry>();
+      entry->job = std::move(*job);
+      entries_.emplace(entry->job.id, entry);
+    }
+    NotifyLocked();
+  }
+  {
+    std::lock_guard<std::mutex> lock(save_mutex_);
+    table_path_ = table_path;
+  }
+  Save();
+}
+
+void DownloadManager::SetMaxActive(size_t max_active) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_active_ = std::max<size_t>(1, max_active);
+  }
+  Pump();
+}
+
+std::string DownloadManager::Submit(
+    const DownloadTask& task,
+    std::optional<DownloadService::OnDownloadTaskSuccessfully> callback,
+    Options options) {
+  auto entry = std::make_shared<Entry>();
+  entry->task = task;
+  entry->callback = std::move(callback);
+  entry->options = std::move(options);
+  entry->options.resume_from.resize(task.items.size(), 0);
+  entry->created.assign(task.items.size(), false);
+  auto& job = entry->job;
+  job.id = task.id;
+  job.type = task.type;
+  job.created_at = UnixNow();
+  for (size_t i = 0; i < task.items.size(); i++) {
+    const auto& item = task.items[i];
+    auto resumed = entry->options.resume_from[i];
+    job.items.push_back({item.id, item.downloadUrl, item.localPath.string(),
+                         item.bytes.value_or(0), resumed});
+    entry->windows.emplace_back(Clock::now(), resumed);
+  }
+  entry->window = {Clock::now(), job.DownloadedBytes()};
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(task.id);
+    if (it != entries_.end() && !it->second->job.Finished()) {
+      throw std::runtime_error("Download " + task.id +
+                               " is already in progress");
+    }
+    if (queue_.size() >= max_queued_) {
+      throw std::runtime_error("Too many downloads queued, try again later");
+    }
+    entries_[task.id] = entry;
+    queue_.push_back(task.id);
+
+    // Oldest finished jobs beyond the limit
+    std::vector<std::pair<int64_t, std::string>> finished;
+    for (const auto& [id, e] : entries_) {
+      if (e->job.Finished()) {
+        finished.emplace_back(e->job.finished_at, id);
+      }
+    }
+    if (finished.size() > kMaxFinished) {
+      std::sort(finished.begin(), finished.end());
+      for (size_t i = 0; i < finished.size() - kMaxFinished; i++) {
+        entries_.erase(finished[i].second);
+      }
+    }
+    NotifyLocked();
+  }
+  LOG_INFO << "Queued download " << task.id << " of " << task.items.size()
+           << " files";
+  Save();
+  Pump();
+  return task.id;
+}
+
+bool DownloadManager::Cancel(const std::string& id) {
+  std::shared_ptr<Entry> entry;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(id);
+    if (it == entries_.end() || it->second->job.Finished()) {
+      return false;
+    }
+    entry = it->second;
+    // Running transfers abort and the job finishes once they reported back
+    entry->cancelled->store(true);
+    if (entry->job.state != State::kQueued) {
+      return true;
+    }
+    queue_.erase(std::remove(queue_.begin(), queue_.end(), id), queue_.end());
+  }
+  Finish(entry, State::kCancelled, "");
+  return true;
+}
+
+std::vector<DownloadManager::Job> DownloadManager::List() const {
+  std::vector<Job> jobs;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& [id, entry] : entries_) {
+      jobs.push_back(Snapshot(*entry));
+    }
+  }
+  std::stable_sort(jobs.begin(), jobs.end(), [](const Job& a, const Job& b) {
+    return a.created_at > b.created_at;
+  });
+  return jobs;
+}
+
+std::optional<DownloadManager::Job> DownloadManager::Get(
+    const std::string& id) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(id);
+  if (it == entries_.end()) {
+    return std::nullopt;
+  }
+  return Snapshot(*it->second);
+}
+
+void DownloadManager::WaitForChange(uint64_t& seen,
+                                    std::chrono::milliseconds timeout) const {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait_for(lock, timeout, [this, seen] { return changes_ != seen; });
+  seen = changes_;
+}
+
+DownloadManager::Job DownloadManager::Wait(const std::string& id) const {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto it = entries_.find(id);
+  if (it == entries_.end()) {
+    throw std::runtime_error("No download " + id);
+  }
+  // Held, the table may drop the entry meanwhile
+  auto entry = it->second;
+  cv_.wait(lock, [&entry] { return entry->job.Finished(); });
+  return Snapshot(*entry);
+}
+
+DownloadManager::Job DownloadManager::Snapshot(const Entry& entry) const {
+  auto job = entry.job;
+  if (job.state != State::kDownloading) {
+    return job;
+  }
+  // A transfer that stalled has not updated its rate in a while
+  auto now = Clock::now();
+  for (size_t i = 0; i < job.items.size(); i++) {
+    auto& item = job.items[i];
+    const auto& [start, bytes] = entry.windows[i];
+    if (!item.done && now - start >= 2 * kRateWindow) {
+      item.bytes_per_second = Rate(item.downloaded_bytes - bytes, now - start);
+    }
+  }
+  const auto& [start, bytes] = entry.window;
+  if (now - start >= 2 * kRateWindow) {
+    job.bytes_per_second = Rate(job.DownloadedBytes() - bytes, now - start);
+  }
+  return job;
+}
+
+void DownloadManager::NotifyLocked() {
+  changes_++;
+  cv_.notify_all();
+}
+
+void DownloadManager::Pump() {
+  std::vector<std::shared_ptr<Entry>> started;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (active_ < max_active_ && !queue_.empty()) {
+      auto it = entries_.find(queue_.front());
+      queue_.pop_front();
+      if (it == entries_.end() || it->second->job.state != State::kQueued) {
+        continue;
+      }
+      it->second->job.state = State::kDownloading;
+      active_++;
+      started.push_back(it->second);
+    }
+    if (started.empty()) {
+      return;
+    }
+    NotifyLocked();
+  }
+  Save();
+  for (const auto& entry : started) {
+    LOG_INFO << "Starting download " << entry->job.id;
+    Start(entry);
+  }
+}
+
+void DownloadManager::Start(const std::shared_ptr<Entry>& entry) {
+  const auto& items = entry->task.items;
+  if (!entry->options.validate || items.empty()) {
+    Download(entry);
+    return;
+  }
+  // Every item is checked before any is downloaded
+  entry->left = items.size();
+  for (size_t i = 0; i < items.size(); i++) {
+    DownloadEngine::Transfer t;
+    t.url = items[i].downloadUrl;
+    t.head = true;
+    t.cancel = entry->cancelled;
+    t.on_done = [this, entry, i](const DownloadEngine::Result& result) {
+      auto& item = entry->task.items[i];
+      if (!result.ok()) {
+        if (entry->error.empty()) {
+          entry->error = "Found invalid download item: " + item.downloadUrl +
+                         " - " + result.error;
+        }
+      } else if (result.content_length >= 0) {
+        item.bytes = result.content_length;
+        std::lock_guard<std::mutex> lock(mutex_);
+        entry->job.items[i].total_bytes = *item.bytes;
+      }
+      if (--entry->left > 0) {
+        return;
+      }
+      if (entry->error.empty() && !entry->cancelled->load()) {
+        Download(entry);
+      } else {
+        Complete(entry);
+      }
+    };
+    DownloadEngine::Global().Add(std::move(t));
+  }
+}
+
+void DownloadManager::Download(const std::shared_ptr<Entry>& entry) {
+  const auto& items = entry->task.items;
+  if (items.empty()) {
+    Complete(entry);
+    return;
+  }
+  entry->left = items.size();
+  {
+    // Time spent queued and validating does not count
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto now = Clock::now();
+    for (size_t i = 0; i < items.size(); i++) {
+      entry->windows[i] = {now, entry->job.items[i].downloaded_bytes};
+    }
+    entry->window = {now, entry->job.DownloadedBytes()};
+  }
+  for (size_t i = 0; i < items.size(); i++) {
+    if (entry->options.connections > 1 &&
+        items[i].bytes.value_or(0) >= DownloadService::kMinSegmentedBytes) {
+      TransferSegmented(entry, i);
+    } else {
+      Transfer(entry, i, entry->options.resume_from[i]);
+    }
+  }
+}
+
+void DownloadManager::Transfer(const std::shared_ptr<Entry>& entry, size_t i,
+                               uint64_t resume_from) {
+  const auto& item = entry->task.items[i];
+  auto sink = std::make_shared<FileSink>(item.localPath, resume_from > 0);
+  DownloadEngine::Transfer t;
+  t.url = item.downloadUrl;
+  t.resume_from = resume_from;
+  t.cancel = entry->cancelled;
+  t.on_data = [this, entry, sink, i](const char* data, size_t size) {
+    if (!sink->Write(data, size)) {
+      return false;
+    }
+    AddBytes(entry, i, size);
+    return true;
+  };
+  t.on_done = [this, entry, sink, i](const DownloadEngine::Result& result) {
+    const auto& item = entry->task.items[i];
+    std::string error;
+    if (!sink->Close(result.ok()) ||
+        (result.aborted && !entry->cancelled->load())) {
+      error = "Failed to write " + item.localPath.string();
+    } else if (!result.ok() && !entry->cancelled->load()) {
+      error = "Failed to download " + item.localPath.filename().string() +
+              ": " + result.error;
+    }
+    entry->created[i] = sink->Created();
+    ItemDone(entry, i, result.ok() && error.empty(), error);
+  };
+  DownloadEngine::Global().Add(std::move(t));
+}
+
+void DownloadManager::TransferSegmented(const std::shared_ptr<Entry>& entry,
+                                        size_t i) {
+  const auto& item = entry->task.items[i];
+  std::shared_ptr<SegmentedDownload> download;
+  try {
+    download = std::make_shared<SegmentedDownload>(
+        item, entry->options.connections, entry->options.resume_from[i],
+        entry->cancelled);
+  } catch (const std::exception& e) {
+    ItemDone(entry, i, false, e.what());
+    return;
+  }
+  ResetBytes(entry, i, download->Received());
+  download->Start(
+      [this, entry, i](size_t size) { AddBytes(entry, i, size); },
+      [this, entry, i](bool ranges_ignored, const std::string& error) {
+        if (ranges_ignored) {
+          LOG_INFO << "Server does not serve ranges of "
+                   << entry->task.items[i].downloadUrl
+                   << ", downloading over one connection";
+          ResetBytes(entry, i, 0);
+          Transfer(entry, i, 0);
+          return;
+        }
+        ItemDone(entry, i, error.empty() && !entry->cancelled->load(),
+                 error);
+      });
+}
+
+void DownloadManager::AddBytes(const std::shared_ptr<Entry>& entry, size_t i,
+                               size_t size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& job = entry->job;
+  auto& progress = job.items[i];
+  progress.downloaded_bytes += size;
+  auto now = Clock::now();
+  Advance(entry->windows[i], progress.downloaded_bytes, now,
+          progress.bytes_per_second);
+  Advance(entry->window, job.DownloadedBytes(), now, job.bytes_per_second);
+}
+
+void DownloadManager::ResetBytes(const std::shared_ptr<Entry>& entry,
+                                 size_t i, uint64_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& job = entry->job;
+  job.items[i].downloaded_bytes = bytes;
+  auto now = Clock::now();
+  entry->windows[i] = {now, bytes};
+  entry->window = {now, job.DownloadedBytes()};
+}
+
+void DownloadManager::ItemDone(const std::shared_ptr<Entry>& entry, size_t i,
+                               bool ok, const std::string& error) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& progress = entry->job.items[i];
+    progress.done = ok;
+    progress.bytes_per_second = 0;
+    if (progress.done && progress.total_bytes == 0) {
+      progress.total_bytes = progress.downloaded_bytes;
+    }
+    if (!error.empty() && entry->error.empty()) {
+      entry->error = error;
+    }
+  }
+  if (--entry->left == 0) {
+    Complete(entry);
+  }
+}
+
+void DownloadManager::Complete(const std::shared_ptr<Entry>& entry) {
+  if (entry->cancelled->load()) {
+    // Partial files are of no use to anyone. Only those this job created
+    // go: a file it never got to open may be someone else's, and segmented
+    // ones are kept with their state to resume from.
+    for (size_t i = 0; i < entry->task.items.size(); i++) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!entry->job.items[i].done && entry->created[i]) {
+        std::error_code ec;
+        std::filesystem::remove(entry->task.items[i].localPath, ec);
+      }
+    }
+    Finish(entry, State::kCancelled, "");
+    return;
+  }
+  if (!entry->error.empty()) {
+    Finish(entry, State::kFailed, entry->error);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entry->job.state = State::kVerifying;
+    NotifyLocked();
+  }
+  // Checksums and the callback are too slow for the engine thread
+  auto work = [this, entry] {
+    try {
+      DownloadService::VerifyChecksums(entry->task);
+      if (entry->cancelled->load()) {
+        Finish(entry, State::kCancelled, "");
+        return;
+      }
+      if (entry->callback.has_value()) {
+        entry->callback.value()(entry->task);
+      }
+      Finish(entry, State::kCompleted, "");
+    } catch (const std::exception& e) {
+      Finish(entry, State::kFailed, e.what());
+    }
+  };
+  if (!WorkerPool::Global().Submit(work)) {
+    std::thread(work).detach();
+  }
+}
+
+void DownloadManager::Finish(const std::shared_ptr<Entry>& entry, State state,
+                             const std::string& error) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& job = entry->job;
+    if (job.Finished()) {
+      return;
+    }
+    if (job.state != State::kQueued) {
+      active_--;
+    }
+    job.state = state;
+    job.error = error;
+    job.finished_at = UnixNow();
+    job.bytes_per_second = 0;
+    for (auto& item : job.items) {
+      item.bytes_per_second = 0;
+    }
+    finishing_++;
+    NotifyLocked();
+  }
+  if (state == State::kFailed) {
+    LOG_ERROR << "Download " << entry->job.id << " failed: " << error;
+  } else {
+    LOG_INFO << "Download " << entry->job.id << " "
+             << kStateNames[static_cast<int>(state)];
+  }
+  Save();
+  Pump();
+  std::lock_guard<std::mutex> lock(mutex_);
+  finishing_--;
+  NotifyLocked();
+}
+
+void DownloadManager::Save() {
+  std::lock_guard<std::mutex> save_lock(save_mutex_);
+  if (table_path_.empty()) {
+    return;
+  }
+  Json::Value table(Json::arrayValue);
+  for (const auto& job : List()) {
+    table.append(job.ToJson());
+  }
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "";
+  if (!binary_io_utils::WriteFileAtomically(
+          table_path_, Json::writeString(builder, table))) {
+    LOG_WARN << "Failed to write the download table "
+             << table_path_.string();
+  }
+}
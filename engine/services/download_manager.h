@@ -0,0 +1,190 @@
+#pragma once
+
+#include <json/json.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+#include "services/download_service.h"
+
+/**
+ * The download jobs of the process: a task's files, downloaded on the
+ * DownloadEngine, with their progress. Files of at least
+ * DownloadService::kMinSegmentedBytes are downloaded as byte ranges over
+ * several connections, and what each range received is saved to
+ * <file>.segments; a later job for the same url resumes from there.
+ *
+ * At most `max_active` jobs download at once, later ones wait in a queue of
+ * bounded length. A job can be cancelled while queued or running. Its
+ * callback runs exactly once on the WorkerPool, after the files are
+ * downloaded and their checksums verified, and the job only counts as
+ * completed once it returned.
+ *
+ * Once Open() was called, the job table is kept in a file so that finished
+ * and failed jobs outlive a restart. Jobs that were running at the time are
+ * marked failed on the next start, their callbacks are gone.
+ */
+class DownloadManager {
+ public:
+  enum class State {
+    kQueued,
+    kDownloading,
+    kVerifying,
+    kCompleted,
+    kFailed,
+    kCancelled
+  };
+
+  struct ItemProgress {
+    std::string id;
+    std::string url;
+    std::string path;
+    // 0 if unknown
+    uint64_t total_bytes = 0;
+    uint64_t downloaded_bytes = 0;
+    uint64_t bytes_per_second = 0;
+    bool done = false;
+  };
+
+  struct Job {
+    std::string id;
+    DownloadType type = DownloadType::Miscellaneous;
+    State state = State::kQueued;
+    // Set once the job failed
+    std::string error;
+    std::vector<ItemProgress> items;
+    // Unix time in seconds
+    int64_t created_at = 0;
+    // 0 until it finished
+    int64_t finished_at = 0;
+    // Of all items together, 0 unless downloading
+    uint64_t bytes_per_second = 0;
+
+    bool Finished() const;
+    uint64_t TotalBytes() const;
+    uint64_t DownloadedBytes() const;
+    Json::Value ToJson() const;
+    static std::optional<Job> FromJson(const Json::Value& json);
+  };
+
+  struct Options {
+    // HEAD requests for the items first, which set their sizes
+    bool validate = true;
+    // Bytes of each item already on disk, appended to. Empty for none.
+    // Segmented items resume from their saved state instead, if they have
+    // one.
+    std::vector<uint64_t> resume_from;
+    // Connections a large file is downloaded over, 1 for no ranges
+    int connections = DownloadService::kDefaultConnections;
+  };
+
+  static constexpr size_t kDefaultMaxQueued = 64;
+  // Finished jobs kept in the table, the oldest are dropped
+  static constexpr size_t kMaxFinished = 100;
+
+  DownloadManager(size_t max_active, size_t max_queued);
+  ~DownloadManager();
+
+  DownloadManager(const DownloadManager&) = delete;
+  DownloadManager& operator=(const DownloadManager&) = delete;
+
+  // Never destroyed, transfers and callbacks may still run at exit
+  static DownloadManager& Global();
+
+  /**
+   * Loads the job table from `table_path` and saves it there from now on.
+   * RunServer calls it; the CLI keeps its jobs in memory.
+   */
+  void Open(const std::filesystem::path& table_path);
+
+  // Queued jobs start when the limit rises, running ones finish when it drops
+  void SetMaxActive(size_t max_active);
+
+  /**
+   * Queues the download of `task`, under the task's id. Throws if a job of
+   * that id has not finished yet or the queue is full.
+   */
+  std::string Submit(
+      const DownloadTask& task,
+      std::optional<DownloadService::OnDownloadTaskSuccessfully> callback,
+      Options options);
+  std::string Submit(
+      const DownloadTask& task,
+      std::optional<DownloadService::OnDownloadTaskSuccessfully> callback =
+          std::nullopt) {
+    return Submit(task, std::move(callback), Options());
+  }
+
+  // False if there is no such job or it already finished
+  bool Cancel(const std::string& id);
+
+  // Newest first
+  std::vector<Job> List() const;
+  std::optional<Job> Get(const std::string& id) const;
+
+  /**
+   * Waits until a job changes state after `seen`, or for `timeout`, and
+   * updates `seen`. Byte counts change without waking anyone, callers that
+   * show them poll at the interval they want.
+   */
+  void WaitForChange(uint64_t& seen, std::chrono::milliseconds timeout) const;
+
+  // Blocks until the job finished, throws if there is no such job
+  Job Wait(const std::string& id) const;
+
+  // Where the received ranges of the file at `path` are saved
+  static std::filesystem::path SegmentsPath(const std::filesystem::path& path);
+
+  // Bytes of `item` a segmented download would resume from, if any
+  static std::optional<uint64_t> SavedSegmentBytes(const DownloadItem& item);
+
+ private:
+  struct Entry;
+
+  // Starts queued jobs while there is room
+  void Pump();
+  void Start(const std::shared_ptr<Entry>& entry);
+  void Download(const std::shared_ptr<Entry>& entry);
+  // Item `i` over a single connection
+  void Transfer(const std::shared_ptr<Entry>& entry, size_t i,
+                uint64_t resume_from);
+  // Item `i` as ranges, or over a single connection if ranges are ignored
+  void TransferSegmented(const std::shared_ptr<Entry>& entry, size_t i);
+  void AddBytes(const std::shared_ptr<Entry>& entry, size_t i, size_t size);
+  void ResetBytes(const std::shared_ptr<Entry>& entry, size_t i,
+                  uint64_t bytes);
+  // Once item `i` downloaded, failed or was cancelled
+  void ItemDone(const std::shared_ptr<Entry>& entry, size_t i, bool ok,
+                const std::string& error);
+  // Once every transfer of the job is done
+  void Complete(const std::shared_ptr<Entry>& entry);
+  void Finish(const std::shared_ptr<Entry>& entry, State state,
+              const std::string& error);
+  Job Snapshot(const Entry& entry) const;
+  // Writes the table if Open() was called
+  void Save();
+  void NotifyLocked();
+
+  mutable std::mutex mutex_;
+  mutable std::condition_variable cv_;
+  std::map<std::string, std::shared_ptr<Entry>> entries_;
+  std::deque<std::string> queue_;
+  size_t max_active_;
+  const size_t max_queued_;
+  size_t active_ = 0;
+  // Finish() calls still using the manager, waited for on destruction
+  size_t finishing_ = 0;
+  uint64_t changes_ = 0;
+
+  std::mutex save_mutex_;
+  std::filesystem::path table_path_;
+};
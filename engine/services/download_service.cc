@@ -1,45 +1,125 @@
 #include "download_service.h"
-#include <curl/curl.h>
-#include <httplib.h>
 #include <stdio.h>
 #include <trantor/utils/Logger.h>
+#include <algorithm>
+#include <chrono>
 #include <filesystem>
 #include <ostream>
-#include <thread>
 #include "exceptions/failed_curl_exception.h"
-#include "exceptions/failed_init_curl_exception.h"
-#include "exceptions/failed_open_file_exception.h"
+#include "services/download_engine.h"
+#include "services/download_manager.h"
+#include "services/file_hash_service.h"
 #include "utils/format_utils.h"
 #include "utils/logging_utils.h"
 
 namespace {
-size_t WriteCallback(void* ptr, size_t size, size_t nmemb, FILE* stream) {
-  size_t written = fwrite(ptr, size, nmemb, stream);
-  return written;
+// How often progress is printed
+constexpr auto kProgressInterval = std::chrono::seconds(1);
+
+bool AskYesNo(const std::string& question) {
+  std::cout << question << " [Y/n]: " << std::flush;
+  std::string answer{""};
+  std::cin >> answer;
+  return answer == "Y" || answer == "y" || answer.empty();
+}
+
+enum class ExistingFile { kStartOver, kResume, kSkip };
+
+// Asks what to do about the first `have` bytes of `item` found on disk
+ExistingFile AskAboutExistingFile(const DownloadItem& item, uint64_t have) {
+  auto total = item.bytes.value_or(0);
+  if (have < total) {
+    CLI_LOG("Found unfinished download! Additional "
+            << format_utils::BytesToHumanReadable(total - have)
+            << " need to be downloaded.");
+    if (AskYesNo("Continue download")) {
+      CLI_LOG("Resuming download..");
+      return ExistingFile::kResume;
+    }
+    CLI_LOG("Start over..");
+    return ExistingFile::kStartOver;
+  }
+  CLI_LOG(item.localPath.filename().string() << " is already downloaded!");
+  if (AskYesNo("Re-download?")) {
+    CLI_LOG("Re-downloading..");
+    return ExistingFile::kStartOver;
+  }
+  return ExistingFile::kSkip;
+}
+
+void PrintProgress(const std::string& label, uint64_t now, uint64_t total,
+                   uint64_t rate) {
+  std::cout << "\r" << label << ": "
+            << format_utils::BytesToHumanReadable(now);
+  if (total > 0) {
+    std::cout << " / " << format_utils::BytesToHumanReadable(total);
+  }
+  std::cout << ", " << format_utils::BytesToHumanReadable(rate) << "/s   "
+            << std::flush;
 }
 }  // namespace
 
 void DownloadService::AddDownloadTask(
     DownloadTask& task, std::optional<OnDownloadTaskSuccessfully> callback) {
   CLI_LOG("Validating download items, please wait..");
-  // preprocess to check if all the item are valid
-  auto total_download_size{0};
-  for (auto& item : task.items) {
-    try {
-      auto size = GetFileSize(item.downloadUrl);
-      item.bytes = size;
-      total_download_size += size;
-    } catch (const FailedCurlException& e) {
-      CTL_ERR("Found invalid download item: " << item.downloadUrl << " - "
-                                              << e.what());
-      throw;
-    }
-  }
+  Validate(task);
 
-  // all items are valid, start downloading
+  DownloadTask pending{task.id, task.type, {}};
+  // Validated already
+  DownloadManager::Options options;
+  options.validate = false;
+  options.connections = connections_;
   for (const auto& item : task.items) {
-    CLI_LOG("Start downloading: " + item.localPath.filename().string());
-    Download(task.id, item, true);
+    CTL_INF("Absolute file output: " << item.localPath.string());
+    // What a segmented download saved, or else what a single connection
+    // left behind
+    auto saved = connections_ > 1 ? DownloadManager::SavedSegmentBytes(item)
+                                  : std::nullopt;
+    auto have = saved;
+    if (!have.has_value() && item.bytes.has_value() &&
+        std::filesystem::exists(item.localPath)) {
+      have = std::filesystem::file_size(item.localPath);
+    }
+    uint64_t resume_from = 0;
+    if (have.has_value()) {
+      auto answer = AskAboutExistingFile(item, *have);
+      if (answer == ExistingFile::kSkip) {
+        continue;
+      }
+      if (answer == ExistingFile::kResume && !saved.has_value()) {
+        resume_from = *have;
+      } else if (answer == ExistingFile::kStartOver && saved.has_value()) {
+        // Or the job would resume from it
+        std::error_code ec;
+        std::filesystem::remove(
+            DownloadManager::SegmentsPath(item.localPath), ec);
+      }
+    }
+    pending.items.push_back(item);
+    options.resume_from.push_back(resume_from);
+  }
+  if (!pending.items.empty()) {
+    auto& manager = DownloadManager::Global();
+    auto id = manager.Submit(pending, std::nullopt, std::move(options));
+    auto label = pending.items.size() == 1
+                     ? pending.items[0].localPath.filename().string()
+                     : std::to_string(pending.items.size()) + " files";
+    CLI_LOG("Start downloading: " << label);
+    uint64_t seen = 0;
+    std::optional<DownloadManager::Job> job;
+    while (true) {
+      job = manager.Get(id);
+      PrintProgress(label, job->DownloadedBytes(), job->TotalBytes(),
+                    job->bytes_per_second);
+      if (job->Finished()) {
+        break;
+      }
+      manager.WaitForChange(seen, kProgressInterval);
+    }
+    std::cout << std::endl;
+    if (job->state != DownloadManager::State::kCompleted) {
+      throw FailedCurlException(job->error);
+    }
   }
 
   if (callback.has_value()) {
@@ -47,120 +127,64 @@ void DownloadService::AddDownloadTask(
   }
 }
 
-uint64_t DownloadService::GetFileSize(const std::string& url) const {
-  CURL* curl;
-  curl = curl_easy_init();
-
-  if (!curl) {
-    throw FailedInitCurlException();
+void DownloadService::Validate(DownloadTask& task) {
+  std::vector<std::string> urls;
+  for (const auto& item : task.items) {
+    urls.push_back(item.downloadUrl);
   }
-
-  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-  curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
-  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-  CURLcode res = curl_easy_perform(curl);
-
-  if (res != CURLE_OK) {
-    // if we have a failed here. it meant the url is invalid
-    throw FailedCurlException("CURL failed: " +
-                              std::string(curl_easy_strerror(res)));
+  // All at once, the items of a task usually share a host and a connection
+  auto results = DownloadEngine::Global().Head(urls);
+  for (size_t i = 0; i < results.size(); i++) {
+    auto& item = task.items[i];
+    if (!results[i].ok()) {
+      CTL_ERR("Found invalid download item: " << item.downloadUrl << " - "
+                                              << results[i].error);
+      throw FailedCurlException("CURL failed: " + results[i].error);
+    }
+    if (results[i].content_length >= 0) {
+      item.bytes = results[i].content_length;
+    }
   }
-
-  curl_off_t content_length = 0;
-  res = curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T,
-                          &content_length);
-  return content_length;
 }
 
-void DownloadService::AddAsyncDownloadTask(
-    const DownloadTask& task,
-    std::optional<OnDownloadTaskSuccessfully> callback) {
-
+void DownloadService::VerifyChecksums(const DownloadTask& task) {
+  std::vector<std::filesystem::path> paths;
+  std::vector<const DownloadItem*> items;
   for (const auto& item : task.items) {
-    std::thread([this, task, &callback, item]() {
-      this->Download(task.id, item, false);
-    }).detach();
-  }
-
-  // TODO: how to call the callback when all the download has finished?
-}
-
-void DownloadService::Download(const std::string& download_id,
-                               const DownloadItem& download_item,
-                               bool allow_resume) {
-  CTL_INF("Absolute file output: " << download_item.localPath.string());
-
-  CURL* curl;
-  FILE* file;
-  CURLcode res;
-
-  curl = curl_easy_init();
-  if (!curl) {
-    throw FailedInitCurlException();
-  }
-
-  std::string mode = "wb";
-  if (allow_resume && std::filesystem::exists(download_item.localPath) &&
-      download_item.bytes.has_value()) {
-    FILE* existing_file = fopen(download_item.localPath.string().c_str(), "r");
-    fseek(existing_file, 0, SEEK_END);
-    curl_off_t existing_file_size = ftell(existing_file);
-    fclose(existing_file);
-    auto missing_bytes = download_item.bytes.value() - existing_file_size;
-    if (missing_bytes > 0) {
-      CLI_LOG("Found unfinished download! Additional "
-              << format_utils::BytesToHumanReadable(missing_bytes)
-              << " need to be downloaded.");
-      std::cout << "Continue download [Y/n]: " << std::flush;
-      std::string answer{""};
-      std::cin >> answer;
-      if (answer == "Y" || answer == "y" || answer.empty()) {
-        mode = "ab";
-        CLI_LOG("Resuming download..");
-      } else {
-        CLI_LOG("Start over..");
-      }
-    } else {
-      CLI_LOG(download_item.localPath.filename().string()
-              << " is already downloaded!");
-      std::cout << "Re-download? [Y/n]: " << std::flush;
-
-      std::string answer = "";
-      std::cin >> answer;
-      if (answer == "Y" || answer == "y" || answer.empty()) {
-        CLI_LOG("Re-downloading..");
-      } else {
-        return;
-      }
+    if (item.checksum.has_value()) {
+      paths.push_back(item.localPath);
+      items.push_back(&item);
     }
   }
-
-  file = fopen(download_item.localPath.string().c_str(), mode.c_str());
-  if (!file) {
-    auto err_msg{"Failed to open output file " +
-                 download_item.localPath.string()};
-    throw FailedOpenFileException(err_msg);
+  if (paths.empty()) {
+    return;
   }
-
-  curl_easy_setopt(curl, CURLOPT_URL, download_item.downloadUrl.c_str());
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &WriteCallback);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, file);
-  curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
-  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-
-  if (mode == "ab") {
-    fseek(file, 0, SEEK_END);
-    curl_off_t local_file_size = ftell(file);
-    curl_easy_setopt(curl, CURLOPT_RESUME_FROM_LARGE, local_file_size);
+  CLI_LOG("Verifying checksums..");
+  auto digests = FileHashService().Sha256(paths);
+  for (size_t i = 0; i < items.size(); ++i) {
+    if (digests[i] != *items[i]->checksum) {
+      // A corrupted file is useless, and would be resumed from otherwise
+      std::error_code ec;
+      std::filesystem::remove(items[i]->localPath, ec);
+      throw std::runtime_error("Checksum mismatch for " +
+                               items[i]->localPath.filename().string() +
+                               ": expected " + *items[i]->checksum +
+                               ", got " + digests[i]);
+    }
   }
+}
 
-  res = curl_easy_perform(curl);
-
-  if (res != CURLE_OK) {
-    fprintf(stderr, "curl_easy_perform() failed: %s\n",
-            curl_easy_strerror(res));
+uint64_t DownloadService::GetFileSize(const std::string& url) const {
+  auto result = DownloadEngine::Global().Head({url}).front();
+  if (!result.ok()) {
+    // if we have a failed here. it meant the url is invalid
+    throw FailedCurlException("CURL failed: " + result.error);
   }
+  return std::max<int64_t>(result.content_length, 0);
+}
 
-  fclose(file);
-  curl_easy_cleanup(curl);
+std::string DownloadService::AddAsyncDownloadTask(
+    const DownloadTask& task,
+    std::optional<OnDownloadTaskSuccessfully> callback) {
+  return DownloadManager::Global().Submit(task, std::move(callback));
 }
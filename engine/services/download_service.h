@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <filesystem>
 #include <functional>
 #include <optional>
@@ -18,6 +19,7 @@ struct DownloadItem {
    */
   std::filesystem::path localPath;
 
+  // SHA-256 of the file, checked once the download finishes
   std::optional<std::string> checksum;
 
   std::optional<uint64_t> bytes;
@@ -50,16 +52,41 @@ struct DownloadTask {
   }
 };
 
+/**
+ * Downloads the items of a task over DownloadEngine::Global(), which runs
+ * the transfers of every task on one thread and shares connections between
+ * them.
+ */
 class DownloadService {
  public:
   using OnDownloadTaskSuccessfully =
       std::function<void(const DownloadTask& task)>;
 
+  // Connections a large file is downloaded over
+  static constexpr int kDefaultConnections = 8;
+  // Smaller files, or files of unknown size, use a single connection
+  static constexpr uint64_t kMinSegmentedBytes = 64ull << 20;
+
+  explicit DownloadService(int connections = kDefaultConnections)
+      : connections_(connections) {}
+
+  /**
+   * Checks every item with a HEAD request, all at once, then downloads them
+   * side by side as a DownloadManager job, large ones over connections_
+   * connections each, and blocks until they are done. Asks before resuming
+   * or replacing a file that is already there.
+   */
   void AddDownloadTask(
       DownloadTask& task,
       std::optional<OnDownloadTaskSuccessfully> callback = std::nullopt);
 
-  void AddAsyncDownloadTask(
+  /**
+   * Queues the task as a job of DownloadManager::Global() and returns its
+   * id. `callback` runs on the WorkerPool once every item is downloaded and
+   * verified. Throws if the task is already downloading or the queue is
+   * full.
+   */
+  std::string AddAsyncDownloadTask(
       const DownloadTask& task,
       std::optional<OnDownloadTaskSuccessfully> callback = std::nullopt);
 
@@ -70,7 +97,12 @@ class DownloadService {
    */
   uint64_t GetFileSize(const std::string& url) const;
 
+  // Throws on the first item whose file does not match its checksum
+  static void VerifyChecksums(const DownloadTask& task);
+
  private:
-  void Download(const std::string& download_id,
-                const DownloadItem& download_item, bool allow_resume);
+  // Sets the size of every item, throws on the first invalid one
+  static void Validate(DownloadTask& task);
+
+  int connections_;
 };
@@ -0,0 +1,249 @@
+#include "file_hash_service.h"
+
+#include <openssl/evp.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include "utils/binary_io_utils.h"
+#include "utils/mapped_file.h"
+
+namespace {
+constexpr uint64_t kPrime1 = 11400714785074694791ull;
+constexpr uint64_t kPrime2 = 14029467366897019727ull;
+constexpr uint64_t kPrime3 = 1609587929392839161ull;
+constexpr uint64_t kPrime4 = 9650029242287828579ull;
+constexpr uint64_t kPrime5 = 2870177450012600261ull;
+
+// OpenSSL is fed this much at a time, so the mapping is read sequentially
+constexpr size_t kSha256Block = 4 << 20;
+
+constexpr char kIntegrityPrefix[] = "xxh64t";
+
+inline uint64_t Rotl(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t Read64(const uint8_t* p) {
+  uint64_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint32_t Read32(const uint8_t* p) {
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint64_t Round(uint64_t acc, uint64_t input) {
+  acc += input * kPrime2;
+  return Rotl(acc, 31) * kPrime1;
+}
+
+inline uint64_t MergeRound(uint64_t acc, uint64_t val) {
+  acc ^= Round(0, val);
+  return acc * kPrime1 + kPrime4;
+}
+
+std::string ToHex(const uint8_t* data, size_t size) {
+  static constexpr char kDigits[] = "0123456789abcdef";
+  std::string hex(size * 2, '0');
+  for (size_t i = 0; i < size; ++i) {
+    hex[2 * i] = kDigits[data[i] >> 4];
+    hex[2 * i + 1] = kDigits[data[i] & 0xf];
+  }
+  return hex;
+}
+
+std::string ToHex(uint64_t v) {
+  std::ostringstream ss;
+  ss << std::hex << std::setw(16) << std::setfill('0') << v;
+  return ss.str();
+}
+
+// Runs fn(i) for i in [0, n) on up to `threads` threads
+template <typename Fn>
+void ParallelFor(size_t n, size_t threads, Fn fn) {
+  threads = std::min(threads, n);
+  if (threads <= 1) {
+    for (size_t i = 0; i < n; ++i) {
+      fn(i);
+    }
+    return;
+  }
+  std::atomic<size_t> next{0};
+  std::exception_ptr error;
+  std::mutex error_mutex;
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < threads; ++t) {
+    workers.emplace_back([&]() {
+      for (size_t i = next++; i < n; i = next++) {
+        try {
+          fn(i);
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(error_mutex);
+          error = std::current_exception();
+          next = n;
+        }
+      }
+    });
+  }
+  for (auto& w : workers) {
+    w.join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+}  // namespace
+
+FileHashService::FileHashService(size_t max_threads)
+    : max_threads_(max_threads > 0
+                       ? max_threads
+                       : std::max(1u, std::thread::hardware_concurrency())) {}
+
+uint64_t FileHashService::Xxh64(const void* data, size_t size, uint64_t seed) {
+  auto p = static_cast<const uint8_t*>(data);
+  auto end = p + size;
+  uint64_t h;
+  if (size >= 32) {
+    uint64_t v1 = seed + kPrime1 + kPrime2;
+    uint64_t v2 = seed + kPrime2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - kPrime1;
+    for (; p + 32 <= end; p += 32) {
+      v1 = Round(v1, Read64(p));
+      v2 = Round(v2, Read64(p + 8));
+      v3 = Round(v3, Read64(p + 16));
+      v4 = Round(v4, Read64(p + 24));
+    }
+    h = Rotl(v1, 1) + Rotl(v2, 7) + Rotl(v3, 12) + Rotl(v4, 18);
+    h = MergeRound(h, v1);
+    h = MergeRound(h, v2);
+    h = MergeRound(h, v3);
+    h = MergeRound(h, v4);
+  } else {
+    h = seed + kPrime5;
+  }
+  h += size;
+  for (; p + 8 <= end; p += 8) {
+    h ^= Round(0, Read64(p));
+    h = Rotl(h, 27) * kPrime1 + kPrime4;
+  }
+  if (p + 4 <= end) {
+    h ^= Read32(p) * kPrime1;
+    h = Rotl(h, 23) * kPrime2 + kPrime3;
+    p += 4;
+  }
+  for (; p < end; ++p) {
+    h ^= *p * kPrime5;
+    h = Rotl(h, 11) * kPrime1;
+  }
+  h ^= h >> 33;
+  h *= kPrime2;
+  h ^= h >> 29;
+  h *= kPrime3;
+  h ^= h >> 32;
+  return h;
+}
+
+std::string FileHashService::Sha256(const std::filesystem::path& path) const {
+  MappedFile file(path);
+  std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> ctx(
+      EVP_MD_CTX_new(), EVP_MD_CTX_free);
+  if (!ctx || EVP_DigestInit_ex(ctx.get(), EVP_sha256(), nullptr) != 1) {
+    throw std::runtime_error("Failed to initialize SHA-256");
+  }
+  for (size_t offset = 0; offset < file.size(); offset += kSha256Block) {
+    auto n = std::min(kSha256Block, file.size() - offset);
+    if (EVP_DigestUpdate(ctx.get(), file.data() + offset, n) != 1) {
+      throw std::runtime_error("Failed to hash " + path.string());
+    }
+  }
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int digest_size = 0;
+  if (EVP_DigestFinal_ex(ctx.get(), digest, &digest_size) != 1) {
+    throw std::runtime_error("Failed to hash " + path.string());
+  }
+  return ToHex(digest, digest_size);
+}
+
+std::string FileHashService::Fingerprint(
+    const std::filesystem::path& path) const {
+  MappedFile file(path);
+  auto n_chunks = (file.size() + kChunkSize - 1) / kChunkSize;
+  std::vector<uint64_t> leaves(n_chunks);
+  ParallelFor(n_chunks, max_threads_, [&](size_t i) {
+    auto offset = i * kChunkSize;
+    auto n = std::min<size_t>(kChunkSize, file.size() - offset);
+    leaves[i] = Xxh64(file.data() + offset, n);
+  });
+  return ToHex(Xxh64(leaves.data(), leaves.size() * sizeof(uint64_t),
+                     static_cast<uint64_t>(file.size())));
+}
+
+std::vector<std::string> FileHashService::Sha256(
+    const std::vector<std::filesystem::path>& paths) const {
+  std::vector<std::string> digests(paths.size());
+  ParallelFor(paths.size(), max_threads_,
+              [&](size_t i) { digests[i] = Sha256(paths[i]); });
+  return digests;
+}
+
+std::vector<std::string> FileHashService::Fingerprint(
+    const std::vector<std::filesystem::path>& paths) const {
+  // Each file already uses every thread
+  std::vector<std::string> digests;
+  for (const auto& path : paths) {
+    digests.push_back(Fingerprint(path));
+  }
+  return digests;
+}
+
+std::string FileHashService::FilesIdentity(
+    const std::vector<std::filesystem::path>& paths) {
+  binary_io_utils::BinaryWriter w;
+  for (const auto& path : paths) {
+    binary_io_utils::FileIdentity id;
+    if (!binary_io_utils::GetFileIdentity(path, id)) {
+      throw std::runtime_error("Missing model file " + path.string());
+    }
+    w.Write<uint64_t>(id.size);
+    w.Write<int64_t>(id.mtime_ns);
+    w.Write<uint64_t>(id.inode);
+  }
+  return ToHex(Xxh64(w.data().data(), w.data().size()));
+}
+
+std::string IntegrityRecord::ToString() const {
+  std::string s = std::string(kIntegrityPrefix) + ":";
+  for (size_t i = 0; i < fingerprints.size(); ++i) {
+    s += (i > 0 ? "+" : "") + fingerprints[i];
+  }
+  return s + ":" + files_identity;
+}
+
+std::optional<IntegrityRecord> IntegrityRecord::FromString(
+    const std::string& s) {
+  auto first = s.find(':');
+  auto second = s.find(':', first == std::string::npos ? first : first + 1);
+  if (first == std::string::npos || second == std::string::npos ||
+      s.compare(0, first, kIntegrityPrefix) != 0) {
+    return std::nullopt;
+  }
+  IntegrityRecord record;
+  std::istringstream fingerprints(s.substr(first + 1, second - first - 1));
+  for (std::string f; std::getline(fingerprints, f, '+');) {
+    record.fingerprints.push_back(f);
+  }
+  record.files_identity = s.substr(second + 1);
+  return record;
+}
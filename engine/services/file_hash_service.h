@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+/**
+ * Content hashes of model files, read through a read-only mapping.
+ *
+ * Sha256() is the digest Hugging Face publishes as the oid of LFS files. It
+ * can only be computed front to back, so several files are hashed side by
+ * side rather than one file in pieces.
+ *
+ * Fingerprint() is for local checks. The file is cut into kChunkSize chunks
+ * which are hashed with xxh64 on all threads, the fingerprint is the xxh64 of
+ * the chunk hashes seeded with the file size.
+ */
+class FileHashService {
+ public:
+  static constexpr uint64_t kChunkSize = 16ull << 20;
+
+  // 0 uses every core
+  explicit FileHashService(size_t max_threads = 0);
+
+  std::string Sha256(const std::filesystem::path& path) const;
+  std::string Fingerprint(const std::filesystem::path& path) const;
+
+  // One digest per file, in the same order
+  std::vector<std::string> Sha256(
+      const std::vector<std::filesystem::path>& paths) const;
+  std::vector<std::string> Fingerprint(
+      const std::vector<std::filesystem::path>& paths) const;
+
+  /**
+   * Cheap stand-in for the content of a set of files: their sizes,
+   * modification times and inodes. If it has not changed since the files
+   * were last hashed, neither have the hashes.
+   */
+  static std::string FilesIdentity(
+      const std::vector<std::filesystem::path>& paths);
+
+  static uint64_t Xxh64(const void* data, size_t size, uint64_t seed = 0);
+
+ private:
+  size_t max_threads_;
+};
+
+/**
+ * Result of the last `cortex models verify`, kept in the model registry as
+ * "xxh64t:<fingerprint>+<fingerprint>...:<files identity>".
+ */
+struct IntegrityRecord {
+  // Fingerprint() of each file, in file order
+  std::vector<std::string> fingerprints;
+  std::string files_identity;
+
+  std::string ToString() const;
+  static std::optional<IntegrityRecord> FromString(const std::string& s);
+};
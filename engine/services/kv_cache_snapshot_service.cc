@@ -0,0 +1,214 @@
+#include "kv_cache_snapshot_service.h"
+#include <trantor/utils/Logger.h>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+constexpr const auto kSnapshotExtension = ".kv";
+
+uint64_t Fnv1a(const std::string& s, uint64_t h = 14695981039346656037ull) {
+  for (unsigned char c : s) {
+    h ^= c;
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+std::string ToHex(uint64_t v) {
+  std::ostringstream oss;
+  oss << std::hex << std::setw(16) << std::setfill('0') << v;
+  return oss.str();
+}
+
+// Session ids come from clients, only keep them as file names when they are
+// obviously safe.
+std::string SessionFileStem(const std::string& session_id) {
+  bool safe = !session_id.empty() && session_id.size() <= 128 &&
+              session_id[0] != '.' &&
+              std::all_of(session_id.begin(), session_id.end(), [](char c) {
+                return std::isalnum(static_cast<unsigned char>(c)) ||
+                       c == '-' || c == '_' || c == '.';
+              });
+  return safe ? session_id : ToHex(Fnv1a(session_id));
+}
+
+// Map the snapshot and ask the kernel to read it in, so the engine's restore
+// does not wait on random reads.
+void PrefetchFile(const std::filesystem::path& path) {
+#ifndef _WIN32
+  int fd = open(path.string().c_str(), O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  auto size = static_cast<size_t>(std::filesystem::file_size(path));
+  if (size > 0) {
+    void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr != MAP_FAILED) {
+      madvise(addr, size, MADV_WILLNEED);
+      munmap(addr, size);
+    }
+  }
+  close(fd);
+#endif
+}
+}  // namespace
+
+KvCacheSnapshotService::KvCacheSnapshotService(std::filesystem::path root,
+                                               uint64_t max_bytes)
+    : root_(std::move(root)), max_bytes_(max_bytes) {
+  std::filesystem::create_directories(root_);
+  LoadIndex();
+}
+
+std::string KvCacheSnapshotService::ModelHash(const std::string& model_path) {
+  std::error_code ec;
+  auto size = std::filesystem::file_size(model_path, ec);
+  auto mtime = std::filesystem::last_write_time(model_path, ec);
+  auto h = Fnv1a(model_path);
+  h = Fnv1a(std::to_string(ec ? 0 : size), h);
+  h = Fnv1a(std::to_string(ec ? 0 : mtime.time_since_epoch().count()), h);
+  return ToHex(h);
+}
+
+std::filesystem::path KvCacheSnapshotService::SnapshotPath(
+    const std::string& model_hash, const std::string& session_id) const {
+  auto dir = root_ / model_hash;
+  std::filesystem::create_directories(dir);
+  return dir / (SessionFileStem(session_id) + kSnapshotExtension);
+}
+
+std::optional<std::filesystem::path> KvCacheSnapshotService::Find(
+    const std::string& model_hash, const std::string& session_id) {
+  std::filesystem::path path;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(Key(model_hash, session_id));
+    if (it == entries_.end()) {
+      return std::nullopt;
+    }
+    if (!std::filesystem::exists(it->second.path)) {
+      EraseLocked(it->first);
+      return std::nullopt;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second.lru_it);
+    path = it->second.path;
+  }
+  // Persist the access time so the LRU order survives a restart
+  std::error_code ec;
+  std::filesystem::last_write_time(
+      path, std::filesystem::file_time_type::clock::now(), ec);
+  PrefetchFile(path);
+  return path;
+}
+
+void KvCacheSnapshotService::Commit(const std::string& model_hash,
+                                    const std::string& session_id) {
+  auto path = SnapshotPath(model_hash, session_id);
+  std::error_code ec;
+  auto bytes = std::filesystem::file_size(path, ec);
+  if (ec) {
+    LOG_WARN << "KV cache snapshot was not written: " << path.string();
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto key = Key(model_hash, session_id);
+  EraseLocked(key);
+  lru_.push_front(key);
+  entries_[key] = Entry{path, bytes, lru_.begin()};
+  total_bytes_ += bytes;
+  EvictIfNeeded();
+}
+
+void KvCacheSnapshotService::Remove(const std::string& model_hash,
+                                    const std::string& session_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto key = Key(model_hash, session_id);
+  auto it = entries_.find(key);
+  if (it == entries_.end()) {
+    return;
+  }
+  std::error_code ec;
+  std::filesystem::remove(it->second.path, ec);
+  EraseLocked(key);
+}
+
+uint64_t KvCacheSnapshotService::TotalBytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return total_bytes_;
+}
+
+std::string KvCacheSnapshotService::Key(const std::string& model_hash,
+                                        const std::string& session_id) {
+  return model_hash + "/" + SessionFileStem(session_id);
+}
+
+void KvCacheSnapshotService::LoadIndex() {
+  struct Found {
+    std::string key;
+    std::filesystem::path path;
+    uint64_t bytes;
+    std::filesystem::file_time_type last_used;
+  };
+  std::vector<Found> found;
+  std::error_code ec;
+  for (const auto& model_dir :
+       std::filesystem::directory_iterator(root_, ec)) {
+    if (!model_dir.is_directory()) {
+      continue;
+    }
+    for (const auto& f : std::filesystem::directory_iterator(model_dir, ec)) {
+      if (!f.is_regular_file() || f.path().extension() != kSnapshotExtension) {
+        continue;
+      }
+      found.push_back(Found{
+          model_dir.path().filename().string() + "/" +
+              f.path().stem().string(),
+          f.path(), static_cast<uint64_t>(f.file_size()),
+          f.last_write_time()});
+    }
+  }
+  std::sort(found.begin(), found.end(), [](const Found& a, const Found& b) {
+    return a.last_used > b.last_used;
+  });
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& f : found) {
+    lru_.push_back(f.key);
+    entries_[f.key] = Entry{std::move(f.path), f.bytes, std::prev(lru_.end())};
+    total_bytes_ += f.bytes;
+  }
+  EvictIfNeeded();
+  LOG_INFO << "KV cache snapshots: " << entries_.size() << " files, "
+           << total_bytes_ << " bytes";
+}
+
+void KvCacheSnapshotService::EvictIfNeeded() {
+  // Never evict the snapshot that was just committed
+  while (total_bytes_ > max_bytes_ && lru_.size() > 1) {
+    auto key = lru_.back();
+    std::error_code ec;
+    std::filesystem::remove(entries_[key].path, ec);
+    LOG_INFO << "Evicted KV cache snapshot " << key;
+    EraseLocked(key);
+  }
+}
+
+void KvCacheSnapshotService::EraseLocked(const std::string& key) {
+  auto it = entries_.find(key);
+  if (it == entries_.end()) {
+    return;
+  }
+  total_bytes_ -= it->second.bytes;
+  lru_.erase(it->second.lru_it);
+  entries_.erase(it);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+/**
+ * On-disk store for engine KV cache snapshots.
+ *
+ * Snapshots live under <root>/<model_hash>/<session_id>.kv. The engine writes
+ * and reads the files itself; this store hands out the paths, keeps an LRU
+ * index over them and evicts the least recently used snapshots once the total
+ * size goes above the configured limit.
+ */
+class KvCacheSnapshotService {
+ public:
+  KvCacheSnapshotService(std::filesystem::path root, uint64_t max_bytes);
+
+  /**
+   * Identifies a model file by its path, size and modification time, so a
+   * snapshot is never restored into different weights.
+   */
+  static std::string ModelHash(const std::string& model_path);
+
+  /**
+   * Path the engine should write the snapshot of a session to.
+   */
+  std::filesystem::path SnapshotPath(const std::string& model_hash,
+                                     const std::string& session_id) const;
+
+  /**
+   * Returns the snapshot of a session if there is one. The file is mapped and
+   * its pages are prefetched so that the engine reads it from page cache.
+   */
+  std::optional<std::filesystem::path> Find(const std::string& model_hash,
+                                            const std::string& session_id);
+
+  /**
+   * Records a snapshot that the engine just wrote, then evicts old snapshots
+   * until the store fits in its budget again.
+   */
+  void Commit(const std::string& model_hash, const std::string& session_id);
+
+  void Remove(const std::string& model_hash, const std::string& session_id);
+
+  uint64_t TotalBytes() const;
+
+ private:
+  struct Entry {
+    std::filesystem::path path;
+    uint64_t bytes;
+    std::list<std::string>::iterator lru_it;
+  };
+
+  static std::string Key(const std::string& model_hash,
+                         const std::string& session_id);
+  void LoadIndex();
+  void EvictIfNeeded();
+  void EraseLocked(const std::string& key);
+
+  std::filesystem::path root_;
+  uint64_t max_bytes_;
+  uint64_t total_bytes_ = 0;
+  // Most recently used at the front
+  std::list<std::string> lru_;
+  std::unordered_map<std::string, Entry> entries_;
+  mutable std::mutex mutex_;
+};
@@ -0,0 +1,367 @@
+#include "model_catalog_service.h"
+#include <json/json.h>
+#include <trantor/utils/Logger.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include "config/model_config_snapshot.h"
+#include "config/yaml_config.h"
+#include "utils/string_utils.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <climits>
+#endif
+
+namespace {
+#ifdef __linux__
+// Whatever can change a model.yml or the model files ToJson() lists
+constexpr uint32_t kWatchMask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                                IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF |
+                                IN_MOVE_SELF;
+#endif
+
+#ifdef __linux__
+// Config snapshots written while parsing, or their temporaries. Their events
+// are not changes of the model.
+bool IsSnapshotFile(const std::string& name) {
+  static const auto suffix = config::ModelConfigSnapshot::PathFor("").string();
+  return string_utils::EndsWith(name, suffix) ||
+         (name.find(suffix + ".") != std::string::npos &&
+          string_utils::EndsWith(name, ".tmp"));
+}
+#endif
+
+std::string Serialize(const Json::Value& value) {
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "";
+  return Json::writeString(builder, value);
+}
+
+std::string ETag(const std::string& body) {
+  // FNV-1a, stable across restarts unlike std::hash
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (unsigned char c : body) {
+    h = (h ^ c) * 0x100000001b3ull;
+  }
+  char buf[24];
+  std::snprintf(buf, sizeof(buf), "\"%016llx\"",
+                static_cast<unsigned long long>(h));
+  return buf;
+}
+}  // namespace
+
+ModelCatalogService::ModelCatalogService(ModelRegistryService& registry)
+    : registry_(registry) {
+#ifdef __linux__
+  inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd_ < 0) {
+    LOG_WARN << "inotify is unavailable, model.yml files are checked on "
+                "every listing";
+  }
+#endif
+}
+
+ModelCatalogService::~ModelCatalogService() {
+#ifdef __linux__
+  if (inotify_fd_ >= 0) {
+    close(inotify_fd_);
+  }
+#endif
+}
+
+ModelCatalogService& ModelCatalogService::Global() {
+  static ModelCatalogService catalog(ModelRegistryService::Global());
+  return catalog;
+}
+
+uint64_t ModelCatalogService::Parses() const {
+  std::lock_guard<std::mutex> l(mutex_);
+  return parses_;
+}
+
+bool ModelCatalogService::Watch(const std::filesystem::path& dir) {
+#ifdef __linux__
+  if (inotify_fd_ < 0) {
+    return false;
+  }
+  int wd = inotify_add_watch(inotify_fd_, dir.string().c_str(), kWatchMask);
+  if (wd < 0) {
+    LOG_DEBUG << "Cannot watch " << dir.string() << ", errno " << errno;
+    return false;
+  }
+  watches_[wd] = dir.string();
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool ModelCatalogService::DrainEvents() {
+#ifdef __linux__
+  if (inotify_fd_ < 0) {
+    return false;
+  }
+  bool marked = false;
+  constexpr size_t kEventSize = sizeof(inotify_event) + NAME_MAX + 1;
+  alignas(inotify_event) char buf[16 * kEventSize];
+  // The model whose model.yml is `name` in `dir`, or with an empty `name`
+  // every model in `dir`
+  auto mark = [this, &marked](const std::string& dir, const std::string& name,
+                              bool unwatched) {
+    for (auto& [path, model] : models_) {
+      std::filesystem::path p(path);
+      if (p.parent_path().string() == dir &&
+          (name.empty() || p.filename().string() == name)) {
+        model.dirty = true;
+        model.watched = model.watched && !unwatched;
+        marked = true;
+      }
+    }
+  };
+  ssize_t n;
+  while ((n = read(inotify_fd_, buf, sizeof(buf))) > 0) {
+    for (ssize_t pos = 0; pos < n;) {
+      auto* ev = reinterpret_cast<const inotify_event*>(buf + pos);
+      pos += sizeof(inotify_event) + ev->len;
+      if (ev->mask & IN_Q_OVERFLOW) {
+        // Lost events, trust nothing
+        for (auto& [path, model] : models_) {
+          model.dirty = true;
+        }
+        marked = true;
+        continue;
+      }
+      auto it = watches_.find(ev->wd);
+      if (it == watches_.end()) {
+        continue;
+      }
+      if (ev->len > 0 && IsSnapshotFile(ev->name)) {
+        continue;
+      }
+      bool gone = ev->mask & IN_IGNORED;
+      // The directory itself went away. A model without a files list takes
+      // the GGUF files it finds beside its model.yml, so those count for
+      // every model there.
+      std::string name = ev->len > 0 ? ev->name : "";
+      if (gone || (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) ||
+          string_utils::EndsWith(name, ".gguf")) {
+        name.clear();
+      }
+      mark(it->second, name, gone);
+      if (gone) {
+        watches_.erase(it);
+      }
+    }
+  }
+  return marked;
+#else
+  return false;
+#endif
+}
+
+void ModelCatalogService::Parse(Model& model) {
+  auto dir = std::filesystem::path(model.yaml_path).parent_path();
+  if (!model.watched) {
+    // Before reading, so that a write racing with it is not missed
+    model.watched = Watch(dir);
+  }
+  model.dirty = false;
+  model.parsed.reset();
+  binary_io_utils::GetFileIdentity(model.yaml_path, model.identity);
+  parses_++;
+  try {
+    config::YamlHandler yaml_handler;
+    yaml_handler.ModelConfigFromFile(model.yaml_path);
+    const auto& config = yaml_handler.GetModelConfig();
+    auto parsed = std::make_shared<CatalogModel>();
+    parsed->engine = config.engine;
+    parsed->config = config.ToJson();
+    parsed->json = Serialize(parsed->config);
+    model.parsed = std::move(parsed);
+  } catch (const std::exception& e) {
+    LOG_ERROR << "Failed to load yaml file for model: " << model.yaml_path
+              << ", error: " << e.what();
+  }
+}
+
+std::shared_ptr<ModelCatalogService::Listing> ModelCatalogService::Refresh(
+    ModelRegistryService::Snapshot snapshot) {
+  bool changed = DrainEvents() || !listing_ || snapshot != snapshot_;
+  if (!changed && all_watched_) {
+    return listing_;
+  }
+
+  all_watched_ = true;
+  auto listing = std::make_shared<Listing>();
+  std::unordered_map<std::string, Model> live;
+  for (const auto& entry : snapshot->List()) {
+    auto& path = entry.path_to_model_yaml;
+    auto it = live.find(path);
+    if (it == live.end()) {
+      Model model;
+      if (auto old = models_.find(path); old != models_.end()) {
+        model = std::move(old->second);
+      } else {
+        model.yaml_path = path;
+      }
+      if (!model.dirty && !model.watched) {
+        binary_io_utils::FileIdentity id;
+        model.dirty = !binary_io_utils::GetFileIdentity(path, id) ||
+                      !(id == model.identity);
+      }
+      if (model.dirty) {
+        Parse(model);
+        changed = true;
+      }
+      all_watched_ = all_watched_ && model.watched;
+      it = live.emplace(path, std::move(model)).first;
+    }
+    if (!it->second.parsed) {
+      continue;
+    }
+    auto& parsed = it->second.parsed;
+    if (parsed->model_id.empty()) {
+      // Just parsed, not listed yet
+      parsed->model_id = entry.model_id;
+    }
+    std::shared_ptr<const CatalogModel> listed = parsed;
+    if (parsed->model_id != entry.model_id) {
+      // Another entry with the same model.yml
+      auto copy = std::make_shared<CatalogModel>(*parsed);
+      copy->model_id = entry.model_id;
+      listed = std::move(copy);
+    }
+    listing->by_id.emplace(entry.model_id, listing->models.size());
+    listing->models.push_back(std::move(listed));
+  }
+  // Models no longer registered
+  changed = changed || live.size() != models_.size();
+  models_ = std::move(live);
+  snapshot_ = std::move(snapshot);
+  if (changed) {
+    listing_ = std::move(listing);
+  }
+  return listing_;
+}
+
+std::shared_ptr<const ModelCatalogService::Listing>
+ModelCatalogService::List() {
+  auto snapshot = registry_.Get();
+  std::lock_guard<std::mutex> l(mutex_);
+  auto listing = Refresh(std::move(snapshot));
+  if (!listing->body.empty()) {
+    return listing;
+  }
+  // Streams reading this listing only look at its models
+  listing->body = "{\"data\":[";
+  for (size_t i = 0; i < listing->models.size(); i++) {
+    if (i > 0) {
+      listing->body += ',';
+    }
+    listing->body += listing->models[i]->json;
+  }
+  listing->body += "],\"object\":\"list\",\"result\":\"OK\"}";
+  listing->etag = ETag(listing->body);
+  return listing;
+}
+
+std::unique_ptr<ModelCatalogService::ListingStream> ModelCatalogService::Query(
+    ListQuery query) {
+  auto snapshot = registry_.Get();
+  std::shared_ptr<const Listing> listing;
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    listing = Refresh(std::move(snapshot));
+  }
+  return std::make_unique<ListingStream>(std::move(listing), std::move(query));
+}
+
+ModelCatalogService::ListingStream::ListingStream(
+    std::shared_ptr<const Listing> listing, ListQuery query)
+    : listing_(std::move(listing)), query_(std::move(query)) {
+  if (!query_.after.empty()) {
+    auto it = listing_->by_id.find(query_.after);
+    if (it == listing_->by_id.end()) {
+      throw std::runtime_error("Model not found: " + query_.after);
+    }
+    next_ = it->second + 1;
+  }
+}
+
+size_t ModelCatalogService::ListingStream::NextMatch(size_t from) const {
+  const auto& models = listing_->models;
+  for (; from < models.size(); from++) {
+    const auto& m = *models[from];
+    if ((query_.engine.empty() || m.engine == query_.engine) &&
+        string_utils::StartsWith(m.model_id, query_.prefix)) {
+      break;
+    }
+  }
+  return from;
+}
+
+std::string ModelCatalogService::ListingStream::Render(
+    const CatalogModel& model) const {
+  if (query_.fields.empty()) {
+    return model.json;
+  }
+  Json::Value projected(Json::objectValue);
+  for (const auto& field : query_.fields) {
+    if (model.config.isMember(field)) {
+      projected[field] = model.config[field];
+    }
+  }
+  return Serialize(projected);
+}
+
+bool ModelCatalogService::ListingStream::Fill() {
+  if (finished_) {
+    return false;
+  }
+  if (!started_) {
+    started_ = true;
+    pending_ += "{\"data\":[";
+    return true;
+  }
+  auto match = NextMatch(next_);
+  bool more = match < listing_->models.size();
+  if (more && (query_.limit == 0 || sent_ < query_.limit)) {
+    const auto& model = *listing_->models[match];
+    if (sent_ > 0) {
+      pending_ += ',';
+    }
+    pending_ += Render(model);
+    last_id_ = model.model_id;
+    next_ = match + 1;
+    sent_++;
+    return true;
+  }
+  finished_ = true;
+  pending_ += "],\"has_more\":";
+  pending_ += more ? "true" : "false";
+  pending_ += ",\"last_id\":" + Serialize(last_id_);
+  pending_ += ",\"object\":\"list\",\"result\":\"OK\"}";
+  return true;
+}
+
+size_t ModelCatalogService::ListingStream::Read(char* buf, size_t size) {
+  size_t n = 0;
+  while (n < size) {
+    if (pending_pos_ == pending_.size()) {
+      pending_.clear();
+      pending_pos_ = 0;
+      if (!Fill()) {
+        break;
+      }
+    }
+    auto chunk = std::min(size - n, pending_.size() - pending_pos_);
+    std::memcpy(buf + n, pending_.data() + pending_pos_, chunk);
+    pending_pos_ += chunk;
+    n += chunk;
+  }
+  return n;
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <json/json.h>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "services/model_registry_service.h"
+#include "utils/binary_io_utils.h"
+
+/**
+ * The response of GET /models/list, kept serialized between requests.
+ *
+ * Each model's model.yml is parsed once and its ModelConfig::ToJson() kept as
+ * a JSON string. On Linux the directory of every model.yml is watched with
+ * inotify and a model is parsed again only after its model.yml, a GGUF file
+ * beside it, or the directory itself changed. Elsewhere the file's size and
+ * mtime are compared instead, which still saves the YAML parse. The body is
+ * only reassembled when a model or the registry changed, so an unchanged
+ * poll costs a copy of the body, or a 304 when the client sends the ETag
+ * back.
+ *
+ * Filtered or paged listings are streamed from the same cache, one model at
+ * a time, see Query(). They never build the full body.
+ */
+class ModelCatalogService {
+ public:
+  struct CatalogModel {
+    // In the registry, the cursor of paged listings
+    std::string model_id;
+    std::string engine;
+    Json::Value config;
+    // `config`, serialized
+    std::string json;
+  };
+
+  struct Listing {
+    // {"data":[...],"object":"list","result":"OK"}, built by the first
+    // List() of this listing, Query() does not need it
+    std::string body;
+    // Quoted, as sent in the ETag header
+    std::string etag;
+    // In registry order, without the models whose model.yml is broken
+    std::vector<std::shared_ptr<const CatalogModel>> models;
+    // model_id to index in `models`
+    std::unordered_map<std::string, size_t> by_id;
+  };
+
+  struct ListQuery {
+    // At most this many models, 0 for all of them
+    size_t limit = 0;
+    // Only the models listed after this model_id
+    std::string after;
+    // Only the models of this engine, e.g. "cortex.llamacpp"
+    std::string engine;
+    // Only the models whose model_id starts with this
+    std::string prefix;
+    // Only these keys of each model, all of them if empty
+    std::vector<std::string> fields;
+  };
+
+  /**
+   * The body of a queried listing, produced as it is read:
+   * {"data":[...],"has_more":false,"last_id":"...","object":"list",
+   * "result":"OK"}. Pass "last_id" as `after` to get the next page.
+   */
+  class ListingStream {
+   public:
+    // Throws if `query.after` is not a listed model
+    ListingStream(std::shared_ptr<const Listing> listing, ListQuery query);
+
+    // Copies the next bytes of the body into `buf`, returns 0 at the end
+    size_t Read(char* buf, size_t size);
+
+   private:
+    // Appends the next piece of the body to pending_, false at the end
+    bool Fill();
+    // Index of the next model matching the query from `from`
+    size_t NextMatch(size_t from) const;
+    std::string Render(const CatalogModel& model) const;
+
+    std::shared_ptr<const Listing> listing_;
+    ListQuery query_;
+    size_t next_ = 0;
+    size_t sent_ = 0;
+    std::string last_id_;
+    std::string pending_;
+    size_t pending_pos_ = 0;
+    bool started_ = false;
+    bool finished_ = false;
+  };
+
+  explicit ModelCatalogService(ModelRegistryService& registry);
+  ~ModelCatalogService();
+
+  // Over ModelRegistryService::Global()
+  static ModelCatalogService& Global();
+
+  std::shared_ptr<const Listing> List();
+  std::unique_ptr<ListingStream> Query(ListQuery query);
+
+  // model.yml files parsed so far
+  uint64_t Parses() const;
+
+ private:
+  struct Model {
+    std::string yaml_path;
+    // Null if its model.yml failed to parse
+    std::shared_ptr<CatalogModel> parsed;
+    binary_io_utils::FileIdentity identity;
+    bool dirty = true;
+    bool watched = false;
+  };
+
+  // Marks the models whose model.yml or directory changed since the last
+  // call, returns true if there were any
+  bool DrainEvents();
+  bool Watch(const std::filesystem::path& dir);
+  void Parse(Model& model);
+  // The listing of `snapshot` with every changed model parsed again, its
+  // body not built yet if it is new. Call with mutex_ held.
+  std::shared_ptr<Listing> Refresh(ModelRegistryService::Snapshot snapshot);
+
+  ModelRegistryService& registry_;
+  mutable std::mutex mutex_;
+  // By model.yml path
+  std::unordered_map<std::string, Model> models_;
+  // The registry the listing was built from
+  ModelRegistryService::Snapshot snapshot_;
+  std::shared_ptr<Listing> listing_;
+  // No model needs a stat() to know it did not change
+  bool all_watched_ = false;
+  uint64_t parses_ = 0;
+
+  // inotify descriptor, -1 where unavailable
+  int inotify_fd_ = -1;
+  // Watch descriptor to directory
+  std::unordered_map<int, std::string> watches_;
+};
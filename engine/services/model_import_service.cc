@@ -0,0 +1,288 @@
+#include "model_import_service.h"
+#include <trantor/utils/Logger.h>
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+#include <thread>
+#include <unordered_set>
+#include "config/gguf_parser.h"
+#include "config/yaml_config.h"
+#include "utils/file_manager_utils.h"
+#include "utils/modellist_utils.h"
+#include "utils/worker_pool.h"
+
+namespace {
+// Parsing is mostly waiting on the disk, a network share in particular
+constexpr size_t kMaxThreadsPerCore = 4;
+
+bool HasWildcard(const std::string& s) {
+  return s.find_first_of("*?") != std::string::npos;
+}
+
+// * matches any run of characters, ? any one
+bool WildcardMatch(std::string_view name, std::string_view pattern) {
+  size_t n = 0, p = 0;
+  size_t star = std::string_view::npos, resume = 0;
+  while (n < name.size()) {
+    if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n])) {
+      n++;
+      p++;
+    } else if (p < pattern.size() && pattern[p] == '*') {
+      star = p++;
+      resume = n;
+    } else if (star != std::string_view::npos) {
+      p = star + 1;
+      n = ++resume;
+    } else {
+      return false;
+    }
+  }
+  while (p < pattern.size() && pattern[p] == '*') {
+    p++;
+  }
+  return p == pattern.size();
+}
+
+bool IsGGUF(const std::filesystem::path& path) {
+  auto ext = path.extension().string();
+  std::transform(ext.begin(), ext.end(), ext.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return ext == ".gguf";
+}
+
+// Later shards are imported with the first one
+bool IsFirstShard(const std::string& path) {
+  return config::GGUFHandler::ShardNames(path).front() == path;
+}
+}  // namespace
+
+ModelImportService::ModelImportService(ModelRegistryService& registry,
+                                       std::filesystem::path yaml_dir)
+    : registry_(registry), yaml_dir_(std::move(yaml_dir)) {}
+
+ModelImportService& ModelImportService::Global() {
+  static ModelImportService service(
+      ModelRegistryService::Global(),
+      file_manager_utils::GetModelsContainerPath() / "imported");
+  return service;
+}
+
+bool ModelImportService::IsBatch(const std::string& path) {
+  std::error_code ec;
+  return HasWildcard(std::filesystem::path(path).filename().string()) ||
+         std::filesystem::is_directory(path, ec);
+}
+
+std::vector<std::string> ModelImportService::ExpandPath(
+    const std::string& path) {
+  std::vector<std::string> files;
+  std::error_code ec;
+  auto fs_path = std::filesystem::path(path);
+  auto pattern = fs_path.filename().string();
+  if (HasWildcard(pattern)) {
+    auto dir = fs_path.has_parent_path() ? fs_path.parent_path()
+                                         : std::filesystem::path(".");
+    for (auto it = std::filesystem::directory_iterator(dir, ec);
+         !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+      if (it->is_regular_file(ec) &&
+          WildcardMatch(it->path().filename().string(), pattern)) {
+        files.push_back(it->path().string());
+      }
+    }
+  } else if (std::filesystem::is_directory(fs_path, ec)) {
+    auto options = std::filesystem::directory_options::skip_permission_denied;
+    for (auto it = std::filesystem::recursive_directory_iterator(fs_path,
+                                                                 options, ec);
+         !ec && it != std::filesystem::recursive_directory_iterator();
+         it.increment(ec)) {
+      if (it->is_regular_file(ec) && IsGGUF(it->path())) {
+        files.push_back(it->path().string());
+      }
+    }
+  } else if (std::filesystem::is_regular_file(fs_path, ec)) {
+    files.push_back(path);
+  }
+  if (ec) {
+    throw std::runtime_error("Cannot read " + path + ": " + ec.message());
+  }
+  files.erase(std::remove_if(files.begin(), files.end(),
+                             [](const auto& f) { return !IsFirstShard(f); }),
+              files.end());
+  if (files.empty()) {
+    throw std::runtime_error("No GGUF files found at " + path);
+  }
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+std::string ModelImportService::ModelIdFor(const std::string& file_path) {
+  auto name = std::filesystem::path(file_path).filename().string();
+  // "-00001-of-00003.gguf"
+  constexpr size_t kShardSuffix = 20;
+  if (config::GGUFHandler::ShardNames(name).size() > 1) {
+    return name.substr(0, name.size() - kShardSuffix);
+  }
+  return std::filesystem::path(name).stem().string();
+}
+
+std::vector<ModelImportService::Result> ModelImportService::ImportPath(
+    const std::string& path, const std::string& id_prefix) {
+  if (!IsBatch(path)) {
+    return Import({{id_prefix.empty() ? ModelIdFor(path) : id_prefix, path}});
+  }
+  std::vector<Source> sources;
+  for (auto& file : ExpandPath(path)) {
+    auto id = ModelIdFor(file);
+    sources.push_back(
+        {id_prefix.empty() ? id : id_prefix + "-" + id, std::move(file)});
+  }
+  return Import(sources);
+}
+
+std::string ModelImportService::Prepare(
+    const Source& source, const std::string& yaml_path,
+    const config::MemoryBudget& budget) const {
+  try {
+    config::GGUFHandler gguf_handler;
+    config::YamlHandler yaml_handler;
+    gguf_handler.Parse(source.model_path, config::GGUFParseMode::kCached);
+    auto model_config = gguf_handler.GetModelConfig();
+    config::FitModelConfig(gguf_handler, model_config, budget);
+    model_config.files = gguf_handler.GetFiles();
+    model_config.model = source.model_id;
+    model_config.name = source.model_id;
+    yaml_handler.UpdateModelConfig(model_config);
+    // A model_id such as "author/model" puts its model.yml one level down
+    std::filesystem::create_directories(
+        std::filesystem::path(yaml_path).parent_path());
+    yaml_handler.WriteYamlFile(yaml_path);
+    return "";
+  } catch (const std::exception& e) {
+    return "Error importing model path '" + source.model_path +
+           "' with model_id '" + source.model_id + "': " + e.what();
+  }
+}
+
+std::vector<ModelImportService::Result> ModelImportService::Import(
+    const std::vector<Source>& sources) {
+  std::vector<Result> results;
+  results.reserve(sources.size());
+  for (const auto& s : sources) {
+    results.push_back({s.model_id, s.model_path, ""});
+  }
+  if (sources.empty()) {
+    return results;
+  }
+  std::filesystem::create_directories(yaml_dir_);
+  auto yaml_path = [this](const Result& r) {
+    return (yaml_dir_ / (r.model_id + ".yml")).string();
+  };
+  // Written next to the final file, which may belong to a model that is
+  // already registered, and only renamed over it once the entry is added
+  auto temp_path = [&yaml_path](const Result& r) {
+    return yaml_path(r) + ".import";
+  };
+  auto exists = [](const std::string& id) {
+    return "Fail to import model, model_id '" + id + "' already exists!";
+  };
+
+  // Skip the parse of what is certain to be rejected
+  {
+    auto registry = registry_.Get();
+    std::unordered_set<std::string> ids;
+    for (auto& r : results) {
+      if (registry->Contains(r.model_id) || !ids.insert(r.model_id).second) {
+        r.error = exists(r.model_id);
+      }
+    }
+  }
+
+  int budget_percent = config_yaml_utils::kDefaultMemoryBudgetPercent;
+  try {
+    budget_percent = file_manager_utils::GetCortexConfig().memoryBudgetPercent;
+  } catch (const std::exception& e) {
+    LOG_WARN << "Using the default memory budget: " << e.what();
+  }
+  auto budget = config::SystemMemoryBudget(budget_percent, false);
+  {
+    auto cores = std::max(1u, std::thread::hardware_concurrency());
+    WorkerPool pool(std::min(sources.size(), cores * kMaxThreadsPerCore),
+                    sources.size());
+    for (size_t i = 0; i < sources.size(); i++) {
+      if (!results[i].ok()) {
+        continue;
+      }
+      pool.Submit([this, i, &sources, &results, &budget, &temp_path] {
+        results[i].error = Prepare(sources[i], temp_path(results[i]), budget);
+      });
+    }
+    // Joins once every file is prepared
+  }
+
+  // The model.yml is moved into place before its entry is written, so no
+  // entry ever points at a missing file. Still under the registry lock, the
+  // id cannot be taken in between.
+  std::vector<size_t> added;
+  try {
+    registry_.Update([&](modellist_utils::ModelRegistry& registry) {
+      std::vector<modellist_utils::ModelEntry> entries;
+      for (size_t i = 0; i < results.size(); i++) {
+        auto& r = results[i];
+        if (!r.ok()) {
+          continue;
+        }
+        if (registry.Contains(r.model_id)) {
+          // Added by someone else since the check above
+          r.error = exists(r.model_id);
+          continue;
+        }
+        std::error_code ec;
+        std::filesystem::rename(temp_path(r), yaml_path(r), ec);
+        if (ec) {
+          r.error = "Failed to write " + yaml_path(r) + ": " + ec.message();
+          continue;
+        }
+        entries.push_back({r.model_id, "local", "imported", yaml_path(r),
+                           r.model_id, modellist_utils::ModelStatus::READY,
+                           ""});
+        added.push_back(i);
+      }
+      try {
+        registry.PutAll(entries);
+      } catch (const std::exception& e) {
+        // Entries applied before the failure stay, with their files
+        std::erase_if(added, [&](size_t i) {
+          auto& r = results[i];
+          if (registry.Contains(r.model_id)) {
+            return false;
+          }
+          std::error_code ec;
+          std::filesystem::remove(yaml_path(r), ec);
+          r.error = "Failed to register model_id '" + r.model_id +
+                    "': " + e.what();
+          return true;
+        });
+      }
+      return !entries.empty();
+    });
+  } catch (const std::exception& e) {
+    // Those in `added` were registered before the failure
+    for (size_t i = 0; i < results.size(); i++) {
+      auto& r = results[i];
+      if (r.ok() && std::find(added.begin(), added.end(), i) == added.end()) {
+        r.error = "Failed to register model_id '" + r.model_id +
+                  "': " + e.what();
+      }
+    }
+  }
+
+  for (const auto& r : results) {
+    if (!r.ok()) {
+      std::error_code ec;
+      std::filesystem::remove(temp_path(r), ec);
+    }
+  }
+  LOG_INFO << "Imported " << added.size() << " of " << sources.size()
+           << " models";
+  return results;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "config/model_memory_estimator.h"
+#include "services/model_registry_service.h"
+
+/**
+ * Imports local GGUF files as models, many at a time.
+ *
+ * The files of a batch are parsed, fitted to the memory budget and written
+ * out as model.yml files in parallel on a pool of their own, since the
+ * server's WorkerPool may be the caller. The registry entries of all models
+ * that made it are then added in one registry update, a single write and
+ * sync of its log. A file that fails is reported in its Result and does not
+ * stop the others.
+ */
+class ModelImportService {
+ public:
+  struct Source {
+    std::string model_id;
+    std::string model_path;
+  };
+
+  struct Result {
+    std::string model_id;
+    std::string model_path;
+    // Empty if the model was imported
+    std::string error;
+
+    bool ok() const { return error.empty(); }
+  };
+
+  // model.yml files go to `yaml_dir`, as <model_id>.yml
+  ModelImportService(ModelRegistryService& registry,
+                     std::filesystem::path yaml_dir);
+
+  // Over ModelRegistryService::Global(), to models/imported
+  static ModelImportService& Global();
+
+  // In the order of `sources`
+  std::vector<Result> Import(const std::vector<Source>& sources);
+
+  /**
+   * Import() of a file, every .gguf file under a directory, or the files
+   * matching a pattern with * and ? in its last component, e.g.
+   * /mnt/nas/models/llama-*-Q4_K_M.gguf. The model_id of each file is its name
+   * without the extension or shard suffix, after `id_prefix` and a dash if
+   * one is given. A single file is imported as `id_prefix` itself.
+   */
+  std::vector<Result> ImportPath(const std::string& path,
+                                 const std::string& id_prefix);
+
+  // True if `path` is a directory or a pattern rather than one file
+  static bool IsBatch(const std::string& path);
+  // The GGUF files `path` stands for, sorted, only the first shard of a split
+  // model. Throws if it matches nothing.
+  static std::vector<std::string> ExpandPath(const std::string& path);
+  // "model" for model.gguf or model-00001-of-00003.gguf
+  static std::string ModelIdFor(const std::string& file_path);
+
+ private:
+  // Parses `source` and writes its model.yml to `yaml_path`, returns the
+  // error if any
+  std::string Prepare(const Source& source, const std::string& yaml_path,
+                      const config::MemoryBudget& budget) const;
+
+  ModelRegistryService& registry_;
+  const std::filesystem::path yaml_dir_;
+};
@@ -0,0 +1,117 @@
+#include "model_pin_service.h"
+#include <trantor/utils/Logger.h>
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+#include "utils/format_utils.h"
+#include "utils/mapped_file.h"
+
+struct ModelPinService::Entry {
+  PinnedModel info;
+  std::vector<std::unique_ptr<MappedFile>> mappings;
+};
+
+ModelPinService::ModelPinService(uint64_t max_bytes) : max_bytes_(max_bytes) {}
+
+ModelPinService::~ModelPinService() = default;
+
+ModelPinService::PinnedModel ModelPinService::Pin(
+    const std::string& model, const std::vector<std::string>& files) {
+  uint64_t bytes = 0;
+  for (const auto& f : files) {
+    std::error_code ec;
+    auto size = std::filesystem::file_size(f, ec);
+    if (ec) {
+      throw std::runtime_error("Missing model file " + f);
+    }
+    bytes += size;
+  }
+
+  // The budget is reserved first so that two pins cannot both fit in it,
+  // mapping is slow and done outside the lock. A previous pin of the model
+  // stays until the new one is in place, its bytes count as free.
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    uint64_t previous = 0;
+    if (auto it = pins_.find(model); it != pins_.end()) {
+      previous = it->second->info.bytes;
+    }
+    auto used = used_bytes_ - previous;
+    if (used + bytes > max_bytes_) {
+      throw std::runtime_error(
+          "Pinning " + model + " needs " +
+          format_utils::BytesToHumanReadable(bytes) + ", " +
+          format_utils::BytesToHumanReadable(max_bytes_ -
+                                             std::min(max_bytes_, used)) +
+          " of the pinned models budget is left");
+    }
+    used_bytes_ += bytes;
+  }
+
+  auto pin = std::make_unique<Entry>();
+  pin->info.model = model;
+  pin->info.files = files;
+  pin->info.bytes = bytes;
+  pin->info.locked = true;
+  try {
+    for (const auto& f : files) {
+      pin->mappings.push_back(
+          std::make_unique<MappedFile>(f, MappedFile::Mode::kPinned));
+      pin->info.locked = pin->info.locked && pin->mappings.back()->locked();
+    }
+  } catch (...) {
+    std::lock_guard<std::mutex> l(mutex_);
+    used_bytes_ -= bytes;
+    throw;
+  }
+  if (!pin->info.locked) {
+    LOG_WARN << "Could not lock " << model
+             << " in memory, raise RLIMIT_MEMLOCK to keep it from being "
+                "evicted";
+  }
+  LOG_INFO << "Pinned " << model << ": "
+           << format_utils::BytesToHumanReadable(bytes);
+
+  auto info = pin->info;
+  std::unique_ptr<Entry> replaced;
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    // The previous pin, or that of a concurrent Pin of the same model
+    if (auto it = pins_.find(model); it != pins_.end()) {
+      replaced = std::move(it->second);
+      used_bytes_ -= replaced->info.bytes;
+    }
+    pins_[model] = std::move(pin);
+  }
+  return info;
+}
+
+bool ModelPinService::Unpin(const std::string& model) {
+  std::unique_ptr<Entry> pin;
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    auto it = pins_.find(model);
+    if (it == pins_.end()) {
+      return false;
+    }
+    pin = std::move(it->second);
+    used_bytes_ -= pin->info.bytes;
+    pins_.erase(it);
+  }
+  LOG_INFO << "Unpinned " << model;
+  return true;
+}
+
+std::vector<ModelPinService::PinnedModel> ModelPinService::List() const {
+  std::lock_guard<std::mutex> l(mutex_);
+  std::vector<PinnedModel> models;
+  for (const auto& [model, pin] : pins_) {
+    models.push_back(pin->info);
+  }
+  return models;
+}
+
+uint64_t ModelPinService::UsedBytes() const {
+  std::lock_guard<std::mutex> l(mutex_);
+  return used_bytes_;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Keeps the files of hot models resident in memory, whether or not an engine
+ * has them loaded.
+ *
+ * Each file is mapped read-only with MAP_POPULATE and locked with mlock, so
+ * other I/O cannot evict it from the page cache and reloading the model reads
+ * it from memory. Pins share one byte budget. When the process may not lock
+ * that much (RLIMIT_MEMLOCK), the mapping is still kept and populated, which
+ * keeps the pages referenced, and the pin reports that it is not locked.
+ */
+class ModelPinService {
+ public:
+  struct PinnedModel {
+    std::string model;
+    std::vector<std::string> files;
+    uint64_t bytes = 0;
+    // False when mlock was refused and the pages are only mapped
+    bool locked = false;
+  };
+
+  explicit ModelPinService(uint64_t max_bytes);
+  ~ModelPinService();
+
+  /**
+   * Maps and locks `files` under `model`, replacing any previous pin of it
+   * once they are. Throws if they do not fit in what is left of the budget
+   * or cannot be mapped, a previous pin is then kept.
+   */
+  PinnedModel Pin(const std::string& model,
+                  const std::vector<std::string>& files);
+  // False if the model was not pinned
+  bool Unpin(const std::string& model);
+
+  std::vector<PinnedModel> List() const;
+  uint64_t UsedBytes() const;
+  uint64_t MaxBytes() const { return max_bytes_; }
+
+ private:
+  struct Entry;
+
+  uint64_t max_bytes_;
+  uint64_t used_bytes_ = 0;
+  std::unordered_map<std::string, std::unique_ptr<Entry>> pins_;
+  mutable std::mutex mutex_;
+};
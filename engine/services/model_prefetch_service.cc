@@ -0,0 +1,295 @@
+#include "model_prefetch_service.h"
+#include <trantor/utils/Logger.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <iterator>
+#include <map>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "utils/format_utils.h"
+
+namespace {
+// Tensors are padded to general.alignment, a gap that small is read through
+constexpr uint64_t kMaxMergeGap = 4096;
+
+// Reads [offset, offset + length) of a file into `buf`, which only serves to
+// pull the pages into the page cache
+class ChunkReader {
+ public:
+  ~ChunkReader() {
+#ifndef _WIN32
+    for (auto& [path, fd] : fds_) {
+      close(fd);
+    }
+#endif
+  }
+
+  bool Read(const std::string& path, uint64_t offset, uint64_t length,
+            std::vector<char>& buf) {
+    buf.resize(std::max<size_t>(buf.size(), length));
+#ifdef _WIN32
+    auto& f = files_[path];
+    if (!f.is_open()) {
+      f.open(path, std::ios::binary);
+    }
+    f.clear();
+    f.seekg(offset);
+    return static_cast<bool>(f.read(buf.data(), length));
+#else
+    auto it = fds_.find(path);
+    if (it == fds_.end()) {
+      int fd = open(path.c_str(), O_RDONLY);
+      if (fd < 0) {
+        return false;
+      }
+#if defined(POSIX_FADV_SEQUENTIAL)
+      posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+      it = fds_.emplace(path, fd).first;
+    }
+    while (length > 0) {
+      auto n = pread(it->second, buf.data(), length, offset);
+      if (n <= 0) {
+        return false;
+      }
+      offset += n;
+      length -= n;
+    }
+    return true;
+#endif
+  }
+
+ private:
+#ifdef _WIN32
+  std::map<std::string, std::ifstream> files_;
+#else
+  std::map<std::string, int> fds_;
+#endif
+};
+}  // namespace
+
+struct ModelPrefetchService::Job {
+  std::string model;
+  // Ranges cut into chunks of at most kChunkBytes, in read order
+  std::vector<Range> chunks;
+  uint64_t total_bytes = 0;
+  std::atomic<size_t> next{0};
+  std::atomic<uint64_t> done_bytes{0};
+  std::atomic<size_t> running{0};
+  std::atomic<bool> cancelled{false};
+  std::chrono::steady_clock::time_point start;
+  std::atomic<int64_t> elapsed_ns{-1};
+  std::vector<std::thread> threads;
+  std::mutex done_mutex;
+  std::condition_variable done_cv;
+
+  void Join() {
+    for (auto& t : threads) {
+      if (t.joinable()) {
+        t.join();
+      }
+    }
+  }
+};
+
+ModelPrefetchService::ModelPrefetchService(size_t n_threads)
+    : n_threads_(std::max<size_t>(1, n_threads)) {}
+
+ModelPrefetchService::~ModelPrefetchService() {
+  std::lock_guard<std::mutex> l(mutex_);
+  for (auto& [model, job] : jobs_) {
+    job->cancelled = true;
+  }
+  for (auto& [model, job] : jobs_) {
+    job->Join();
+  }
+  for (auto& job : retired_) {
+    job->Join();
+  }
+}
+
+std::vector<ModelPrefetchService::Range> ModelPrefetchService::PlanRanges(
+    const std::vector<config::GGUFShard>& shards,
+    const std::vector<config::GGUFTensorInfo>& tensors, uint64_t max_bytes) {
+  std::vector<Range> ranges;
+  uint64_t planned = 0;
+  auto add = [&](const std::string& path, uint64_t offset, uint64_t length) {
+    bool merge = false;
+    if (!ranges.empty()) {
+      auto last_end = ranges.back().offset + ranges.back().length;
+      merge = ranges.back().path == path && offset >= last_end &&
+              offset - last_end <= kMaxMergeGap;
+      if (merge) {
+        // Read the padding too
+        length += offset - last_end;
+        offset = last_end;
+      }
+    }
+    length = std::min(length, max_bytes - planned);
+    if (length == 0) {
+      return;
+    }
+    planned += length;
+    if (merge) {
+      ranges.back().length += length;
+    } else {
+      ranges.push_back(Range{path, offset, length});
+    }
+  };
+  if (shards.empty()) {
+    return ranges;
+  }
+  // Metadata and the tensor table are read before any weight
+  add(shards[0].path, 0, shards[0].tensor_data_offset);
+  for (const auto& t : tensors) {
+    if (t.shard >= shards.size()) {
+      continue;
+    }
+    const auto& shard = shards[t.shard];
+    add(shard.path, shard.tensor_data_offset + t.offset, t.size);
+  }
+  return ranges;
+}
+
+void ModelPrefetchService::Start(const std::string& model,
+                                 std::vector<Range> ranges) {
+  auto job = std::make_shared<Job>();
+  job->model = model;
+  for (const auto& r : ranges) {
+    for (uint64_t o = 0; o < r.length; o += kChunkBytes) {
+      job->chunks.push_back(
+          Range{r.path, r.offset + o, std::min(kChunkBytes, r.length - o)});
+    }
+    job->total_bytes += r.length;
+  }
+
+  std::vector<std::shared_ptr<Job>> finished;
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    // Not joined here, the caller may be an IO thread; its threads stop
+    // after their current chunk and are joined by a later call
+    if (auto it = jobs_.find(model); it != jobs_.end()) {
+      it->second->cancelled = true;
+      retired_.push_back(std::move(it->second));
+      jobs_.erase(it);
+    }
+    finished = ReapLocked();
+    if (!job->chunks.empty()) {
+      job->start = std::chrono::steady_clock::now();
+      auto n = std::min(n_threads_, job->chunks.size());
+      job->running = n;
+      for (size_t i = 0; i < n; ++i) {
+        job->threads.emplace_back([j = job.get()]() { Run(*j); });
+      }
+      LOG_INFO << "Prefetching "
+               << format_utils::BytesToHumanReadable(job->total_bytes)
+               << " of " << model << " on " << n << " threads";
+      jobs_[model] = std::move(job);
+    }
+  }
+  for (auto& j : finished) {
+    j->Join();
+  }
+}
+
+std::vector<std::shared_ptr<ModelPrefetchService::Job>>
+ModelPrefetchService::ReapLocked() {
+  std::vector<std::shared_ptr<Job>> finished;
+  auto it = std::partition(retired_.begin(), retired_.end(),
+                           [](const auto& job) { return job->elapsed_ns < 0; });
+  std::move(it, retired_.end(), std::back_inserter(finished));
+  retired_.erase(it, retired_.end());
+  return finished;
+}
+
+void ModelPrefetchService::Run(Job& job) {
+  ChunkReader reader;
+  std::vector<char> buf;
+  for (auto i = job.next++; i < job.chunks.size() && !job.cancelled;
+       i = job.next++) {
+    const auto& c = job.chunks[i];
+    if (!reader.Read(c.path, c.offset, c.length, buf)) {
+      LOG_WARN << "Stopped prefetching " << job.model << ": could not read "
+               << c.path;
+      job.cancelled = true;
+      break;
+    }
+    job.done_bytes += c.length;
+  }
+  // The last thread out reports
+  if (--job.running == 0) {
+    auto elapsed = std::chrono::steady_clock::now() - job.start;
+    job.elapsed_ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    auto seconds = std::chrono::duration<double>(elapsed).count();
+    LOG_INFO << (job.cancelled ? "Cancelled prefetch of " : "Prefetched ")
+             << job.model << ": "
+             << format_utils::BytesToHumanReadable(job.done_bytes) << " in "
+             << seconds << "s, "
+             << format_utils::BytesToHumanReadable(static_cast<uint64_t>(
+                    seconds > 0 ? job.done_bytes / seconds : 0))
+             << "/s";
+    std::lock_guard<std::mutex> l(job.done_mutex);
+    job.done_cv.notify_all();
+  }
+}
+
+void ModelPrefetchService::Cancel(const std::string& model) {
+  std::shared_ptr<Job> job;
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    auto it = jobs_.find(model);
+    if (it == jobs_.end()) {
+      return;
+    }
+    job = std::move(it->second);
+    jobs_.erase(it);
+  }
+  job->cancelled = true;
+  job->Join();
+}
+
+bool ModelPrefetchService::Has(const std::string& model) const {
+  std::lock_guard<std::mutex> l(mutex_);
+  return jobs_.count(model) > 0;
+}
+
+void ModelPrefetchService::Wait(const std::string& model) {
+  std::shared_ptr<Job> job;
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    auto it = jobs_.find(model);
+    if (it == jobs_.end()) {
+      return;
+    }
+    job = it->second;
+  }
+  std::unique_lock<std::mutex> l(job->done_mutex);
+  job->done_cv.wait(l, [&job]() { return job->elapsed_ns >= 0; });
+}
+
+std::optional<ModelPrefetchService::Progress> ModelPrefetchService::GetProgress(
+    const std::string& model) const {
+  std::lock_guard<std::mutex> l(mutex_);
+  auto it = jobs_.find(model);
+  if (it == jobs_.end()) {
+    return std::nullopt;
+  }
+  const auto& job = *it->second;
+  Progress p;
+  p.total_bytes = job.total_bytes;
+  p.done_bytes = job.done_bytes;
+  auto elapsed_ns = job.elapsed_ns.load();
+  p.finished = elapsed_ns >= 0;
+  p.seconds = p.finished ? elapsed_ns / 1e9
+                         : std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - job.start)
+                               .count();
+  return p;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "config/gguf_parser.h"
+
+/**
+ * Reads model files into the page cache while the engine loads them.
+ *
+ * A cold model is otherwise read through page faults as the engine touches
+ * its tensors, a few pages at a time. The prefetcher reads the same bytes
+ * ahead of it in large sequential chunks on several threads, in the order of
+ * the GGUF tensor table, which is the order the engine loads them in.
+ */
+class ModelPrefetchService {
+ public:
+  static constexpr size_t kDefaultThreads = 4;
+  static constexpr uint64_t kChunkBytes = 8ull << 20;
+
+  struct Range {
+    std::string path;
+    uint64_t offset;
+    uint64_t length;
+  };
+
+  struct Progress {
+    uint64_t total_bytes = 0;
+    uint64_t done_bytes = 0;
+    double seconds = 0;
+    bool finished = false;
+
+    double BytesPerSecond() const {
+      return seconds > 0 ? done_bytes / seconds : 0;
+    }
+  };
+
+  explicit ModelPrefetchService(size_t n_threads = kDefaultThreads);
+  // Cancels and waits for every prefetch
+  ~ModelPrefetchService();
+
+  /**
+   * The header of the first shard, then the data of every tensor in table
+   * order, with adjacent tensors merged into one range. Stops after
+   * `max_bytes`, reading more than fits in memory would evict what was just
+   * read.
+   */
+  static std::vector<Range> PlanRanges(
+      const std::vector<config::GGUFShard>& shards,
+      const std::vector<config::GGUFTensorInfo>& tensors, uint64_t max_bytes);
+
+  // Replaces any prefetch already running for the model, without waiting
+  // for it to stop
+  void Start(const std::string& model, std::vector<Range> ranges);
+  void Cancel(const std::string& model);
+  void Wait(const std::string& model);
+  // A prefetch of the model is running or finished, and was not cancelled
+  bool Has(const std::string& model) const;
+  std::optional<Progress> GetProgress(const std::string& model) const;
+
+ private:
+  struct Job;
+
+  static void Run(Job& job);
+  // Takes the replaced jobs whose threads are done, to be joined
+  std::vector<std::shared_ptr<Job>> ReapLocked();
+
+  size_t n_threads_;
+  std::unordered_map<std::string, std::shared_ptr<Job>> jobs_;
+  // Replaced by a newer Start(), still stopping
+  std::vector<std::shared_ptr<Job>> retired_;
+  mutable std::mutex mutex_;
+};
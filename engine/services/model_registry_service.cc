@@ -0,0 +1,135 @@
+#include "model_registry_service.h"
+#include <trantor/utils/Logger.h>
+#include <mutex>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+// Exclusive advisory lock on a file, held until destruction. Only keeps out
+// other cortex processes, which all take it before writing the registry.
+class ModelRegistryService::FileLock {
+ public:
+  explicit FileLock(const std::filesystem::path& path) {
+#ifdef _WIN32
+    handle_ = CreateFileW(path.wstring().c_str(), GENERIC_READ | GENERIC_WRITE,
+                          FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                          OPEN_ALWAYS, 0, nullptr);
+    if (handle_ == INVALID_HANDLE_VALUE) {
+      throw std::runtime_error("Failed to open " + path.string());
+    }
+    OVERLAPPED overlapped{};
+    if (!LockFileEx(handle_, LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD,
+                    &overlapped)) {
+      CloseHandle(handle_);
+      throw std::runtime_error("Failed to lock " + path.string());
+    }
+#else
+    fd_ = open(path.string().c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+      throw std::runtime_error("Failed to open " + path.string());
+    }
+    int rc;
+    while ((rc = flock(fd_, LOCK_EX)) != 0 && errno == EINTR) {
+    }
+    if (rc != 0) {
+      close(fd_);
+      throw std::runtime_error("Failed to lock " + path.string());
+    }
+#endif
+  }
+
+  ~FileLock() {
+#ifdef _WIN32
+    OVERLAPPED overlapped{};
+    UnlockFileEx(handle_, 0, MAXDWORD, MAXDWORD, &overlapped);
+    CloseHandle(handle_);
+#else
+    flock(fd_, LOCK_UN);
+    close(fd_);
+#endif
+  }
+
+  FileLock(const FileLock&) = delete;
+  FileLock& operator=(const FileLock&) = delete;
+
+ private:
+#ifdef _WIN32
+  HANDLE handle_;
+#else
+  int fd_;
+#endif
+};
+
+ModelRegistryService::ModelRegistryService(std::filesystem::path path,
+                                           std::filesystem::path legacy_list)
+    : path_(std::move(path)) {
+  lock_path_ = path_;
+  lock_path_ += ".lock";
+  std::error_code ec;
+  std::filesystem::create_directories(path_.parent_path(), ec);
+  // Another process may be creating or migrating it right now
+  FileLock lock(lock_path_);
+  registry_ = std::make_unique<modellist_utils::ModelRegistry>(
+      path_, std::move(legacy_list));
+  std::unique_lock<std::shared_mutex> l(mutex_);
+  Publish();
+}
+
+ModelRegistryService& ModelRegistryService::Global() {
+  static ModelRegistryService registry(
+      modellist_utils::ModelListUtils::kModelRegistryPath,
+      modellist_utils::ModelListUtils::kModelListPath);
+  return registry;
+}
+
+bool ModelRegistryService::ChangedOnDisk() const {
+  binary_io_utils::FileIdentity id;
+  return binary_io_utils::GetFileIdentity(path_, id) && !(id == seen_);
+}
+
+void ModelRegistryService::Publish() {
+  // Taken before the refresh: whatever is appended after it is picked up by
+  // the next reader
+  binary_io_utils::GetFileIdentity(path_, seen_);
+  registry_->Refresh();
+  snapshot_ =
+      std::make_shared<const modellist_utils::ModelRegistry>(*registry_);
+}
+
+ModelRegistryService::Snapshot ModelRegistryService::Get() {
+  {
+    std::shared_lock<std::shared_mutex> l(mutex_);
+    if (!ChangedOnDisk()) {
+      return snapshot_;
+    }
+  }
+  std::unique_lock<std::shared_mutex> l(mutex_);
+  // Someone else may have caught up while this waited
+  if (ChangedOnDisk()) {
+    LOG_DEBUG << "Model registry changed on disk, refreshing";
+    Publish();
+  }
+  return snapshot_;
+}
+
+bool ModelRegistryService::Update(const Mutation& mutate) {
+  std::unique_lock<std::shared_mutex> l(mutex_);
+  FileLock lock(lock_path_);
+  registry_->Refresh();
+  bool changed = false;
+  try {
+    changed = mutate(*registry_);
+  } catch (...) {
+    // Records written before the failure stay, show them
+    Publish();
+    throw;
+  }
+  Publish();
+  return changed;
+}
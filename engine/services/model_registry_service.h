@@ -0,0 +1,59 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <shared_mutex>
+#include "utils/binary_io_utils.h"
+#include "utils/model_registry.h"
+
+/**
+ * The one model registry of this process, shared by the HTTP handlers and the
+ * CLI commands.
+ *
+ * Readers get an immutable snapshot and only ever take the shared side of the
+ * lock, so concurrent listings and lookups do not wait on each other. A
+ * snapshot stays consistent while it is held, whatever is written meanwhile.
+ * When another process (the CLI next to a running server) changed the file,
+ * the next reader applies its records first.
+ *
+ * Writers are serialized within the process by the lock and across processes
+ * by an advisory lock on a file next to the registry, and only return once
+ * their record is on the disk.
+ */
+class ModelRegistryService {
+ public:
+  using Snapshot = std::shared_ptr<const modellist_utils::ModelRegistry>;
+  // Returns true if it changed the registry
+  using Mutation = std::function<bool(modellist_utils::ModelRegistry&)>;
+
+  ModelRegistryService(std::filesystem::path path,
+                       std::filesystem::path legacy_list = {});
+
+  /**
+   * Registry at ModelListUtils::kModelRegistryPath, opened on first use.
+   */
+  static ModelRegistryService& Global();
+
+  Snapshot Get();
+
+  /**
+   * Runs `mutate` on the latest registry, holding both locks.
+   */
+  bool Update(const Mutation& mutate);
+
+ private:
+  class FileLock;
+
+  // Call with mutex_ held exclusively
+  void Publish();
+  bool ChangedOnDisk() const;
+
+  std::filesystem::path path_;
+  std::filesystem::path lock_path_;
+  mutable std::shared_mutex mutex_;
+  std::unique_ptr<modellist_utils::ModelRegistry> registry_;
+  Snapshot snapshot_;
+  // Of the file when snapshot_ was taken
+  binary_io_utils::FileIdentity seen_;
+};
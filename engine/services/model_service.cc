@@ -2,9 +2,13 @@
 #include <filesystem>
 #include <iostream>
 #include <ostream>
+#include "config/gguf_parser.h"
+#include "config/model_memory_estimator.h"
+#include "services/remote_gguf_inspector.h"
 #include "utils/cli_selection_utils.h"
 #include "utils/cortexso_parser.h"
 #include "utils/file_manager_utils.h"
+#include "utils/format_utils.h"
 #include "utils/huggingface_utils.h"
 #include "utils/logging_utils.h"
 #include "utils/model_callback_utils.h"
@@ -87,7 +91,8 @@ std::optional<config::ModelConfig> ModelService::GetDownloadedModel(
   return std::nullopt;
 }
 
-void ModelService::DownloadModelByDirectUrl(const std::string& url) {
+void ModelService::DownloadModelByDirectUrl(
+    const std::string& url, std::optional<std::string> checksum) {
   auto url_obj = url_parser::FromUrlString(url);
 
   if (url_obj.host == kHuggingFaceHost) {
@@ -111,6 +116,9 @@ void ModelService::DownloadModelByDirectUrl(const std::string& url) {
   }
 
   auto download_url = url_parser::FromUrl(url_obj);
+  if (!ConfirmModelFits(download_url)) {
+    return;
+  }
   // this assume that the model being downloaded is a single gguf file
   auto downloadTask{DownloadTask{.id = model_id,
                                  .type = DownloadType::Model,
@@ -118,6 +126,7 @@ void ModelService::DownloadModelByDirectUrl(const std::string& url) {
                                      .id = url_obj.pathParams.back(),
                                      .downloadUrl = download_url,
                                      .localPath = local_path,
+                                     .checksum = checksum,
                                  }}}};
 
   auto on_finished = [](const DownloadTask& finishedTask) {
@@ -133,6 +142,19 @@ void ModelService::DownloadModelFromCortexso(const std::string& name,
                                              const std::string& branch) {
   auto downloadTask = cortexso_parser::getDownloadTask(name, branch);
   if (downloadTask.has_value()) {
+    for (const auto& item : downloadTask->items) {
+      if (!string_utils::EndsWith(item.downloadUrl, ".gguf")) {
+        continue;
+      }
+      // The first shard's inspection already covers the whole split model
+      auto shards = config::GGUFHandler::ShardNames(item.downloadUrl);
+      if (!shards.empty() && shards.front() != item.downloadUrl) {
+        continue;
+      }
+      if (!ConfirmModelFits(item.downloadUrl)) {
+        return;
+      }
+    }
     DownloadService().AddDownloadTask(downloadTask.value(),
                                       model_callback_utils::DownloadModelCb);
     CLI_LOG("Model " << name << " downloaded successfully!")
@@ -168,5 +190,56 @@ void ModelService::DownloadHuggingFaceGgufModel(
 
   auto download_url = huggingface_utils::GetDownloadableUrl(author, modelName,
                                                             selection.value());
-  DownloadModelByDirectUrl(download_url);
+  std::optional<std::string> checksum;
+  for (const auto& sibling : repo_info->siblings) {
+    if (sibling.rfilename == selection.value()) {
+      checksum = sibling.sha256;
+    }
+  }
+  DownloadModelByDirectUrl(download_url, checksum);
+}
+
+bool ModelService::ConfirmModelFits(const std::string& url) {
+  RemoteModelEstimate estimate;
+  try {
+    estimate = RemoteGGUFInspector().Inspect(url);
+  } catch (const std::exception& e) {
+    CTL_WRN("Could not inspect " << url << " before download: " << e.what());
+    return true;
+  }
+  if (estimate.ctx_len <= 0 || estimate.profile.n_layer == 0) {
+    return true;
+  }
+
+  auto budget = config::SystemMemoryBudget(
+      file_manager_utils::GetCortexConfig().memoryBudgetPercent, false);
+  auto max_ngl = static_cast<int>(estimate.profile.n_layer) + 1;
+  auto fit = config::FitToMemory(estimate.profile, budget, estimate.ctx_len,
+                                 max_ngl);
+  CLI_LOG("Model needs "
+          << format_utils::BytesToHumanReadable(estimate.required_bytes)
+          << " of memory at its context length of " << estimate.ctx_len
+          << " (" << format_utils::BytesToHumanReadable(estimate.weight_bytes)
+          << " of " << estimate.main_type << " weights)");
+  if (fit.fits) {
+    if (fit.ctx_len < estimate.ctx_len) {
+      CLI_LOG("It will run with ctx_len " << fit.ctx_len
+                                          << " to fit the memory budget");
+    }
+    return true;
+  }
+
+  CLI_LOG("Warning: the model does not fit the memory budget of "
+          << format_utils::BytesToHumanReadable(budget.ram_bytes) << " RAM"
+          << (budget.vram_bytes > 0
+                  ? " and " +
+                        format_utils::BytesToHumanReadable(budget.vram_bytes) +
+                        " VRAM"
+                  : "")
+          << " even at ctx_len " << fit.ctx_len
+          << ". A smaller quantization may fit.");
+  std::cout << "Download anyway? [y/N]: " << std::flush;
+  std::string answer;
+  std::cin >> answer;
+  return answer == "Y" || answer == "y";
 }
@@ -14,7 +14,9 @@ class ModelService {
       const std::string& modelId) const;
 
  private:
-  void DownloadModelByDirectUrl(const std::string& url);
+  void DownloadModelByDirectUrl(
+      const std::string& url,
+      std::optional<std::string> checksum = std::nullopt);
 
   void DownloadModelFromCortexso(const std::string& name,
                                  const std::string& branch = "main");
@@ -28,6 +30,13 @@ class ModelService {
 
   void DownloadModelByModelName(const std::string& modelName);
 
+  /**
+   * Reads the header of the GGUF model at `url` to estimate the memory it
+   * needs at its context length, and asks before downloading one that does
+   * not fit the memory budget. False if the user declines.
+   */
+  bool ConfirmModelFits(const std::string& url);
+
   DownloadService download_service_;
 
   constexpr auto static kHuggingFaceHost = "huggingface.co";
@@ -0,0 +1,105 @@
+#include "remote_gguf_inspector.h"
+#include <httplib.h>
+#include <trantor/utils/Logger.h>
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include "utils/format_utils.h"
+#include "utils/url_parser.h"
+
+RemoteGGUFInspector::RemoteGGUFInspector() : read_(&HttpRange) {}
+
+RemoteGGUFInspector::RemoteGGUFInspector(
+    config::GGUFHandler::RangeReader read)
+    : read_(std::move(read)) {}
+
+std::string RemoteGGUFInspector::HttpRange(const std::string& url,
+                                           uint64_t offset, uint64_t length) {
+  if (length == 0) {
+    return {};
+  }
+  auto url_obj = url_parser::FromUrlString(url);
+  httplib::Client cli(url_obj.GetProtocolAndHost());
+  // Hugging Face redirects to its CDN
+  cli.set_follow_location(true);
+  httplib::Headers headers{
+      {"Range", "bytes=" + std::to_string(offset) + "-" +
+                    std::to_string(offset + length - 1)}};
+
+  int status = 0;
+  std::string body;
+  auto res = cli.Get(
+      url_obj.GetPathAndQuery(), headers,
+      [&status, offset](const httplib::Response& r) {
+        status = r.status;
+        // A server ignoring the range sends the whole file, which is only
+        // usable for the head, and only until `length` bytes are in
+        return r.status == httplib::StatusCode::PartialContent_206 ||
+               (r.status == httplib::StatusCode::OK_200 && offset == 0);
+      },
+      [&body, length](const char* data, size_t n) {
+        body.append(data, std::min<uint64_t>(n, length - body.size()));
+        return body.size() < length;
+      });
+
+  if (status == httplib::StatusCode::RangeNotSatisfiable_416) {
+    return {};
+  }
+  if (status == httplib::StatusCode::OK_200 && offset > 0) {
+    throw std::runtime_error(url_obj.host +
+                             " does not support HTTP range requests");
+  }
+  if (status != httplib::StatusCode::PartialContent_206 &&
+      status != httplib::StatusCode::OK_200) {
+    if (status == 0) {
+      throw std::runtime_error("Failed to read " + url + ": " +
+                               httplib::to_string(res.error()));
+    }
+    throw std::runtime_error("Failed to read " + url + ": HTTP " +
+                             std::to_string(status));
+  }
+  return body;
+}
+
+RemoteModelEstimate RemoteGGUFInspector::Inspect(const std::string& url) {
+  // Shards are read in parallel
+  std::atomic<uint64_t> fetched{0};
+  auto counting_read = [this, &fetched](const std::string& path,
+                                        uint64_t offset, uint64_t length) {
+    auto bytes = read_(path, offset, length);
+    fetched += bytes.size();
+    return bytes;
+  };
+
+  config::GGUFHandler handler;
+  handler.ParseHead(url, counting_read);
+
+  RemoteModelEstimate e;
+  e.architecture =
+      handler.GetString(config::GGUFKey::kGeneralArchitecture).value_or("");
+  e.urls = handler.GetFiles();
+  e.fetched_bytes = fetched;
+  e.profile = config::ModelMemoryProfile::FromGGUF(handler);
+  auto summary = handler.GetTensorSummary();
+  e.weight_bytes = summary.total_bytes;
+  uint64_t main_type_bytes = 0;
+  for (const auto& [type, bytes] : summary.type_bytes) {
+    if (bytes > main_type_bytes) {
+      e.main_type = type;
+      main_type_bytes = bytes;
+    }
+  }
+  e.ctx_len = e.profile.n_ctx_train > 0
+                  ? static_cast<int>(e.profile.n_ctx_train)
+                  : handler.GetModelConfig().ctx_len;
+  e.required_bytes = e.profile.WeightBytes() +
+                     e.profile.KvCacheBytes(e.ctx_len) +
+                     config::kComputeBufferBytes;
+  LOG_INFO << "Inspected " << url << ": "
+           << format_utils::BytesToHumanReadable(e.weight_bytes)
+           << " of weights, needs "
+           << format_utils::BytesToHumanReadable(e.required_bytes) << " at "
+           << e.ctx_len << " tokens, read "
+           << format_utils::BytesToHumanReadable(e.fetched_bytes);
+  return e;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "config/gguf_parser.h"
+#include "config/model_memory_estimator.h"
+
+// What a model behind a download URL needs, learned from its header alone
+struct RemoteModelEstimate {
+  std::string architecture;
+  // Shards of a split model, in order
+  std::vector<std::string> urls;
+  // Weights of all shards, roughly the download size
+  uint64_t weight_bytes = 0;
+  // Bytes actually fetched to get here
+  uint64_t fetched_bytes = 0;
+  // The model's own context length, from its metadata
+  int ctx_len = 0;
+  // Weights, KV cache at ctx_len and the compute buffer
+  uint64_t required_bytes = 0;
+  // The quantization type holding most of the weights, e.g. "Q4_K"
+  std::string main_type;
+  config::ModelMemoryProfile profile;
+};
+
+/**
+ * Reads the GGUF header, metadata and tensor table of a model through HTTP
+ * Range requests, without downloading its weights. A few MB are enough to
+ * know whether a 40GB file will fit before it is downloaded.
+ */
+class RemoteGGUFInspector {
+ public:
+  // Range requests over HTTP(S), following redirects
+  RemoteGGUFInspector();
+  // Reads through `read` instead, for sources other than HTTP
+  explicit RemoteGGUFInspector(config::GGUFHandler::RangeReader read);
+
+  // Throws if the URL cannot be read or is not a GGUF model
+  RemoteModelEstimate Inspect(const std::string& url);
+
+  // One "Range: bytes=" GET, fewer bytes past the end of the file
+  static std::string HttpRange(const std::string& url, uint64_t offset,
+                               uint64_t length);
+
+ private:
+  config::GGUFHandler::RangeReader read_;
+};
@@ -0,0 +1,125 @@
+// Compares downloading one large file over one connection and over several
+// range requests, then times a task of many small files.
+//
+// Usage: download_benchmark [size_mb] [per_connection_mb_per_s] [small_files]
+// An in-process HTTP server stands in for a CDN: it answers range requests
+// and caps each connection at `per_connection_mb_per_s` (default 50), the way
+// a single connection to Hugging Face or a CDN tops out below line rate. Each
+// of the `small_files` (default 300) is answered after a round trip's delay.
+#include <httplib.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "services/download_service.h"
+
+namespace {
+// Stands in for the round trip to a remote host
+constexpr auto kRoundTrip = std::chrono::milliseconds(50);
+
+char ByteAt(uint64_t offset) {
+  return static_cast<char>((offset * 2654435761u) >> 24);
+}
+
+bool Verify(const std::filesystem::path& path, uint64_t size) {
+  std::ifstream f(path, std::ios::binary);
+  std::vector<char> buf(1 << 20);
+  uint64_t offset = 0;
+  while (offset < size) {
+    auto n = std::min<uint64_t>(buf.size(), size - offset);
+    if (!f.read(buf.data(), n)) {
+      return false;
+    }
+    for (uint64_t i = 0; i < n; i++) {
+      if (buf[i] != ByteAt(offset + i)) {
+        return false;
+      }
+    }
+    offset += n;
+  }
+  return std::filesystem::file_size(path) == size;
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  uint64_t size = (argc > 1 ? std::stoull(argv[1]) : 1024) << 20;
+  double cap = (argc > 2 ? std::stod(argv[2]) : 50) * (1 << 20);
+  int small_files = argc > 3 ? std::stoi(argv[3]) : 300;
+
+  httplib::Server server;
+  // Ranges of a content provider are answered with 206 by httplib
+  server.Get("/model.gguf", [size, cap](const httplib::Request&,
+                                        httplib::Response& res) {
+    res.set_content_provider(
+        size, "application/octet-stream",
+        [cap](size_t offset, size_t length, httplib::DataSink& sink) {
+          constexpr size_t kChunk = 256 << 10;
+          std::string chunk(std::min(length, kChunk), '\0');
+          for (size_t i = 0; i < chunk.size(); i++) {
+            chunk[i] = ByteAt(offset + i);
+          }
+          // Paces this connection to `cap`
+          std::this_thread::sleep_for(
+              std::chrono::duration<double>(chunk.size() / cap));
+          return sink.write(chunk.data(), chunk.size());
+        });
+  });
+  server.Get(R"(/small/(\d+)\.json)", [](const httplib::Request& req,
+                                          httplib::Response& res) {
+    std::this_thread::sleep_for(kRoundTrip);
+    res.set_content("{\"file\": " + req.matches[1].str() + "}",
+                    "application/json");
+  });
+  server.new_task_queue = [] { return new httplib::ThreadPool(64); };
+  auto port = server.bind_to_any_port("127.0.0.1");
+  std::thread listener([&server] { server.listen_after_bind(); });
+  server.wait_until_ready();
+
+  auto url = "http://127.0.0.1:" + std::to_string(port) + "/model.gguf";
+  auto path = std::filesystem::temp_directory_path() / "download_benchmark";
+  std::cout << size / (1 << 20) << " MiB, "
+            << cap / (1 << 20) << " MiB/s per connection\n";
+  for (int connections : {1, 2, 4, 8, 16}) {
+    std::filesystem::remove(path);
+    DownloadTask task{"benchmark", DownloadType::Miscellaneous,
+                      {DownloadItem{"model", url, path}}};
+    auto start = std::chrono::steady_clock::now();
+    DownloadService(connections).AddDownloadTask(task);
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::cout << connections << " connections: "
+              << size / (1 << 20) / elapsed.count() << " MiB/s"
+              << (Verify(path, size) ? "" : " (corrupted)") << "\n";
+  }
+  std::filesystem::remove(path);
+
+  auto dir = std::filesystem::temp_directory_path() / "download_small";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  DownloadTask task{"benchmark", DownloadType::Miscellaneous, {}};
+  for (int i = 0; i < small_files; i++) {
+    auto name = std::to_string(i) + ".json";
+    task.items.push_back(
+        DownloadItem{name,
+                     "http://127.0.0.1:" + std::to_string(port) + "/small/" +
+                         name,
+                     dir / name});
+  }
+  auto start = std::chrono::steady_clock::now();
+  DownloadService().AddDownloadTask(task);
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::cout << small_files << " small files, "
+            << kRoundTrip.count() << " ms round trip: " << elapsed.count()
+            << " s\n";
+  std::filesystem::remove_all(dir);
+
+  server.stop();
+  listener.join();
+  return 0;
+}
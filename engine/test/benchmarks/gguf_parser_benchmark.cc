@@ -0,0 +1,88 @@
+// Compares eager, lazy and sidecar cached GGUF metadata parsing.
+//
+// Usage: gguf_parser_benchmark [model.gguf] [iterations]
+// Without a model, a synthetic file with a Llama 3 sized vocabulary (128256
+// tokens and 280147 merges) is generated in the temp directory.
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include "config/gguf_parser.h"
+#include "test/gguf_test_writer.h"
+
+namespace {
+constexpr uint64_t kVocabSize = 128256;
+constexpr uint64_t kMerges = 280147;
+
+std::string WriteSyntheticModel() {
+  auto path =
+      (std::filesystem::temp_directory_path() / "gguf_benchmark.gguf").string();
+  test_utils::GGUFWriter w;
+  w.Header(0, 7);
+  w.KeyStr("general.name", "benchmark model");
+  w.KeyU32("llama.context_length", 131072);
+  w.KeyU32("llama.block_count", 32);
+  w.KeyU32("tokenizer.ggml.eos_token_id", 128009);
+  w.KeyArray("tokenizer.ggml.tokens", test_utils::kGGUFString, kVocabSize);
+  for (uint64_t i = 0; i < kVocabSize; i++) {
+    w.Str("token_" + std::to_string(i));
+  }
+  w.KeyArray("tokenizer.ggml.token_type", test_utils::kGGUFInt32, kVocabSize);
+  for (uint64_t i = 0; i < kVocabSize; i++) {
+    w.Value(int32_t{1});
+  }
+  w.KeyArray("tokenizer.ggml.merges", test_utils::kGGUFString, kMerges);
+  for (uint64_t i = 0; i < kMerges; i++) {
+    w.Str("tok_" + std::to_string(i % 997) + " en_" + std::to_string(i));
+  }
+  w.WriteTo(path);
+  return path;
+}
+
+template <typename F>
+double TimeMs(int iterations, F&& f) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    f();
+  }
+  std::chrono::duration<double, std::milli> d =
+      std::chrono::steady_clock::now() - start;
+  return d.count() / iterations;
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  bool synthetic = argc < 2;
+  std::string path = synthetic ? WriteSyntheticModel() : argv[1];
+  int iterations = argc > 2 ? std::stoi(argv[2]) : 10;
+
+  auto lazy = TimeMs(iterations, [&path] {
+    config::GGUFHandler h;
+    h.Parse(path, config::GGUFParseMode::kLazy);
+  });
+  auto eager = TimeMs(iterations, [&path] {
+    config::GGUFHandler h;
+    h.Parse(path, config::GGUFParseMode::kEager);
+  });
+
+  {
+    // Writes the sidecar
+    config::GGUFHandler h;
+    h.Parse(path, config::GGUFParseMode::kCached);
+  }
+  auto cached = TimeMs(iterations, [&path] {
+    config::GGUFHandler h;
+    h.Parse(path, config::GGUFParseMode::kCached);
+  });
+
+  std::cout << path << "\n"
+            << "lazy:   " << lazy << " ms/parse\n"
+            << "eager:  " << eager << " ms/parse\n"
+            << "cached: " << cached << " ms/parse\n";
+  if (synthetic) {
+    std::filesystem::remove(path);
+    std::filesystem::remove(config::GGUFHandler::SidecarPath(path));
+  }
+  return 0;
+}
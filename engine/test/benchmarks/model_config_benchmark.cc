@@ -0,0 +1,107 @@
+// Compares reading a model.yml with yaml-cpp against its compiled snapshot.
+//
+// Usage: model_config_benchmark [model.yml] [iterations]
+// Without a model.yml, one like those of cortexso models is written to the
+// temp directory.
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "config/model_config_snapshot.h"
+#include "config/yaml_config.h"
+
+namespace {
+std::string WriteSyntheticYaml() {
+  auto path =
+      (std::filesystem::temp_directory_path() / "model_config_benchmark.yml")
+          .string();
+  std::ofstream f(path);
+  f << "id: llama3.1:8b-gguf-q4-km\n"
+       "model: llama3.1:8b-gguf-q4-km\n"
+       "name: Meta-Llama-3.1-8B-Instruct\n"
+       "version: 2\n"
+       "files:\n"
+       "  - models/llama3.1/8b-gguf-q4-km/model.gguf\n"
+       "stop:\n"
+       "  - <|end_of_text|>\n"
+       "  - <|eot_id|>\n"
+       "  - <|eom_id|>\n"
+       "stream: true\n"
+       "top_p: 0.9\n"
+       "temperature: 0.7\n"
+       "frequency_penalty: 0\n"
+       "presence_penalty: 0\n"
+       "max_tokens: 8192\n"
+       "seed: -1\n"
+       "dynatemp_range: 0\n"
+       "dynatemp_exponent: 1\n"
+       "top_k: 40\n"
+       "min_p: 0.05\n"
+       "tfs_z: 1\n"
+       "typ_p: 1\n"
+       "repeat_last_n: 64\n"
+       "repeat_penalty: 1\n"
+       "mirostat: false\n"
+       "mirostat_tau: 5\n"
+       "mirostat_eta: 0.1\n"
+       "penalize_nl: false\n"
+       "ignore_eos: false\n"
+       "n_probs: 0\n"
+       "min_keep: 0\n"
+       "ngl: 33\n"
+       "ctx_len: 8192\n"
+       "engine: cortex.llamacpp\n"
+       "prompt_template: \"<|begin_of_text|><|start_header_id|>system"
+       "<|end_header_id|>\\n\\n{system_message}<|eot_id|><|start_header_id|>"
+       "user<|end_header_id|>\\n\\n{prompt}<|eot_id|><|start_header_id|>"
+       "assistant<|end_header_id|>\\n\\n\"\n"
+       "created: 1727432487\n";
+  return path;
+}
+
+template <typename F>
+double TimeUs(int iterations, F&& f) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    f();
+  }
+  std::chrono::duration<double, std::micro> d =
+      std::chrono::steady_clock::now() - start;
+  return d.count() / iterations;
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  bool synthetic = argc < 2;
+  std::string path = synthetic ? WriteSyntheticYaml() : argv[1];
+  int iterations = argc > 2 ? std::stoi(argv[2]) : 1000;
+
+  auto yaml = TimeUs(iterations, [&path] {
+    config::YamlHandler h;
+    h.ModelConfigFromFile(path, false);
+  });
+
+  {
+    // Compiles the snapshot
+    config::YamlHandler h;
+    h.ModelConfigFromFile(path);
+  }
+  bool served = false;
+  auto snapshot = TimeUs(iterations, [&path, &served] {
+    config::YamlHandler h;
+    h.ModelConfigFromFile(path);
+    served = h.FromSnapshot();
+  });
+
+  std::cout << path << "\n"
+            << "yaml-cpp: " << yaml << " us/read\n"
+            << "snapshot: " << snapshot << " us/read"
+            << (served ? "" : " (not served, directory not writable?)")
+            << "\n";
+  if (synthetic) {
+    std::filesystem::remove(path);
+    std::filesystem::remove(config::ModelConfigSnapshot::PathFor(path));
+  }
+  return 0;
+}
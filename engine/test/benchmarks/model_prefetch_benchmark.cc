@@ -0,0 +1,137 @@
+// Compares the cold load time of a model with and without the page cache
+// prefetch the server starts on load.
+//
+// Usage: model_prefetch_benchmark [model.gguf]
+// The load is simulated the way an engine maps a model: every page of every
+// tensor is touched through a mapping, in tensor table order, on one thread.
+// Without a model, a synthetic 1 GiB file is generated in the temp directory.
+// Cold runs need the page cache of the file to be dropped, which is only done
+// on Linux; elsewhere, drop it by hand between runs.
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "config/gguf_parser.h"
+#include "services/model_prefetch_service.h"
+#include "test/gguf_test_writer.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+constexpr uint64_t kTensors = 64;
+constexpr uint64_t kTensorElements = 4ull << 20;  // 16 MiB of F32
+constexpr uint64_t kAlignment = 32;
+
+std::string WriteSyntheticModel() {
+  auto path =
+      (std::filesystem::temp_directory_path() / "prefetch_benchmark.gguf")
+          .string();
+  test_utils::GGUFWriter w;
+  w.Header(kTensors, 0);
+  for (uint64_t i = 0; i < kTensors; i++) {
+    w.Tensor("blk." + std::to_string(i) + ".ffn_up.weight", {kTensorElements},
+             0, i * kTensorElements * 4);
+  }
+  w.Align(kAlignment);
+  w.WriteTo(path);
+  std::ofstream f(path, std::ios::binary | std::ios::app);
+  // Real bytes, a sparse file would read back without touching the disk
+  std::vector<char> data(kTensorElements * 4);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = static_cast<char>(i * 2654435761u >> 24);
+  }
+  for (uint64_t i = 0; i < kTensors; i++) {
+    f.write(data.data(), data.size());
+  }
+  return path;
+}
+
+void DropPageCache(const std::vector<config::GGUFShard>& shards) {
+#if defined(__linux__)
+  for (const auto& s : shards) {
+    int fd = open(s.path.c_str(), O_RDONLY);
+    if (fd >= 0) {
+      fdatasync(fd);
+      posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+      close(fd);
+    }
+  }
+#endif
+}
+
+// Touches every page of every tensor, returns seconds
+double SimulateLoad(const config::GGUFHandler& h) {
+  auto start = std::chrono::steady_clock::now();
+#ifndef _WIN32
+  const auto& shards = h.GetShards();
+  std::vector<const uint8_t*> maps;
+  std::vector<size_t> sizes;
+  for (const auto& s : shards) {
+    int fd = open(s.path.c_str(), O_RDONLY);
+    auto size = static_cast<size_t>(std::filesystem::file_size(s.path));
+    maps.push_back(static_cast<const uint8_t*>(
+        mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0)));
+    sizes.push_back(size);
+    close(fd);
+  }
+  auto page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+  volatile uint64_t sum = 0;
+  for (const auto& t : h.GetTensorInfos()) {
+    auto begin = shards[t.shard].tensor_data_offset + t.offset;
+    for (auto o = begin; o < begin + t.size && o < sizes[t.shard];
+         o += page) {
+      sum += maps[t.shard][o];
+    }
+  }
+  for (size_t i = 0; i < maps.size(); i++) {
+    munmap(const_cast<uint8_t*>(maps[i]), sizes[i]);
+  }
+#endif
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  bool synthetic = argc < 2;
+  std::string path = synthetic ? WriteSyntheticModel() : argv[1];
+  config::GGUFHandler h;
+  h.Parse(path);
+  auto bytes = h.GetTensorSummary().total_bytes;
+
+  DropPageCache(h.GetShards());
+  auto without = SimulateLoad(h);
+
+  DropPageCache(h.GetShards());
+  ModelPrefetchService prefetch;
+  prefetch.Start("benchmark",
+                 ModelPrefetchService::PlanRanges(
+                     h.GetShards(), h.GetTensorInfos(), UINT64_MAX));
+  auto with = SimulateLoad(h);
+  prefetch.Wait("benchmark");
+  auto progress = prefetch.GetProgress("benchmark");
+
+  auto warm = SimulateLoad(h);
+
+  std::cout << path << ": " << (bytes >> 20) << " MiB of tensors\n"
+            << "cold load:                " << without << " s\n"
+            << "cold load with prefetch:  " << with << " s\n"
+            << "warm load:                " << warm << " s\n";
+  if (progress.has_value()) {
+    std::cout << "prefetch: " << (progress->done_bytes >> 20) << " MiB in "
+              << progress->seconds << " s, "
+              << progress->BytesPerSecond() / (1 << 20) << " MiB/s\n";
+  }
+  if (synthetic) {
+    std::filesystem::remove(path);
+  }
+  return 0;
+}
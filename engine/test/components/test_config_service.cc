@@ -0,0 +1,121 @@
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <string>
+#include "gtest/gtest.h"
+#include "services/config_service.h"
+
+#ifndef _WIN32
+#include <signal.h>
+#endif
+
+namespace {
+using config_yaml_utils::CortexConfig;
+// Before and after a change
+using Ports = std::pair<std::string, std::string>;
+
+class ConfigServiceTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = std::filesystem::temp_directory_path() / "config_service";
+    std::filesystem::remove_all(dir_);
+    std::filesystem::create_directories(dir_);
+    path_ = dir_ / ".cortexrc";
+  }
+
+  void TearDown() override { std::filesystem::remove_all(dir_); }
+
+  void WriteConfig(const std::string& port, int queue_size = 1024) {
+    CortexConfig config{
+        .logFolderPath = dir_.string(),
+        .dataFolderPath = dir_.string(),
+        .maxLogLines = config_yaml_utils::kDefaultMaxLines,
+        .apiServerHost = config_yaml_utils::kDefaultHost,
+        .apiServerPort = port,
+        .workerQueueSize = queue_size,
+    };
+    config_yaml_utils::DumpYamlConfig(config, path_.string());
+  }
+
+  // The ports of the next change a subscriber sees
+  std::future<Ports> NextChange(ConfigService& service) {
+    auto promise = std::make_shared<std::promise<Ports>>();
+    auto id = std::make_shared<int>();
+    *id = service.Subscribe(
+        [promise, id, &service](const auto& old, const auto& now) {
+          service.Unsubscribe(*id);
+          promise->set_value({old.apiServerPort, now.apiServerPort});
+        });
+    return promise->get_future();
+  }
+
+  std::filesystem::path dir_;
+  std::filesystem::path path_;
+};
+}  // namespace
+
+TEST_F(ConfigServiceTest, ParsesOncePerChange) {
+  WriteConfig("3928");
+  ConfigService service(path_);
+  auto first = service.Get();
+  EXPECT_EQ(first->apiServerPort, "3928");
+  // Same snapshot, not parsed again
+  EXPECT_EQ(service.Get(), first);
+
+  // Written by this process, read back without a watcher
+  WriteConfig("3929");
+  auto second = service.Get();
+  EXPECT_NE(second, first);
+  EXPECT_EQ(second->apiServerPort, "3929");
+  EXPECT_EQ(first->apiServerPort, "3928");
+}
+
+TEST_F(ConfigServiceTest, KeepsConfigWhenFileBreaks) {
+  ConfigService missing(path_);
+  EXPECT_THROW(missing.Get(), std::runtime_error);
+
+  WriteConfig("3928");
+  ConfigService service(path_);
+  auto good = service.Get();
+  {
+    std::ofstream f(path_);
+    f << "apiServerPort: [unterminated\n";
+  }
+  EXPECT_EQ(service.Get(), good);
+  std::filesystem::remove(path_);
+  EXPECT_EQ(service.Get(), good);
+}
+
+TEST_F(ConfigServiceTest, NotifiesSubscribersOfChanges) {
+  WriteConfig("3928");
+  ConfigService service(path_);
+  service.Start();
+  auto snapshot = service.Get();
+  auto change = NextChange(service);
+
+  WriteConfig("3929", 16);
+  ASSERT_EQ(change.wait_for(std::chrono::seconds(10)),
+            std::future_status::ready);
+  EXPECT_EQ(change.get(), Ports("3928", "3929"));
+  EXPECT_EQ(service.Get()->workerQueueSize, 16);
+  // Readers holding the old snapshot keep it
+  EXPECT_EQ(snapshot->workerQueueSize, 1024);
+  service.Stop();
+}
+
+#ifndef _WIN32
+TEST_F(ConfigServiceTest, ReloadsOnSighup) {
+  WriteConfig("3928");
+  ConfigService service(path_);
+  service.Start(true);
+  auto change = NextChange(service);
+
+  ASSERT_EQ(raise(SIGHUP), 0);
+  ASSERT_EQ(change.wait_for(std::chrono::seconds(10)),
+            std::future_status::ready);
+  EXPECT_EQ(change.get(), Ports("3928", "3928"));
+  service.Stop();
+  signal(SIGHUP, SIG_DFL);
+}
+#endif
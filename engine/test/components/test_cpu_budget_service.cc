@@ -0,0 +1,104 @@
+#include <algorithm>
+#include <numeric>
+#include <vector>
+#include "gtest/gtest.h"
+#include "services/cpu_budget_service.h"
+
+namespace {
+std::vector<int> Cores(int n) {
+  std::vector<int> cores(n);
+  std::iota(cores.begin(), cores.end(), 0);
+  return cores;
+}
+
+bool Disjoint(std::vector<int> a, std::vector<int> b) {
+  std::sort(a.begin(), a.end());
+  std::sort(b.begin(), b.end());
+  std::vector<int> common;
+  std::set_intersection(a.begin(), a.end(), b.begin(), b.end(),
+                        std::back_inserter(common));
+  return common.empty();
+}
+}  // namespace
+
+class CpuBudgetServiceTest : public ::testing::Test {};
+
+TEST_F(CpuBudgetServiceTest, IoCoresAreNotHandedToModels) {
+  CpuBudgetService budget(Cores(16), 2);
+  EXPECT_EQ(budget.IoCores(), (std::vector<int>{0, 1}));
+
+  auto cores = budget.Acquire("model", "cortex.llamacpp", 0);
+  EXPECT_EQ(cores.size(), 14);
+  EXPECT_TRUE(Disjoint(cores, budget.IoCores()));
+  EXPECT_EQ(budget.FreeCores(), 0);
+}
+
+TEST_F(CpuBudgetServiceTest, ModelsGetDisjointCores) {
+  CpuBudgetService budget(Cores(16), 2);
+  auto a = budget.Acquire("a", "cortex.llamacpp", 6);
+  auto b = budget.Acquire("b", "cortex.llamacpp", 0);
+  EXPECT_EQ(a.size(), 6);
+  EXPECT_EQ(b.size(), 7);
+  EXPECT_TRUE(Disjoint(a, b));
+
+  // b had an even share, it grows into the cores a gave back
+  budget.Release("a");
+  EXPECT_EQ(budget.FreeCores(), 0);
+  EXPECT_FALSE(budget.Holds("a"));
+  EXPECT_TRUE(budget.Holds("b"));
+}
+
+TEST_F(CpuBudgetServiceTest, EvenSharesShrinkForNewModels) {
+  CpuBudgetService budget(Cores(16), 2);
+  auto a = budget.Acquire("a", "cortex.llamacpp", 0);
+  EXPECT_EQ(a.size(), 14);
+  // a gives half back rather than being shared
+  auto b = budget.Acquire("b", "cortex.llamacpp", 0);
+  EXPECT_EQ(b.size(), 7);
+  EXPECT_EQ(budget.FreeCores(), 0);
+  // Taken from both, the largest first
+  EXPECT_EQ(budget.Acquire("c", "cortex.llamacpp", 0).size(), 4);
+  EXPECT_EQ(budget.FreeCores(), 0);
+
+  budget.Release("b");
+  budget.Release("c");
+  EXPECT_EQ(budget.FreeCores(), 0);
+  budget.Release("a");
+  EXPECT_EQ(budget.FreeCores(), 14);
+}
+
+TEST_F(CpuBudgetServiceTest, ExpectedModelsSizeTheFirstShare) {
+  CpuBudgetService budget(Cores(16), 2);
+  budget.SetExpectedModels(2);
+  EXPECT_EQ(budget.Acquire("a", "cortex.llamacpp", 0).size(), 7);
+  EXPECT_EQ(budget.FreeCores(), 7);
+  EXPECT_EQ(budget.Acquire("b", "cortex.llamacpp", 0).size(), 7);
+  EXPECT_EQ(budget.FreeCores(), 0);
+}
+
+TEST_F(CpuBudgetServiceTest, ScopedPinRestoresTheMask) {
+  auto before = CpuBudgetService::CurrentThreadCores();
+  {
+    CpuBudgetService::ScopedPin pin({before.empty() ? 0 : before.front()});
+  }
+  EXPECT_EQ(CpuBudgetService::CurrentThreadCores(), before);
+}
+
+TEST_F(CpuBudgetServiceTest, ShareLargestHolderWhenExhausted) {
+  CpuBudgetService budget(Cores(8), 1);
+  auto a = budget.Acquire("a", "cortex.llamacpp", 5);
+  budget.Acquire("b", "cortex.llamacpp", 2);
+  auto c = budget.Acquire("c", "cortex.llamacpp", 0);
+  EXPECT_EQ(c, a);
+
+  // Borrowed cores only come back once their owner is gone too
+  budget.Release("c");
+  EXPECT_EQ(budget.FreeCores(), 0);
+  budget.ReleaseEngine("cortex.llamacpp");
+  EXPECT_EQ(budget.FreeCores(), 7);
+}
+
+TEST_F(CpuBudgetServiceTest, SingleCoreMachine) {
+  CpuBudgetService budget(Cores(1), 1);
+  EXPECT_EQ(budget.Acquire("model", "cortex.llamacpp", 0).size(), 1);
+}
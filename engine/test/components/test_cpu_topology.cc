@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include "gtest/gtest.h"
+#include "services/cpu_budget_service.h"
+#include "utils/cpuid/cpu_topology.h"
+
+using namespace cortex::cpuid;
+
+class CpuTopologyTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    root_ = std::filesystem::temp_directory_path() / "cortex_fake_sysfs";
+    std::filesystem::remove_all(root_);
+  }
+
+  void TearDown() override { std::filesystem::remove_all(root_); }
+
+  void Write(const std::filesystem::path& rel, const std::string& content) {
+    auto p = root_ / rel;
+    std::filesystem::create_directories(p.parent_path());
+    std::ofstream(p) << content << "\n";
+  }
+
+  // Two sockets, each one NUMA node with 2 cores x 2 hardware threads.
+  // Siblings are numbered the way Linux does: cpu0/cpu4 share core 0.
+  void WriteDualSocket() {
+    Write("devices/system/cpu/online", "0-7");
+    Write("devices/system/node/node0/cpulist", "0-1,4-5");
+    Write("devices/system/node/node1/cpulist", "2-3,6-7");
+    for (int id = 0; id < 8; id++) {
+      auto cpu = "devices/system/cpu/cpu" + std::to_string(id);
+      int package = (id % 4) / 2;
+      Write(cpu + "/topology/physical_package_id", std::to_string(package));
+      Write(cpu + "/topology/core_id", std::to_string(id % 2));
+      Write(cpu + "/cache/index3/level", "3");
+      Write(cpu + "/cache/index3/id", std::to_string(package));
+    }
+  }
+
+  std::filesystem::path root_;
+};
+
+TEST_F(CpuTopologyTest, ParseCpuList) {
+  EXPECT_EQ(ParseCpuList("0-3,8-9,12"),
+            (std::vector<int>{0, 1, 2, 3, 8, 9, 12}));
+  EXPECT_EQ(ParseCpuList("5"), (std::vector<int>{5}));
+  EXPECT_TRUE(ParseCpuList("").empty());
+}
+
+TEST_F(CpuTopologyTest, ProbeDualSocket) {
+  WriteDualSocket();
+  auto t = ProbeTopology(root_);
+  ASSERT_EQ(t.cpus.size(), 8);
+  EXPECT_EQ(t.numa_nodes(), 2);
+  EXPECT_EQ(t.packages(), 2);
+  EXPECT_FALSE(t.is_hybrid());
+
+  auto cpu6 = t.find(6);
+  ASSERT_NE(cpu6, nullptr);
+  EXPECT_EQ(cpu6->numa_node, 1);
+  EXPECT_EQ(cpu6->l3, 1);
+  EXPECT_EQ(cpu6->smt_rank, 1);
+  EXPECT_EQ(t.find(2)->smt_rank, 0);
+}
+
+TEST_F(CpuTopologyTest, ProbeHybrid) {
+  Write("devices/system/cpu/online", "0-5");
+  Write("devices/cpu_core/cpus", "0-1");
+  Write("devices/cpu_atom/cpus", "2-5");
+  auto t = ProbeTopology(root_);
+  EXPECT_TRUE(t.is_hybrid());
+  EXPECT_TRUE(t.find(1)->performance);
+  EXPECT_FALSE(t.find(2)->performance);
+}
+
+TEST_F(CpuTopologyTest, ProbeKeepsOnlyAllowedCpus) {
+  WriteDualSocket();
+  // As under taskset -c 2,3,6 or docker --cpuset-cpus=2,3,6
+  auto t = ProbeTopology(root_, {2, 3, 6, 42});
+  ASSERT_EQ(t.cpus.size(), 3);
+  EXPECT_EQ(t.numa_nodes(), 1);
+  EXPECT_EQ(t.packages(), 1);
+  EXPECT_EQ(t.find(0), nullptr);
+  EXPECT_EQ(t.find(42), nullptr);
+  ASSERT_NE(t.find(6), nullptr);
+  EXPECT_EQ(t.find(6)->smt_rank, 1);
+
+  CpuBudgetService budget(std::move(t), 1);
+  auto cores = budget.Acquire("a", "cortex.llamacpp", 8);
+  for (int id : cores) {
+    EXPECT_TRUE(id == 2 || id == 3 || id == 6) << id;
+  }
+}
+
+TEST_F(CpuTopologyTest, AllowedCpusOfThisProcess) {
+  auto allowed = AllowedCpus();
+#if defined(__linux__)
+  ASSERT_FALSE(allowed.empty());
+  EXPECT_TRUE(std::is_sorted(allowed.begin(), allowed.end()));
+#endif
+  EXPECT_LE(allowed.size(), std::max(1u, std::thread::hardware_concurrency()));
+}
+
+TEST_F(CpuTopologyTest, ModelStaysInOneNumaNode) {
+  WriteDualSocket();
+  CpuBudgetService budget(ProbeTopology(root_), 1);
+  // cpu0 goes to IO, so node 1 is the one with room for four threads
+  auto a = budget.Acquire("a", "cortex.llamacpp", 4);
+  EXPECT_EQ(a, (std::vector<int>{2, 3, 6, 7}));
+
+  // cpu1 is the only first hardware thread left in node 0
+  auto b = budget.Acquire("b", "cortex.llamacpp", 2);
+  EXPECT_EQ(b, (std::vector<int>{1, 4}));
+}
+
+TEST_F(CpuTopologyTest, IoOnECoresComputeOnPCores) {
+  Write("devices/system/cpu/online", "0-5");
+  Write("devices/cpu_atom/cpus", "4-5");
+  CpuBudgetService budget(ProbeTopology(root_), 1);
+  EXPECT_EQ(budget.IoCores(), (std::vector<int>{4}));
+  EXPECT_EQ(budget.Acquire("model", "cortex.llamacpp", 4),
+            (std::vector<int>{0, 1, 2, 3}));
+}
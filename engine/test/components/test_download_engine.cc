@@ -0,0 +1,139 @@
+#include <httplib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+#include "gtest/gtest.h"
+#include "services/download_engine.h"
+
+namespace {
+constexpr auto kDelay = std::chrono::milliseconds(50);
+
+class DownloadEngineTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    server_.Get(R"(/files/(\d+))", [this](const httplib::Request& req,
+                                          httplib::Response& res) {
+      auto n = ++in_flight_;
+      int max = max_in_flight_;
+      while (n > max && !max_in_flight_.compare_exchange_weak(max, n)) {
+      }
+      std::this_thread::sleep_for(kDelay);
+      res.set_content("file " + req.matches[1].str(), "text/plain");
+      --in_flight_;
+    });
+    server_.Get("/missing", [](const httplib::Request&,
+                               httplib::Response& res) { res.status = 404; });
+    server_.new_task_queue = [] { return new httplib::ThreadPool(32); };
+    port_ = server_.bind_to_any_port("127.0.0.1");
+    listener_ = std::thread([this] { server_.listen_after_bind(); });
+    server_.wait_until_ready();
+  }
+
+  void TearDown() override {
+    server_.stop();
+    listener_.join();
+  }
+
+  std::string Url(const std::string& path) const {
+    return "http://127.0.0.1:" + std::to_string(port_) + path;
+  }
+
+  httplib::Server server_;
+  std::thread listener_;
+  int port_ = 0;
+  std::atomic<int> in_flight_{0};
+  std::atomic<int> max_in_flight_{0};
+};
+}  // namespace
+
+TEST_F(DownloadEngineTest, HeadsAllUrlsAtOnce) {
+  DownloadEngine engine;
+  std::vector<std::string> urls;
+  for (int i = 0; i < 20; i++) {
+    urls.push_back(Url("/files/" + std::to_string(i)));
+  }
+  urls.push_back(Url("/missing"));
+
+  auto start = std::chrono::steady_clock::now();
+  auto results = engine.Head(urls);
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  ASSERT_EQ(results.size(), urls.size());
+  for (int i = 0; i < 20; i++) {
+    EXPECT_TRUE(results[i].ok()) << results[i].error;
+    EXPECT_EQ(results[i].content_length,
+              static_cast<int64_t>(("file " + std::to_string(i)).size()));
+  }
+  EXPECT_FALSE(results.back().ok());
+  EXPECT_EQ(results.back().status, 404);
+  // One after the other they would take 20 delays
+  EXPECT_LT(elapsed, kDelay * 10);
+}
+
+TEST_F(DownloadEngineTest, CapsConnections) {
+  constexpr int kFiles = 40;
+  constexpr long kConnections = 4;
+  DownloadEngine engine(kConnections);
+  std::vector<std::string> bodies(kFiles);
+  std::vector<std::promise<DownloadEngine::Result>> done(kFiles);
+  for (int i = 0; i < kFiles; i++) {
+    DownloadEngine::Transfer t;
+    t.url = Url("/files/" + std::to_string(i));
+    t.on_data = [&bodies, i](const char* data, size_t size) {
+      bodies[i].append(data, size);
+      return true;
+    };
+    t.on_done = [&done, i](const DownloadEngine::Result& result) {
+      done[i].set_value(result);
+    };
+    engine.Add(std::move(t));
+  }
+  for (int i = 0; i < kFiles; i++) {
+    auto result = done[i].get_future().get();
+    EXPECT_TRUE(result.ok()) << result.error;
+    EXPECT_EQ(result.status, 200);
+    EXPECT_EQ(bodies[i], "file " + std::to_string(i));
+  }
+  EXPECT_LE(max_in_flight_, kConnections);
+  EXPECT_GT(max_in_flight_, 1);
+}
+
+TEST_F(DownloadEngineTest, CallbacksAbortTransfers) {
+  DownloadEngine engine;
+  std::promise<DownloadEngine::Result> done;
+  DownloadEngine::Transfer t;
+  t.url = Url("/files/1");
+  t.on_response = [](long status) { return status == 206; };
+  t.on_data = [](const char*, size_t) {
+    ADD_FAILURE() << "Body of an aborted transfer";
+    return true;
+  };
+  t.on_done = [&done](const DownloadEngine::Result& result) {
+    done.set_value(result);
+  };
+  engine.Add(std::move(t));
+  auto result = done.get_future().get();
+  EXPECT_FALSE(result.ok());
+  EXPECT_TRUE(result.aborted);
+}
+
+TEST_F(DownloadEngineTest, FailsTransfersLeftAtDestruction) {
+  std::atomic<int> failed{0};
+  {
+    DownloadEngine engine(1);
+    for (int i = 0; i < 5; i++) {
+      DownloadEngine::Transfer t;
+      t.url = Url("/files/" + std::to_string(i));
+      t.on_done = [&failed](const DownloadEngine::Result& result) {
+        failed += !result.ok();
+      };
+      engine.Add(std::move(t));
+    }
+  }
+  // One connection, so at most the first is done by now
+  EXPECT_GE(failed, 4);
+}
@@ -0,0 +1,299 @@
+#include <httplib.h>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "gtest/gtest.h"
+#include "services/download_manager.h"
+#include "utils/binary_io_utils.h"
+
+namespace {
+constexpr auto kDelay = std::chrono::milliseconds(100);
+// Downloaded as ranges, byte i of it is i % 251
+constexpr uint64_t kLargeBytes = DownloadService::kMinSegmentedBytes;
+// sha256("file 1")
+constexpr const char* kFile1Sha256 =
+    "83bf7fcd913e81d35f0d0e94ed1ec0611e8e3b4909c23b00ef9f076f205e67c6";
+
+class DownloadManagerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = std::filesystem::temp_directory_path() / "cortex_download_manager";
+    std::filesystem::remove_all(dir_);
+    std::filesystem::create_directories(dir_);
+
+    server_.Get(R"(/files/(\d+))", [this](const httplib::Request& req,
+                                          httplib::Response& res) {
+      auto n = ++in_flight_;
+      int max = max_in_flight_;
+      while (n > max && !max_in_flight_.compare_exchange_weak(max, n)) {
+      }
+      std::this_thread::sleep_for(kDelay);
+      res.set_content("file " + req.matches[1].str(), "text/plain");
+      --in_flight_;
+    });
+    // A megabyte at 100 KB/s, long enough to be cancelled
+    server_.Get("/slow", [](const httplib::Request&, httplib::Response& res) {
+      res.set_content_provider(
+          1 << 20, "application/octet-stream",
+          [](size_t, size_t length, httplib::DataSink& sink) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            std::string chunk(std::min<size_t>(length, 1024), 'x');
+            return sink.write(chunk.data(), chunk.size());
+          });
+    });
+    // Served as ranges, a megabyte every 50ms on each connection
+    server_.Get("/large", [this](const httplib::Request&,
+                                 httplib::Response& res) {
+      auto first = std::make_shared<bool>(true);
+      res.set_content_provider(
+          kLargeBytes, "application/octet-stream",
+          [this, first](size_t offset, size_t length,
+                        httplib::DataSink& sink) {
+            // The whole rest of the range the first time
+            if (*first) {
+              requested_ += length;
+              *first = false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            std::string chunk(std::min<size_t>(length, 1 << 20), '\0');
+            for (size_t i = 0; i < chunk.size(); i++) {
+              chunk[i] = static_cast<char>((offset + i) % 251);
+            }
+            return sink.write(chunk.data(), chunk.size());
+          });
+    });
+    server_.new_task_queue = [] { return new httplib::ThreadPool(16); };
+    port_ = server_.bind_to_any_port("127.0.0.1");
+    listener_ = std::thread([this] { server_.listen_after_bind(); });
+    server_.wait_until_ready();
+  }
+
+  void TearDown() override {
+    server_.stop();
+    listener_.join();
+    std::filesystem::remove_all(dir_);
+  }
+
+  DownloadTask Task(const std::string& id, const std::string& path) const {
+    return DownloadTask{
+        id,
+        DownloadType::Miscellaneous,
+        {DownloadItem{id, "http://127.0.0.1:" + std::to_string(port_) + path,
+                      dir_ / id}}};
+  }
+
+  std::filesystem::path dir_;
+  httplib::Server server_;
+  std::thread listener_;
+  int port_ = 0;
+  std::atomic<int> in_flight_{0};
+  std::atomic<int> max_in_flight_{0};
+  std::atomic<uint64_t> requested_{0};
+};
+}  // namespace
+
+TEST_F(DownloadManagerTest, RunsAtMostMaxActiveJobs) {
+  DownloadManager manager(2, DownloadManager::kDefaultMaxQueued);
+  std::vector<std::string> ids;
+  for (int i = 0; i < 6; i++) {
+    ids.push_back(manager.Submit(
+        Task("job" + std::to_string(i), "/files/" + std::to_string(i))));
+  }
+  for (int i = 0; i < 6; i++) {
+    auto job = manager.Wait(ids[i]);
+    EXPECT_EQ(job.state, DownloadManager::State::kCompleted) << job.error;
+    std::string data;
+    ASSERT_TRUE(binary_io_utils::ReadFile(dir_ / ids[i], data));
+    EXPECT_EQ(data, "file " + std::to_string(i));
+    EXPECT_EQ(job.DownloadedBytes(), data.size());
+    EXPECT_EQ(job.TotalBytes(), data.size());
+  }
+  EXPECT_EQ(max_in_flight_, 2);
+}
+
+TEST_F(DownloadManagerTest, BoundsTheQueue) {
+  DownloadManager manager(1, 2);
+  manager.Submit(Task("running", "/slow"));
+  manager.Submit(Task("queued1", "/slow"));
+  manager.Submit(Task("queued2", "/slow"));
+  EXPECT_THROW(manager.Submit(Task("queued3", "/slow")), std::runtime_error);
+  // Nor is a job submitted twice
+  EXPECT_THROW(manager.Submit(Task("running", "/slow")), std::runtime_error);
+  EXPECT_EQ(manager.Get("queued2")->state, DownloadManager::State::kQueued);
+  EXPECT_FALSE(manager.Get("queued3").has_value());
+}
+
+TEST_F(DownloadManagerTest, CancelsQueuedAndRunningJobs) {
+  DownloadManager manager(1, DownloadManager::kDefaultMaxQueued);
+  std::atomic<int> callbacks{0};
+  auto count = [&callbacks](const DownloadTask&) { callbacks++; };
+  manager.Submit(Task("running", "/slow"), count);
+  manager.Submit(Task("queued", "/slow"), count);
+
+  EXPECT_TRUE(manager.Cancel("queued"));
+  EXPECT_EQ(manager.Get("queued")->state, DownloadManager::State::kCancelled);
+
+  uint64_t seen = 0;
+  while (manager.Get("running")->DownloadedBytes() == 0) {
+    manager.WaitForChange(seen, std::chrono::milliseconds(50));
+  }
+  EXPECT_TRUE(manager.Cancel("running"));
+  auto job = manager.Wait("running");
+  EXPECT_EQ(job.state, DownloadManager::State::kCancelled);
+  EXPECT_LT(job.DownloadedBytes(), 1u << 20);
+  // The partial file is gone, and finished jobs cannot be cancelled again
+  EXPECT_FALSE(std::filesystem::exists(dir_ / "running"));
+  EXPECT_FALSE(manager.Cancel("running"));
+  EXPECT_FALSE(manager.Cancel("unknown"));
+  EXPECT_EQ(callbacks, 0);
+}
+
+TEST_F(DownloadManagerTest, KeepsFilesItDidNotCreate) {
+  DownloadManager manager(1, DownloadManager::kDefaultMaxQueued);
+  ASSERT_TRUE(binary_io_utils::WriteFileAtomically(dir_ / "existing", "mine"));
+  // Cancelled while its HEAD request is still waiting for the server
+  manager.Submit(Task("existing", "/files/1"));
+  EXPECT_TRUE(manager.Cancel("existing"));
+  EXPECT_EQ(manager.Wait("existing").state,
+            DownloadManager::State::kCancelled);
+  std::string data;
+  ASSERT_TRUE(binary_io_utils::ReadFile(dir_ / "existing", data));
+  EXPECT_EQ(data, "mine");
+}
+
+TEST_F(DownloadManagerTest, ResumesLargeFilesFromTheirRanges) {
+  DownloadManager manager(1, DownloadManager::kDefaultMaxQueued);
+  auto task = Task("large", "/large");
+  manager.Submit(task);
+  uint64_t seen = 0;
+  while (manager.Get("large")->DownloadedBytes() == 0) {
+    manager.WaitForChange(seen, std::chrono::milliseconds(50));
+  }
+  EXPECT_TRUE(manager.Cancel("large"));
+  EXPECT_EQ(manager.Wait("large").state, DownloadManager::State::kCancelled);
+
+  // Kept, with what each range received
+  auto path = dir_ / "large";
+  EXPECT_TRUE(std::filesystem::exists(DownloadManager::SegmentsPath(path)));
+  task.items[0].bytes = kLargeBytes;
+  auto saved = DownloadManager::SavedSegmentBytes(task.items[0]);
+  ASSERT_TRUE(saved.has_value());
+  EXPECT_GT(*saved, 0u);
+  EXPECT_LT(*saved, kLargeBytes);
+
+  requested_ = 0;
+  manager.Submit(task);
+  auto job = manager.Wait("large");
+  EXPECT_EQ(job.state, DownloadManager::State::kCompleted) << job.error;
+  EXPECT_EQ(job.DownloadedBytes(), kLargeBytes);
+  // Only the rest of each range was asked for
+  EXPECT_EQ(requested_, kLargeBytes - *saved);
+  EXPECT_FALSE(std::filesystem::exists(DownloadManager::SegmentsPath(path)));
+  std::string data;
+  ASSERT_TRUE(binary_io_utils::ReadFile(path, data));
+  std::string expected(kLargeBytes, '\0');
+  for (size_t i = 0; i < expected.size(); i++) {
+    expected[i] = static_cast<char>(i % 251);
+  }
+  EXPECT_TRUE(data == expected);
+}
+
+TEST_F(DownloadManagerTest, RunsCallbackOnceAfterVerification) {
+  DownloadManager manager(2, DownloadManager::kDefaultMaxQueued);
+  std::atomic<int> callbacks{0};
+  auto count = [&callbacks](const DownloadTask&) { callbacks++; };
+
+  auto good = Task("good", "/files/1");
+  good.items[0].checksum = kFile1Sha256;
+  auto bad = Task("bad", "/files/2");
+  bad.items[0].checksum = kFile1Sha256;
+  manager.Submit(good, count);
+  manager.Submit(bad, count);
+
+  EXPECT_EQ(manager.Wait("good").state, DownloadManager::State::kCompleted);
+  auto job = manager.Wait("bad");
+  EXPECT_EQ(job.state, DownloadManager::State::kFailed);
+  EXPECT_NE(job.error.find("Checksum mismatch"), std::string::npos);
+  EXPECT_EQ(callbacks, 1);
+}
+
+TEST_F(DownloadManagerTest, FailsJobsWhoseCallbackThrows) {
+  DownloadManager manager(1, DownloadManager::kDefaultMaxQueued);
+  manager.Submit(Task("job", "/files/1"), [](const DownloadTask&) {
+    throw std::runtime_error("Install failed");
+  });
+  auto job = manager.Wait("job");
+  EXPECT_EQ(job.state, DownloadManager::State::kFailed);
+  EXPECT_EQ(job.error, "Install failed");
+}
+
+TEST_F(DownloadManagerTest, KeepsTheJobTable) {
+  auto table = dir_ / "downloads.json";
+  {
+    DownloadManager manager(1, DownloadManager::kDefaultMaxQueued);
+    manager.Open(table);
+    manager.Submit(Task("done", "/files/1"));
+    manager.Wait("done");
+    manager.Submit(Task("running", "/slow"));
+    // Saved while it is still running, as a crash would leave it
+    std::filesystem::copy_file(table, dir_ / "crashed.json");
+  }
+
+  DownloadManager manager(1, DownloadManager::kDefaultMaxQueued);
+  manager.Open(dir_ / "crashed.json");
+  auto jobs = manager.List();
+  ASSERT_EQ(jobs.size(), 2u);
+  auto done = manager.Get("done");
+  ASSERT_TRUE(done.has_value());
+  EXPECT_EQ(done->state, DownloadManager::State::kCompleted);
+  EXPECT_EQ(done->DownloadedBytes(), std::string("file 1").size());
+  EXPECT_GT(done->finished_at, 0);
+  auto running = manager.Get("running");
+  ASSERT_TRUE(running.has_value());
+  EXPECT_EQ(running->state, DownloadManager::State::kFailed);
+  EXPECT_EQ(running->error, "Interrupted by a restart");
+  // Interrupted jobs can be submitted again
+  EXPECT_NO_THROW(manager.Submit(Task("running", "/files/2")));
+  EXPECT_EQ(manager.Wait("running").state,
+            DownloadManager::State::kCompleted);
+}
+
+TEST(DownloadManagerJobTest, RoundTripsThroughJson) {
+  DownloadManager::Job job;
+  job.id = "model";
+  job.type = DownloadType::Model;
+  job.state = DownloadManager::State::kFailed;
+  job.error = "Disk full";
+  job.created_at = 100;
+  job.finished_at = 200;
+  job.items.push_back({"a", "https://host/a", "/tmp/a", 10, 5, 0, false});
+  job.items.push_back({"b", "https://host/b", "/tmp/b", 20, 20, 0, true});
+
+  auto json = job.ToJson();
+  EXPECT_EQ(json["status"].asString(), "failed");
+  EXPECT_EQ(json["type"].asString(), "model");
+  EXPECT_EQ(json["total_bytes"].asUInt64(), 30u);
+  EXPECT_EQ(json["downloaded_bytes"].asUInt64(), 25u);
+
+  auto back = DownloadManager::Job::FromJson(json);
+  ASSERT_TRUE(back.has_value());
+  EXPECT_EQ(back->id, job.id);
+  EXPECT_EQ(back->type, job.type);
+  EXPECT_EQ(back->state, job.state);
+  EXPECT_EQ(back->error, job.error);
+  EXPECT_EQ(back->created_at, job.created_at);
+  EXPECT_EQ(back->finished_at, job.finished_at);
+  ASSERT_EQ(back->items.size(), 2u);
+  EXPECT_EQ(back->items[0].path, "/tmp/a");
+  EXPECT_EQ(back->items[0].downloaded_bytes, 5u);
+  EXPECT_TRUE(back->items[1].done);
+
+  Json::Value broken;
+  broken["id"] = "x";
+  broken["status"] = "sleeping";
+  EXPECT_FALSE(DownloadManager::Job::FromJson(broken).has_value());
+}
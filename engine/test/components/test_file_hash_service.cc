@@ -0,0 +1,98 @@
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include "gtest/gtest.h"
+#include "services/file_hash_service.h"
+
+class FileHashServiceTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = std::filesystem::temp_directory_path() / "cortex_file_hash";
+    std::filesystem::create_directories(dir_);
+  }
+
+  void TearDown() override { std::filesystem::remove_all(dir_); }
+
+  std::filesystem::path WriteFile(const std::string& name,
+                                  const std::string& content) {
+    auto path = dir_ / name;
+    std::ofstream out(path, std::ios::binary);
+    out << content;
+    return path;
+  }
+
+  std::filesystem::path dir_;
+};
+
+TEST_F(FileHashServiceTest, Xxh64KnownValues) {
+  EXPECT_EQ(FileHashService::Xxh64("", 0), 0xef46db3751d8e999ull);
+  EXPECT_EQ(FileHashService::Xxh64("abc", 3), 0x44bc2cf5ad770999ull);
+  std::string s = "Nobody inspects the spammish repetition";
+  EXPECT_EQ(FileHashService::Xxh64(s.data(), s.size()), 0xfbcea83c8a378bf1ull);
+}
+
+TEST_F(FileHashServiceTest, Sha256MatchesKnownDigest) {
+  auto path = WriteFile("abc", "abc");
+  FileHashService hasher;
+  EXPECT_EQ(hasher.Sha256(path),
+            "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+  auto empty = WriteFile("empty", "");
+  EXPECT_EQ(hasher.Sha256(empty),
+            "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+  EXPECT_EQ(hasher.Sha256({path, empty}),
+            (std::vector<std::string>{hasher.Sha256(path),
+                                      hasher.Sha256(empty)}));
+}
+
+TEST_F(FileHashServiceTest, FingerprintIsTreeOfChunks) {
+  // Two full chunks and a partial one
+  std::string content(2 * FileHashService::kChunkSize + 1000, '\0');
+  for (size_t i = 0; i < content.size(); ++i) {
+    content[i] = static_cast<char>(i * 31 + (i >> 13));
+  }
+  auto path = WriteFile("model.gguf", content);
+
+  uint64_t leaves[3];
+  for (size_t i = 0; i < 3; ++i) {
+    auto offset = i * FileHashService::kChunkSize;
+    leaves[i] = FileHashService::Xxh64(
+        content.data() + offset,
+        std::min<size_t>(FileHashService::kChunkSize, content.size() - offset));
+  }
+  char expected[17];
+  snprintf(expected, sizeof(expected), "%016llx",
+           static_cast<unsigned long long>(FileHashService::Xxh64(
+               leaves, sizeof(leaves), content.size())));
+
+  // Same result whatever the number of threads
+  EXPECT_EQ(FileHashService(1).Fingerprint(path), expected);
+  EXPECT_EQ(FileHashService(8).Fingerprint(path), expected);
+
+  content[FileHashService::kChunkSize + 5] ^= 1;
+  auto changed = WriteFile("model.gguf", content);
+  EXPECT_NE(FileHashService().Fingerprint(changed), expected);
+}
+
+TEST_F(FileHashServiceTest, FilesIdentityFollowsFiles) {
+  auto a = WriteFile("a", "aaaa");
+  auto b = WriteFile("b", "bbbb");
+  auto identity = FileHashService::FilesIdentity({a, b});
+  EXPECT_EQ(FileHashService::FilesIdentity({a, b}), identity);
+  EXPECT_NE(FileHashService::FilesIdentity({b, a}), identity);
+  WriteFile("b", "bbbbb");
+  EXPECT_NE(FileHashService::FilesIdentity({a, b}), identity);
+  std::filesystem::remove(b);
+  EXPECT_THROW(FileHashService::FilesIdentity({a, b}), std::runtime_error);
+}
+
+TEST_F(FileHashServiceTest, IntegrityRecordRoundTrip) {
+  IntegrityRecord record{{"0123456789abcdef", "fedcba9876543210"}, "1111"};
+  auto s = record.ToString();
+  EXPECT_EQ(s, "xxh64t:0123456789abcdef+fedcba9876543210:1111");
+  auto parsed = IntegrityRecord::FromString(s);
+  ASSERT_TRUE(parsed.has_value());
+  EXPECT_EQ(parsed->fingerprints, record.fingerprints);
+  EXPECT_EQ(parsed->files_identity, "1111");
+  EXPECT_FALSE(IntegrityRecord::FromString("").has_value());
+  EXPECT_FALSE(IntegrityRecord::FromString("md5:abc:def").has_value());
+}
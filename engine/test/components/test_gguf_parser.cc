@@ -1,12 +1,14 @@
 #include "gtest/gtest.h"
 #include "config/gguf_parser.h"
 #include "config/yaml_config.h"
+#include "test/gguf_test_writer.h"
 #include <fstream>
 #include <cstdio>
 #include <vector>
 #include <stdexcept>
 #include <iostream>
 #include <iomanip>
+#include <filesystem>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -155,4 +157,337 @@ ctx_len: 4096
         }
         FAIL() << "Exception thrown: " << e.what();
     }
-}
\ No newline at end of file
+}
+class GGUFLazyParserTest : public GGUFParserTest {
+protected:
+    // Metadata with a small vocabulary, enough to exercise arrays
+    std::string createMockGGUFFileWithTokens() {
+        std::string gguf_path = getTempFilePath("mock_vocab-model", ".gguf");
+        test_utils::GGUFWriter w;
+        w.Header(0, 6);
+        w.KeyStr("general.name", "vocab model");
+        w.KeyArray("tokenizer.ggml.tokens", test_utils::kGGUFString, 3);
+        w.Str("<s>").Str("</s>").Str("hello");
+        w.KeyArray("tokenizer.ggml.scores", test_utils::kGGUFFloat32, 3);
+        for (float f : {0.0f, 0.0f, -1.5f}) {
+            w.Value(f);
+        }
+        w.KeyU32("tokenizer.ggml.eos_token_id", 1);
+        w.KeyU32("llama.block_count", 22);
+        w.Key("llama.context_length", test_utils::kGGUFUInt64).U64(2048);
+        w.WriteTo(gguf_path);
+        return gguf_path;
+    }
+};
+
+TEST_F(GGUFLazyParserTest, DecodeValuesOnDemand) {
+    auto gguf_path = createMockGGUFFileWithTokens();
+    gguf_handler->Parse(gguf_path);
+
+    EXPECT_EQ(gguf_handler->GetString("general.name"), "vocab model");
+    EXPECT_EQ(gguf_handler->GetArrayLength("tokenizer.ggml.tokens"), 3);
+    EXPECT_EQ(gguf_handler->GetArrayString("tokenizer.ggml.tokens", 2), "hello");
+    EXPECT_FALSE(gguf_handler->GetArrayString("tokenizer.ggml.tokens", 3).has_value());
+    EXPECT_EQ(gguf_handler->GetInt("llama.context_length"), 2048);
+    EXPECT_FALSE(gguf_handler->GetInt("general.name").has_value());
+    EXPECT_FALSE(gguf_handler->GetInt("missing").has_value());
+
+    const auto& config = gguf_handler->GetModelConfig();
+    EXPECT_EQ(config.name, "vocab-model");
+    EXPECT_EQ(config.ctx_len, 2048);
+    EXPECT_EQ(config.ngl, 23);
+    EXPECT_EQ(config.stop, std::vector<std::string>{"</s>"});
+    std::remove(gguf_path.c_str());
+}
+
+TEST_F(GGUFLazyParserTest, EagerModeGivesSameConfig) {
+    auto gguf_path = createMockGGUFFileWithTokens();
+    gguf_handler->Parse(gguf_path);
+    auto lazy_config = gguf_handler->GetModelConfig();
+
+    config::GGUFHandler eager;
+    eager.Parse(gguf_path, config::GGUFParseMode::kEager);
+    EXPECT_EQ(eager.GetModelConfig().name, lazy_config.name);
+    EXPECT_EQ(eager.GetModelConfig().ctx_len, lazy_config.ctx_len);
+    EXPECT_EQ(eager.GetModelConfig().stop, lazy_config.stop);
+    std::remove(gguf_path.c_str());
+}
+
+TEST_F(GGUFLazyParserTest, RejectTruncatedFile) {
+    auto gguf_path = createMockGGUFFileWithTokens();
+    std::filesystem::resize_file(gguf_path,
+                                 std::filesystem::file_size(gguf_path) - 4);
+    EXPECT_THROW(gguf_handler->Parse(gguf_path), std::runtime_error);
+    std::remove(gguf_path.c_str());
+}
+
+TEST_F(GGUFLazyParserTest, RejectCraftedCounts) {
+    // Lengths and counts whose byte sizes overflow or exceed the file
+    auto write_file = [this](uint64_t kv_count, uint64_t array_length) {
+        std::string gguf_path = getTempFilePath("mock_crafted-model", ".gguf");
+        test_utils::GGUFWriter()
+            .Header(0, kv_count)
+            .KeyArray("x", test_utils::kGGUFFloat32, array_length)
+            .U32(0)
+            .WriteTo(gguf_path);
+        return gguf_path;
+    };
+
+    // 4 * (2^62 + 1) wraps around to 4, the one float that is there
+    for (auto mode : {config::GGUFParseMode::kLazy,
+                      config::GGUFParseMode::kEager}) {
+        auto gguf_path = write_file(1, (1ull << 62) + 1);
+        config::GGUFHandler handler;
+        EXPECT_THROW(handler.Parse(gguf_path, mode), std::runtime_error);
+        std::remove(gguf_path.c_str());
+    }
+
+    auto gguf_path = write_file(1ull << 60, 1);
+    config::GGUFHandler handler;
+    EXPECT_THROW(handler.Parse(gguf_path), std::runtime_error);
+    std::remove(gguf_path.c_str());
+}
+
+class GGUFTensorInfoTest : public GGUFParserTest {
+protected:
+    struct MockTensor {
+        std::string name;
+        std::vector<uint64_t> dims;
+        uint32_t type;
+    };
+
+    // Header, an alignment key and the tensor info table, no weight data.
+    // Shards of a split model also get the split.* keys.
+    std::string createMockGGUFFileWithTensors(
+        const std::vector<MockTensor>& tensors, uint32_t alignment,
+        std::string gguf_path = "", uint16_t split_no = 0,
+        uint16_t split_count = 0, int32_t split_tensors = 0) {
+        if (gguf_path.empty()) {
+            gguf_path = getTempFilePath("mock_tensors-model", ".gguf");
+        }
+        test_utils::GGUFWriter w;
+        w.Header(tensors.size(), split_count > 0 ? 4 : 1);
+        w.KeyU32("general.alignment", alignment);
+        if (split_count > 0) {
+            w.Key("split.no", test_utils::kGGUFUInt16).Value(split_no);
+            w.Key("split.count", test_utils::kGGUFUInt16).Value(split_count);
+            w.Key("split.tensors.count", test_utils::kGGUFInt32)
+                .Value(split_tensors);
+        }
+
+        uint64_t offset = 0;
+        for (const auto& t : tensors) {
+            w.Tensor(t.name, t.dims, t.type, offset);
+            uint64_t n = 1;
+            for (auto d : t.dims) {
+                n *= d;
+            }
+            auto size = config::GGUFHandler::GGMLTypeSize(t.type, n).value_or(64);
+            offset += (size + alignment - 1) / alignment * alignment;
+        }
+        w.WriteTo(gguf_path);
+        return gguf_path;
+    }
+};
+
+TEST_F(GGUFTensorInfoTest, ParseTensorTable) {
+    auto gguf_path = createMockGGUFFileWithTensors(
+        {{"token_embd.weight", {4096, 32000}, 12},
+         {"blk.0.attn_q.weight", {4096, 4096}, 12},
+         {"blk.0.ffn_down.weight", {14336, 4096}, 14},
+         {"blk.0.attn_norm.weight", {4096}, 0},
+         {"blk.1.attn_q.weight", {4096, 4096}, 8},
+         {"output_norm.weight", {4096}, 0},
+         {"output.weight", {4096, 32000}, 14}},
+        64);
+    gguf_handler->Parse(gguf_path);
+
+    const auto& tensors = gguf_handler->GetTensorInfos();
+    ASSERT_EQ(tensors.size(), 7);
+    EXPECT_EQ(tensors[2].name, "blk.0.ffn_down.weight");
+    EXPECT_EQ(tensors[2].dims, (std::vector<uint64_t>{14336, 4096}));
+    EXPECT_EQ(config::GGUFHandler::GGMLTypeName(tensors[2].type), "Q6_K");
+    EXPECT_EQ(tensors[1].size, 4096ull * 4096 / 256 * 144);
+    EXPECT_EQ(tensors[4].size, 4096ull * 4096 / 32 * 34);
+    EXPECT_EQ(gguf_handler->GetTensorDataOffset() % 64, 0);
+
+    auto summary = gguf_handler->GetTensorSummary();
+    uint64_t q4_k = 4096ull * 32000 / 256 * 144 + 4096ull * 4096 / 256 * 144;
+    uint64_t q6_k = 14336ull * 4096 / 256 * 210 + 4096ull * 32000 / 256 * 210;
+    EXPECT_EQ(summary.embedding_bytes, 4096ull * 32000 / 256 * 144);
+    EXPECT_EQ(summary.output_bytes, 4096ull * 32000 / 256 * 210 + 4096 * 4);
+    ASSERT_EQ(summary.block_bytes.size(), 2);
+    EXPECT_EQ(summary.block_bytes[0], 4096ull * 4096 / 256 * 144 +
+                                          14336ull * 4096 / 256 * 210 +
+                                          4096 * 4);
+    EXPECT_EQ(summary.block_bytes[1], 4096ull * 4096 / 32 * 34);
+    EXPECT_EQ(summary.type_bytes["Q4_K"], q4_k);
+    EXPECT_EQ(summary.type_bytes["Q6_K"], q6_k);
+    EXPECT_EQ(summary.type_bytes["F32"], 2 * 4096 * 4);
+    EXPECT_EQ(summary.total_bytes, q4_k + q6_k + summary.type_bytes["Q8_0"] +
+                                       2 * 4096 * 4);
+    std::remove(gguf_path.c_str());
+}
+
+TEST_F(GGUFTensorInfoTest, UnknownTypeTakesSizeFromLayout) {
+    auto gguf_path = createMockGGUFFileWithTensors(
+        {{"blk.0.attn_q.weight", {256}, 999},
+         {"blk.0.attn_k.weight", {256}, 0}},
+        32);
+    gguf_handler->Parse(gguf_path);
+    const auto& tensors = gguf_handler->GetTensorInfos();
+    ASSERT_EQ(tensors.size(), 2);
+    EXPECT_EQ(config::GGUFHandler::GGMLTypeName(tensors[0].type), "unknown");
+    EXPECT_EQ(tensors[0].size, 64);
+    EXPECT_EQ(tensors[1].size, 256 * 4);
+    std::remove(gguf_path.c_str());
+}
+
+TEST_F(GGUFTensorInfoTest, RejectTruncatedTensorTable) {
+    auto gguf_path = createMockGGUFFileWithTensors(
+        {{"blk.0.attn_q.weight", {4096, 4096}, 12}}, 32);
+    std::filesystem::resize_file(gguf_path,
+                                 std::filesystem::file_size(gguf_path) - 4);
+    EXPECT_THROW(gguf_handler->Parse(gguf_path), std::runtime_error);
+    std::remove(gguf_path.c_str());
+}
+
+TEST_F(GGUFLazyParserTest, ReuseSidecarCache) {
+    auto gguf_path = createMockGGUFFileWithTokens();
+    auto sidecar = config::GGUFHandler::SidecarPath(gguf_path);
+    gguf_handler->Parse(gguf_path, config::GGUFParseMode::kCached);
+    EXPECT_FALSE(gguf_handler->FromSidecar());
+    ASSERT_TRUE(std::filesystem::exists(sidecar));
+    auto parsed = gguf_handler->GetModelConfig();
+
+    config::GGUFHandler cached;
+    cached.Parse(gguf_path, config::GGUFParseMode::kCached);
+    EXPECT_TRUE(cached.FromSidecar());
+    EXPECT_EQ(cached.GetModelConfig().name, parsed.name);
+    EXPECT_EQ(cached.GetModelConfig().ctx_len, parsed.ctx_len);
+    EXPECT_EQ(cached.GetModelConfig().ngl, parsed.ngl);
+    EXPECT_EQ(cached.GetModelConfig().stop, parsed.stop);
+    EXPECT_EQ(cached.GetModelConfig().prompt_template, parsed.prompt_template);
+    EXPECT_EQ(cached.GetString("general.name"), "vocab model");
+    EXPECT_EQ(cached.GetInt("llama.context_length"), 2048);
+    EXPECT_EQ(cached.GetArrayLength("tokenizer.ggml.tokens"), 3);
+    EXPECT_FALSE(cached.GetArrayString("tokenizer.ggml.tokens", 0).has_value());
+
+    // A changed model invalidates the sidecar
+    {
+        std::ofstream f(gguf_path, std::ios::binary | std::ios::app);
+        f.put(0);
+    }
+    config::GGUFHandler stale;
+    stale.Parse(gguf_path, config::GGUFParseMode::kCached);
+    EXPECT_FALSE(stale.FromSidecar());
+    EXPECT_EQ(stale.GetArrayString("tokenizer.ggml.tokens", 2), "hello");
+    std::remove(gguf_path.c_str());
+    std::filesystem::remove(sidecar);
+}
+
+TEST_F(GGUFTensorInfoTest, SidecarKeepsTensorTable) {
+    auto gguf_path = createMockGGUFFileWithTensors(
+        {{"blk.0.attn_q.weight", {4096, 4096}, 12},
+         {"output.weight", {4096, 32000}, 14}},
+        32);
+    gguf_handler->Parse(gguf_path, config::GGUFParseMode::kCached);
+    config::GGUFHandler cached;
+    cached.Parse(gguf_path, config::GGUFParseMode::kCached);
+    ASSERT_TRUE(cached.FromSidecar());
+    ASSERT_EQ(cached.GetTensorInfos().size(), 2);
+    EXPECT_EQ(cached.GetTensorInfos()[1].name, "output.weight");
+    EXPECT_EQ(cached.GetTensorInfos()[1].dims,
+              gguf_handler->GetTensorInfos()[1].dims);
+    EXPECT_EQ(cached.GetTensorSummary().total_bytes,
+              gguf_handler->GetTensorSummary().total_bytes);
+    EXPECT_EQ(cached.GetTensorDataOffset(),
+              gguf_handler->GetTensorDataOffset());
+    std::remove(gguf_path.c_str());
+    std::filesystem::remove(config::GGUFHandler::SidecarPath(gguf_path));
+}
+
+TEST_F(GGUFTensorInfoTest, MergeShardsOfSplitModel) {
+    auto dir = std::filesystem::temp_directory_path() /
+               ("mock_split-" + std::to_string(getpid()));
+    std::filesystem::create_directories(dir);
+    auto shard = [&dir](int i) {
+        return (dir / ("model-0000" + std::to_string(i) + "-of-00003.gguf"))
+            .string();
+    };
+    createMockGGUFFileWithTensors({{"token_embd.weight", {4096, 32000}, 12},
+                                   {"blk.0.attn_q.weight", {4096, 4096}, 12}},
+                                  32, shard(1), 0, 3, 5);
+    createMockGGUFFileWithTensors({{"blk.1.attn_q.weight", {4096, 4096}, 12},
+                                   {"blk.2.attn_q.weight", {4096, 4096}, 12}},
+                                  32, shard(2), 1, 3, 5);
+    createMockGGUFFileWithTensors({{"output.weight", {4096, 32000}, 14}}, 32,
+                                  shard(3), 2, 3, 5);
+
+    EXPECT_EQ(config::GGUFHandler::FindShards(shard(2)),
+              (std::vector<std::string>{shard(1), shard(2), shard(3)}));
+    EXPECT_THROW(gguf_handler->Parse(shard(2)), std::runtime_error);
+
+    gguf_handler->Parse(shard(1), config::GGUFParseMode::kCached);
+    const auto& tensors = gguf_handler->GetTensorInfos();
+    ASSERT_EQ(tensors.size(), 5);
+    EXPECT_EQ(tensors[3].name, "blk.2.attn_q.weight");
+    EXPECT_EQ(tensors[3].shard, 1);
+    EXPECT_EQ(tensors[4].shard, 2);
+    EXPECT_EQ(gguf_handler->GetFiles(),
+              (std::vector<std::string>{shard(1), shard(2), shard(3)}));
+    auto summary = gguf_handler->GetTensorSummary();
+    EXPECT_EQ(summary.block_bytes.size(), 3);
+    EXPECT_EQ(summary.output_bytes, 4096ull * 32000 / 256 * 210);
+
+    config::GGUFHandler cached;
+    cached.Parse(shard(1), config::GGUFParseMode::kCached);
+    ASSERT_TRUE(cached.FromSidecar());
+    EXPECT_EQ(cached.GetFiles(), gguf_handler->GetFiles());
+    EXPECT_EQ(cached.GetTensorInfos()[4].shard, 2);
+    EXPECT_EQ(cached.GetShards()[2].tensor_data_offset,
+              gguf_handler->GetShards()[2].tensor_data_offset);
+
+    // A missing shard fails the import instead of loading part of a model
+    std::filesystem::remove(shard(3));
+    config::GGUFHandler partial;
+    EXPECT_THROW(partial.Parse(shard(1), config::GGUFParseMode::kCached),
+                 std::runtime_error);
+    std::filesystem::remove_all(dir);
+}
+
+TEST_F(GGUFLazyParserTest, WellKnownKeysFollowArchitecture) {
+    std::string gguf_path = getTempFilePath("mock_qwen-model", ".gguf");
+    test_utils::GGUFWriter w;
+    w.Header(0, 5);
+    w.KeyStr("general.architecture", "qwen2");
+    // Another architecture's key must not be picked up
+    w.KeyU32("llama.context_length", 4096);
+    w.Key("qwen2.context_length", test_utils::kGGUFUInt16)
+        .Value(uint16_t{32768});
+    w.Key("qwen2.block_count", test_utils::kGGUFInt64).Value(int64_t{28});
+    w.Key("qwen2.use_parallel_residual", test_utils::kGGUFBool).Value(true);
+    w.WriteTo(gguf_path);
+
+    gguf_handler->Parse(gguf_path);
+    EXPECT_EQ(gguf_handler->GetInt(config::GGUFKey::kContextLength), 32768);
+    EXPECT_EQ(gguf_handler->GetInt(config::GGUFKey::kBlockCount), 28);
+    EXPECT_FALSE(gguf_handler->GetInt(config::GGUFKey::kHeadCount).has_value());
+    EXPECT_EQ(gguf_handler->GetString(config::GGUFKey::kGeneralArchitecture),
+              "qwen2");
+    EXPECT_EQ(gguf_handler->GetBool("qwen2.use_parallel_residual"), true);
+    EXPECT_FALSE(gguf_handler->GetFloat("qwen2.block_count").has_value());
+    EXPECT_EQ(gguf_handler->GetModelConfig().ctx_len, 32768);
+    EXPECT_EQ(gguf_handler->GetModelConfig().ngl, 29);
+    std::remove(gguf_path.c_str());
+}
+
+TEST_F(GGUFLazyParserTest, EagerModeDecodesArrays) {
+    auto gguf_path = createMockGGUFFileWithTokens();
+    gguf_handler->Parse(gguf_path, config::GGUFParseMode::kEager);
+    EXPECT_EQ(gguf_handler->GetArrayString(config::GGUFKey::kTokenizerTokens, 1),
+              "</s>");
+    EXPECT_EQ(gguf_handler->GetArrayLength("tokenizer.ggml.scores"), 3);
+    EXPECT_EQ(gguf_handler->GetInt("llama.context_length"), 2048);
+    std::remove(gguf_path.c_str());
+}
@@ -0,0 +1,75 @@
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include "gtest/gtest.h"
+#include "services/kv_cache_snapshot_service.h"
+
+class KvCacheSnapshotServiceTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    root_ = std::filesystem::temp_directory_path() / "cortex_kv_snapshots";
+    std::filesystem::remove_all(root_);
+  }
+
+  void TearDown() override { std::filesystem::remove_all(root_); }
+
+  // Simulate the engine writing a snapshot
+  void WriteSnapshot(KvCacheSnapshotService& store,
+                     const std::string& model_hash,
+                     const std::string& session_id, size_t bytes) {
+    std::ofstream out(store.SnapshotPath(model_hash, session_id),
+                      std::ios::binary);
+    out << std::string(bytes, 'k');
+  }
+
+  std::filesystem::path root_;
+};
+
+TEST_F(KvCacheSnapshotServiceTest, FindCommittedSnapshot) {
+  KvCacheSnapshotService store(root_, 1024);
+  EXPECT_FALSE(store.Find("model", "session").has_value());
+
+  WriteSnapshot(store, "model", "session", 100);
+  store.Commit("model", "session");
+
+  auto found = store.Find("model", "session");
+  ASSERT_TRUE(found.has_value());
+  EXPECT_EQ(std::filesystem::file_size(*found), 100);
+  EXPECT_FALSE(store.Find("other_model", "session").has_value());
+  EXPECT_EQ(store.TotalBytes(), 100);
+}
+
+TEST_F(KvCacheSnapshotServiceTest, EvictLeastRecentlyUsed) {
+  KvCacheSnapshotService store(root_, 250);
+  WriteSnapshot(store, "model", "a", 100);
+  store.Commit("model", "a");
+  WriteSnapshot(store, "model", "b", 100);
+  store.Commit("model", "b");
+
+  // Touch "a" so that "b" becomes the oldest
+  ASSERT_TRUE(store.Find("model", "a").has_value());
+  WriteSnapshot(store, "model", "c", 100);
+  store.Commit("model", "c");
+
+  EXPECT_TRUE(store.Find("model", "a").has_value());
+  EXPECT_FALSE(store.Find("model", "b").has_value());
+  EXPECT_TRUE(store.Find("model", "c").has_value());
+  EXPECT_EQ(store.TotalBytes(), 200);
+}
+
+TEST_F(KvCacheSnapshotServiceTest, ReloadIndexFromDisk) {
+  {
+    KvCacheSnapshotService store(root_, 1024);
+    WriteSnapshot(store, "model", "session", 10);
+    store.Commit("model", "session");
+  }
+  KvCacheSnapshotService store(root_, 1024);
+  EXPECT_TRUE(store.Find("model", "session").has_value());
+  EXPECT_EQ(store.TotalBytes(), 10);
+}
+
+TEST_F(KvCacheSnapshotServiceTest, UnsafeSessionIdStaysInsideRoot) {
+  KvCacheSnapshotService store(root_, 1024);
+  auto path = store.SnapshotPath("model", "../../etc/passwd");
+  EXPECT_EQ(path.parent_path(), root_ / "model");
+}
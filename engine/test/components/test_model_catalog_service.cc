@@ -0,0 +1,214 @@
+#include <json/json.h>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+#include "services/model_catalog_service.h"
+
+namespace {
+using modellist_utils::ModelEntry;
+using modellist_utils::ModelRegistry;
+using modellist_utils::ModelStatus;
+
+class ModelCatalogServiceTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = std::filesystem::temp_directory_path() / "model_catalog_service";
+    std::filesystem::remove_all(dir_);
+    std::filesystem::create_directories(dir_);
+    registry_ = std::make_unique<ModelRegistryService>(dir_ / "registry");
+  }
+
+  void TearDown() override {
+    registry_.reset();
+    std::filesystem::remove_all(dir_);
+  }
+
+  void AddModel(const std::string& id, const std::string& name) {
+    auto yaml = dir_ / id / "model.yml";
+    WriteYaml(yaml, name);
+    registry_->Update([&](ModelRegistry& r) {
+      r.Put(ModelEntry{id, "author", "main", yaml.string(), id,
+                       ModelStatus::READY});
+      return true;
+    });
+  }
+
+  void WriteYaml(const std::filesystem::path& path, const std::string& name,
+                 const std::string& engine = "cortex.onnx") {
+    std::filesystem::create_directories(path.parent_path());
+    std::ofstream f(path);
+    f << "name: " << name << "\nengine: " << engine << "\n";
+  }
+
+  // In small reads, as a chunked response would
+  static Json::Value ReadAll(ModelCatalogService::ListingStream& stream) {
+    std::string body;
+    char buf[7];
+    while (auto n = stream.Read(buf, sizeof(buf))) {
+      body.append(buf, n);
+    }
+    return Parse(body);
+  }
+
+  static Json::Value Parse(const std::string& body) {
+    Json::Value root;
+    std::string errors;
+    Json::CharReaderBuilder builder;
+    std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+    EXPECT_TRUE(reader->parse(body.data(), body.data() + body.size(), &root,
+                              &errors))
+        << errors;
+    return root;
+  }
+
+  std::filesystem::path dir_;
+  std::unique_ptr<ModelRegistryService> registry_;
+};
+}  // namespace
+
+TEST_F(ModelCatalogServiceTest, ServesCachedListing) {
+  AddModel("a", "first");
+  AddModel("b", "second");
+  ModelCatalogService catalog(*registry_);
+
+  auto listing = catalog.List();
+  auto root = Parse(listing->body);
+  EXPECT_EQ(root["object"].asString(), "list");
+  EXPECT_EQ(root["result"].asString(), "OK");
+  ASSERT_EQ(root["data"].size(), 2);
+  EXPECT_EQ(root["data"][0]["name"].asString(), "first");
+  EXPECT_EQ(root["data"][1]["name"].asString(), "second");
+  EXPECT_EQ(listing->etag.front(), '"');
+  EXPECT_EQ(catalog.Parses(), 2);
+
+  // Nothing changed, nothing parsed or rebuilt
+  EXPECT_EQ(catalog.List(), listing);
+  EXPECT_EQ(catalog.Parses(), 2);
+}
+
+TEST_F(ModelCatalogServiceTest, ReparsesOnlyChangedModels) {
+  AddModel("a", "first");
+  AddModel("b", "second");
+  ModelCatalogService catalog(*registry_);
+  auto before = catalog.List();
+
+  WriteYaml(dir_ / "b" / "model.yml", "renamed");
+  auto after = catalog.List();
+  EXPECT_EQ(catalog.Parses(), 3);
+  EXPECT_NE(after->etag, before->etag);
+  EXPECT_EQ(Parse(after->body)["data"][1]["name"].asString(), "renamed");
+}
+
+TEST_F(ModelCatalogServiceTest, ReparsesOnlyTheChangedFileOfADirectory) {
+  // Imported models share a directory
+  for (const std::string id : {"a", "b"}) {
+    auto yaml = dir_ / "imported" / (id + ".yml");
+    WriteYaml(yaml, id);
+    registry_->Update([&](ModelRegistry& r) {
+      r.Put(ModelEntry{id, "author", "main", yaml.string(), id,
+                       ModelStatus::READY});
+      return true;
+    });
+  }
+  ModelCatalogService catalog(*registry_);
+  auto before = catalog.List();
+  EXPECT_EQ(catalog.Parses(), 2);
+
+  WriteYaml(dir_ / "imported" / "b.yml", "renamed");
+  std::ofstream(dir_ / "imported" / "notes.txt") << "unrelated";
+  auto after = catalog.List();
+  EXPECT_EQ(catalog.Parses(), 3);
+  EXPECT_EQ(Parse(after->body)["data"][1]["name"].asString(), "renamed");
+}
+
+TEST_F(ModelCatalogServiceTest, FollowsTheRegistry) {
+  AddModel("a", "first");
+  ModelCatalogService catalog(*registry_);
+  auto before = catalog.List();
+
+  AddModel("b", "second");
+  auto added = catalog.List();
+  EXPECT_EQ(Parse(added->body)["data"].size(), 2);
+  EXPECT_EQ(catalog.Parses(), 2);
+
+  registry_->Update([](ModelRegistry& r) { return r.Remove("b"); });
+  auto removed = catalog.List();
+  EXPECT_EQ(removed->body, before->body);
+  EXPECT_EQ(removed->etag, before->etag);
+  EXPECT_EQ(catalog.Parses(), 2);
+}
+
+TEST_F(ModelCatalogServiceTest, SkipsBrokenYaml) {
+  AddModel("a", "first");
+  AddModel("b", "second");
+  {
+    std::ofstream f(dir_ / "b" / "model.yml");
+    f << "name: [unterminated\n";
+  }
+  ModelCatalogService catalog(*registry_);
+  EXPECT_EQ(Parse(catalog.List()->body)["data"].size(), 1);
+}
+
+TEST_F(ModelCatalogServiceTest, PagesThroughQueries) {
+  for (int i = 0; i < 5; i++) {
+    AddModel("model-" + std::to_string(i), "m" + std::to_string(i));
+  }
+  AddModel("other", "o");
+  ModelCatalogService catalog(*registry_);
+
+  ModelCatalogService::ListQuery query;
+  query.limit = 2;
+  query.prefix = "model-";
+  query.fields = {"name", "engine"};
+  std::vector<std::string> names;
+  for (int page = 0;; page++) {
+    auto root = ReadAll(*catalog.Query(query));
+    ASSERT_LE(root["data"].size(), 2);
+    for (const auto& m : root["data"]) {
+      names.push_back(m["name"].asString());
+      // Projected
+      EXPECT_EQ(m.size(), 2);
+    }
+    if (!root["has_more"].asBool()) {
+      EXPECT_EQ(page, 2);
+      break;
+    }
+    query.after = root["last_id"].asString();
+  }
+  EXPECT_EQ(names, (std::vector<std::string>{"m0", "m1", "m2", "m3", "m4"}));
+  // The queries' cache, its full body built on demand
+  EXPECT_EQ(catalog.Parses(), 6);
+  auto listing = catalog.List();
+  EXPECT_EQ(Parse(listing->body)["data"].size(), 6);
+  EXPECT_FALSE(listing->etag.empty());
+  EXPECT_EQ(catalog.Parses(), 6);
+
+  query.after = "deleted";
+  EXPECT_THROW(catalog.Query(query), std::runtime_error);
+}
+
+TEST_F(ModelCatalogServiceTest, FiltersByEngine) {
+  AddModel("a", "first");
+  WriteYaml(dir_ / "b" / "model.yml", "second", "cortex.llamacpp");
+  registry_->Update([&](ModelRegistry& r) {
+    r.Put(ModelEntry{"b", "author", "main",
+                     (dir_ / "b" / "model.yml").string(), "b",
+                     ModelStatus::READY});
+    return true;
+  });
+  ModelCatalogService catalog(*registry_);
+
+  ModelCatalogService::ListQuery query;
+  query.engine = "cortex.llamacpp";
+  auto root = ReadAll(*catalog.Query(query));
+  ASSERT_EQ(root["data"].size(), 1);
+  EXPECT_EQ(root["data"][0]["name"].asString(), "second");
+  EXPECT_EQ(root["last_id"].asString(), "b");
+  EXPECT_FALSE(root["has_more"].asBool());
+
+  // An unfiltered query is the cached body plus the paging keys
+  auto all = ReadAll(*catalog.Query({}));
+  EXPECT_EQ(all["data"], Parse(catalog.List()->body)["data"]);
+}
@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "config/gguf_parser.h"
+#include "gtest/gtest.h"
+#include "services/model_import_service.h"
+#include "test/gguf_test_writer.h"
+
+namespace {
+using modellist_utils::ModelEntry;
+using modellist_utils::ModelRegistry;
+using modellist_utils::ModelStatus;
+
+class ModelImportServiceTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = std::filesystem::temp_directory_path() / "model_import_service";
+    std::filesystem::remove_all(dir_);
+    std::filesystem::create_directories(dir_ / "share" / "nested");
+    registry_ = std::make_unique<ModelRegistryService>(dir_ / "registry");
+  }
+
+  void TearDown() override {
+    registry_.reset();
+    std::filesystem::remove_all(dir_);
+  }
+
+  // A header-only llama model
+  std::string WriteGGUF(const std::string& name) {
+    auto path = (dir_ / "share" / name).string();
+    test_utils::GGUFWriter()
+        .Header(0, 3)
+        .KeyStr("general.architecture", "llama")
+        .KeyU32("llama.block_count", 2)
+        .KeyU32("llama.context_length", 4096)
+        .WriteTo(path);
+    return path;
+  }
+
+  std::filesystem::path dir_;
+  std::unique_ptr<ModelRegistryService> registry_;
+};
+}  // namespace
+
+TEST_F(ModelImportServiceTest, ExpandsDirectoriesAndPatterns) {
+  auto a = WriteGGUF("a.gguf");
+  auto b = WriteGGUF("nested/b-00001-of-00002.gguf");
+  WriteGGUF("nested/b-00002-of-00002.gguf");
+  std::ofstream(dir_ / "share" / "readme.txt") << "not a model";
+
+  auto share = (dir_ / "share").string();
+  EXPECT_TRUE(ModelImportService::IsBatch(share));
+  EXPECT_EQ(ModelImportService::ExpandPath(share),
+            (std::vector<std::string>{a, b}));
+  EXPECT_EQ(ModelImportService::ExpandPath(share + "/nested/b-*.gguf"),
+            std::vector<std::string>{b});
+  EXPECT_TRUE(ModelImportService::IsBatch(share + "/*.gguf"));
+  EXPECT_FALSE(ModelImportService::IsBatch(a));
+  EXPECT_THROW(ModelImportService::ExpandPath(share + "/*.bin"),
+               std::runtime_error);
+
+  EXPECT_EQ(ModelImportService::ModelIdFor(a), "a");
+  EXPECT_EQ(ModelImportService::ModelIdFor(b), "b");
+}
+
+TEST_F(ModelImportServiceTest, ImportsBatchAndReportsFailures) {
+  WriteGGUF("a.gguf");
+  WriteGGUF("b.gguf");
+  WriteGGUF("nested/c.gguf");
+  std::ofstream(dir_ / "share" / "broken.gguf") << "GGUF but not really";
+  registry_->Update([&](ModelRegistry& r) {
+    r.Put(ModelEntry{"local-b", "author", "main", "elsewhere.yml", "local-b",
+                     ModelStatus::READY});
+    return true;
+  });
+  ModelImportService service(*registry_, dir_ / "imported");
+
+  auto results = service.ImportPath((dir_ / "share").string(), "local");
+  ASSERT_EQ(results.size(), 4);
+  EXPECT_EQ(results[0].model_id, "local-a");
+  EXPECT_TRUE(results[0].ok()) << results[0].error;
+  EXPECT_EQ(results[1].model_id, "local-b");
+  EXPECT_NE(results[1].error.find("already exists"), std::string::npos);
+  EXPECT_EQ(results[2].model_id, "local-broken");
+  EXPECT_FALSE(results[2].ok());
+  EXPECT_EQ(results[3].model_id, "local-c");
+  EXPECT_TRUE(results[3].ok()) << results[3].error;
+
+  auto registry = registry_->Get();
+  EXPECT_EQ(registry->Size(), 3);
+  auto entry = registry->FindById("local-c");
+  ASSERT_TRUE(entry.has_value());
+  EXPECT_EQ(entry->path_to_model_yaml,
+            (dir_ / "imported" / "local-c.yml").string());
+  // Only the imported models' YAML, no leftovers
+  std::vector<std::string> written;
+  for (const auto& f : std::filesystem::directory_iterator(dir_ / "imported")) {
+    written.push_back(f.path().filename().string());
+  }
+  std::sort(written.begin(), written.end());
+  EXPECT_EQ(written, (std::vector<std::string>{"local-a.yml", "local-c.yml"}));
+
+  // Again, nothing left to import
+  for (const auto& r : service.ImportPath((dir_ / "share").string(), "local")) {
+    EXPECT_FALSE(r.ok());
+  }
+  EXPECT_EQ(registry_->Get()->Size(), 3);
+}
+
+TEST_F(ModelImportServiceTest, DoesNotRegisterModelsWhoseYamlFailed) {
+  WriteGGUF("a.gguf");
+  WriteGGUF("b.gguf");
+  // Nothing can be renamed over a directory that is not empty
+  std::filesystem::create_directories(dir_ / "imported" / "local-a.yml" / "x");
+  ModelImportService service(*registry_, dir_ / "imported");
+
+  auto results = service.ImportPath((dir_ / "share").string(), "local");
+  ASSERT_EQ(results.size(), 2);
+  EXPECT_NE(results[0].error.find("Failed to write"), std::string::npos);
+  EXPECT_TRUE(results[1].ok()) << results[1].error;
+
+  auto registry = registry_->Get();
+  EXPECT_FALSE(registry->Contains("local-a"));
+  EXPECT_TRUE(registry->Contains("local-b"));
+  EXPECT_FALSE(
+      std::filesystem::exists(dir_ / "imported" / "local-a.yml.import"));
+}
+
+TEST_F(ModelImportServiceTest, ImportsIdsWithASlash) {
+  auto path = WriteGGUF("a.gguf");
+  ModelImportService service(*registry_, dir_ / "imported");
+
+  auto results = service.Import({{"author/model", path}});
+  ASSERT_EQ(results.size(), 1);
+  EXPECT_TRUE(results[0].ok()) << results[0].error;
+  auto entry = registry_->Get()->FindById("author/model");
+  ASSERT_TRUE(entry.has_value());
+  EXPECT_EQ(entry->path_to_model_yaml,
+            (dir_ / "imported" / "author" / "model.yml").string());
+  EXPECT_TRUE(std::filesystem::exists(entry->path_to_model_yaml));
+}
@@ -0,0 +1,120 @@
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include "config/gguf_parser.h"
+#include "config/model_memory_estimator.h"
+#include "gtest/gtest.h"
+#include "test/gguf_test_writer.h"
+
+namespace {
+constexpr uint64_t kMiB = 1024 * 1024;
+constexpr uint64_t kGiB = 1024 * kMiB;
+
+// Llama 3 8B like: 32 layers, 8 KV heads of 128
+config::ModelMemoryProfile MakeProfile() {
+  config::ModelMemoryProfile p;
+  p.n_layer = 32;
+  p.n_ctx_train = 131072;
+  p.n_head_kv = 8;
+  p.head_dim_k = 128;
+  p.head_dim_v = 128;
+  p.layer_bytes.assign(32, 200 * kMiB);
+  p.output_bytes = 400 * kMiB;
+  p.other_bytes = 400 * kMiB;
+  return p;
+}
+}  // namespace
+
+class ModelMemoryEstimatorTest : public ::testing::Test {};
+
+TEST_F(ModelMemoryEstimatorTest, KvCacheBytes) {
+  auto p = MakeProfile();
+  // 2 (K and V) x 32 layers x 8 heads x 128 x 2 bytes = 128 KiB per token
+  EXPECT_EQ(p.KvBytesPerLayerToken() * p.n_layer, 128 * 1024);
+  EXPECT_EQ(p.KvCacheBytes(131072), 16 * kGiB);
+  EXPECT_EQ(p.WeightBytes(), 32 * 200 * kMiB + 800 * kMiB);
+}
+
+TEST_F(ModelMemoryEstimatorTest, KeepTrainedContextWhenItFits) {
+  auto fit = config::FitToMemory(MakeProfile(), {64 * kGiB, 0}, 131072, 33);
+  EXPECT_TRUE(fit.fits);
+  EXPECT_EQ(fit.ctx_len, 131072);
+  EXPECT_EQ(fit.ngl, 33);
+}
+
+TEST_F(ModelMemoryEstimatorTest, HalveContextToFitRam) {
+  // 7.4 GiB of weights and 512 MiB of scratch leave room for 4 GiB of cache
+  auto fit = config::FitToMemory(MakeProfile(), {12 * kGiB, 0}, 131072, 33);
+  EXPECT_TRUE(fit.fits);
+  EXPECT_EQ(fit.ctx_len, 32768);
+  EXPECT_LE(fit.ram_bytes, 12 * kGiB);
+}
+
+TEST_F(ModelMemoryEstimatorTest, OffloadWhatFitsVram) {
+  // 2 GiB of cache at 16k, 64 MiB per layer
+  auto fit =
+      config::FitToMemory(MakeProfile(), {32 * kGiB, 4 * kGiB}, 16384, 33);
+  EXPECT_TRUE(fit.fits);
+  EXPECT_EQ(fit.ctx_len, 16384);
+  // (4096 - 512) MiB / (200 + 64) MiB per layer
+  EXPECT_EQ(fit.ngl, 13);
+  EXPECT_LE(fit.vram_bytes, 4 * kGiB);
+
+  auto all = config::FitToMemory(MakeProfile(), {32 * kGiB, 24 * kGiB}, 16384,
+                                 33);
+  EXPECT_EQ(all.ngl, 33);
+  EXPECT_EQ(all.ram_bytes, 400 * kMiB);
+}
+
+TEST_F(ModelMemoryEstimatorTest, ReportSmallestConfigWhenNothingFits) {
+  auto fit = config::FitToMemory(MakeProfile(), {1 * kGiB, 0}, 131072, 33);
+  EXPECT_FALSE(fit.fits);
+  EXPECT_EQ(fit.ctx_len, config::kMinFitCtxLen);
+
+  auto small = config::FitToMemory(MakeProfile(), {1 * kGiB, 0}, 512, 33);
+  EXPECT_EQ(small.ctx_len, 512);
+}
+
+TEST_F(ModelMemoryEstimatorTest, FitModelConfigFromGGUF) {
+  auto path = (std::filesystem::temp_directory_path() /
+               "mock_memory_estimator.gguf")
+                  .string();
+  test_utils::GGUFWriter w;
+  w.Header(3, 6).KeyStr("general.architecture", "llama");
+  for (auto [key, value] :
+       {std::pair<const char*, uint32_t>{"llama.block_count", 2},
+        {"llama.context_length", 65536},
+        {"llama.embedding_length", 4096},
+        {"llama.attention.head_count", 32},
+        {"llama.attention.head_count_kv", 8}}) {
+    w.KeyU32(key, value);
+  }
+  uint64_t offset = 0;
+  for (auto name : {"token_embd.weight", "blk.0.attn_q.weight",
+                    "blk.1.attn_q.weight"}) {
+    w.Tensor(name, {4096, 4096}, 8, offset);  // Q8_0
+    offset += 4096 * 4096 / 32 * 34;
+  }
+  w.WriteTo(path);
+
+  config::GGUFHandler handler;
+  handler.Parse(path);
+  auto profile = config::ModelMemoryProfile::FromGGUF(handler);
+  EXPECT_EQ(profile.n_layer, 2);
+  EXPECT_EQ(profile.n_ctx_train, 65536);
+  EXPECT_EQ(profile.n_head_kv, 8);
+  EXPECT_EQ(profile.head_dim_k, 128);
+  EXPECT_EQ(profile.layer_bytes[1], 4096ull * 4096 / 32 * 34);
+  EXPECT_EQ(profile.other_bytes, 4096ull * 4096 / 32 * 34);
+
+  auto mc = handler.GetModelConfig();
+  EXPECT_EQ(mc.ctx_len, 65536);
+  // 8 KiB of cache per token, about 200 MiB are left next to the weights and
+  // scratch buffers
+  auto fit = config::FitModelConfig(handler, mc, {768 * kMiB, 0});
+  EXPECT_TRUE(fit.fits);
+  EXPECT_EQ(mc.ctx_len, 16384);
+  EXPECT_EQ(mc.max_tokens, 16384);
+  EXPECT_EQ(mc.ngl, 3);
+  std::filesystem::remove(path);
+}
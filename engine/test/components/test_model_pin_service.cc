@@ -0,0 +1,83 @@
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include "gtest/gtest.h"
+#include "services/model_pin_service.h"
+
+class ModelPinServiceTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = std::filesystem::temp_directory_path() / "cortex_pin";
+    std::filesystem::create_directories(dir_);
+  }
+
+  void TearDown() override { std::filesystem::remove_all(dir_); }
+
+  std::string WriteFile(const std::string& name, size_t bytes) {
+    auto path = (dir_ / name).string();
+    std::ofstream out(path, std::ios::binary);
+    out << std::string(bytes, 'p');
+    return path;
+  }
+
+  std::filesystem::path dir_;
+};
+
+TEST_F(ModelPinServiceTest, PinsWithinBudget) {
+  auto a = WriteFile("a-00001-of-00002.gguf", 4096);
+  auto b = WriteFile("a-00002-of-00002.gguf", 1000);
+  auto c = WriteFile("c.gguf", 8192);
+  ModelPinService pins(10000);
+
+  auto pinned = pins.Pin("a", {a, b});
+  EXPECT_EQ(pinned.model, "a");
+  EXPECT_EQ(pinned.bytes, 5096);
+  EXPECT_EQ(pins.UsedBytes(), 5096);
+
+  // 5096 + 8192 is over the budget, the pin of "a" is kept
+  EXPECT_THROW(pins.Pin("c", {c}), std::runtime_error);
+  EXPECT_EQ(pins.UsedBytes(), 5096);
+  ASSERT_EQ(pins.List().size(), 1);
+
+  EXPECT_TRUE(pins.Unpin("a"));
+  EXPECT_FALSE(pins.Unpin("a"));
+  EXPECT_EQ(pins.UsedBytes(), 0);
+  EXPECT_EQ(pins.Pin("c", {c}).bytes, 8192);
+}
+
+TEST_F(ModelPinServiceTest, RepinReplaces) {
+  auto a = WriteFile("a.gguf", 6000);
+  auto b = WriteFile("b.gguf", 3000);
+  ModelPinService pins(8000);
+  pins.Pin("model", {a});
+  // Only fits because the previous pin of the model is released
+  pins.Pin("model", {b});
+  EXPECT_EQ(pins.UsedBytes(), 3000);
+  auto list = pins.List();
+  ASSERT_EQ(list.size(), 1);
+  EXPECT_EQ(list[0].files, std::vector<std::string>{b});
+}
+
+TEST_F(ModelPinServiceTest, FailedRepinKeepsThePin) {
+  auto a = WriteFile("a.gguf", 6000);
+  ModelPinService pins(8000);
+  pins.Pin("model", {a});
+  EXPECT_THROW(pins.Pin("model", {a, (dir_ / "missing.gguf").string()}),
+               std::runtime_error);
+  // Over the budget even without the previous pin
+  auto big = WriteFile("big.gguf", 9000);
+  EXPECT_THROW(pins.Pin("model", {big}), std::runtime_error);
+  EXPECT_EQ(pins.UsedBytes(), 6000);
+  auto list = pins.List();
+  ASSERT_EQ(list.size(), 1);
+  EXPECT_EQ(list[0].files, std::vector<std::string>{a});
+}
+
+TEST_F(ModelPinServiceTest, MissingFileReleasesBudget) {
+  ModelPinService pins(8000);
+  EXPECT_THROW(pins.Pin("model", {(dir_ / "missing.gguf").string()}),
+               std::runtime_error);
+  EXPECT_EQ(pins.UsedBytes(), 0);
+  EXPECT_TRUE(pins.List().empty());
+}
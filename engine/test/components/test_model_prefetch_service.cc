@@ -0,0 +1,100 @@
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include "gtest/gtest.h"
+#include "services/model_prefetch_service.h"
+
+class ModelPrefetchServiceTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = std::filesystem::temp_directory_path() / "cortex_prefetch";
+    std::filesystem::create_directories(dir_);
+  }
+
+  void TearDown() override { std::filesystem::remove_all(dir_); }
+
+  std::string WriteFile(const std::string& name, size_t bytes) {
+    auto path = (dir_ / name).string();
+    std::ofstream out(path, std::ios::binary);
+    out << std::string(bytes, 'w');
+    return path;
+  }
+
+  std::filesystem::path dir_;
+};
+
+TEST_F(ModelPrefetchServiceTest, PlanFollowsTensorOrder) {
+  std::vector<config::GGUFShard> shards{{"a.gguf", 1024}, {"b.gguf", 512}};
+  std::vector<config::GGUFTensorInfo> tensors{
+      {"token_embd.weight", {}, 0, 0, 1000, 0},
+      // 24 bytes of alignment padding in between, merged
+      {"blk.0.attn_q.weight", {}, 0, 1024, 2000, 0},
+      {"blk.1.attn_q.weight", {}, 0, 0, 3000, 1},
+      // Out of order in the file, a range of its own
+      {"output.weight", {}, 0, 8192, 100, 0},
+  };
+  auto ranges = ModelPrefetchService::PlanRanges(shards, tensors, UINT64_MAX);
+  ASSERT_EQ(ranges.size(), 3);
+  EXPECT_EQ(ranges[0].path, "a.gguf");
+  EXPECT_EQ(ranges[0].offset, 0);
+  EXPECT_EQ(ranges[0].length, 1024 + 1024 + 2000);
+  EXPECT_EQ(ranges[1].path, "b.gguf");
+  EXPECT_EQ(ranges[1].offset, 512);
+  EXPECT_EQ(ranges[1].length, 3000);
+  EXPECT_EQ(ranges[2].offset, 1024 + 8192);
+
+  // Capped by the memory budget
+  ranges = ModelPrefetchService::PlanRanges(shards, tensors, 3000);
+  ASSERT_EQ(ranges.size(), 1);
+  EXPECT_EQ(ranges[0].length, 3000);
+}
+
+TEST_F(ModelPrefetchServiceTest, ReadsEveryRange) {
+  auto a = WriteFile("a.gguf", 3 * ModelPrefetchService::kChunkBytes + 10);
+  auto b = WriteFile("b.gguf", 1000);
+  ModelPrefetchService prefetch(3);
+  EXPECT_FALSE(prefetch.GetProgress("model").has_value());
+
+  prefetch.Start("model",
+                 {{a, 0, 3 * ModelPrefetchService::kChunkBytes + 10},
+                  {b, 100, 900}});
+  prefetch.Wait("model");
+  auto progress = prefetch.GetProgress("model");
+  ASSERT_TRUE(progress.has_value());
+  EXPECT_TRUE(progress->finished);
+  EXPECT_EQ(progress->total_bytes,
+            3 * ModelPrefetchService::kChunkBytes + 10 + 900);
+  EXPECT_EQ(progress->done_bytes, progress->total_bytes);
+
+  prefetch.Cancel("model");
+  EXPECT_FALSE(prefetch.GetProgress("model").has_value());
+}
+
+TEST_F(ModelPrefetchServiceTest, StopsOnMissingFile) {
+  ModelPrefetchService prefetch;
+  prefetch.Start("model", {{(dir_ / "missing.gguf").string(), 0, 4096}});
+  prefetch.Wait("model");
+  auto progress = prefetch.GetProgress("model");
+  ASSERT_TRUE(progress.has_value());
+  EXPECT_TRUE(progress->finished);
+  EXPECT_EQ(progress->done_bytes, 0);
+}
+
+TEST_F(ModelPrefetchServiceTest, ReplacesAPrefetch) {
+  auto a = WriteFile("a.gguf", 4 * ModelPrefetchService::kChunkBytes);
+  ModelPrefetchService prefetch(1);
+  EXPECT_FALSE(prefetch.Has("model"));
+  prefetch.Start("model", {{a, 0, 4 * ModelPrefetchService::kChunkBytes}});
+  EXPECT_TRUE(prefetch.Has("model"));
+
+  // The first one stops in the background, the second reads everything
+  prefetch.Start("model", {{a, 0, 1000}});
+  prefetch.Wait("model");
+  auto progress = prefetch.GetProgress("model");
+  ASSERT_TRUE(progress.has_value());
+  EXPECT_EQ(progress->total_bytes, 1000);
+  EXPECT_EQ(progress->done_bytes, 1000);
+
+  prefetch.Cancel("model");
+  EXPECT_FALSE(prefetch.Has("model"));
+}
@@ -0,0 +1,137 @@
+#include <filesystem>
+#include <fstream>
+#include "gtest/gtest.h"
+#include "utils/model_registry.h"
+
+namespace {
+using modellist_utils::ModelEntry;
+using modellist_utils::ModelRegistry;
+using modellist_utils::ModelStatus;
+
+class ModelRegistryTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = std::filesystem::temp_directory_path() / "model registry test";
+    std::filesystem::remove_all(dir_);
+    std::filesystem::create_directories(dir_);
+    path_ = dir_ / "model.registry";
+  }
+
+  void TearDown() override { std::filesystem::remove_all(dir_); }
+
+  static ModelEntry Entry(const std::string& id, const std::string& alias) {
+    return ModelEntry{id,    "author/" + id,     "main",
+                      "/models dir/" + id + "/model.yml",
+                      alias, ModelStatus::READY};
+  }
+
+  std::filesystem::path dir_;
+  std::filesystem::path path_;
+};
+}  // namespace
+
+TEST_F(ModelRegistryTest, FindsByIdAndAlias) {
+  ModelRegistry registry(path_);
+  registry.Put(Entry("a", "alias-a"));
+  registry.Put(Entry("b", "alias-b"));
+
+  EXPECT_EQ(registry.Find("a")->model_alias, "alias-a");
+  EXPECT_EQ(registry.Find("alias-b")->model_id, "b");
+  EXPECT_FALSE(registry.Find("c").has_value());
+  EXPECT_TRUE(registry.Contains("alias-a"));
+  EXPECT_FALSE(registry.Contains("alias-c"));
+
+  // Realiasing drops the old alias
+  registry.Put(Entry("a", "renamed"));
+  EXPECT_FALSE(registry.Contains("alias-a"));
+  EXPECT_EQ(registry.Find("renamed")->model_id, "a");
+
+  EXPECT_TRUE(registry.Remove("b"));
+  EXPECT_FALSE(registry.Remove("b"));
+  EXPECT_FALSE(registry.Contains("alias-b"));
+}
+
+TEST_F(ModelRegistryTest, PersistsInInsertionOrder) {
+  {
+    ModelRegistry registry(path_);
+    for (auto id : {"c", "a", "b"}) {
+      registry.Put(Entry(id, id));
+    }
+    registry.Replace("a", Entry("a2", "a2"));
+  }
+  ModelRegistry registry(path_);
+  auto list = registry.List();
+  ASSERT_EQ(list.size(), 3);
+  EXPECT_EQ(list[0].model_id, "c");
+  EXPECT_EQ(list[1].model_id, "b");
+  EXPECT_EQ(list[2].model_id, "a2");
+  // Paths with spaces survive, model.list split them
+  EXPECT_EQ(list[0].path_to_model_yaml, "/models dir/c/model.yml");
+}
+
+TEST_F(ModelRegistryTest, MigratesModelList) {
+  auto legacy = dir_ / "model.list";
+  {
+    std::ofstream f(legacy);
+    f << "m1 author/m1 main /p/m1.yml m1 READY sha256:abc\n";
+    f << "broken line\n";
+    f << "m2 author/m2 main /p/m2.yml m2 RUNNING\n";
+  }
+  ModelRegistry registry(path_, legacy);
+  ASSERT_EQ(registry.Size(), 2);
+  EXPECT_EQ(registry.Find("m1")->integrity, "sha256:abc");
+  EXPECT_EQ(registry.Find("m2")->status, ModelStatus::RUNNING);
+  EXPECT_FALSE(std::filesystem::exists(legacy));
+  EXPECT_TRUE(std::filesystem::exists(dir_ / "model.list.migrated"));
+}
+
+TEST_F(ModelRegistryTest, DropsTornTail) {
+  {
+    ModelRegistry registry(path_);
+    registry.Put(Entry("a", "a"));
+    registry.Put(Entry("b", "b"));
+  }
+  // A crash in the middle of the last append
+  auto size = std::filesystem::file_size(path_);
+  std::filesystem::resize_file(path_, size - 3);
+
+  ModelRegistry registry(path_);
+  EXPECT_EQ(registry.Size(), 1);
+  registry.Put(Entry("c", "c"));
+
+  ModelRegistry reopened(path_);
+  ASSERT_EQ(reopened.Size(), 2);
+  EXPECT_TRUE(reopened.Contains("c"));
+}
+
+TEST_F(ModelRegistryTest, RefreshSeesOtherInstances) {
+  ModelRegistry first(path_);
+  ModelRegistry second(path_);
+  first.Put(Entry("a", "a"));
+  EXPECT_FALSE(second.Contains("a"));
+  second.Refresh();
+  EXPECT_TRUE(second.Contains("a"));
+
+  // Compaction rewrites the file under the other instance
+  second.Put(Entry("b", "b"));
+  second.Compact();
+  first.Refresh();
+  EXPECT_EQ(first.Size(), 2);
+  first.Put(Entry("c", "c"));
+  second.Refresh();
+  EXPECT_EQ(second.Size(), 3);
+}
+
+TEST_F(ModelRegistryTest, CompactsDeadRecords) {
+  ModelRegistry registry(path_);
+  registry.Put(Entry("a", "a"));
+  for (int i = 0; i < 1000; i++) {
+    registry.Put(Entry("b", "b" + std::to_string(i)));
+  }
+  EXPECT_LE(registry.LogRecords(), 2 * 256 + 2);
+  EXPECT_EQ(registry.Find("b")->model_alias, "b999");
+
+  ModelRegistry reopened(path_);
+  EXPECT_EQ(reopened.Size(), 2);
+  EXPECT_EQ(reopened.Find("b999")->model_id, "b");
+}
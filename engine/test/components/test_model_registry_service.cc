@@ -0,0 +1,87 @@
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+#include "gtest/gtest.h"
+#include "services/model_registry_service.h"
+
+namespace {
+using modellist_utils::ModelEntry;
+using modellist_utils::ModelRegistry;
+using modellist_utils::ModelStatus;
+
+class ModelRegistryServiceTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = std::filesystem::temp_directory_path() / "model_registry_service";
+    std::filesystem::remove_all(dir_);
+    path_ = dir_ / "model.registry";
+  }
+
+  void TearDown() override { std::filesystem::remove_all(dir_); }
+
+  static ModelRegistryService::Mutation Put(const std::string& id) {
+    return [id](ModelRegistry& r) {
+      if (r.Contains(id)) {
+        return false;
+      }
+      r.Put(ModelEntry{id, "author", "main", "/m.yml", id,
+                       ModelStatus::READY});
+      return true;
+    };
+  }
+
+  std::filesystem::path dir_;
+  std::filesystem::path path_;
+};
+}  // namespace
+
+TEST_F(ModelRegistryServiceTest, SnapshotsStayConsistent) {
+  ModelRegistryService service(path_);
+  EXPECT_TRUE(service.Update(Put("a")));
+  EXPECT_FALSE(service.Update(Put("a")));
+
+  auto before = service.Get();
+  EXPECT_TRUE(service.Update(Put("b")));
+  EXPECT_EQ(before->Size(), 1);
+  EXPECT_EQ(service.Get()->Size(), 2);
+  // Nothing changed, the same snapshot is handed out
+  EXPECT_EQ(service.Get(), service.Get());
+}
+
+// Two services on one file stand in for the server and a CLI process: the
+// lock file keeps their writers apart just the same
+TEST_F(ModelRegistryServiceTest, SerializesWritersAcrossInstances) {
+  ModelRegistryService server(path_);
+  ModelRegistryService cli(path_);
+  constexpr int kThreads = 8;
+  constexpr int kPerThread = 50;
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&, t] {
+      auto& service = t % 2 == 0 ? server : cli;
+      for (int i = 0; i < kPerThread; i++) {
+        service.Update(Put(std::to_string(t) + "-" + std::to_string(i)));
+        // Readers run alongside and always see a whole registry
+        auto snapshot = service.Get();
+        EXPECT_EQ(snapshot->List().size(), snapshot->Size());
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  EXPECT_EQ(server.Get()->Size(), kThreads * kPerThread);
+  EXPECT_EQ(cli.Get()->Size(), kThreads * kPerThread);
+  EXPECT_EQ(ModelRegistry(path_).Size(), kThreads * kPerThread);
+}
+
+TEST_F(ModelRegistryServiceTest, ReadersSeeOtherProcessWrites) {
+  ModelRegistryService server(path_);
+  EXPECT_EQ(server.Get()->Size(), 0);
+  ModelRegistryService cli(path_);
+  cli.Update(Put("pulled"));
+  EXPECT_TRUE(server.Get()->Contains("pulled"));
+}
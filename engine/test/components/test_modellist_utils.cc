@@ -90,6 +90,21 @@ TEST_F(ModelListUtilsTestSuite, TestPersistence) {
   model_list_.DeleteModelEntry("test_model_id");
 }
 
+TEST_F(ModelListUtilsTestSuite, TestPersistIntegrity) {
+  model_list_.AddModelEntry(kTestModel);
+  EXPECT_TRUE(model_list_.GetModelInfo("test_model_id").integrity.empty());
+
+  modellist_utils::ModelEntry verified_model = kTestModel;
+  verified_model.integrity = "xxh64t:0123456789abcdef:fedcba9876543210";
+  EXPECT_TRUE(model_list_.UpdateModelEntry("test_model_id", verified_model));
+
+  modellist_utils::ModelListUtils new_model_list;
+  auto retrieved_model = new_model_list.GetModelInfo("test_alias");
+  EXPECT_EQ(retrieved_model.integrity, verified_model.integrity);
+  EXPECT_EQ(retrieved_model.status, modellist_utils::ModelStatus::READY);
+  model_list_.DeleteModelEntry("test_model_id");
+}
+
 TEST_F(ModelListUtilsTestSuite, TestUpdateModelAlias) {
   // Add the test model
   ASSERT_TRUE(model_list_.AddModelEntry(kTestModel));
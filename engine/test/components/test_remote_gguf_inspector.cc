@@ -0,0 +1,177 @@
+#include <httplib.h>
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "gtest/gtest.h"
+#include "services/remote_gguf_inspector.h"
+#include "test/gguf_test_writer.h"
+
+namespace {
+using test_utils::GGUFWriter;
+
+constexpr uint32_t kQ4K = 12;
+constexpr uint64_t kAlignment = 32;
+constexpr uint64_t kEmbd = 1024;
+constexpr uint64_t kVocab = 200000;
+
+// A 2 layer llama whose vocabulary alone takes a few MB of metadata, so the
+// head has to be read in more than one range. Shard `split_no` of
+// `split_count` holds layer `split_no`.
+std::string MakeModel(uint16_t split_no = 0, uint16_t split_count = 0) {
+  GGUFWriter w;
+  bool first = split_no == 0;
+  std::vector<std::string> tensors;
+  for (int l = 0; l < 2; l++) {
+    if (split_count == 0 || l == split_no) {
+      tensors.push_back("blk." + std::to_string(l) + ".ffn_up.weight");
+    }
+  }
+  w.Header(tensors.size(), first ? (split_count > 0 ? 10 : 8) : 2);
+  if (first) {
+    w.KeyStr("general.architecture", "llama");
+    w.KeyU32("llama.context_length", 8192);
+    w.KeyU32("llama.block_count", 2);
+    w.KeyU32("llama.embedding_length", kEmbd);
+    w.KeyU32("llama.attention.head_count", 16);
+    w.KeyU32("llama.attention.head_count_kv", 4);
+    w.KeyArray("tokenizer.ggml.tokens", test_utils::kGGUFString, kVocab);
+    for (uint64_t i = 0; i < kVocab; i++) {
+      w.Str("token" + std::to_string(i));
+    }
+  }
+  if (split_count > 0) {
+    w.KeyU32("split.no", split_no);
+    w.KeyU32("split.count", split_count);
+    if (first) {
+      w.KeyU32("split.tensors.count", 2);
+    }
+  } else {
+    w.KeyU32("general.alignment", kAlignment);
+  }
+  uint64_t size = kEmbd * kEmbd / 256 * 144;
+  for (size_t i = 0; i < tensors.size(); i++) {
+    w.Tensor(tensors[i], {kEmbd, kEmbd}, kQ4K, i * size);
+  }
+  w.Align(kAlignment);
+  // Weights that a download would have to fetch
+  w.data().append(tensors.size() * size + (16u << 20), '\1');
+  return w.data();
+}
+
+// Serves byte ranges of in-memory files, recording what was read
+class FakeRemote {
+ public:
+  std::map<std::string, std::string> files;
+  uint64_t reads = 0;
+
+  config::GGUFHandler::RangeReader Reader() {
+    return [this](const std::string& url, uint64_t offset, uint64_t length) {
+      std::lock_guard<std::mutex> l(mutex_);
+      auto it = files.find(url);
+      if (it == files.end()) {
+        throw std::runtime_error("404 " + url);
+      }
+      reads++;
+      if (offset >= it->second.size()) {
+        return std::string();
+      }
+      return it->second.substr(offset, length);
+    };
+  }
+
+ private:
+  std::mutex mutex_;
+};
+}  // namespace
+
+TEST(RemoteGGUFInspectorTest, EstimatesFromHeadOnly) {
+  FakeRemote remote;
+  remote.files["https://host/m.gguf"] = MakeModel();
+  auto file_size = remote.files["https://host/m.gguf"].size();
+  RemoteGGUFInspector inspector(remote.Reader());
+
+  auto e = inspector.Inspect("https://host/m.gguf");
+  EXPECT_EQ(e.architecture, "llama");
+  EXPECT_EQ(e.urls, std::vector<std::string>{"https://host/m.gguf"});
+  EXPECT_EQ(e.ctx_len, 8192);
+  EXPECT_EQ(e.main_type, "Q4_K");
+  EXPECT_EQ(e.weight_bytes, 2 * kEmbd * kEmbd / 256 * 144);
+  // Grown past the first range, but the weights were never read
+  EXPECT_GT(remote.reads, 1);
+  EXPECT_GT(e.fetched_bytes, config::GGUFHandler::kInitialHeadBytes);
+  EXPECT_LT(e.fetched_bytes, file_size - e.weight_bytes);
+
+  // f16 K and V of 4 heads of 64 for 2 layers
+  uint64_t kv = 2 * 8192ull * 4 * (64 + 64) * 2;
+  EXPECT_EQ(e.profile.KvCacheBytes(8192), kv);
+  EXPECT_EQ(e.required_bytes,
+            e.weight_bytes + kv + config::kComputeBufferBytes);
+}
+
+TEST(RemoteGGUFInspectorTest, ReadsEveryShardHead) {
+  FakeRemote remote;
+  remote.files["https://host/m-00001-of-00002.gguf"] = MakeModel(0, 2);
+  remote.files["https://host/m-00002-of-00002.gguf"] = MakeModel(1, 2);
+  RemoteGGUFInspector inspector(remote.Reader());
+
+  auto e = inspector.Inspect("https://host/m-00001-of-00002.gguf");
+  ASSERT_EQ(e.urls.size(), 2);
+  EXPECT_EQ(e.urls[1], "https://host/m-00002-of-00002.gguf");
+  EXPECT_EQ(e.weight_bytes, 2 * kEmbd * kEmbd / 256 * 144);
+  EXPECT_EQ(e.profile.layer_bytes.size(), 2);
+
+  remote.files.erase("https://host/m-00002-of-00002.gguf");
+  EXPECT_THROW(inspector.Inspect("https://host/m-00001-of-00002.gguf"),
+               std::runtime_error);
+}
+
+TEST(RemoteGGUFInspectorTest, RejectsNonGGUF) {
+  FakeRemote remote;
+  remote.files["https://host/m.gguf"] = std::string(4096, 'x');
+  RemoteGGUFInspector inspector(remote.Reader());
+  EXPECT_THROW(inspector.Inspect("https://host/m.gguf"), std::runtime_error);
+
+  // Ends in the middle of the metadata
+  remote.files["https://host/m.gguf"] = MakeModel().substr(0, 3 << 20);
+  EXPECT_THROW(inspector.Inspect("https://host/m.gguf"),
+               config::GGUFTruncatedError);
+}
+
+TEST(RemoteGGUFInspectorTest, HttpRangeRequests) {
+  auto model = MakeModel();
+  std::vector<std::string> ranges;
+  std::mutex mutex;
+  httplib::Server server;
+  // httplib answers Range requests on set_content() with 206 and the slice
+  server.Get("/model.gguf",
+             [&](const httplib::Request& req, httplib::Response& res) {
+               std::lock_guard<std::mutex> l(mutex);
+               ranges.push_back(req.get_header_value("Range"));
+               res.set_content(model, "application/octet-stream");
+             });
+  auto port = server.bind_to_any_port("127.0.0.1");
+  std::thread listener([&server]() { server.listen_after_bind(); });
+  server.wait_until_ready();
+
+  auto url = "http://127.0.0.1:" + std::to_string(port) + "/model.gguf";
+  auto head = RemoteGGUFInspector::HttpRange(url, 0, 24);
+  ASSERT_EQ(head.size(), 24);
+  EXPECT_EQ(std::memcmp(head.data(), model.data(), 24), 0);
+  EXPECT_EQ(RemoteGGUFInspector::HttpRange(url, model.size() - 10, 100),
+            model.substr(model.size() - 10));
+
+  RemoteGGUFInspector inspector;
+  auto e = inspector.Inspect(url);
+  EXPECT_EQ(e.ctx_len, 8192);
+  EXPECT_LT(e.fetched_bytes, model.size() - e.weight_bytes);
+
+  server.stop();
+  listener.join();
+  for (const auto& r : ranges) {
+    EXPECT_EQ(r.rfind("bytes=", 0), 0);
+  }
+}
@@ -0,0 +1,47 @@
+#include <atomic>
+#include <chrono>
+#include <future>
+#include "gtest/gtest.h"
+#include "utils/worker_pool.h"
+
+class WorkerPoolTest : public ::testing::Test {};
+
+TEST_F(WorkerPoolTest, RunsTasksOnWorkerThreads) {
+  WorkerPool pool(2, 16);
+  EXPECT_FALSE(WorkerPool::OnWorkerThread());
+  std::promise<bool> on_worker;
+  ASSERT_TRUE(pool.Submit(
+      [&on_worker] { on_worker.set_value(WorkerPool::OnWorkerThread()); }));
+  EXPECT_TRUE(on_worker.get_future().get());
+}
+
+TEST_F(WorkerPoolTest, RejectsWhenQueueIsFull) {
+  WorkerPool pool(1, 1);
+  std::promise<void> release;
+  auto released = release.get_future().share();
+  std::promise<void> started;
+  ASSERT_TRUE(pool.Submit([&started, released] {
+    started.set_value();
+    released.wait();
+  }));
+  started.get_future().wait();
+
+  EXPECT_TRUE(pool.Submit([] {}));
+  EXPECT_FALSE(pool.Submit([] {}));
+  // As after a config reload
+  pool.SetMaxQueue(2);
+  EXPECT_TRUE(pool.Submit([] {}));
+  EXPECT_FALSE(pool.Submit([] {}));
+  release.set_value();
+}
+
+TEST_F(WorkerPoolTest, DrainsQueueOnDestruction) {
+  std::atomic<int> done{0};
+  {
+    WorkerPool pool(1, 64);
+    for (int i = 0; i < 32; i++) {
+      pool.Submit([&done] { done++; });
+    }
+  }
+  EXPECT_EQ(done, 32);
+}
@@ -1,7 +1,10 @@
 #include <cstdio>
+#include <filesystem>
 #include <fstream>
 #include <stdexcept>
 #include <string>
+#include <vector>
+#include "config/model_config_snapshot.h"
 #include "config/yaml_config.h"
 #include "gtest/gtest.h"
 
@@ -48,6 +51,8 @@ class YamlHandlerTest : public ::testing::Test {
   // Helper function to remove a file
   void removeFile(const std::string& filename) {
     std::remove(filename.c_str());
+    std::remove(
+        config::ModelConfigSnapshot::PathFor(filename).string().c_str());
   }
 };
 
@@ -196,4 +201,77 @@ seed: also_not_an_int
   EXPECT_EQ(new_config.seed, -1);
 
   removeFile(filename);
-}
\ No newline at end of file
+}
+TEST_F(YamlHandlerTest, ServesFreshSnapshot) {
+  std::string filename = createTempYamlFile(R"(
+name: snapshot_model
+engine: cortex.llamacpp
+ctx_len: 4096
+ngl: 33
+temperature: 0.6
+stop:
+  - "<|eot_id|>"
+  - "<|end_of_text|>"
+files:
+  - "/models/snapshot.gguf"
+)");
+
+  handler->ModelConfigFromFile(filename);
+  EXPECT_FALSE(handler->FromSnapshot());
+  // Unset floats are NaN, which never compare equal
+  auto parsed = handler->GetModelConfig().ToJson().toStyledString();
+
+  config::YamlHandler cached;
+  cached.ModelConfigFromFile(filename);
+  EXPECT_TRUE(cached.FromSnapshot());
+  EXPECT_EQ(cached.GetModelConfig().ToJson().toStyledString(), parsed);
+
+  // Edited, the snapshot no longer matches the file
+  {
+    std::ofstream file(filename);
+    file << "name: edited_model\nctx_len: 2048\n";
+  }
+  config::YamlHandler edited;
+  edited.ModelConfigFromFile(filename);
+  EXPECT_FALSE(edited.FromSnapshot());
+  EXPECT_EQ(edited.GetModelConfig().name, "edited_model");
+  EXPECT_EQ(edited.GetModelConfig().ctx_len, 2048);
+
+  removeFile(filename);
+}
+
+TEST_F(YamlHandlerTest, IgnoresBrokenSnapshot) {
+  std::string filename = createTempYamlFile("name: broken_snapshot\n");
+  handler->ModelConfigFromFile(filename);
+  {
+    // Same length, garbled
+    auto path = config::ModelConfigSnapshot::PathFor(filename);
+    auto size = std::filesystem::file_size(path);
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file << std::string(size, '\xff');
+  }
+  config::YamlHandler reread;
+  reread.ModelConfigFromFile(filename);
+  EXPECT_FALSE(reread.FromSnapshot());
+  EXPECT_EQ(reread.GetModelConfig().name, "broken_snapshot");
+
+  removeFile(filename);
+}
+
+TEST_F(YamlHandlerTest, ListsShardsThatAreStillMissing) {
+  auto dir = std::filesystem::temp_directory_path() / "yaml_split_model";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  // Only the first of two shards has arrived
+  std::ofstream(dir / "model-00001-of-00002.gguf") << "GGUF";
+  auto yaml = (dir / "model.yml").string();
+  std::ofstream(yaml) << "name: split\nengine: cortex.llamacpp\n";
+
+  handler->ModelConfigFromFile(yaml);
+  EXPECT_EQ(handler->GetModelConfig().files,
+            (std::vector<std::string>{
+                (dir / "model-00001-of-00002.gguf").string(),
+                (dir / "model-00002-of-00002.gguf").string()}));
+
+  std::filesystem::remove_all(dir);
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "config/gguf_parser.h"
+
+// GGUF fixtures for the component tests and the benchmarks
+namespace test_utils {
+
+// Metadata value types of the GGUF format
+enum GGUFValueType : uint32_t {
+  kGGUFUInt16 = 2,
+  kGGUFUInt32 = 4,
+  kGGUFInt32 = 5,
+  kGGUFFloat32 = 6,
+  kGGUFBool = 7,
+  kGGUFString = 8,
+  kGGUFArray = 9,
+  kGGUFUInt64 = 10,
+  kGGUFInt64 = 11,
+};
+
+/**
+ * Builds a GGUF file in memory, field by field. Nothing is checked, the
+ * counts in the header are whatever the caller writes, so that tests can
+ * also craft broken files.
+ */
+class GGUFWriter {
+ public:
+  // Any fixed size value, in host byte order as GGUF stores it
+  template <typename T>
+  GGUFWriter& Value(T v) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    data_.append(reinterpret_cast<const char*>(&v), sizeof(v));
+    return *this;
+  }
+  GGUFWriter& U32(uint32_t v) { return Value(v); }
+  GGUFWriter& U64(uint64_t v) { return Value(v); }
+
+  GGUFWriter& Str(const std::string& s) {
+    U64(s.size());
+    data_ += s;
+    return *this;
+  }
+
+  // Magic, version and the two counts
+  GGUFWriter& Header(uint64_t tensor_count, uint64_t kv_count,
+                     uint32_t version = 3) {
+    return U32(config::GGUF_MAGIC_NUMBER).U32(version).U64(tensor_count).U64(
+        kv_count);
+  }
+
+  // A key and the type of the value that follows
+  GGUFWriter& Key(const std::string& key, uint32_t type) {
+    return Str(key).U32(type);
+  }
+  GGUFWriter& KeyU32(const std::string& key, uint32_t v) {
+    return Key(key, kGGUFUInt32).U32(v);
+  }
+  GGUFWriter& KeyStr(const std::string& key, const std::string& v) {
+    return Key(key, kGGUFString).Str(v);
+  }
+  // The header of an array, its `length` elements follow
+  GGUFWriter& KeyArray(const std::string& key, uint32_t type,
+                       uint64_t length) {
+    return Key(key, kGGUFArray).U32(type).U64(length);
+  }
+
+  // An entry of the tensor info table
+  GGUFWriter& Tensor(const std::string& name,
+                     const std::vector<uint64_t>& dims, uint32_t type,
+                     uint64_t offset) {
+    Str(name).U32(static_cast<uint32_t>(dims.size()));
+    for (auto d : dims) {
+      U64(d);
+    }
+    return U32(type).U64(offset);
+  }
+
+  // Zeros up to the next multiple of `alignment`
+  GGUFWriter& Align(uint64_t alignment) {
+    data_.resize((data_.size() + alignment - 1) / alignment * alignment);
+    return *this;
+  }
+
+  std::string& data() { return data_; }
+
+  // Throws if the file cannot be written
+  void WriteTo(const std::string& path) const {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file || !file.write(data_.data(), data_.size())) {
+      throw std::runtime_error("Failed to write " + path);
+    }
+  }
+
+ private:
+  std::string data_;
+};
+}  // namespace test_utils
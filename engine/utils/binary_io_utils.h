@@ -0,0 +1,217 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include <io.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+// Little helpers for the compact binary caches written next to models. Values
+// are stored in host byte order, a cache from another machine simply fails
+// validation.
+namespace binary_io_utils {
+
+class BinaryWriter {
+ public:
+  template <typename T>
+  void Write(T v) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    buf_.append(reinterpret_cast<const char*>(&v), sizeof(T));
+  }
+
+  void WriteString(std::string_view s) {
+    Write<uint64_t>(s.size());
+    buf_.append(s.data(), s.size());
+  }
+
+  void WriteBytes(const void* data, size_t size) {
+    buf_.append(static_cast<const char*>(data), size);
+  }
+
+  const std::string& data() const { return buf_; }
+
+ private:
+  std::string buf_;
+};
+
+// Bounds-checked reads, throws std::runtime_error on truncated input
+class BinaryReader {
+ public:
+  explicit BinaryReader(std::string_view data) : data_(data) {}
+
+  template <typename T>
+  T Read() {
+    static_assert(std::is_trivially_copyable_v<T>);
+    T v;
+    std::memcpy(&v, Take(sizeof(T)).data(), sizeof(T));
+    return v;
+  }
+
+  std::string ReadString() { return std::string(ReadStringView()); }
+
+  std::string_view ReadStringView() {
+    auto size = Read<uint64_t>();
+    return Take(size);
+  }
+
+  std::string_view ReadBytes(size_t size) { return Take(size); }
+
+  size_t Position() const { return pos_; }
+  bool AtEnd() const { return pos_ == data_.size(); }
+
+ private:
+  std::string_view Take(uint64_t size) {
+    if (size > data_.size() - pos_) {
+      throw std::runtime_error("Truncated binary data");
+    }
+    auto s = data_.substr(pos_, size);
+    pos_ += size;
+    return s;
+  }
+
+  std::string_view data_;
+  size_t pos_ = 0;
+};
+
+// What a cache derived from a file is keyed by. A file replaced in place keeps
+// its path but not its inode, a file rewritten in place changes its mtime.
+struct FileIdentity {
+  uint64_t size = 0;
+  int64_t mtime_ns = 0;
+  uint64_t inode = 0;
+
+  bool operator==(const FileIdentity& o) const {
+    return size == o.size && mtime_ns == o.mtime_ns && inode == o.inode;
+  }
+  bool operator!=(const FileIdentity& o) const { return !(*this == o); }
+};
+
+inline bool GetFileIdentity(const std::filesystem::path& path,
+                            FileIdentity& id) {
+#if defined(_WIN32)
+  struct _stat64 st;
+  if (_wstat64(path.wstring().c_str(), &st) != 0) {
+    return false;
+  }
+  id.mtime_ns = static_cast<int64_t>(st.st_mtime) * 1000000000;
+  // Always 0 on Windows
+  id.inode = 0;
+#else
+  struct stat st;
+  if (stat(path.string().c_str(), &st) != 0) {
+    return false;
+  }
+#if defined(__APPLE__)
+  id.mtime_ns = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 +
+                st.st_mtimespec.tv_nsec;
+#else
+  id.mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 +
+                st.st_mtim.tv_nsec;
+#endif
+  id.inode = static_cast<uint64_t>(st.st_ino);
+#endif
+  id.size = static_cast<uint64_t>(st.st_size);
+  return true;
+}
+
+inline bool ReadFile(const std::filesystem::path& path, std::string& out) {
+  std::ifstream f(path, std::ios::binary);
+  if (!f) {
+    return false;
+  }
+  f.seekg(0, std::ios::end);
+  auto size = f.tellg();
+  if (size < 0) {
+    return false;
+  }
+  out.resize(static_cast<size_t>(size));
+  f.seekg(0);
+  return static_cast<bool>(f.read(out.data(), out.size()));
+}
+
+// Flushes a file, or on POSIX the entries of a directory, to the disk
+inline bool SyncFile(const std::filesystem::path& path) {
+#if defined(_WIN32)
+  // Directories cannot be opened this way, NTFS journals renames anyway
+  if (std::filesystem::is_directory(path)) {
+    return true;
+  }
+  int fd = _wopen(path.wstring().c_str(), _O_RDWR | _O_BINARY);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = _commit(fd) == 0;
+  _close(fd);
+#else
+  int fd = open(path.string().c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = fsync(fd) == 0;
+  close(fd);
+#endif
+  return ok;
+}
+
+// A sibling of `path` no other writer uses: tagged with the process, the
+// thread and a per-process counter, so concurrent writes of the same file
+// never share a temporary.
+inline std::filesystem::path UniqueTempPath(const std::filesystem::path& path) {
+  static std::atomic<uint64_t> counter{0};
+#if defined(_WIN32)
+  auto pid = _getpid();
+#else
+  auto pid = getpid();
+#endif
+  auto tid = std::hash<std::thread::id>{}(std::this_thread::get_id());
+  auto tmp = path;
+  tmp += "." + std::to_string(pid) + "." + std::to_string(tid) + "." +
+         std::to_string(counter.fetch_add(1)) + ".tmp";
+  return tmp;
+}
+
+// Readers never see a partial file: write to a temporary, then rename. A
+// `durable` write also survives a power loss once this returns.
+inline bool WriteFileAtomically(const std::filesystem::path& path,
+                                std::string_view data, bool durable = false) {
+  auto tmp = UniqueTempPath(path);
+  {
+    std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+    if (!f || !f.write(data.data(), data.size()) || !f.flush()) {
+      std::error_code ec;
+      std::filesystem::remove(tmp, ec);
+      return false;
+    }
+  }
+  std::error_code ec;
+  if (durable && !SyncFile(tmp)) {
+    std::filesystem::remove(tmp, ec);
+    return false;
+  }
+  std::filesystem::rename(tmp, path, ec);
+  if (ec) {
+    std::filesystem::remove(tmp, ec);
+    return false;
+  }
+  if (durable) {
+    auto dir = path.parent_path();
+    return SyncFile(dir.empty() ? std::filesystem::path(".") : dir);
+  }
+  return true;
+}
+}  // namespace binary_io_utils
@@ -13,12 +13,36 @@ struct CortexConfig {
   int maxLogLines;
   std::string apiServerHost;
   std::string apiServerPort;
+  int kvCacheSnapshotMaxMb = 10240;
+  // 0 means one per logical core
+  int ioThreads = 0;
+  int workerThreads = 0;
+  int workerQueueSize = 1024;
+  // 0 means no limit
+  int keepAliveRequests = 0;
+  int idleConnectionTimeout = 60;
+  // Share of the machine's RAM and VRAM a model may use, ctx_len and ngl are
+  // lowered to fit
+  int memoryBudgetPercent = 80;
+  // Memory for pinned model files, 0 disables pinning
+  int pinnedModelsMaxMb = 0;
+  // Download jobs that run at once, the others wait in a queue
+  int maxConcurrentDownloads = 2;
+  // CPU models expected to run side by side, each gets at least this share
+  // of the compute cores by default
+  int expectedCpuModels = 1;
 };
 
 const std::string kCortexFolderName = "cortexcpp";
 const std::string kDefaultHost{"127.0.0.1"};
 const std::string kDefaultPort{"3928"};
 const int kDefaultMaxLines{100000};
+const int kDefaultKvCacheSnapshotMaxMb{10240};
+const int kDefaultWorkerQueueSize{1024};
+const int kDefaultIdleConnectionTimeout{60};
+const int kDefaultMemoryBudgetPercent{80};
+const int kDefaultMaxConcurrentDownloads{2};
+const int kDefaultExpectedCpuModels{1};
 
 inline void DumpYamlConfig(const CortexConfig& config,
                            const std::string& path) {
@@ -35,6 +59,16 @@ inline void DumpYamlConfig(const CortexConfig& config,
     node["maxLogLines"] = config.maxLogLines;
     node["apiServerHost"] = config.apiServerHost;
     node["apiServerPort"] = config.apiServerPort;
+    node["kvCacheSnapshotMaxMb"] = config.kvCacheSnapshotMaxMb;
+    node["ioThreads"] = config.ioThreads;
+    node["workerThreads"] = config.workerThreads;
+    node["workerQueueSize"] = config.workerQueueSize;
+    node["keepAliveRequests"] = config.keepAliveRequests;
+    node["idleConnectionTimeout"] = config.idleConnectionTimeout;
+    node["memoryBudgetPercent"] = config.memoryBudgetPercent;
+    node["pinnedModelsMaxMb"] = config.pinnedModelsMaxMb;
+    node["maxConcurrentDownloads"] = config.maxConcurrentDownloads;
+    node["expectedCpuModels"] = config.expectedCpuModels;
 
     out_file << node;
     out_file.close();
@@ -53,18 +87,35 @@ inline CortexConfig FromYaml(const std::string& path,
 
   try {
     auto node = YAML::LoadFile(config_file_path.string());
-    int max_lines;
-    if (!node["maxLogLines"]) {
-      max_lines = kDefaultMaxLines;
-    } else {
-      max_lines = node["maxLogLines"].as<int>();
-    }
+    // Keys added after the first release may be missing from older files
+    auto get_or = [&node](const std::string& key, auto default_value) {
+      if (!node[key]) {
+        return default_value;
+      }
+      return node[key].as<decltype(default_value)>();
+    };
+    int max_lines = get_or("maxLogLines", kDefaultMaxLines);
     CortexConfig config = {
         .logFolderPath = node["logFolderPath"].as<std::string>(),
         .dataFolderPath = node["dataFolderPath"].as<std::string>(),
         .maxLogLines = max_lines,
         .apiServerHost = node["apiServerHost"].as<std::string>(),
         .apiServerPort = node["apiServerPort"].as<std::string>(),
+        .kvCacheSnapshotMaxMb =
+            get_or("kvCacheSnapshotMaxMb", kDefaultKvCacheSnapshotMaxMb),
+        .ioThreads = get_or("ioThreads", 0),
+        .workerThreads = get_or("workerThreads", 0),
+        .workerQueueSize = get_or("workerQueueSize", kDefaultWorkerQueueSize),
+        .keepAliveRequests = get_or("keepAliveRequests", 0),
+        .idleConnectionTimeout =
+            get_or("idleConnectionTimeout", kDefaultIdleConnectionTimeout),
+        .memoryBudgetPercent =
+            get_or("memoryBudgetPercent", kDefaultMemoryBudgetPercent),
+        .pinnedModelsMaxMb = get_or("pinnedModelsMaxMb", 0),
+        .maxConcurrentDownloads =
+            get_or("maxConcurrentDownloads", kDefaultMaxConcurrentDownloads),
+        .expectedCpuModels =
+            get_or("expectedCpuModels", kDefaultExpectedCpuModels),
     };
     return config;
   } catch (const YAML::BadFile& e) {
@@ -283,6 +283,19 @@ inline drogon::HttpResponsePtr CreateCortexHttpJsonResponse(
   return resp;
 };
 
+// For a body that is already JSON, e.g. kept serialized between requests
+inline drogon::HttpResponsePtr CreateCortexHttpRawJsonResponse(
+    const std::string& body) {
+  auto resp = drogon::HttpResponse::newHttpResponse();
+  resp->setContentTypeCode(drogon::CT_APPLICATION_JSON);
+  resp->setBody(body);
+#ifdef ALLOW_ALL_CORS
+  LOG_INFO << "Respond for all cors!";
+  resp->addHeader("Access-Control-Allow-Origin", "*");
+#endif
+  return resp;
+}
+
 inline drogon::HttpResponsePtr CreateCortexStreamResponse(
     const std::function<std::size_t(char*, std::size_t)>& callback,
     const std::string& attachmentFileName = "") {
@@ -295,6 +308,30 @@ inline drogon::HttpResponsePtr CreateCortexStreamResponse(
   return resp;
 }
 
+// Server-sent events written by `callback` through the stream it is given,
+// from any thread
+inline drogon::HttpResponsePtr CreateCortexAsyncStreamResponse(
+    const std::function<void(drogon::ResponseStreamPtr)>& callback) {
+  auto resp = drogon::HttpResponse::newAsyncStreamResponse(callback);
+  resp->setContentTypeString("text/event-stream");
+#ifdef ALLOW_ALL_CORS
+  LOG_INFO << "Respond for all cors!";
+  resp->addHeader("Access-Control-Allow-Origin", "*");
+#endif
+  return resp;
+}
+
+inline drogon::HttpResponsePtr CreateCortexJsonStreamResponse(
+    const std::function<std::size_t(char*, std::size_t)>& callback) {
+  auto resp = drogon::HttpResponse::newStreamResponse(
+      callback, "", drogon::CT_APPLICATION_JSON);
+#ifdef ALLOW_ALL_CORS
+  LOG_INFO << "Respond for all cors!";
+  resp->addHeader("Access-Control-Allow-Origin", "*");
+#endif
+  return resp;
+}
+
 inline void ltrim(std::string& s) {
   s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](unsigned char ch) {
             return !std::isspace(ch);
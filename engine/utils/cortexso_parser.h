@@ -47,9 +47,14 @@ inline std::optional<DownloadTask> getDownloadTask(
           const std::string download_url = downloadUrlOutput.str();
           auto local_path = model_container_path / path;
 
+          std::optional<std::string> checksum;
+          if (value.contains("lfs") && value["lfs"].contains("oid")) {
+            checksum = value["lfs"]["oid"].get<std::string>();
+          }
           downloadItems.push_back(DownloadItem{.id = path,
                                                .downloadUrl = download_url,
-                                               .localPath = local_path});
+                                               .localPath = local_path,
+                                               .checksum = checksum});
         }
 
         DownloadTask downloadTask{
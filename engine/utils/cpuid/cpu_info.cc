@@ -150,6 +150,10 @@ bool CpuInfo::has_neon() const {
   return impl->has_neon;
 }
 
+CpuTopology CpuInfo::topology() const {
+  return ProbeTopology("/sys", AllowedCpus());
+}
+
 std::string CpuInfo::to_string() {
   std::string s;
   auto get = [](bool flag) -> std::string {
@@ -6,6 +6,8 @@
 #include <memory>
 #include <string>
 
+#include "cpu_topology.h"
+
 namespace cortex::cpuid {
 /// The CpuInfo object extract information about which, if any, additional
 /// instructions are supported by the CPU.
@@ -118,6 +120,9 @@ class CpuInfo {
   /// Return true if the CPU supports ARM Advanced SIMD
   bool has_neon() const;
 
+  /// Return the sockets, NUMA nodes, L3 domains and P/E cores of the machine
+  CpuTopology topology() const;
+
   std::string to_string();
 
  public:
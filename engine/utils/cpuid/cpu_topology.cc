@@ -0,0 +1,223 @@
+#include "cpu_topology.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <numeric>
+#include <set>
+#include <sstream>
+#include <thread>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+namespace cortex::cpuid {
+namespace {
+std::string ReadLine(const std::filesystem::path& p) {
+  std::ifstream f(p);
+  std::string line;
+  std::getline(f, line);
+  return line;
+}
+
+int ReadInt(const std::filesystem::path& p, int fallback) {
+  try {
+    auto line = ReadLine(p);
+    return line.empty() ? fallback : std::stoi(line);
+  } catch (const std::exception&) {
+    return fallback;
+  }
+}
+
+int FindL3(const std::filesystem::path& cpu_dir) {
+  std::error_code ec;
+  for (const auto& index :
+       std::filesystem::directory_iterator(cpu_dir / "cache", ec)) {
+    if (ReadInt(index.path() / "level", 0) != 3) {
+      continue;
+    }
+    if (auto id = ReadInt(index.path() / "id", -1); id >= 0) {
+      return id;
+    }
+    // Older kernels have no id, name the domain after its first CPU
+    auto shared = ParseCpuList(ReadLine(index.path() / "shared_cpu_list"));
+    return shared.empty() ? -1 : shared.front();
+  }
+  return -1;
+}
+}  // namespace
+
+CpuTopology CpuTopology::Flat(const std::vector<int>& ids) {
+  CpuTopology t;
+  for (int id : ids) {
+    LogicalCpu c;
+    c.id = id;
+    c.core = id;
+    t.cpus.push_back(c);
+  }
+  return t;
+}
+
+int CpuTopology::numa_nodes() const {
+  std::set<int> nodes;
+  for (const auto& c : cpus) {
+    nodes.insert(c.numa_node);
+  }
+  return static_cast<int>(nodes.size());
+}
+
+int CpuTopology::packages() const {
+  std::set<int> p;
+  for (const auto& c : cpus) {
+    p.insert(c.package);
+  }
+  return static_cast<int>(p.size());
+}
+
+bool CpuTopology::is_hybrid() const {
+  return std::any_of(cpus.begin(), cpus.end(),
+                     [](const LogicalCpu& c) { return !c.performance; });
+}
+
+const LogicalCpu* CpuTopology::find(int id) const {
+  for (const auto& c : cpus) {
+    if (c.id == id) {
+      return &c;
+    }
+  }
+  return nullptr;
+}
+
+std::string CpuTopology::to_string() const {
+  std::ostringstream s;
+  auto physical = std::count_if(
+      cpus.begin(), cpus.end(),
+      [](const LogicalCpu& c) { return c.smt_rank == 0; });
+  auto p_cpus = std::count_if(
+      cpus.begin(), cpus.end(),
+      [](const LogicalCpu& c) { return c.performance; });
+  s << "cpus = " << cpus.size() << "| cores = " << physical
+    << "| packages = " << packages() << "| numa_nodes = " << numa_nodes()
+    << "| p_cpus = " << p_cpus;
+  return s.str();
+}
+
+std::vector<int> ParseCpuList(const std::string& s) {
+  std::vector<int> res;
+  std::stringstream ss(s);
+  std::string range;
+  while (std::getline(ss, range, ',')) {
+    try {
+      auto dash = range.find('-');
+      if (dash == std::string::npos) {
+        res.push_back(std::stoi(range));
+        continue;
+      }
+      int first = std::stoi(range.substr(0, dash));
+      int last = std::stoi(range.substr(dash + 1));
+      for (int i = first; i <= last; i++) {
+        res.push_back(i);
+      }
+    } catch (const std::exception&) {
+      // Skip whitespace and garbage
+    }
+  }
+  return res;
+}
+
+std::vector<int> AllowedCpus() {
+  std::vector<int> ids;
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+    return ids;
+  }
+  for (int id = 0; id < CPU_SETSIZE; id++) {
+    if (CPU_ISSET(id, &set)) {
+      ids.push_back(id);
+    }
+  }
+#endif
+  return ids;
+}
+
+CpuTopology ProbeTopology(const std::filesystem::path& sysfs_root,
+                          const std::vector<int>& allowed) {
+  auto flat = [&allowed] {
+    if (!allowed.empty()) {
+      return CpuTopology::Flat(allowed);
+    }
+    std::vector<int> ids(std::max(1u, std::thread::hardware_concurrency()));
+    std::iota(ids.begin(), ids.end(), 0);
+    return CpuTopology::Flat(ids);
+  };
+#if defined(__linux__)
+  auto cpu_root = sysfs_root / "devices/system/cpu";
+  auto online = ParseCpuList(ReadLine(cpu_root / "online"));
+  if (!allowed.empty()) {
+    std::set<int> keep(allowed.begin(), allowed.end());
+    std::erase_if(online, [&keep](int id) { return !keep.count(id); });
+  }
+  if (online.empty()) {
+    return flat();
+  }
+
+  std::map<int, int> node_of;
+  std::error_code ec;
+  for (const auto& node :
+       std::filesystem::directory_iterator(sysfs_root / "devices/system/node",
+                                           ec)) {
+    auto name = node.path().filename().string();
+    if (name.rfind("node", 0) != 0 || name.size() == 4 ||
+        !std::all_of(name.begin() + 4, name.end(), ::isdigit)) {
+      continue;
+    }
+    for (int cpu : ParseCpuList(ReadLine(node.path() / "cpulist"))) {
+      node_of[cpu] = std::stoi(name.substr(4));
+    }
+  }
+
+  // Intel hybrid parts expose their P and E cores as separate PMUs, ARM
+  // big.LITTLE reports a capacity per CPU
+  std::set<int> e_cores;
+  auto atom = ParseCpuList(ReadLine(sysfs_root / "devices/cpu_atom/cpus"));
+  e_cores.insert(atom.begin(), atom.end());
+  if (e_cores.empty()) {
+    std::map<int, int> capacity;
+    int max_capacity = 0;
+    for (int id : online) {
+      auto c = ReadInt(
+          cpu_root / ("cpu" + std::to_string(id)) / "cpu_capacity", 0);
+      capacity[id] = c;
+      max_capacity = std::max(max_capacity, c);
+    }
+    for (const auto& [id, c] : capacity) {
+      if (c > 0 && c < max_capacity) {
+        e_cores.insert(id);
+      }
+    }
+  }
+
+  CpuTopology t;
+  std::map<std::pair<int, int>, int> threads_per_core;
+  for (int id : online) {
+    auto dir = cpu_root / ("cpu" + std::to_string(id));
+    LogicalCpu c;
+    c.id = id;
+    c.package = std::max(0, ReadInt(dir / "topology/physical_package_id", 0));
+    c.core = ReadInt(dir / "topology/core_id", id);
+    c.numa_node = node_of.count(id) ? node_of[id] : 0;
+    c.l3 = FindL3(dir);
+    c.smt_rank = threads_per_core[{c.package, c.core}]++;
+    c.performance = e_cores.find(id) == e_cores.end();
+    t.cpus.push_back(c);
+  }
+  return t;
+#else
+  (void)sysfs_root;
+  return flat();
+#endif
+}
+}  // namespace cortex::cpuid
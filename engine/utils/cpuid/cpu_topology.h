@@ -0,0 +1,55 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace cortex::cpuid {
+/// A logical CPU (hardware thread) and where it sits in the machine
+struct LogicalCpu {
+  int id = 0;
+  /// Socket
+  int package = 0;
+  /// Physical core id, unique within a package
+  int core = 0;
+  int numa_node = 0;
+  /// Id of the L3 cache shared by this CPU, -1 if unknown
+  int l3 = -1;
+  /// 0 for the first hardware thread of a physical core, 1 for its SMT
+  /// sibling, ...
+  int smt_rank = 0;
+  /// False for the efficiency cores of a hybrid CPU
+  bool performance = true;
+};
+
+/// Sockets, NUMA nodes, L3 domains and P/E cores of the machine
+struct CpuTopology {
+  std::vector<LogicalCpu> cpus;
+
+  /// A single node topology over the given CPUs, used where the topology
+  /// cannot be probed
+  static CpuTopology Flat(const std::vector<int>& ids);
+
+  int numa_nodes() const;
+  int packages() const;
+  bool is_hybrid() const;
+  const LogicalCpu* find(int id) const;
+
+  std::string to_string() const;
+};
+
+/// Parses a kernel cpulist such as "0-3,8-11"
+std::vector<int> ParseCpuList(const std::string& s);
+
+/// The CPUs this process may run on, as narrowed by `taskset` or a cgroup
+/// cpuset (docker --cpuset-cpus). Empty where unknown.
+std::vector<int> AllowedCpus();
+
+/// Reads the topology from sysfs (/sys/devices/system/cpu and
+/// /sys/devices/system/node). Tests point `sysfs_root` at a fake tree. Falls
+/// back to a flat topology over hardware_concurrency() CPUs on other
+/// platforms. Only the CPUs in `allowed` are kept, all of them if it is
+/// empty.
+CpuTopology ProbeTopology(const std::filesystem::path& sysfs_root = "/sys",
+                          const std::vector<int>& allowed = {});
+}  // namespace cortex::cpuid
@@ -3,6 +3,7 @@
 #include <string>
 #include <string_view>
 #include "logging_utils.h"
+#include "services/config_service.h"
 #include "services/download_service.h"
 #include "utils/config_yaml_utils.h"
 
@@ -140,14 +141,24 @@ inline void CreateConfigFileIfNotExist() {
       .maxLogLines = config_yaml_utils::kDefaultMaxLines,
       .apiServerHost = config_yaml_utils::kDefaultHost,
       .apiServerPort = config_yaml_utils::kDefaultPort,
+      .kvCacheSnapshotMaxMb = config_yaml_utils::kDefaultKvCacheSnapshotMaxMb,
+      .ioThreads = 0,
+      .workerThreads = 0,
+      .workerQueueSize = config_yaml_utils::kDefaultWorkerQueueSize,
+      .keepAliveRequests = 0,
+      .idleConnectionTimeout = config_yaml_utils::kDefaultIdleConnectionTimeout,
+      .memoryBudgetPercent = config_yaml_utils::kDefaultMemoryBudgetPercent,
+      .pinnedModelsMaxMb = 0,
+      .maxConcurrentDownloads =
+          config_yaml_utils::kDefaultMaxConcurrentDownloads,
+      .expectedCpuModels = config_yaml_utils::kDefaultExpectedCpuModels,
   };
   DumpYamlConfig(config, config_path.string());
 }
 
+// Parsed once per change of the file, see ConfigService
 inline config_yaml_utils::CortexConfig GetCortexConfig() {
-  auto config_path = GetConfigurationPath();
-  std::string variant = "";  // TODO: empty for now
-  return config_yaml_utils::FromYaml(config_path.string(), variant);
+  return *ConfigService::Global().Get();
 }
 
 inline std::filesystem::path GetCortexDataPath() {
@@ -1,7 +1,10 @@
 #pragma once
 
 #include <drogon/HttpController.h>
+#include <exception>
+#include <functional>
 #include "utils/cortex_utils.h"
+#include "utils/worker_pool.h"
 
 using namespace drogon;
 
@@ -22,4 +25,62 @@ inline bool HasFieldInReq(const HttpRequestPtr& req,
   return true;
 }
 
+/**
+ * Hands a blocking handler over to the worker pool, keeping the event loop
+ * free. Replies 503 when the pool is saturated, and 500 when the handler
+ * throws, as drogon does for handlers on its own threads.
+ */
+inline void RunOnWorkerPool(
+    std::function<void(const HttpResponsePtr&)>& callback,
+    std::function<void(std::function<void(const HttpResponsePtr&)>&&)> work) {
+  auto submitted = WorkerPool::Global().Submit(
+      [cb = callback, work = std::move(work)]() mutable {
+        auto reply = cb;
+        try {
+          work(std::move(cb));
+        } catch (const std::exception& e) {
+          Json::Value res;
+          res["message"] = e.what();
+          auto resp = cortex_utils::CreateCortexHttpJsonResponse(res);
+          resp->setStatusCode(k500InternalServerError);
+          reply(resp);
+          LOG_ERROR << "Unhandled exception in handler: " << e.what();
+        }
+      });
+  if (!submitted) {
+    Json::Value res;
+    res["message"] = "Server is busy, try again later";
+    auto resp = cortex_utils::CreateCortexHttpJsonResponse(res);
+    resp->setStatusCode(k503ServiceUnavailable);
+    callback(resp);
+    LOG_WARN << "Worker pool is full, rejected request";
+  }
+}
+
+/**
+ * The first line of a blocking handler, so that it runs on the worker pool:
+ *
+ *   if (http_util::DispatchToWorkerPool(this, &Models::GetModel, req,
+ *                                       callback)) {
+ *     return;
+ *   }
+ *
+ * On an event loop thread, calls `handler` again on a worker with the same
+ * request and path parameters, copied, and returns true. On a worker thread
+ * returns false and the handler carries on.
+ */
+template <typename Self, typename Handler, typename... Args>
+bool DispatchToWorkerPool(Self* self, Handler handler,
+                          const HttpRequestPtr& req,
+                          std::function<void(const HttpResponsePtr&)>& callback,
+                          const Args&... args) {
+  if (WorkerPool::OnWorkerThread()) {
+    return false;
+  }
+  RunOnWorkerPool(callback, [self, handler, req, args...](auto&& cb) {
+    std::invoke(handler, self, req, std::move(cb), args...);
+  });
+  return true;
+}
+
 }  // namespace http_util
@@ -20,6 +20,8 @@ struct HuggingFaceBranch {
 
 struct HuggingFaceFileSibling {
   std::string rfilename;
+  // SHA-256 of files stored in LFS
+  std::optional<std::string> sha256;
 };
 
 struct HuggingFaceGgufInfo {
@@ -87,10 +89,12 @@ inline std::optional<HuggingFaceModelRepoInfo> GetHuggingFaceModelRepoInfo(
   if (author.empty() || modelName.empty()) {
     throw std::runtime_error("Author and model name cannot be empty");
   }
+  // blobs=true adds the LFS checksums of the files
   auto url_obj =
       url_parser::Url{.protocol = "https",
                       .host = kHuggingfaceHost,
-                      .pathParams = {"api", "models", author, modelName}};
+                      .pathParams = {"api", "models", author, modelName},
+                      .queries = {{"blobs", std::string("true")}}};
 
   httplib::Client cli(url_obj.GetProtocolAndHost());
   auto res = cli.Get(url_obj.GetPathAndQuery());
@@ -117,6 +121,9 @@ inline std::optional<HuggingFaceModelRepoInfo> GetHuggingFaceModelRepoInfo(
     auto sibling_info = HuggingFaceFileSibling{
         .rfilename = sibling["rfilename"],
     };
+    if (sibling.contains("lfs") && sibling["lfs"].contains("sha256")) {
+      sibling_info.sha256 = sibling["lfs"]["sha256"];
+    }
     siblings.push_back(sibling_info);
   }
 
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Read-only mapping of a whole file, empty files map to nothing. Throws if
+ * the file cannot be opened or mapped.
+ */
+class MappedFile {
+ public:
+  enum class Mode {
+    // Read once from front to back, e.g. to hash it
+    kSequential,
+    // Every page faulted in now and locked in memory if the process may
+    // lock that much, see locked()
+    kPinned,
+  };
+
+  explicit MappedFile(const std::filesystem::path& path,
+                      Mode mode = Mode::kSequential) {
+#ifdef _WIN32
+    HANDLE file = CreateFileW(
+        path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING,
+        mode == Mode::kSequential ? FILE_FLAG_SEQUENTIAL_SCAN : 0, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+      throw std::runtime_error("Failed to open " + path.string());
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+      CloseHandle(file);
+      throw std::runtime_error("Failed to get the size of " + path.string());
+    }
+    size_ = static_cast<size_t>(size.QuadPart);
+    if (size_ > 0) {
+      HANDLE mapping =
+          CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+      if (mapping != nullptr) {
+        data_ = static_cast<const uint8_t*>(
+            MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        CloseHandle(mapping);
+      }
+    }
+    CloseHandle(file);
+    if (size_ > 0 && data_ == nullptr) {
+      throw std::runtime_error("Failed to map " + path.string());
+    }
+    if (mode == Mode::kPinned && size_ > 0) {
+      // Faults every page in, the working set limit decides how much stays
+      locked_ = VirtualLock(const_cast<uint8_t*>(data_), size_);
+    }
+#else
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("Failed to open " + path.string());
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      throw std::runtime_error("Failed to get the size of " + path.string());
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ > 0) {
+      int flags = mode == Mode::kPinned ? MAP_SHARED : MAP_PRIVATE;
+#ifdef MAP_POPULATE
+      if (mode == Mode::kPinned) {
+        flags |= MAP_POPULATE;
+      }
+#endif
+      void* p = mmap(nullptr, size_, PROT_READ, flags, fd, 0);
+      if (p == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error("Failed to map " + path.string());
+      }
+      data_ = static_cast<const uint8_t*>(p);
+      madvise(p, size_,
+              mode == Mode::kPinned ? MADV_WILLNEED : MADV_SEQUENTIAL);
+      locked_ = mode == Mode::kPinned && mlock(p, size_) == 0;
+    }
+    close(fd);
+#endif
+  }
+
+  ~MappedFile() {
+    if (data_ == nullptr) {
+      return;
+    }
+    auto* p = const_cast<uint8_t*>(data_);
+#ifdef _WIN32
+    if (locked_) {
+      VirtualUnlock(p, size_);
+    }
+    UnmapViewOfFile(p);
+#else
+    if (locked_) {
+      munlock(p, size_);
+    }
+    munmap(p, size_);
+#endif
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+  // Whether the pages of a kPinned mapping are locked, an empty file counts
+  // as locked
+  bool locked() const { return locked_ || (data_ == nullptr && size_ == 0); }
+
+ private:
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+  bool locked_ = false;
+};
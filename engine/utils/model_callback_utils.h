@@ -4,8 +4,10 @@
 #include <filesystem>
 
 #include "config/gguf_parser.h"
+#include "config/model_memory_estimator.h"
 #include "config/yaml_config.h"
 #include "services/download_service.h"
+#include "utils/file_manager_utils.h"
 #include "utils/logging_utils.h"
 
 namespace model_callback_utils {
@@ -29,11 +31,16 @@ inline void WriteYamlOutput(const DownloadItem& modelYmlDownloadItem) {
 inline void ParseGguf(const DownloadItem& ggufDownloadItem) {
   config::GGUFHandler gguf_handler;
   config::YamlHandler yaml_handler;
-  gguf_handler.Parse(ggufDownloadItem.localPath.string());
+  gguf_handler.Parse(ggufDownloadItem.localPath.string(),
+                     config::GGUFParseMode::kCached);
   config::ModelConfig model_config = gguf_handler.GetModelConfig();
+  config::FitModelConfig(
+      gguf_handler, model_config,
+      config::SystemMemoryBudget(
+          file_manager_utils::GetCortexConfig().memoryBudgetPercent, false));
   model_config.id =
       ggufDownloadItem.localPath.parent_path().filename().string();
-  model_config.files = {ggufDownloadItem.localPath.string()};
+  model_config.files = gguf_handler.GetFiles();
   yaml_handler.UpdateModelConfig(model_config);
 
   std::string yaml_filename{model_config.id + ".yaml"};
@@ -0,0 +1,400 @@
+#include "model_registry.h"
+#include <trantor/utils/Logger.h>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include "utils/binary_io_utils.h"
+
+namespace modellist_utils {
+namespace {
+// "CMRG"
+constexpr uint32_t kMagic = 0x47524d43;
+constexpr size_t kHeaderSize = 16;
+constexpr size_t kRecordHeaderSize = 8;
+// A record larger than this is garbage, not an entry
+constexpr uint32_t kMaxPayloadSize = 1 << 20;
+// Logs shorter than this are never compacted
+constexpr uint64_t kCompactMinRecords = 256;
+
+enum RecordOp : uint8_t {
+  kPut = 1,
+  kRemove = 2,
+};
+
+constexpr std::array<uint32_t, 256> MakeCrcTable() {
+  std::array<uint32_t, 256> table{};
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++) {
+      c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+    }
+    table[i] = c;
+  }
+  return table;
+}
+
+constexpr auto kCrcTable = MakeCrcTable();
+
+uint32_t Crc32(std::string_view data) {
+  uint32_t c = 0xffffffffu;
+  for (unsigned char b : data) {
+    c = kCrcTable[(c ^ b) & 0xff] ^ (c >> 8);
+  }
+  return c ^ 0xffffffffu;
+}
+}  // namespace
+
+ModelRegistry::ModelRegistry(std::filesystem::path path,
+                             std::filesystem::path legacy_list)
+    : path_(std::move(path)) {
+  if (!std::filesystem::exists(path_)) {
+    std::vector<ModelEntry> entries;
+    bool migrate =
+        !legacy_list.empty() && std::filesystem::exists(legacy_list);
+    if (migrate) {
+      entries = ParseModelList(legacy_list);
+    }
+    auto data = Header(1);
+    for (const auto& e : entries) {
+      data += Record(PutPayload(e));
+    }
+    std::error_code ec;
+    std::filesystem::create_directories(path_.parent_path(), ec);
+    if (!binary_io_utils::WriteFileAtomically(path_, data, true)) {
+      throw std::runtime_error("Unable to create model registry: " +
+                               path_.string());
+    }
+    if (migrate) {
+      auto migrated = legacy_list;
+      migrated += ".migrated";
+      std::filesystem::rename(legacy_list, migrated, ec);
+      LOG_INFO << "Migrated " << entries.size() << " models from "
+               << legacy_list.string() << " to " << path_.string();
+    }
+  }
+  Load();
+}
+
+std::vector<ModelEntry> ModelRegistry::ParseModelList(
+    const std::filesystem::path& path) {
+  std::vector<ModelEntry> entries;
+  std::ifstream file(path);
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream iss(line);
+    ModelEntry entry;
+    std::string status_str;
+    if (!(iss >> entry.model_id >> entry.author_repo_id >> entry.branch_name >>
+          entry.path_to_model_yaml >> entry.model_alias >> status_str)) {
+      LOG_WARN << "Invalid entry in model.list: " << line;
+      continue;
+    }
+    entry.status =
+        (status_str == "RUNNING") ? ModelStatus::RUNNING : ModelStatus::READY;
+    // Optional, lists written before it was added do not have it
+    iss >> entry.integrity;
+    entries.push_back(std::move(entry));
+  }
+  return entries;
+}
+
+std::string ModelRegistry::Header(uint64_t generation) {
+  binary_io_utils::BinaryWriter w;
+  w.Write<uint32_t>(kMagic);
+  w.Write<uint32_t>(kVersion);
+  w.Write<uint64_t>(generation);
+  return w.data();
+}
+
+std::string ModelRegistry::Record(const std::string& payload) {
+  binary_io_utils::BinaryWriter w;
+  w.Write<uint32_t>(static_cast<uint32_t>(payload.size()));
+  w.Write<uint32_t>(Crc32(payload));
+  w.WriteBytes(payload.data(), payload.size());
+  return w.data();
+}
+
+std::string ModelRegistry::PutPayload(const ModelEntry& entry) {
+  binary_io_utils::BinaryWriter w;
+  w.Write<uint8_t>(kPut);
+  w.WriteString(entry.model_id);
+  w.WriteString(entry.author_repo_id);
+  w.WriteString(entry.branch_name);
+  w.WriteString(entry.path_to_model_yaml);
+  w.WriteString(entry.model_alias);
+  w.Write<uint8_t>(entry.status == ModelStatus::RUNNING ? 1 : 0);
+  w.WriteString(entry.integrity);
+  return w.data();
+}
+
+std::string ModelRegistry::RemovePayload(const std::string& model_id) {
+  binary_io_utils::BinaryWriter w;
+  w.Write<uint8_t>(kRemove);
+  w.WriteString(model_id);
+  return w.data();
+}
+
+void ModelRegistry::Load() {
+  std::string data;
+  if (!binary_io_utils::ReadFile(path_, data)) {
+    throw std::runtime_error("Unable to read model registry: " +
+                             path_.string());
+  }
+  binary_io_utils::BinaryReader r(data);
+  if (data.size() < kHeaderSize || r.Read<uint32_t>() != kMagic ||
+      r.Read<uint32_t>() != kVersion) {
+    throw std::runtime_error("Invalid model registry: " + path_.string());
+  }
+  by_id_.clear();
+  by_alias_.clear();
+  next_seq_ = 0;
+  log_records_ = 0;
+  generation_ = r.Read<uint64_t>();
+  log_end_ = kHeaderSize +
+             ApplyRecords(std::string_view(data).substr(kHeaderSize));
+  if (log_end_ < data.size()) {
+    LOG_WARN << "Ignored " << data.size() - log_end_
+             << " bytes of incomplete records at the end of "
+             << path_.string();
+  }
+}
+
+void ModelRegistry::Refresh() {
+  std::ifstream f(path_, std::ios::binary);
+  char header[kHeaderSize];
+  if (!f.read(header, kHeaderSize)) {
+    throw std::runtime_error("Unable to read model registry: " +
+                             path_.string());
+  }
+  uint64_t generation;
+  std::memcpy(&generation, header + 8, sizeof(generation));
+  f.seekg(0, std::ios::end);
+  auto size = static_cast<uint64_t>(f.tellg());
+  if (generation != generation_ || size < log_end_) {
+    Load();
+    return;
+  }
+  if (size == log_end_) {
+    return;
+  }
+  std::string tail(size - log_end_, '\0');
+  f.seekg(log_end_);
+  if (!f.read(tail.data(), tail.size())) {
+    return;
+  }
+  log_end_ += ApplyRecords(tail);
+}
+
+size_t ModelRegistry::ApplyRecords(std::string_view data) {
+  size_t pos = 0;
+  while (data.size() - pos >= kRecordHeaderSize) {
+    binary_io_utils::BinaryReader header(data.substr(pos, kRecordHeaderSize));
+    auto size = header.Read<uint32_t>();
+    auto crc = header.Read<uint32_t>();
+    if (size > kMaxPayloadSize ||
+        size > data.size() - pos - kRecordHeaderSize) {
+      break;
+    }
+    auto payload = data.substr(pos + kRecordHeaderSize, size);
+    if (Crc32(payload) != crc) {
+      break;
+    }
+    try {
+      binary_io_utils::BinaryReader r(payload);
+      auto op = r.Read<uint8_t>();
+      if (op == kPut) {
+        ModelEntry e;
+        e.model_id = r.ReadString();
+        e.author_repo_id = r.ReadString();
+        e.branch_name = r.ReadString();
+        e.path_to_model_yaml = r.ReadString();
+        e.model_alias = r.ReadString();
+        e.status =
+            r.Read<uint8_t>() == 1 ? ModelStatus::RUNNING : ModelStatus::READY;
+        e.integrity = r.ReadString();
+        ApplyPut(std::move(e));
+      } else if (op == kRemove) {
+        ApplyRemove(r.ReadString());
+      } else {
+        LOG_WARN << "Unknown model registry record " << static_cast<int>(op);
+      }
+    } catch (const std::runtime_error& e) {
+      // The checksum matched, so it was written like this
+      LOG_WARN << "Invalid model registry record: " << e.what();
+    }
+    pos += kRecordHeaderSize + size;
+    log_records_++;
+  }
+  return pos;
+}
+
+void ModelRegistry::ApplyPut(ModelEntry entry) {
+  auto it = by_id_.find(entry.model_id);
+  uint64_t seq = next_seq_;
+  if (it != by_id_.end()) {
+    seq = it->second.seq;
+    ApplyRemove(entry.model_id);
+  } else {
+    next_seq_++;
+  }
+  by_alias_.emplace(entry.model_alias, entry.model_id);
+  auto id = entry.model_id;
+  by_id_.emplace(std::move(id), Slot{seq, std::move(entry)});
+}
+
+void ModelRegistry::ApplyRemove(const std::string& model_id) {
+  auto it = by_id_.find(model_id);
+  if (it == by_id_.end()) {
+    return;
+  }
+  auto [begin, end] = by_alias_.equal_range(it->second.entry.model_alias);
+  for (auto a = begin; a != end; ++a) {
+    if (a->second == model_id) {
+      by_alias_.erase(a);
+      break;
+    }
+  }
+  by_id_.erase(it);
+}
+
+std::optional<ModelEntry> ModelRegistry::FindById(
+    const std::string& model_id) const {
+  if (auto it = by_id_.find(model_id); it != by_id_.end()) {
+    return it->second.entry;
+  }
+  return std::nullopt;
+}
+
+std::optional<ModelEntry> ModelRegistry::Find(
+    const std::string& identifier) const {
+  if (auto e = FindById(identifier); e.has_value()) {
+    return e;
+  }
+  return FindByAlias(identifier);
+}
+
+std::optional<ModelEntry> ModelRegistry::FindByAlias(
+    const std::string& alias) const {
+  if (auto it = by_alias_.find(alias); it != by_alias_.end()) {
+    return FindById(it->second);
+  }
+  return std::nullopt;
+}
+
+bool ModelRegistry::Contains(const std::string& name) const {
+  return by_id_.count(name) > 0 || by_alias_.count(name) > 0;
+}
+
+std::vector<ModelEntry> ModelRegistry::List() const {
+  std::vector<const Slot*> slots;
+  slots.reserve(by_id_.size());
+  for (const auto& [id, slot] : by_id_) {
+    slots.push_back(&slot);
+  }
+  std::sort(slots.begin(), slots.end(),
+            [](const Slot* a, const Slot* b) { return a->seq < b->seq; });
+  std::vector<ModelEntry> entries;
+  entries.reserve(slots.size());
+  for (const auto* s : slots) {
+    entries.push_back(s->entry);
+  }
+  return entries;
+}
+
+void ModelRegistry::Append(const std::vector<std::string>& payloads) {
+  Refresh();
+  // A torn record at the end would hide everything appended after it
+  std::error_code ec;
+  if (std::filesystem::file_size(path_, ec) > log_end_ && !ec) {
+    std::filesystem::resize_file(path_, log_end_, ec);
+  }
+  std::string records;
+  for (const auto& payload : payloads) {
+    records += Record(payload);
+  }
+  {
+    std::ofstream f(path_, std::ios::binary | std::ios::app);
+    if (!f || !f.write(records.data(), records.size()) || !f.flush()) {
+      throw std::runtime_error("Unable to write model registry: " +
+                               path_.string());
+    }
+  }
+  if (!binary_io_utils::SyncFile(path_)) {
+    throw std::runtime_error("Unable to sync model registry: " +
+                             path_.string());
+  }
+  log_end_ += records.size();
+  log_records_ += payloads.size();
+}
+
+void ModelRegistry::Put(const ModelEntry& entry) {
+  Append({PutPayload(entry)});
+  ApplyPut(entry);
+  MaybeCompact();
+}
+
+void ModelRegistry::PutAll(const std::vector<ModelEntry>& entries) {
+  if (entries.empty()) {
+    return;
+  }
+  std::vector<std::string> payloads;
+  payloads.reserve(entries.size());
+  for (const auto& e : entries) {
+    payloads.push_back(PutPayload(e));
+  }
+  Append(payloads);
+  for (const auto& e : entries) {
+    ApplyPut(e);
+  }
+  MaybeCompact();
+}
+
+void ModelRegistry::Replace(const std::string& model_id,
+                            const ModelEntry& entry) {
+  if (model_id == entry.model_id) {
+    Put(entry);
+    return;
+  }
+  // One write and one sync, a crash in between cannot lose the entry
+  Append({RemovePayload(model_id), PutPayload(entry)});
+  ApplyRemove(model_id);
+  ApplyPut(entry);
+  MaybeCompact();
+}
+
+bool ModelRegistry::Remove(const std::string& model_id) {
+  if (by_id_.find(model_id) == by_id_.end()) {
+    return false;
+  }
+  Append({RemovePayload(model_id)});
+  ApplyRemove(model_id);
+  MaybeCompact();
+  return true;
+}
+
+void ModelRegistry::MaybeCompact() {
+  if (log_records_ > kCompactMinRecords && log_records_ > 2 * by_id_.size()) {
+    Compact();
+  }
+}
+
+void ModelRegistry::Compact() {
+  auto entries = List();
+  auto data = Header(generation_ + 1);
+  for (const auto& e : entries) {
+    data += Record(PutPayload(e));
+  }
+  if (!binary_io_utils::WriteFileAtomically(path_, data, true)) {
+    throw std::runtime_error("Unable to compact model registry: " +
+                             path_.string());
+  }
+  LOG_DEBUG << "Compacted model registry from " << log_records_ << " to "
+            << entries.size() << " records";
+  generation_++;
+  log_end_ = data.size();
+  log_records_ = entries.size();
+}
+}  // namespace modellist_utils
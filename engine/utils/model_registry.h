@@ -0,0 +1,101 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "utils/modellist_utils.h"
+
+namespace modellist_utils {
+/**
+ * The model registry, an append-only log of entry changes with an in-memory
+ * index on model_id and alias.
+ *
+ * The file starts with "CMRG", a version and a generation, followed by
+ * records of { u32 payload size, u32 crc32 of the payload, payload }. A
+ * payload puts a whole entry or deletes one by model_id. A record is only
+ * applied if it is complete and its checksum matches, a write torn by a
+ * crash is dropped on the next load and cut off before the next append.
+ * Once most records are dead the log is rewritten with one record per entry.
+ *
+ * Other instances, in this process or another, append to the same file.
+ * Refresh() applies what they appended since the last call, and reloads the
+ * whole log when it was compacted in the meantime. Writers must be
+ * serialized by the caller, see ModelRegistryService.
+ */
+class ModelRegistry {
+ public:
+  static constexpr uint32_t kVersion = 1;
+
+  /**
+   * Opens or creates the registry at `path`. A new registry takes over the
+   * entries of `legacy_list`, a model.list text file, which is then renamed
+   * to model.list.migrated.
+   */
+  explicit ModelRegistry(std::filesystem::path path,
+                         std::filesystem::path legacy_list = {});
+
+  void Refresh();
+
+  // By model_id first, then alias
+  std::optional<ModelEntry> Find(const std::string& identifier) const;
+  std::optional<ModelEntry> FindById(const std::string& model_id) const;
+  std::optional<ModelEntry> FindByAlias(const std::string& alias) const;
+  // True if `name` is taken as a model_id or an alias
+  bool Contains(const std::string& name) const;
+  // In the order the models were added
+  std::vector<ModelEntry> List() const;
+  size_t Size() const { return by_id_.size(); }
+
+  // Adds the entry, or replaces the one with the same model_id
+  void Put(const ModelEntry& entry);
+  // Put() of each entry, in one write and one sync of the log
+  void PutAll(const std::vector<ModelEntry>& entries);
+  // Replaces the entry of `model_id`, which may change its model_id
+  void Replace(const std::string& model_id, const ModelEntry& entry);
+  bool Remove(const std::string& model_id);
+
+  // Rewrites the log with only the live entries
+  void Compact();
+  // Records in the log, live or not
+  uint64_t LogRecords() const { return log_records_; }
+
+  // model.list lines, for the migration
+  static std::vector<ModelEntry> ParseModelList(
+      const std::filesystem::path& path);
+
+ private:
+  struct Slot {
+    // Order of insertion, List() sorts by it
+    uint64_t seq;
+    ModelEntry entry;
+  };
+
+  void Load();
+  // Applies the complete records at the start of `data`, returns the bytes
+  // they take
+  size_t ApplyRecords(std::string_view data);
+  void ApplyPut(ModelEntry entry);
+  void ApplyRemove(const std::string& model_id);
+  // One record per payload, in one write
+  void Append(const std::vector<std::string>& payloads);
+  void MaybeCompact();
+  static std::string PutPayload(const ModelEntry& entry);
+  static std::string RemovePayload(const std::string& model_id);
+  static std::string Header(uint64_t generation);
+  static std::string Record(const std::string& payload);
+
+  std::filesystem::path path_;
+  std::unordered_map<std::string, Slot> by_id_;
+  // Alias to model_id, aliases are not unique when empty
+  std::unordered_multimap<std::string, std::string> by_alias_;
+  uint64_t next_seq_ = 0;
+  uint64_t log_records_ = 0;
+  // End of the last complete record
+  uint64_t log_end_ = 0;
+  // Bumped by every compaction, a log with another generation is reloaded
+  uint64_t generation_ = 0;
+};
+}  // namespace modellist_utils
@@ -7,48 +7,21 @@
 #include <sstream>
 #include <stdexcept>
 #include "file_manager_utils.h"
+#include "model_registry.h"
+#include "services/model_registry_service.h"
 namespace modellist_utils {
 const std::string ModelListUtils::kModelListPath =
     (file_manager_utils::GetModelsContainerPath() /
      std::filesystem::path("model.list"))
         .string();
 
-std::vector<ModelEntry> ModelListUtils::LoadModelList() const {
-  std::vector<ModelEntry> entries;
-  std::filesystem::path file_path(kModelListPath);
-
-  // Check if the file exists, if not, create it
-  if (!std::filesystem::exists(file_path)) {
-    std::ofstream create_file(kModelListPath);
-    if (!create_file) {
-      throw std::runtime_error("Unable to create model.list file: " +
-                               kModelListPath);
-    }
-    create_file.close();
-    return entries;  // Return empty vector for newly created file
-  }
-
-  std::ifstream file(kModelListPath);
-  if (!file.is_open()) {
-    throw std::runtime_error("Unable to open model.list file: " +
-                             kModelListPath);
-  }
+const std::string ModelListUtils::kModelRegistryPath =
+    (file_manager_utils::GetModelsContainerPath() /
+     std::filesystem::path("model.registry"))
+        .string();
 
-  std::string line;
-  while (std::getline(file, line)) {
-    std::istringstream iss(line);
-    ModelEntry entry;
-    std::string status_str;
-    if (!(iss >> entry.model_id >> entry.author_repo_id >> entry.branch_name >>
-          entry.path_to_model_yaml >> entry.model_alias >> status_str)) {
-      LOG_WARN << "Invalid entry in model.list: " << line;
-    } else {
-      entry.status =
-          (status_str == "RUNNING") ? ModelStatus::RUNNING : ModelStatus::READY;
-      entries.push_back(entry);
-    }
-  }
-  return entries;
+std::vector<ModelEntry> ModelListUtils::LoadModelList() const {
+  return ModelRegistryService::Global().Get()->List();
 }
 
 bool ModelListUtils::IsUnique(const std::vector<ModelEntry>& entries,
@@ -62,25 +35,17 @@ bool ModelListUtils::IsUnique(const std::vector<ModelEntry>& entries,
       });
 }
 
-void ModelListUtils::SaveModelList(
-    const std::vector<ModelEntry>& entries) const {
-  std::ofstream file(kModelListPath);
-  if (!file.is_open()) {
-    throw std::runtime_error("Unable to open model.list file for writing: " +
-                             kModelListPath);
-  }
-
-  for (const auto& entry : entries) {
-    file << entry.model_id << " " << entry.author_repo_id << " "
-         << entry.branch_name << " " << entry.path_to_model_yaml << " "
-         << entry.model_alias << " "
-         << (entry.status == ModelStatus::RUNNING ? "RUNNING" : "READY")
-         << std::endl;
-  }
-}
-
 std::string ModelListUtils::GenerateShortenedAlias(
     const std::string& model_id, const std::vector<ModelEntry>& entries) const {
+  return GenerateShortenedAliasIf(
+      model_id, [this, &entries, &model_id](const std::string& candidate) {
+        return IsUnique(entries, model_id, candidate);
+      });
+}
+
+std::string ModelListUtils::GenerateShortenedAliasIf(
+    const std::string& model_id,
+    const std::function<bool(const std::string&)>& is_unique) const {
   std::vector<std::string> parts;
   std::istringstream iss(model_id);
   std::string part;
@@ -123,7 +88,7 @@ std::string ModelListUtils::GenerateShortenedAlias(
 
   // Find the first unique candidate
   for (const auto& candidate : candidates) {
-    if (IsUnique(entries, model_id, candidate)) {
+    if (is_unique(candidate)) {
       return candidate;
     }
   }
@@ -132,7 +97,7 @@ std::string ModelListUtils::GenerateShortenedAlias(
   std::string base_candidate = candidates.back();
   int suffix = 1;
   std::string unique_candidate = base_candidate;
-  while (!IsUnique(entries, model_id, unique_candidate)) {
+  while (!is_unique(unique_candidate)) {
     unique_candidate = base_candidate + "-" + std::to_string(suffix++);
   }
 
@@ -140,18 +105,11 @@ std::string ModelListUtils::GenerateShortenedAlias(
 }
 
 ModelEntry ModelListUtils::GetModelInfo(const std::string& identifier) const {
-  std::lock_guard<std::mutex> lock(mutex_);
-  auto entries = LoadModelList();
-  auto it = std::find_if(
-      entries.begin(), entries.end(), [&identifier](const ModelEntry& entry) {
-        return entry.model_id == identifier || entry.model_alias == identifier;
-      });
-
-  if (it != entries.end()) {
-    return *it;
-  } else {
-    throw std::runtime_error("Model not found: " + identifier);
+  auto registry = ModelRegistryService::Global().Get();
+  if (auto entry = registry->Find(identifier); entry.has_value()) {
+    return *entry;
   }
+  throw std::runtime_error("Model not found: " + identifier);
 }
 
 void ModelListUtils::PrintModelInfo(const ModelEntry& entry) const {
@@ -165,76 +123,59 @@ void ModelListUtils::PrintModelInfo(const ModelEntry& entry) const {
 }
 
 bool ModelListUtils::AddModelEntry(ModelEntry new_entry, bool use_short_alias) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  auto entries = LoadModelList();
-
-  if (IsUnique(entries, new_entry.model_id, new_entry.model_alias)) {
+  return ModelRegistryService::Global().Update([&](ModelRegistry& registry) {
+    auto is_unique = [&registry, &new_entry](const std::string& alias) {
+      return !registry.Contains(new_entry.model_id) &&
+             !registry.Contains(alias);
+    };
+    if (!is_unique(new_entry.model_alias)) {
+      return false;  // Entry not added due to non-uniqueness
+    }
     if (use_short_alias) {
       new_entry.model_alias =
-          GenerateShortenedAlias(new_entry.model_id, entries);
+          GenerateShortenedAliasIf(new_entry.model_id, is_unique);
     }
     new_entry.status = ModelStatus::READY;  // Set default status to READY
-    entries.push_back(std::move(new_entry));
-    SaveModelList(entries);
+    registry.Put(new_entry);
     return true;
-  }
-  return false;  // Entry not added due to non-uniqueness
+  });
 }
 
 bool ModelListUtils::UpdateModelEntry(const std::string& identifier,
                                       const ModelEntry& updated_entry) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  auto entries = LoadModelList();
-  auto it = std::find_if(
-      entries.begin(), entries.end(), [&identifier](const ModelEntry& entry) {
-        return entry.model_id == identifier || entry.model_alias == identifier;
-      });
-
-  if (it != entries.end()) {
-    *it = updated_entry;
-    SaveModelList(entries);
+  return ModelRegistryService::Global().Update([&](ModelRegistry& registry) {
+    auto entry = registry.Find(identifier);
+    if (!entry.has_value()) {
+      return false;  // Entry not found
+    }
+    registry.Replace(entry->model_id, updated_entry);
     return true;
-  }
-  return false;  // Entry not found
+  });
 }
 
 bool ModelListUtils::UpdateModelAlias(const std::string& model_id,
                                       const std::string& new_model_alias) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  auto entries = LoadModelList();
-  auto it = std::find_if(
-      entries.begin(), entries.end(), [&model_id](const ModelEntry& entry) {
-        return entry.model_id == model_id || entry.model_alias == model_id;
-      });
-  bool check_alias_unique = std::none_of(
-      entries.begin(), entries.end(), [&](const ModelEntry& entry) {
-        return (entry.model_id == new_model_alias && entry.model_id != model_id) ||
-               entry.model_alias == new_model_alias;
-      });
-  if (it != entries.end() && check_alias_unique) {
-
-    (*it).model_alias = new_model_alias;
-    SaveModelList(entries);
+  return ModelRegistryService::Global().Update([&](ModelRegistry& registry) {
+    auto entry = registry.Find(model_id);
+    auto owner = registry.FindById(new_model_alias);
+    bool check_alias_unique =
+        !(owner.has_value() && owner->model_id != model_id) &&
+        !registry.FindByAlias(new_model_alias).has_value();
+    if (!entry.has_value() || !check_alias_unique) {
+      return false;  // Entry not found
+    }
+    entry->model_alias = new_model_alias;
+    registry.Put(*entry);
     return true;
-  }
-  return false;  // Entry not found
+  });
 }
 
 bool ModelListUtils::DeleteModelEntry(const std::string& identifier) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  auto entries = LoadModelList();
-  auto it = std::find_if(entries.begin(), entries.end(),
-                         [&identifier](const ModelEntry& entry) {
-                           return (entry.model_id == identifier ||
-                                   entry.model_alias == identifier) &&
-                                  entry.status == ModelStatus::READY;
-                         });
-
-  if (it != entries.end()) {
-    entries.erase(it);
-    SaveModelList(entries);
-    return true;
-  }
-  return false;  // Entry not found or not in READY state
+  return ModelRegistryService::Global().Update([&](ModelRegistry& registry) {
+    auto entry = registry.Find(identifier);
+    // Not found or not in READY state
+    return entry.has_value() && entry->status == ModelStatus::READY &&
+           registry.Remove(entry->model_id);
+  });
 }
-}  // namespace modellist_utils
\ No newline at end of file
+}  // namespace modellist_utils
@@ -1,6 +1,6 @@
 #pragma once
 #include <trantor/utils/Logger.h>
-#include <mutex>
+#include <functional>
 #include <string>
 #include <vector>
 #include "logging_utils.h"
@@ -15,20 +15,26 @@ struct ModelEntry {
   std::string path_to_model_yaml;
   std::string model_alias;
   ModelStatus status;
+  // Result of the last `models verify`, empty if never verified. See
+  // IntegrityRecord.
+  std::string integrity;
 };
 
+// A view of ModelRegistryService::Global(), cheap to construct anywhere
 class ModelListUtils {
 
  private:
-  mutable std::mutex mutex_;  // For thread safety
-
     bool IsUnique(const std::vector<ModelEntry>& entries,
                 const std::string& model_id,
                 const std::string& model_alias) const;
-  void SaveModelList(const std::vector<ModelEntry>& entries) const;
+  std::string GenerateShortenedAliasIf(
+      const std::string& model_id,
+      const std::function<bool(const std::string&)>& is_unique) const;
 
  public:
+  // Text registry of older versions, migrated on first use
   static const std::string kModelListPath;
+  static const std::string kModelRegistryPath;
   std::vector<ModelEntry> LoadModelList() const;
   ModelListUtils() = default;
   std::string GenerateShortenedAlias(
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <trantor/utils/Logger.h>
+#include <cstdint>
+#include <fstream>
 #include <regex>
 #include <sstream>
 #include <vector>
@@ -8,6 +10,9 @@
 #include "utils/logging_utils.h"
 #ifdef _WIN32
 #include <windows.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#include <sys/sysctl.h>
 #endif
 
 namespace system_info_utils {
@@ -20,12 +25,64 @@ constexpr static auto kGpuQueryCommand{
     "--format=csv,noheader,nounits"};
 constexpr static auto kGpuInfoRegex{
     R"((\d+),\s*(\d+),\s*([^,]+),\s*([\d\.]+))"};
+constexpr static auto kGpuFreeMemoryCommand{
+    "nvidia-smi --query-gpu=memory.free --format=csv,noheader,nounits"};
 
 struct SystemInfo {
   std::string os;
   std::string arch;
 };
 
+struct MemoryInfo {
+  uint64_t total_bytes = 0;
+  // What can be allocated without swapping, including reclaimable page cache
+  uint64_t available_bytes = 0;
+};
+
+inline MemoryInfo GetMemoryInfo() {
+  MemoryInfo info;
+#if defined(_WIN32)
+  MEMORYSTATUSEX status;
+  status.dwLength = sizeof(status);
+  if (GlobalMemoryStatusEx(&status)) {
+    info.total_bytes = status.ullTotalPhys;
+    info.available_bytes = status.ullAvailPhys;
+  }
+#elif defined(__APPLE__)
+  uint64_t memsize = 0;
+  size_t len = sizeof(memsize);
+  if (sysctlbyname("hw.memsize", &memsize, &len, nullptr, 0) == 0) {
+    info.total_bytes = memsize;
+  }
+  vm_statistics64_data_t vm;
+  mach_msg_type_number_t count = HOST_VM_INFO64_COUNT;
+  if (host_statistics64(mach_host_self(), HOST_VM_INFO64,
+                        reinterpret_cast<host_info64_t>(&vm),
+                        &count) == KERN_SUCCESS) {
+    info.available_bytes =
+        static_cast<uint64_t>(vm.free_count + vm.inactive_count) *
+        vm_page_size;
+  }
+#elif defined(__linux__)
+  std::ifstream meminfo("/proc/meminfo");
+  std::string key;
+  uint64_t kb;
+  std::string unit;
+  while (meminfo >> key >> kb) {
+    std::getline(meminfo, unit);
+    if (key == "MemTotal:") {
+      info.total_bytes = kb * 1024;
+    } else if (key == "MemAvailable:") {
+      info.available_bytes = kb * 1024;
+    }
+  }
+#endif
+  if (info.available_bytes == 0 || info.available_bytes > info.total_bytes) {
+    info.available_bytes = info.total_bytes;
+  }
+  return info;
+}
+
 /**
  * @brief Get the Gpu Arch. Currently we only support Ampere and Ada.
  * Might need to come up with better way to detect the GPU architecture.
@@ -215,6 +272,25 @@ inline std::vector<GpuInfo> GetGpuInfoListVulkan() {
   return gpuInfoList;
 }
 
+// Free VRAM of every NVIDIA GPU together, in MiB, 0 if unknown
+inline uint64_t GetGpuFreeMemoryMiB() {
+  uint64_t free_mib = 0;
+  try {
+    CommandExecutor cmd(kGpuFreeMemoryCommand);
+    std::istringstream output(cmd.execute());
+    std::string line;
+    while (std::getline(output, line)) {
+      try {
+        free_mib += std::stoull(line);
+      } catch (const std::exception&) {
+      }
+    }
+  } catch (const std::exception& e) {
+    LOG_ERROR << "Error: " << e.what();
+  }
+  return free_mib;
+}
+
 inline std::vector<GpuInfo> GetGpuInfoList() {
   std::vector<GpuInfo> gpuInfoList;
 
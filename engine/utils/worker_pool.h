@@ -0,0 +1,116 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Fixed size thread pool with a bounded queue for blocking work (file IO,
+ * YAML parsing, outbound HTTP) that must not run on the drogon event loops.
+ * Submit() fails instead of blocking when the queue is full so that callers
+ * can shed load.
+ */
+class WorkerPool {
+ public:
+  constexpr static size_t kDefaultMaxQueue = 1024;
+
+  WorkerPool(size_t threads, size_t max_queue) : max_queue_(max_queue) {
+    threads = std::max<size_t>(1, threads);
+    for (size_t i = 0; i < threads; i++) {
+      workers_.emplace_back([this] { Run(); });
+    }
+  }
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  // Runs what is already queued, then joins
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopped_ = true;
+    }
+    cv_.notify_all();
+    for (auto& w : workers_) {
+      w.join();
+    }
+  }
+
+  bool Submit(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stopped_ || tasks_.size() >= max_queue_) {
+        return false;
+      }
+      tasks_.push_back(std::move(task));
+    }
+    cv_.notify_one();
+    return true;
+  }
+
+  size_t Size() const { return workers_.size(); }
+
+  // Queued tasks beyond a lowered limit still run
+  void SetMaxQueue(size_t max_queue) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_queue_ = std::max<size_t>(1, max_queue);
+  }
+
+  size_t Pending() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return tasks_.size();
+  }
+
+  static bool OnWorkerThread() { return on_worker_thread_; }
+
+  /**
+   * Sets the size of the Global() pool. Has no effect once the pool is
+   * created, RunServer calls it before the server starts.
+   */
+  static void Configure(size_t threads, size_t max_queue) {
+    global_threads_ = threads;
+    global_max_queue_ = max_queue;
+  }
+
+  static WorkerPool& Global() {
+    static WorkerPool pool(
+        global_threads_ > 0
+            ? global_threads_
+            : std::max(1u, std::thread::hardware_concurrency()),
+        global_max_queue_ > 0 ? global_max_queue_ : kDefaultMaxQueue);
+    return pool;
+  }
+
+ private:
+  void Run() {
+    on_worker_thread_ = true;
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return stopped_ || !tasks_.empty(); });
+        if (tasks_.empty()) {
+          return;
+        }
+        task = std::move(tasks_.front());
+        tasks_.pop_front();
+      }
+      task();
+    }
+  }
+
+  inline static size_t global_threads_ = 0;
+  inline static size_t global_max_queue_ = kDefaultMaxQueue;
+  inline static thread_local bool on_worker_thread_ = false;
+
+  size_t max_queue_;
+  std::vector<std::thread> workers_;
+  std::deque<std::function<void()>> tasks_;
+  bool stopped_ = false;
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+};